@@ -6,6 +6,8 @@
 #include "Common.h"
 #include <ctime>
 #include <chrono>
+#include <cmath>
+#include <cstdint>
 
 namespace KeToanApp {
 
@@ -33,6 +35,12 @@ namespace KeToanApp {
         PhaiTra = 2
     };
 
+    enum class DocumentType : uint8_t {
+        ChungTuKeToan = 0,
+        PhieuNhap = 1,
+        PhieuXuat = 2
+    };
+
     // Basic structures
     struct Date {
         int day;
@@ -66,6 +74,38 @@ namespace KeToanApp {
         }
     };
 
+    // Fixed-point money in 1/10000 đồng. Sums are exact, unlike Decimal.
+    struct Money {
+        static const int64_t kScale = 10000;
+
+        int64_t units;
+
+        Money() : units(0) {}
+
+        static Money FromUnits(int64_t u) { Money m; m.units = u; return m; }
+        static Money FromDouble(double v) { return FromUnits(std::llround(v * kScale)); }
+
+        double ToDouble() const { return static_cast<double>(units) / kScale; }
+
+        Money& operator+=(Money other) { units += other.units; return *this; }
+        Money& operator-=(Money other) { units -= other.units; return *this; }
+        Money operator+(Money other) const { return FromUnits(units + other.units); }
+        Money operator-(Money other) const { return FromUnits(units - other.units); }
+        Money operator-() const { return FromUnits(-units); }
+        bool operator==(Money other) const { return units == other.units; }
+        bool operator!=(Money other) const { return units != other.units; }
+        bool operator<(Money other) const { return units < other.units; }
+
+        std::string ToString(int precision = 2) const {
+            char buffer[64];
+            sprintf_s(buffer, "%.*f", precision, ToDouble());
+            return buffer;
+        }
+    };
+
+    // Serial day number: days since 1970-01-01 (see DateTimeHelper::ToDayNumber)
+    using DayNumber = int32_t;
+
     // Common data structures
     struct AppSettings {
         std::string databasePath;
@@ -96,6 +136,13 @@ namespace KeToanApp {
             : KeToanException("Database Error: " + message) {}
     };
 
+    // A statement stopped by sqlite3_interrupt(): cancelled or out of time
+    class QueryInterruptedException : public DatabaseException {
+    public:
+        explicit QueryInterruptedException(const std::string& message)
+            : DatabaseException(message) {}
+    };
+
     class ValidationException : public KeToanException {
     public:
         explicit ValidationException(const std::string& message)
@@ -1,5 +1,7 @@
 #include "Application.h"
+#include "../Database/QueryStats.h"
 #include "../Utils/Logger.h"
+#include "../Utils/Trace.h"
 
 namespace KeToanApp {
 
@@ -9,6 +11,17 @@ namespace KeToanApp {
         : hInstance_(hInstance)
         , config_()
         , database_(nullptr)
+        , numberAllocator_(nullptr)
+        , indexRefresher_(nullptr)
+        , postingQueue_(nullptr)
+        , codeDictionary_(nullptr)
+        , masterData_(nullptr)
+        , validation_(nullptr)
+        , analyticsCache_(nullptr)
+        , balanceIndex_(nullptr)
+        , stockIndex_(nullptr)
+        , lotAllocator_(nullptr)
+        , engineTables_(nullptr)
         , mainWindow_(nullptr)
         , initialized_(false)
     {
@@ -17,6 +30,10 @@ namespace KeToanApp {
 
     Application::~Application() {
         Shutdown();
+        // Not shut down if initialization failed part way
+        if (indexRefresher_) {
+            indexRefresher_->Stop();
+        }
         instance_ = nullptr;
     }
 
@@ -32,6 +49,14 @@ namespace KeToanApp {
             Logger::Warning("Failed to load config, using defaults");
         }
 
+        InitializeLogging();
+        InitializeDiagnostics();
+
+        // Pick up edits to config.ini while running
+        if (!config_.Watch()) {
+            Logger::Warning("Config hot reload unavailable");
+        }
+
         // Initialize common controls
         if (!InitializeCommonControls()) {
             Logger::Error("Failed to initialize common controls");
@@ -83,10 +108,50 @@ namespace KeToanApp {
 
         Logger::Info("Shutting down application...");
 
-        // Cleanup in reverse order
+        // No config callbacks may fire into components being torn down
+        config_.StopWatching();
+
+        // Cleanup in reverse order; the refresher stops before the indexes
         mainWindow_.reset();
+        if (indexRefresher_) {
+            indexRefresher_->Stop();
+        }
+        engineTables_.reset();
+        lotAllocator_.reset();
+        stockIndex_.reset();
+        balanceIndex_.reset();
+        analyticsCache_.reset();
+        validation_.reset();
+        if (masterData_) {
+            masterData_->Stop();
+        }
+        masterData_.reset();
+        postingQueue_.reset();
+        indexRefresher_.reset();
+
+        // Numbers reserved but not used stay available to the next run
+        if (numberAllocator_) {
+            numberAllocator_->ReturnUnused();
+        }
+        numberAllocator_.reset();
+
+        // Codes first seen this run keep their ids next time
+        if (codeDictionary_) {
+            codeDictionary_->Save();
+        }
+        codeDictionary_.reset();
         database_.reset();
 
+        // Every statement is finalized by now
+        const std::string statsFile = config_.GetString("Diagnostics.QueryStatsFile");
+        if (!statsFile.empty() && QueryStats::WriteJson(statsFile)) {
+            Logger::Info("Query stats written to %s", statsFile.c_str());
+        }
+        QueryStats::LogSummary(10);
+        if (Trace::IsEnabled()) {
+            WriteTrace();
+        }
+
         // Save configuration
         config_.Save();
 
@@ -94,6 +159,73 @@ namespace KeToanApp {
         Logger::Info("Application shutdown complete");
     }
 
+    void Application::InitializeLogging() {
+        config_.Declare("Logging.LogLevel", "Info",
+            Config::OneOf({ "Debug", "Info", "Warning", "Error" }));
+        config_.DeclareBool("Logging.ConsoleOutput", false);
+
+        auto applyLevel = [](const std::string&, const std::string& value) {
+            if (value == "Debug") Logger::SetLogLevel(LogLevel::Debug);
+            else if (value == "Warning") Logger::SetLogLevel(LogLevel::Warning);
+            else if (value == "Error") Logger::SetLogLevel(LogLevel::Error);
+            else Logger::SetLogLevel(LogLevel::Info);
+        };
+        auto applyConsole = [](const std::string&, const std::string& value) {
+            bool enable = false;
+            Config::ParseBool(value, enable);
+            Logger::SetConsoleOutput(enable);
+        };
+
+        applyLevel("Logging.LogLevel", config_.GetString("Logging.LogLevel"));
+        applyConsole("Logging.ConsoleOutput", config_.GetString("Logging.ConsoleOutput"));
+        config_.Subscribe("Logging.LogLevel", applyLevel);
+        config_.Subscribe("Logging.ConsoleOutput", applyConsole);
+    }
+
+    void Application::InitializeDiagnostics() {
+        // Per-statement timings and the slow-query log (QueryStats)
+        config_.DeclareBool("Diagnostics.QueryStats", true);
+        config_.DeclareInt("Diagnostics.SlowQueryMs", 200, 0, 3600000);
+        config_.DeclareInt("Diagnostics.SlowQueryKeep", 50, 0, 10000);
+        config_.Declare("Diagnostics.QueryStatsFile", "");
+
+        auto apply = [this](const std::string&, const std::string&) {
+            QueryStats::SetEnabled(config_.GetBool("Diagnostics.QueryStats"));
+            QueryStats::SetSlowThreshold(static_cast<uint64_t>(config_.GetInt("Diagnostics.SlowQueryMs")) * 1000);
+            QueryStats::SetSlowQueryKeep(static_cast<size_t>(config_.GetInt("Diagnostics.SlowQueryKeep")));
+        };
+        apply(std::string(), std::string());
+        config_.Subscribe("Diagnostics.QueryStats", apply);
+        config_.Subscribe("Diagnostics.SlowQueryMs", apply);
+        config_.Subscribe("Diagnostics.SlowQueryKeep", apply);
+
+        // Span tracing (Trace): switching Trace.Enabled off writes Trace.File
+        config_.DeclareBool("Trace.Enabled", false);
+        config_.DeclareInt("Trace.EventsPerThread", 65536, 1024, 16777216);
+        config_.Declare("Trace.File", "trace.json");
+
+        Trace::SetThreadName("Main");
+        auto applyTrace = [this](const std::string&, const std::string&) {
+            const bool enable = config_.GetBool("Trace.Enabled");
+            if (enable && !Trace::IsEnabled()) {
+                Trace::Start(static_cast<size_t>(config_.GetInt("Trace.EventsPerThread")));
+            }
+            else if (!enable && Trace::IsEnabled()) {
+                WriteTrace();
+            }
+        };
+        applyTrace(std::string(), std::string());
+        config_.Subscribe("Trace.Enabled", applyTrace);
+    }
+
+    void Application::WriteTrace() {
+        Trace::Stop();
+        const std::string traceFile = config_.GetString("Trace.File");
+        if (Trace::WriteChromeJson(traceFile)) {
+            Logger::Info("Trace written to %s", traceFile.c_str());
+        }
+    }
+
     bool Application::InitializeCommonControls() {
         INITCOMMONCONTROLSEX icex;
         icex.dwSize = sizeof(INITCOMMONCONTROLSEX);
@@ -112,11 +244,101 @@ namespace KeToanApp {
         try {
             database_ = std::make_unique<DatabaseManager>(config_.GetSettings());
 
+            // Reader connections backing report read views
+            config_.DeclareInt("Database.ReaderPoolSize", 4, 1, 64);
+            database_->SetReaderPoolSize(static_cast<size_t>(config_.GetInt("Database.ReaderPoolSize")));
+            config_.Subscribe("Database.ReaderPoolSize", [this](const std::string&, const std::string&) {
+                if (database_) database_->SetReaderPoolSize(static_cast<size_t>(config_.GetInt("Database.ReaderPoolSize")));
+            });
+
             if (!database_->Connect()) {
                 Logger::Error("Failed to connect to database");
                 return false;
             }
 
+            // SoCT / SoPhieu sequences per document type and period
+            numberAllocator_ = std::make_unique<DocumentNumberAllocator>(*database_, config_);
+
+            // Applies committed changes to the in-memory indexes created
+            // below; a posted batch wakes it at once
+            indexRefresher_ = std::make_unique<IndexRefresher>(*database_, config_);
+
+            postingQueue_ = std::make_unique<PostingQueue>(*database_, config_, numberAllocator_.get());
+            postingQueue_->SetCommitListener([this]() { indexRefresher_->Notify(); });
+            if (!postingQueue_->Start()) {
+                Logger::Error("Failed to start posting queue");
+                return false;
+            }
+
+            // Ids of product, account and counterparty codes shared by the
+            // in-memory engines
+            codeDictionary_ = std::make_unique<CodeDictionary>(*database_);
+            if (!codeDictionary_->Load()) {
+                Logger::Error("Failed to load code dictionary");
+                return false;
+            }
+
+            // Products and accounts for validation, reloaded from the
+            // ChangeLog by a background thread
+            masterData_ = std::make_unique<MasterDataCache>(*database_, config_, *codeDictionary_);
+            if (!masterData_->Load()) {
+                Logger::Error("Failed to load master data");
+                return false;
+            }
+            if (!masterData_->Start()) {
+                Logger::Warning("Master data refresh not started; the cache stays as loaded");
+            }
+            validation_ = std::make_unique<ValidationService>(*database_, config_, *masterData_);
+
+            // Columnar cache for pivot reports; the first refresh pass loads it
+            config_.DeclareBool("Analytics.Enabled", false);
+            if (config_.GetBool("Analytics.Enabled")) {
+                analyticsCache_ = std::make_unique<AnalyticsCache>(*database_, *codeDictionary_);
+                indexRefresher_->Add("analytics cache", [this]() { return analyticsCache_->Refresh(); });
+            }
+
+            // As-of-date account balances for the ledger views
+            config_.DeclareBool("Balances.Enabled", true);
+            if (config_.GetBool("Balances.Enabled")) {
+                balanceIndex_ = std::make_unique<BalanceIndex>(*database_, config_, *codeDictionary_);
+                if (!balanceIndex_->Build()) {
+                    Logger::Warning("Balance index not built; the next Refresh() retries");
+                }
+                indexRefresher_->Add("balance index", [this]() { return balanceIndex_->Refresh(); });
+            }
+
+            // Stock on hand as of a date and movement history per product
+            config_.DeclareBool("StockIndex.Enabled", true);
+            if (config_.GetBool("StockIndex.Enabled")) {
+                stockIndex_ = std::make_unique<StockMovementIndex>(*database_, *codeDictionary_);
+                if (!stockIndex_->Build()) {
+                    Logger::Warning("Stock index not built; the next Refresh() retries");
+                }
+                indexRefresher_->Add("stock index", [this]() { return stockIndex_->Refresh(); });
+            }
+
+            // FEFO lot picking for issues
+            config_.DeclareBool("Lots.Enabled", true);
+            if (config_.GetBool("Lots.Enabled")) {
+                lotAllocator_ = std::make_unique<LotAllocator>(*database_, *codeDictionary_);
+                if (!lotAllocator_->Build()) {
+                    Logger::Warning("Lot allocator not built; the next Refresh() retries");
+                }
+                // Also drops the holds of issues once their lines are committed
+                indexRefresher_->Add("lot allocator", [this]() { return lotAllocator_->Refresh(); });
+            }
+
+            // vt_account_balance and vt_stock_on_hand for SQL reports
+            if (balanceIndex_ || stockIndex_) {
+                engineTables_ = std::make_unique<EngineTables>(*database_, *codeDictionary_,
+                    balanceIndex_.get(), stockIndex_.get());
+                if (!engineTables_->Register()) {
+                    Logger::Warning("Engine virtual tables not registered");
+                }
+            }
+
+            indexRefresher_->Start();
+
             Logger::Info("Database initialized: %s", config_.GetSettings().databasePath.c_str());
             return true;
         }
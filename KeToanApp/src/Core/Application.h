@@ -4,6 +4,17 @@
 #include "KeToanApp/Types.h"
 #include "Config.h"
 #include "../Database/DatabaseManager.h"
+#include "../Database/DocumentNumberAllocator.h"
+#include "../Database/PostingQueue.h"
+#include "../Services/AnalyticsCache.h"
+#include "../Services/BalanceIndex.h"
+#include "../Services/CodeDictionary.h"
+#include "../Services/EngineTables.h"
+#include "../Services/IndexRefresher.h"
+#include "../Services/LotAllocator.h"
+#include "../Services/MasterDataCache.h"
+#include "../Services/StockMovementIndex.h"
+#include "../Services/ValidationService.h"
 #include "../UI/MainWindow.h"
 
 namespace KeToanApp {
@@ -30,6 +41,15 @@ namespace KeToanApp {
         HINSTANCE GetInstance() const { return hInstance_; }
         Config& GetConfig() { return config_; }
         DatabaseManager& GetDatabase() { return *database_; }
+        DocumentNumberAllocator& GetNumberAllocator() { return *numberAllocator_; }
+        PostingQueue& GetPostingQueue() { return *postingQueue_; }
+        CodeDictionary& GetCodeDictionary() { return *codeDictionary_; }
+        MasterDataCache& GetMasterData() { return *masterData_; }
+        ValidationService& GetValidation() { return *validation_; }
+        AnalyticsCache* GetAnalyticsCache() { return analyticsCache_.get(); }   // null unless Analytics.Enabled
+        BalanceIndex* GetBalanceIndex() { return balanceIndex_.get(); }         // null unless Balances.Enabled
+        StockMovementIndex* GetStockMovementIndex() { return stockIndex_.get(); }  // null unless StockIndex.Enabled
+        LotAllocator* GetLotAllocator() { return lotAllocator_.get(); }         // null unless Lots.Enabled
         MainWindow* GetMainWindow() { return mainWindow_.get(); }
 
         // Singleton access
@@ -41,10 +61,24 @@ namespace KeToanApp {
         HINSTANCE hInstance_;
         Config config_;
         std::unique_ptr<DatabaseManager> database_;
+        std::unique_ptr<DocumentNumberAllocator> numberAllocator_;
+        std::unique_ptr<IndexRefresher> indexRefresher_;    // notified by postingQueue_
+        std::unique_ptr<PostingQueue> postingQueue_;
+        std::unique_ptr<CodeDictionary> codeDictionary_;
+        std::unique_ptr<MasterDataCache> masterData_;
+        std::unique_ptr<ValidationService> validation_;
+        std::unique_ptr<AnalyticsCache> analyticsCache_;
+        std::unique_ptr<BalanceIndex> balanceIndex_;
+        std::unique_ptr<StockMovementIndex> stockIndex_;
+        std::unique_ptr<LotAllocator> lotAllocator_;
+        std::unique_ptr<EngineTables> engineTables_;
         std::unique_ptr<MainWindow> mainWindow_;
         bool initialized_;
 
         // Initialize components
+        void InitializeLogging();
+        void InitializeDiagnostics();
+        void WriteTrace();
         bool InitializeCommonControls();
         bool InitializeDatabase();
         bool InitializeMainWindow();
@@ -1,33 +1,465 @@
 #include "Config.h"
 #include "../Utils/Logger.h"
+#include "../Utils/MappedFile.h"
+#include "../Utils/StringHelper.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
 #include <fstream>
 #include <sstream>
+#include <string_view>
 
 namespace KeToanApp {
 
+    namespace {
+
+        // Characters treated as blanks around keys, values and section names
+        bool IsBlank(char c) {
+            return c == ' ' || c == '\t' || c == '\r';
+        }
+
+        std::string_view TrimView(std::string_view s) {
+            size_t begin = 0;
+            size_t end = s.size();
+            while (begin < end && IsBlank(s[begin])) ++begin;
+            while (end > begin && IsBlank(s[end - 1])) --end;
+            return s.substr(begin, end - begin);
+        }
+
+        // Debounce delay between a change notification and the re-parse,
+        // so editors that write the file in several steps are read once.
+        const DWORD kReloadDebounceMs = 100;
+
+    } // namespace
+
     Config::Config()
-        : settings_()
+        : mutex_()
+        , entries_()
+        , subscriptions_()
+        , nextSubscriptionId_(1)
+        , settings_()
         , configPath_("config.ini")
+        , watcherThread_()
+        , stopEvent_(nullptr)
+        , watching_(false)
     {
+        // Keys backing AppSettings
+        Declare("Database.Type", "SQLite", OneOf({ "SQLite", "SQLServer" }));
+        Declare("Database.Path", settings_.databasePath,
+            [](const std::string& value) { return !value.empty(); });
+        Declare("Application.Language", settings_.language);
+        Declare("Application.DateFormat", settings_.dateFormat);
+        DeclareInt("Application.NumberPrecision", settings_.numberPrecision, 0, 6);
+    }
+
+    Config::~Config() {
+        StopWatching();
     }
 
     bool Config::Load(const std::string& filename) {
-        configPath_ = filename;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            configPath_ = filename;
+        }
 
-        std::ifstream file(filename);
-        if (!file.is_open()) {
+        std::vector<Change> values;
+        if (!ParseFile(filename, values)) {
             Logger::Warning("Config file not found: %s, using defaults", filename.c_str());
             return false;
         }
 
-        // Simple INI parser
-        std::string line;
-        std::string currentSection;
+        Apply(values, true);
+        Logger::Info("Configuration loaded from: %s", filename.c_str());
+        return true;
+    }
+
+    bool Config::Reload() {
+        std::string path;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            path = configPath_;
+        }
+
+        std::vector<Change> values;
+        if (!ParseFile(path, values)) {
+            Logger::Warning("Config reload failed, keeping current values: %s", path.c_str());
+            return false;
+        }
+
+        Apply(values, true);
+        Logger::Info("Configuration reloaded from: %s", path.c_str());
+        return true;
+    }
+
+    bool Config::Save(const std::string& filename) {
+        // Group entries by section, preserving first-seen order
+        std::vector<std::string> sections;
+        std::map<std::string, std::vector<std::pair<size_t, Change>>> bySection;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (const auto& item : entries_) {
+                size_t dot = item.first.find('.');
+                std::string section = item.first.substr(0, dot);
+                std::string key = dot == std::string::npos ? "" : item.first.substr(dot + 1);
+
+                auto& list = bySection[section];
+                if (list.empty()) {
+                    sections.push_back(section);
+                }
+                list.push_back({ item.second.order, { key, item.second.value } });
+            }
+        }
+
+        auto firstOrder = [&](const std::string& section) {
+            size_t order = SIZE_MAX;
+            for (const auto& item : bySection[section]) {
+                order = std::min(order, item.first);
+            }
+            return order;
+        };
+        std::sort(sections.begin(), sections.end(),
+            [&](const std::string& a, const std::string& b) { return firstOrder(a) < firstOrder(b); });
+
+        std::ofstream file(filename);
+        if (!file.is_open()) {
+            Logger::Error("Failed to save config file: %s", filename.c_str());
+            return false;
+        }
+
+        for (size_t i = 0; i < sections.size(); ++i) {
+            auto& list = bySection[sections[i]];
+            std::sort(list.begin(), list.end(),
+                [](const auto& a, const auto& b) { return a.first < b.first; });
+
+            if (i > 0) file << "\n";
+            file << "[" << sections[i] << "]\n";
+            for (const auto& item : list) {
+                file << item.second.first << "=" << item.second.second << "\n";
+            }
+        }
+
+        file.close();
+        Logger::Info("Configuration saved to: %s", filename.c_str());
+        return true;
+    }
+
+    bool Config::Watch() {
+        if (watching_) {
+            return true;
+        }
+
+        std::string path;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            path = configPath_;
+        }
+
+        wchar_t fullPath[MAX_PATH];
+        std::wstring widePath = StringHelper::ToWideString(path);
+        DWORD length = GetFullPathNameW(widePath.c_str(), MAX_PATH, fullPath, nullptr);
+        if (length == 0 || length >= MAX_PATH) {
+            Logger::Error("Cannot resolve config path for watching: %s", path.c_str());
+            return false;
+        }
+
+        std::wstring filePath(fullPath, length);
+        size_t slash = filePath.find_last_of(L"\\/");
+        std::wstring directory = slash == std::wstring::npos ? L"." : filePath.substr(0, slash);
+
+        stopEvent_ = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+        if (!stopEvent_) {
+            Logger::Error("Failed to create config watcher event (error %lu)", GetLastError());
+            return false;
+        }
+
+        watching_ = true;
+        watcherThread_ = std::thread(&Config::WatchLoop, this, directory, filePath);
+        Logger::Info("Watching configuration file: %s", path.c_str());
+        return true;
+    }
+
+    void Config::StopWatching() {
+        if (!watching_) {
+            return;
+        }
+
+        SetEvent(stopEvent_);
+        if (watcherThread_.joinable()) {
+            watcherThread_.join();
+        }
+
+        CloseHandle(stopEvent_);
+        stopEvent_ = nullptr;
+        watching_ = false;
+    }
+
+    void Config::WatchLoop(std::wstring directory, std::wstring filePath) {
+        HANDLE change = FindFirstChangeNotificationW(directory.c_str(), FALSE,
+            FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME);
+        if (change == INVALID_HANDLE_VALUE) {
+            Logger::Error("Config watcher could not monitor directory (error %lu)", GetLastError());
+            return;
+        }
+
+        auto lastWriteTime = [&filePath](ULONGLONG& stamp) {
+            WIN32_FILE_ATTRIBUTE_DATA info;
+            if (!GetFileAttributesExW(filePath.c_str(), GetFileExInfoStandard, &info)) {
+                return false;
+            }
+            stamp = (static_cast<ULONGLONG>(info.ftLastWriteTime.dwHighDateTime) << 32)
+                  | info.ftLastWriteTime.dwLowDateTime;
+            return true;
+        };
+
+        ULONGLONG seen = 0;
+        lastWriteTime(seen);
+
+        HANDLE handles[2] = { stopEvent_, change };
+        for (;;) {
+            DWORD wait = WaitForMultipleObjects(2, handles, FALSE, INFINITE);
+            if (wait != WAIT_OBJECT_0 + 1) {
+                break;  // stop requested or wait failed
+            }
+
+            // Any file in the directory may have triggered; only reload ours
+            if (WaitForSingleObject(stopEvent_, kReloadDebounceMs) == WAIT_OBJECT_0) {
+                break;
+            }
+
+            ULONGLONG stamp = 0;
+            if (lastWriteTime(stamp) && stamp != seen) {
+                seen = stamp;
+                Reload();
+            }
+
+            if (!FindNextChangeNotification(change)) {
+                Logger::Error("Config watcher lost directory handle (error %lu)", GetLastError());
+                break;
+            }
+        }
+
+        FindCloseChangeNotification(change);
+    }
+
+    void Config::Declare(const std::string& key, const std::string& defaultValue,
+                         Validator validator) {
+        std::vector<Change> changed;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            auto it = entries_.find(key);
+            if (it == entries_.end()) {
+                Entry entry{ defaultValue, defaultValue, validator, true, entries_.size() };
+                entries_.emplace(key, std::move(entry));
+            } else {
+                Entry& entry = it->second;
+                bool wasDeclared = entry.declared;
+                entry.defaultValue = defaultValue;
+                entry.validator = validator;
+                entry.declared = true;
+
+                // Value may have been read from file before the owner declared it
+                if (entry.validator && !entry.validator(entry.value)) {
+                    Logger::Warning("Config %s: invalid value '%s', using default '%s'",
+                        key.c_str(), entry.value.c_str(), defaultValue.c_str());
+                    entry.value = defaultValue;
+                    changed.push_back({ key, entry.value });
+                } else if (!wasDeclared) {
+                    changed.push_back({ key, entry.value });
+                }
+            }
+
+            SyncSettingsLocked();
+        }
+
+        Notify(changed);
+    }
+
+    void Config::DeclareBool(const std::string& key, bool defaultValue) {
+        Declare(key, defaultValue ? "true" : "false",
+            [](const std::string& value) {
+                bool parsed;
+                return ParseBool(value, parsed);
+            });
+    }
+
+    void Config::DeclareInt(const std::string& key, int64_t defaultValue,
+                            int64_t minValue, int64_t maxValue) {
+        Declare(key, std::to_string(defaultValue),
+            [minValue, maxValue](const std::string& value) {
+                int64_t parsed;
+                return ParseInt(value, parsed) && parsed >= minValue && parsed <= maxValue;
+            });
+    }
+
+    void Config::DeclareDouble(const std::string& key, double defaultValue,
+                               double minValue, double maxValue) {
+        std::ostringstream ss;
+        ss << defaultValue;
+        Declare(key, ss.str(),
+            [minValue, maxValue](const std::string& value) {
+                double parsed;
+                return ParseDouble(value, parsed) && parsed >= minValue && parsed <= maxValue;
+            });
+    }
+
+    bool Config::IsDeclared(const std::string& key) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(key);
+        return it != entries_.end() && it->second.declared;
+    }
+
+    std::string Config::GetString(const std::string& key) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(key);
+        return it != entries_.end() ? it->second.value : std::string();
+    }
+
+    bool Config::GetBool(const std::string& key) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(key);
+        if (it == entries_.end()) {
+            return false;
+        }
+
+        bool result = false;
+        if (!ParseBool(it->second.value, result)) {
+            ParseBool(it->second.defaultValue, result);
+        }
+        return result;
+    }
+
+    int64_t Config::GetInt(const std::string& key) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(key);
+        if (it == entries_.end()) {
+            return 0;
+        }
+
+        int64_t result = 0;
+        if (!ParseInt(it->second.value, result)) {
+            ParseInt(it->second.defaultValue, result);
+        }
+        return result;
+    }
+
+    double Config::GetDouble(const std::string& key) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(key);
+        if (it == entries_.end()) {
+            return 0.0;
+        }
+
+        double result = 0.0;
+        if (!ParseDouble(it->second.value, result)) {
+            ParseDouble(it->second.defaultValue, result);
+        }
+        return result;
+    }
+
+    bool Config::Set(const std::string& key, const std::string& value) {
+        std::vector<Change> changed;
+        bool accepted;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            accepted = ApplyLocked(key, value, changed);
+            SyncSettingsLocked();
+        }
+
+        Notify(changed);
+        return accepted;
+    }
+
+    Config::SubscriptionId Config::Subscribe(const std::string& key, ChangeCallback callback) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        SubscriptionId id = nextSubscriptionId_++;
+        subscriptions_.push_back({ id, key, std::move(callback) });
+        return id;
+    }
+
+    void Config::Unsubscribe(SubscriptionId id) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        subscriptions_.erase(
+            std::remove_if(subscriptions_.begin(), subscriptions_.end(),
+                [id](const Subscription& s) { return s.id == id; }),
+            subscriptions_.end());
+    }
+
+    AppSettings Config::GetSettings() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return settings_;
+    }
+
+    Config::Validator Config::OneOf(std::vector<std::string> allowed) {
+        return [allowed = std::move(allowed)](const std::string& value) {
+            return std::find(allowed.begin(), allowed.end(), value) != allowed.end();
+        };
+    }
+
+    bool Config::ParseBool(const std::string& value, bool& result) {
+        std::string lower = StringHelper::ToLower(value);
+        if (lower == "true" || lower == "1" || lower == "yes" || lower == "on") {
+            result = true;
+            return true;
+        }
+        if (lower == "false" || lower == "0" || lower == "no" || lower == "off") {
+            result = false;
+            return true;
+        }
+        return false;
+    }
+
+    bool Config::ParseInt(const std::string& value, int64_t& result) {
+        if (value.empty()) {
+            return false;
+        }
+
+        char* end = nullptr;
+        errno = 0;
+        long long parsed = std::strtoll(value.c_str(), &end, 10);
+        if (errno != 0 || *end != '\0') {
+            return false;
+        }
+
+        result = parsed;
+        return true;
+    }
+
+    bool Config::ParseDouble(const std::string& value, double& result) {
+        if (value.empty()) {
+            return false;
+        }
+
+        char* end = nullptr;
+        errno = 0;
+        double parsed = std::strtod(value.c_str(), &end);
+        if (errno != 0 || *end != '\0') {
+            return false;
+        }
 
-        while (std::getline(file, line)) {
-            // Remove whitespace
-            line.erase(0, line.find_first_not_of(" \t"));
-            line.erase(line.find_last_not_of(" \t") + 1);
+        result = parsed;
+        return true;
+    }
+
+    bool Config::ParseFile(const std::string& filename, std::vector<Change>& values) const {
+        MappedFile file;
+        if (!file.Open(filename)) {
+            return false;
+        }
+
+        std::string_view text(file.Data() ? file.Data() : "", file.Size());
+
+        // Skip UTF-8 BOM written by Notepad
+        if (text.size() >= 3 && text.compare(0, 3, "\xEF\xBB\xBF") == 0) {
+            text.remove_prefix(3);
+        }
+
+        // Simple INI parser over the mapped view; no per-line allocation
+        std::string_view section;
+        while (!text.empty()) {
+            size_t eol = text.find('\n');
+            std::string_view line = TrimView(text.substr(0, eol));
+            text.remove_prefix(eol == std::string_view::npos ? text.size() : eol + 1);
 
             // Skip empty lines and comments
             if (line.empty() || line[0] == ';' || line[0] == '#') {
@@ -35,73 +467,125 @@ namespace KeToanApp {
             }
 
             // Section header
-            if (line[0] == '[' && line[line.length() - 1] == ']') {
-                currentSection = line.substr(1, line.length() - 2);
+            if (line.front() == '[' && line.back() == ']') {
+                section = TrimView(line.substr(1, line.size() - 2));
                 continue;
             }
 
             // Key-value pair
             size_t pos = line.find('=');
-            if (pos != std::string::npos) {
-                std::string key = line.substr(0, pos);
-                std::string value = line.substr(pos + 1);
-
-                // Trim key and value
-                key.erase(0, key.find_first_not_of(" \t"));
-                key.erase(key.find_last_not_of(" \t") + 1);
-                value.erase(0, value.find_first_not_of(" \t"));
-                value.erase(value.find_last_not_of(" \t") + 1);
-
-                // Parse based on section
-                if (currentSection == "Database") {
-                    if (key == "Type") {
-                        if (value == "SQLite") {
-                            settings_.dbType = DatabaseType::SQLite;
-                        } else if (value == "SQLServer") {
-                            settings_.dbType = DatabaseType::SQLServer;
-                        }
-                    } else if (key == "Path") {
-                        settings_.databasePath = value;
+            if (pos == std::string_view::npos) {
+                continue;
+            }
+
+            std::string_view key = TrimView(line.substr(0, pos));
+            std::string_view value = TrimView(line.substr(pos + 1));
+            if (key.empty()) {
+                continue;
+            }
+
+            std::string fullKey;
+            fullKey.reserve(section.size() + 1 + key.size());
+            fullKey.append(section).append(1, '.').append(key);
+            values.emplace_back(std::move(fullKey), std::string(value));
+        }
+
+        return true;
+    }
+
+    void Config::Apply(const std::vector<Change>& values, bool fromFile) {
+        std::vector<Change> changed;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            for (const auto& item : values) {
+                ApplyLocked(item.first, item.second, changed);
+            }
+
+            // Declared keys removed from the file fall back to their defaults
+            if (fromFile) {
+                for (auto& item : entries_) {
+                    if (!item.second.declared || item.second.value == item.second.defaultValue) {
+                        continue;
                     }
-                } else if (currentSection == "Application") {
-                    if (key == "Language") {
-                        settings_.language = value;
-                    } else if (key == "DateFormat") {
-                        settings_.dateFormat = value;
-                    } else if (key == "NumberPrecision") {
-                        settings_.numberPrecision = std::stoi(value);
+
+                    bool present = std::any_of(values.begin(), values.end(),
+                        [&](const Change& c) { return c.first == item.first; });
+                    if (!present) {
+                        item.second.value = item.second.defaultValue;
+                        changed.push_back({ item.first, item.second.value });
                     }
                 }
             }
+
+            SyncSettingsLocked();
         }
 
-        file.close();
-        Logger::Info("Configuration loaded from: %s", filename.c_str());
-        return true;
+        Notify(changed);
     }
 
-    bool Config::Save(const std::string& filename) {
-        std::ofstream file(filename);
-        if (!file.is_open()) {
-            Logger::Error("Failed to save config file: %s", filename.c_str());
+    bool Config::ApplyLocked(const std::string& key, const std::string& value,
+                             std::vector<Change>& changed) {
+        auto it = entries_.find(key);
+        if (it == entries_.end()) {
+            // Unknown keys are kept so Save() round-trips them
+            Entry entry{ value, value, nullptr, false, entries_.size() };
+            entries_.emplace(key, std::move(entry));
+            changed.push_back({ key, value });
+            return true;
+        }
+
+        Entry& entry = it->second;
+        if (entry.validator && !entry.validator(value)) {
+            Logger::Warning("Config %s: rejected invalid value '%s', keeping '%s'",
+                key.c_str(), value.c_str(), entry.value.c_str());
             return false;
         }
 
-        // Write Database section
-        file << "[Database]\n";
-        file << "Type=" << (settings_.dbType == DatabaseType::SQLite ? "SQLite" : "SQLServer") << "\n";
-        file << "Path=" << settings_.databasePath << "\n";
-        file << "\n";
+        if (entry.value != value) {
+            entry.value = value;
+            changed.push_back({ key, value });
+        }
+        return true;
+    }
 
-        // Write Application section
-        file << "[Application]\n";
-        file << "Language=" << settings_.language << "\n";
-        file << "DateFormat=" << settings_.dateFormat << "\n";
-        file << "NumberPrecision=" << settings_.numberPrecision << "\n";
+    void Config::SyncSettingsLocked() {
+        static const std::string empty;
+        auto value = [this](const char* key) -> const std::string& {
+            auto it = entries_.find(key);
+            return it != entries_.end() ? it->second.value : empty;
+        };
 
-        file.close();
-        Logger::Info("Configuration saved to: %s", filename.c_str());
-        return true;
+        settings_.dbType = value("Database.Type") == "SQLServer"
+            ? DatabaseType::SQLServer : DatabaseType::SQLite;
+        if (!value("Database.Path").empty()) settings_.databasePath = value("Database.Path");
+        if (!value("Application.Language").empty()) settings_.language = value("Application.Language");
+        if (!value("Application.DateFormat").empty()) settings_.dateFormat = value("Application.DateFormat");
+
+        int64_t precision;
+        if (ParseInt(value("Application.NumberPrecision"), precision)) {
+            settings_.numberPrecision = static_cast<int>(precision);
+        }
+    }
+
+    void Config::Notify(const std::vector<Change>& changed) {
+        if (changed.empty()) {
+            return;
+        }
+
+        std::vector<Subscription> targets;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            targets = subscriptions_;
+        }
+
+        for (const auto& change : changed) {
+            for (const auto& subscription : targets) {
+                if (subscription.key.empty() || subscription.key == change.first) {
+                    subscription.callback(change.first, change.second);
+                }
+            }
+        }
     }
 
 } // namespace KeToanApp
@@ -2,43 +2,127 @@
 
 #include "KeToanApp/Common.h"
 #include "KeToanApp/Types.h"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
 
 namespace KeToanApp {
 
+    // Typed configuration registry backed by config.ini.
+    //
+    // Keys are addressed as "Section.Key". Subsystems declare the keys they
+    // own with a default and an optional validator; values read from the file
+    // are validated before they replace the current value. Once Watch() is
+    // called the file is re-parsed whenever it changes on disk and subscribers
+    // of the changed keys are notified, so tuning knobs apply without restart.
     class Config {
     public:
+        using Validator = std::function<bool(const std::string& value)>;
+        using ChangeCallback = std::function<void(const std::string& key, const std::string& value)>;
+        using SubscriptionId = uint64_t;
+
         Config();
-        ~Config() = default;
+        ~Config();
+
+        // Non-copyable
+        Config(const Config&) = delete;
+        Config& operator=(const Config&) = delete;
 
         // Load/Save configuration
         bool Load(const std::string& filename = "config.ini");
+        bool Reload();
         bool Save(const std::string& filename = "config.ini");
 
+        // Hot reload: watch the loaded file for changes
+        bool Watch();
+        void StopWatching();
+        bool IsWatching() const { return watching_; }
+
+        // Key registry. Declaring an existing key keeps its current value if
+        // it passes the new validator, otherwise resets it to the default.
+        void Declare(const std::string& key, const std::string& defaultValue,
+                     Validator validator = nullptr);
+        void DeclareBool(const std::string& key, bool defaultValue);
+        void DeclareInt(const std::string& key, int64_t defaultValue,
+                        int64_t minValue, int64_t maxValue);
+        void DeclareDouble(const std::string& key, double defaultValue,
+                           double minValue, double maxValue);
+        bool IsDeclared(const std::string& key) const;
+
+        // Typed accessors. Values that fail to parse fall back to the default.
+        std::string GetString(const std::string& key) const;
+        bool GetBool(const std::string& key) const;
+        int64_t GetInt(const std::string& key) const;
+        double GetDouble(const std::string& key) const;
+
+        // Runtime override; validated like file values. Notifies subscribers.
+        bool Set(const std::string& key, const std::string& value);
+
+        // Change notification. Callbacks run on the thread that applied the
+        // change (the watcher thread for file reloads), outside the registry lock.
+        // An empty key subscribes to every key.
+        SubscriptionId Subscribe(const std::string& key, ChangeCallback callback);
+        void Unsubscribe(SubscriptionId id);
+
         // Getters
-        const AppSettings& GetSettings() const { return settings_; }
-        AppSettings& GetSettings() { return settings_; }
+        // Snapshot of the legacy settings block, kept in sync with the registry
+        AppSettings GetSettings() const;
 
         // Specific getters
-        std::string GetDatabasePath() const { return settings_.databasePath; }
-        DatabaseType GetDatabaseType() const { return settings_.dbType; }
-        std::string GetLanguage() const { return settings_.language; }
+        std::string GetDatabasePath() const { return GetString("Database.Path"); }
+        DatabaseType GetDatabaseType() const { return GetSettings().dbType; }
+        std::string GetLanguage() const { return GetString("Application.Language"); }
 
         // Setters
-        void SetDatabasePath(const std::string& path) { settings_.databasePath = path; }
-        void SetDatabaseType(DatabaseType type) { settings_.dbType = type; }
-        void SetLanguage(const std::string& lang) { settings_.language = lang; }
+        void SetDatabasePath(const std::string& path) { Set("Database.Path", path); }
+        void SetDatabaseType(DatabaseType type) { Set("Database.Type", type == DatabaseType::SQLite ? "SQLite" : "SQLServer"); }
+        void SetLanguage(const std::string& lang) { Set("Application.Language", lang); }
+
+        // Common validators
+        static Validator OneOf(std::vector<std::string> allowed);
+        static bool ParseBool(const std::string& value, bool& result);
+        static bool ParseInt(const std::string& value, int64_t& result);
+        static bool ParseDouble(const std::string& value, double& result);
 
     private:
+        struct Entry {
+            std::string value;
+            std::string defaultValue;
+            Validator validator;
+            bool declared;
+            size_t order;       // first-seen order, used by Save()
+        };
+
+        struct Subscription {
+            SubscriptionId id;
+            std::string key;
+            ChangeCallback callback;
+        };
+
+        using Change = std::pair<std::string, std::string>;
+
+        mutable std::mutex mutex_;
+        std::map<std::string, Entry> entries_;
+        std::vector<Subscription> subscriptions_;
+        SubscriptionId nextSubscriptionId_;
         AppSettings settings_;
         std::string configPath_;
 
+        // File watcher
+        std::thread watcherThread_;
+        HANDLE stopEvent_;
+        std::atomic<bool> watching_;
+
         // Helper methods
-        std::string ReadValue(const std::string& section,
-                             const std::string& key,
-                             const std::string& defaultValue);
-        void WriteValue(const std::string& section,
-                       const std::string& key,
-                       const std::string& value);
+        bool ParseFile(const std::string& filename, std::vector<Change>& values) const;
+        void Apply(const std::vector<Change>& values, bool fromFile);
+        bool ApplyLocked(const std::string& key, const std::string& value,
+                         std::vector<Change>& changed);
+        void SyncSettingsLocked();
+        void Notify(const std::vector<Change>& changed);
+        void WatchLoop(std::wstring directory, std::wstring filePath);
     };
 
 } // namespace KeToanApp
@@ -0,0 +1,91 @@
+#include "BulkInserter.h"
+#include "../Utils/Logger.h"
+
+namespace KeToanApp {
+
+    BulkInserter::BulkInserter(DatabaseManager& database)
+        : database_(database)
+        , lock_()
+        , active_(false)
+        , rowsInserted_(0)
+    {
+    }
+
+    BulkInserter::~BulkInserter() {
+        if (active_) {
+            Rollback();
+        }
+    }
+
+    bool BulkInserter::Begin() {
+        if (active_) {
+            return true;
+        }
+
+        lock_ = database_.Lock();
+        if (!database_.BeginTransaction()) {
+            lock_.unlock();
+            return false;
+        }
+
+        active_ = true;
+        rowsInserted_ = 0;
+        return true;
+    }
+
+    bool BulkInserter::Commit() {
+        if (!active_) {
+            return false;
+        }
+
+        // Statements must not hold the transaction open
+        statements_.clear();
+        bool ok = database_.Commit();
+        if (!ok) {
+            database_.Rollback();
+        }
+
+        active_ = false;
+        lock_.unlock();
+        return ok;
+    }
+
+    void BulkInserter::Rollback() {
+        if (!active_) {
+            return;
+        }
+
+        statements_.clear();
+        database_.Rollback();
+        Logger::Warning("Bulk insert rolled back after %lld rows", static_cast<long long>(rowsInserted_));
+
+        active_ = false;
+        lock_.unlock();
+    }
+
+    Statement& BulkInserter::Prepare(const std::string& sql) {
+        if (!active_) {
+            throw DatabaseException("Bulk insert is not active");
+        }
+
+        auto it = statements_.find(sql);
+        if (it == statements_.end()) {
+            Connection* connection = database_.GetConnection();
+            if (!connection) {
+                throw DatabaseException("Database not connected");
+            }
+            it = statements_.emplace(sql, connection->Prepare(sql)).first;
+        }
+
+        it->second->Reset();
+        return *it->second;
+    }
+
+    int BulkInserter::Execute(Statement& statement) {
+        statement.Execute();
+        int changes = database_.GetConnection()->Changes();
+        rowsInserted_ += changes;
+        return changes;
+    }
+
+} // namespace KeToanApp
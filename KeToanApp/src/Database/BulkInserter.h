@@ -0,0 +1,49 @@
+#pragma once
+
+#include "KeToanApp/Common.h"
+#include "KeToanApp/Types.h"
+#include "DatabaseManager.h"
+#include <cstdint>
+#include <map>
+#include <mutex>
+
+namespace KeToanApp {
+
+    // Bulk insert path: one writer transaction, prepared statements cached
+    // by SQL text and reused for every row.
+    //
+    // The database lock is held from Begin() to Commit()/Rollback(), so a
+    // bulk load is atomic and posting waits until it ends. Anything not
+    // committed is rolled back on destruction.
+    class BulkInserter {
+    public:
+        explicit BulkInserter(DatabaseManager& database);
+        ~BulkInserter();
+
+        // Non-copyable
+        BulkInserter(const BulkInserter&) = delete;
+        BulkInserter& operator=(const BulkInserter&) = delete;
+
+        bool Begin();
+        bool Commit();
+        void Rollback();
+        bool IsActive() const { return active_; }
+
+        // Cached statement, reset with bindings cleared and ready to bind.
+        // Throws DatabaseException if the SQL does not prepare.
+        Statement& Prepare(const std::string& sql);
+
+        // Runs a bound statement; returns the number of rows it changed
+        int Execute(Statement& statement);
+
+        int64_t GetRowsInserted() const { return rowsInserted_; }
+
+    private:
+        DatabaseManager& database_;
+        std::unique_lock<std::recursive_mutex> lock_;
+        std::map<std::string, std::unique_ptr<Statement>> statements_;
+        bool active_;
+        int64_t rowsInserted_;
+    };
+
+} // namespace KeToanApp
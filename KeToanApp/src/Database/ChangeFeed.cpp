@@ -0,0 +1,190 @@
+#include "ChangeFeed.h"
+#include "../Utils/Logger.h"
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+
+namespace KeToanApp {
+
+    ChangeFeed::ChangeFeed(DatabaseManager& database, const std::string& consumer)
+        : database_(database)
+        , consumer_(consumer)
+        , cursor_(0)
+        , polled_(0)
+        , loaded_(false)
+    {
+    }
+
+    bool ChangeFeed::LoadCursor() {
+        auto lock = database_.Lock();
+        Connection* connection = database_.GetConnection();
+        if (!connection) {
+            Logger::Error("Database not connected");
+            return false;
+        }
+
+        try {
+            // Registering holds back Purge() until this consumer has caught up
+            auto reg = connection->Prepare(
+                "INSERT OR IGNORE INTO ChangeLogCursor (Consumer, Seq) VALUES (?, 0)");
+            reg->BindText(1, consumer_);
+            reg->Execute();
+
+            auto stmt = connection->Prepare("SELECT Seq FROM ChangeLogCursor WHERE Consumer = ?");
+            stmt->BindText(1, consumer_);
+            cursor_ = stmt->Step() ? stmt->ColumnInt64(0) : 0;
+        }
+        catch (const DatabaseException& e) {
+            Logger::Error("Change feed %s: loading cursor failed: %s", consumer_.c_str(), e.what());
+            return false;
+        }
+
+        polled_ = cursor_;
+        loaded_ = true;
+        return true;
+    }
+
+    bool ChangeFeed::Poll(std::vector<ChangeRecord>& batch, size_t maxRecords) {
+        batch.clear();
+        if (!loaded_ && !LoadCursor()) {
+            return false;
+        }
+
+        std::unique_ptr<ReadView> view = database_.OpenReadView();
+        if (!view) {
+            return false;
+        }
+
+        if (!ReadChanges(*view, polled_, maxRecords, batch)) {
+            return false;
+        }
+
+        if (!batch.empty()) {
+            polled_ = batch.back().seq;
+        }
+        return true;
+    }
+
+    bool ChangeFeed::Acknowledge() {
+        if (!loaded_ || polled_ == cursor_) {
+            return true;
+        }
+
+        auto lock = database_.Lock();
+        Connection* connection = database_.GetConnection();
+        if (!connection) {
+            Logger::Error("Database not connected");
+            return false;
+        }
+
+        try {
+            auto stmt = connection->Prepare(
+                "UPDATE ChangeLogCursor SET Seq = ?, UpdatedAt = CURRENT_TIMESTAMP WHERE Consumer = ?");
+            stmt->BindInt64(1, polled_).BindText(2, consumer_);
+            stmt->Execute();
+        }
+        catch (const DatabaseException& e) {
+            Logger::Error("Change feed %s: saving cursor failed: %s", consumer_.c_str(), e.what());
+            return false;
+        }
+
+        cursor_ = polled_;
+        return true;
+    }
+
+    bool ChangeFeed::Rewind() {
+        loaded_ = false;
+        return LoadCursor();
+    }
+
+    bool ChangeFeed::ReadChanges(ReadView& view, int64_t afterSeq, size_t maxRecords,
+        std::vector<ChangeRecord>& records)
+    {
+        try {
+            auto stmt = view.Prepare(
+                "SELECT Seq, TableName, RowKey, Operation, ChangedAt FROM ChangeLog "
+                "WHERE Seq > ? ORDER BY Seq LIMIT ?");
+            stmt->BindInt64(1, afterSeq).BindInt64(2, static_cast<int64_t>(maxRecords));
+
+            while (stmt->Step()) {
+                ChangeRecord record;
+                record.seq = stmt->ColumnInt64(0);
+                record.tableName = stmt->ColumnText(1);
+                record.rowKey = stmt->ColumnText(2);
+                record.operation = static_cast<ChangeOperation>(stmt->ColumnInt64(3));
+                record.changedAt = stmt->ColumnText(4);
+                records.push_back(std::move(record));
+            }
+        }
+        catch (const DatabaseException& e) {
+            Logger::Error("Reading change log failed: %s", e.what());
+            return false;
+        }
+        return true;
+    }
+
+    int64_t ChangeFeed::GetHeadSequence(ReadView& view) {
+        std::string value;
+        if (!view.ExecuteScalar("SELECT COALESCE(MAX(Seq), 0) FROM ChangeLog", value)) {
+            return 0;
+        }
+        return std::atoll(value.c_str());
+    }
+
+    bool ChangeFeed::Purge(DatabaseManager& database) {
+        // Cursors only move forward, so reading them before the delete
+        // can only keep more than needed
+        const int64_t lowest = ChangeCursor::GetLowest(database);
+        const int64_t horizon = lowest >= 0 ? lowest : std::numeric_limits<int64_t>::max();
+
+        auto lock = database.Lock();
+        Connection* connection = database.GetConnection();
+        if (!connection) {
+            Logger::Error("Database not connected");
+            return false;
+        }
+
+        try {
+            // Without saved consumers nothing is known to be consumed; keep the log
+            auto stmt = connection->Prepare(
+                "DELETE FROM ChangeLog WHERE EXISTS (SELECT 1 FROM ChangeLogCursor) "
+                "AND Seq <= (SELECT MIN(Seq) FROM ChangeLogCursor) AND Seq <= ?");
+            stmt->BindInt64(1, horizon);
+            stmt->Execute();
+        }
+        catch (const DatabaseException& e) {
+            Logger::Error("Purging change log failed: %s", e.what());
+            return false;
+        }
+        return true;
+    }
+
+    std::mutex ChangeCursor::mutex_;
+    std::vector<const ChangeCursor*> ChangeCursor::cursors_;
+
+    ChangeCursor::ChangeCursor(DatabaseManager& database)
+        : database_(database)
+        , seq_(-1)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        cursors_.push_back(this);
+    }
+
+    ChangeCursor::~ChangeCursor() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        cursors_.erase(std::find(cursors_.begin(), cursors_.end(), this));
+    }
+
+    int64_t ChangeCursor::GetLowest(DatabaseManager& database) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        int64_t lowest = -1;
+        for (const ChangeCursor* cursor : cursors_) {
+            const int64_t seq = cursor->seq_.load(std::memory_order_acquire);
+            if (&cursor->database_ == &database && seq >= 0 && (lowest < 0 || seq < lowest)) {
+                lowest = seq;
+            }
+        }
+        return lowest;
+    }
+
+} // namespace KeToanApp
@@ -0,0 +1,110 @@
+#pragma once
+
+#include "KeToanApp/Common.h"
+#include "KeToanApp/Types.h"
+#include "DatabaseManager.h"
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+namespace KeToanApp {
+
+    // Values of ChangeLog.Operation
+    enum class ChangeOperation {
+        Insert = 1,
+        Update = 2,     // header or detail lines changed
+        Void = 3,       // TrangThai set to DaXoa
+        Delete = 4      // row removed, e.g. archived by period close
+    };
+
+    struct ChangeRecord {
+        int64_t seq;
+        std::string tableName;     // ChungTuKeToan, PhieuNhap, PhieuXuat, SanPham or TaiKhoanKeToan
+        std::string rowKey;        // SoCT / SoPhieu / MaSP / SoTK
+        ChangeOperation operation;
+        std::string changedAt;
+    };
+
+    // Consumer of the ChangeLog table.
+    //
+    // Triggers append one entry per document or master-data row change in
+    // the writer's transaction, so Seq order is commit order and a reader
+    // never sees a gap that is later filled. A named consumer reads
+    // batches after its saved cursor and acknowledges them once processed:
+    //
+    //     ChangeFeed feed(database, "SoCai");
+    //     while (feed.Poll(batch) && !batch.empty()) { apply(batch); feed.Acknowledge(); }
+    //
+    // Acknowledging inside the transaction that writes the derived data makes
+    // the update exactly-once. Consumers that keep no state on disk can use
+    // the static ReadChanges() with their own in-memory position, held in a
+    // ChangeCursor so Purge() keeps what they have not read.
+    class ChangeFeed {
+    public:
+        ChangeFeed(DatabaseManager& database, const std::string& consumer);
+        ~ChangeFeed() = default;
+
+        // Non-copyable
+        ChangeFeed(const ChangeFeed&) = delete;
+        ChangeFeed& operator=(const ChangeFeed&) = delete;
+
+        // Next batch after the last polled position, oldest first
+        bool Poll(std::vector<ChangeRecord>& batch, size_t maxRecords = 500);
+
+        // Persists the position of the last Poll()
+        bool Acknowledge();
+
+        // Rewinds to the saved cursor, e.g. after a failed batch
+        bool Rewind();
+
+        int64_t GetCursor() const { return cursor_; }
+        int64_t GetPolled() const { return polled_; }
+        const std::string& GetConsumer() const { return consumer_; }
+
+        // Reads changes with Seq > afterSeq from a read view's snapshot
+        static bool ReadChanges(ReadView& view, int64_t afterSeq, size_t maxRecords,
+            std::vector<ChangeRecord>& records);
+        static int64_t GetHeadSequence(ReadView& view);
+
+        // Deletes entries every registered consumer has acknowledged and
+        // every set ChangeCursor on database has passed
+        static bool Purge(DatabaseManager& database);
+
+    private:
+        DatabaseManager& database_;
+        std::string consumer_;
+        int64_t cursor_;    // acknowledged
+        int64_t polled_;    // returned by the last Poll()
+        bool loaded_;
+
+        bool LoadCursor();
+    };
+
+    // In-memory ChangeLog position of an in-process consumer (the indexes
+    // and caches), registered for as long as the object lives. Unset until
+    // the consumer first loads; an unset cursor does not hold back Purge(),
+    // as the load reads the tables rather than the log.
+    class ChangeCursor {
+    public:
+        explicit ChangeCursor(DatabaseManager& database);
+        ~ChangeCursor();
+
+        // Non-copyable
+        ChangeCursor(const ChangeCursor&) = delete;
+        ChangeCursor& operator=(const ChangeCursor&) = delete;
+
+        void Set(int64_t seq) { seq_.store(seq, std::memory_order_release); }
+        void Reset() { Set(-1); }
+
+        // Lowest set cursor on database; -1 if none is set
+        static int64_t GetLowest(DatabaseManager& database);
+
+    private:
+        DatabaseManager& database_;
+        std::atomic<int64_t> seq_;
+
+        static std::mutex mutex_;
+        static std::vector<const ChangeCursor*> cursors_;
+    };
+
+} // namespace KeToanApp
@@ -1,16 +1,54 @@
 #include "Connection.h"
+#include "QueryStats.h"
+#include "SqlFunctions.h"
 #include "../Utils/Logger.h"
-
-// Note: This is a placeholder implementation
-// You need to link against SQLite3 library and include sqlite3.h
-// For now, we'll use dummy implementations
+#include "../Utils/StringHelper.h"
+#include <sqlite3.h>
+#include <chrono>
 
 namespace KeToanApp {
 
-    Connection::Connection(const AppSettings& settings)
+    namespace {
+
+        // Texts a connection keeps counters for; SQL built with values in
+        // it would otherwise grow the map without end
+        const size_t kMaxExecStats = 256;
+
+        // Times one sqlite3_exec() or scalar query into QueryStats
+        class ExecutionTimer {
+        public:
+            ExecutionTimer(const std::string& query, QueryStats::Counters* counters)
+                : query_(query)
+                , counters_(counters)
+                , started_(counters ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point())
+            {
+            }
+
+            void Finish(uint64_t rows, bool failed) {
+                if (!counters_) {
+                    return;
+                }
+                const uint64_t micros = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - started_).count());
+                if (QueryStats::Record(counters_, micros, rows, failed)) {
+                    QueryStats::RecordSlow(query_, micros, rows);
+                }
+            }
+
+        private:
+            const std::string& query_;
+            QueryStats::Counters* counters_;
+            std::chrono::steady_clock::time_point started_;
+        };
+
+    } // namespace
+
+    Connection::Connection(const AppSettings& settings, ConnectionMode mode)
         : settings_(settings)
+        , mode_(mode)
         , db_(nullptr)
         , isOpen_(false)
+        , setupLevel_(0)
         , lastError_("")
     {
     }
@@ -24,23 +62,47 @@ namespace KeToanApp {
             return true;
         }
 
-        // TODO: Implement actual SQLite connection
-        // For now, this is a placeholder
-        /*
-        int rc = sqlite3_open(settings_.databasePath.c_str(), &db_);
+        int flags = mode_ == ConnectionMode::ReadOnly
+            ? SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX
+            : SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX;
+        int rc = sqlite3_open_v2(settings_.databasePath.c_str(), &db_, flags, nullptr);
         if (rc != SQLITE_OK) {
-            SetLastError(sqlite3_errmsg(db_));
+            SetLastError(db_ ? sqlite3_errmsg(db_) : "Out of memory");
             Logger::Error("Failed to open database: %s", lastError_.c_str());
             sqlite3_close(db_);
             db_ = nullptr;
             return false;
         }
-        */
-
-        Logger::Info("Database connection opened (placeholder): %s",
-                    settings_.databasePath.c_str());
 
         isOpen_ = true;
+
+        sqlite3_busy_timeout(db_, 5000);
+
+        // money_sum(), daynum() and friends, on readers and the writer alike
+        if (!SqlFunctions::Register(db_)) {
+            Close();
+            return false;
+        }
+
+        if (mode_ == ConnectionMode::ReadOnly) {
+            // The writer has already switched the file to WAL
+            if (!Execute("PRAGMA query_only=ON")) {
+                Close();
+                return false;
+            }
+        } else {
+            // WAL lets readers proceed during posting; FULL keeps each commit durable
+            if (!Execute("PRAGMA journal_mode=WAL") ||
+                !Execute("PRAGMA synchronous=FULL") ||
+                !Execute("PRAGMA foreign_keys=ON")) {
+                Close();
+                return false;
+            }
+        }
+
+        Logger::Info("Database connection opened (%s): %s",
+            mode_ == ConnectionMode::ReadOnly ? "read-only" : "read-write",
+            settings_.databasePath.c_str());
         return true;
     }
 
@@ -49,13 +111,10 @@ namespace KeToanApp {
             return;
         }
 
-        // TODO: Close actual SQLite connection
-        /*
         if (db_) {
-            sqlite3_close(db_);
+            sqlite3_close_v2(db_);
             db_ = nullptr;
         }
-        */
 
         isOpen_ = false;
         Logger::Info("Database connection closed");
@@ -67,10 +126,10 @@ namespace KeToanApp {
             return false;
         }
 
-        // TODO: Execute actual SQLite query
-        /*
+        ExecutionTimer timer(query, GetExecStats(query));
         char* errMsg = nullptr;
         int rc = sqlite3_exec(db_, query.c_str(), nullptr, nullptr, &errMsg);
+        timer.Finish(0, rc != SQLITE_OK);
 
         if (rc != SQLITE_OK) {
             SetLastError(errMsg ? errMsg : "Unknown error");
@@ -78,9 +137,8 @@ namespace KeToanApp {
             Logger::Error("Query execution failed: %s", lastError_.c_str());
             return false;
         }
-        */
 
-        Logger::Debug("Query executed (placeholder): %s", query.c_str());
+        Logger::Debug("Query executed: %s", query.c_str());
         return true;
     }
 
@@ -90,12 +148,12 @@ namespace KeToanApp {
             return false;
         }
 
-        // TODO: Execute actual SQLite query and get scalar result
-        /*
-        sqlite3_stmt* stmt;
+        ExecutionTimer timer(query, GetExecStats(query));
+        sqlite3_stmt* stmt = nullptr;
         int rc = sqlite3_prepare_v2(db_, query.c_str(), -1, &stmt, nullptr);
 
         if (rc != SQLITE_OK) {
+            timer.Finish(0, true);
             SetLastError(sqlite3_errmsg(db_));
             return false;
         }
@@ -103,18 +161,51 @@ namespace KeToanApp {
         rc = sqlite3_step(stmt);
         if (rc == SQLITE_ROW) {
             const char* text = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
-            if (text) {
-                result = text;
-            }
+            result = text ? text : "";
+        } else if (rc != SQLITE_DONE) {
+            SetLastError(sqlite3_errmsg(db_));
         }
 
+        timer.Finish(rc == SQLITE_ROW ? 1 : 0, rc != SQLITE_ROW && rc != SQLITE_DONE);
         sqlite3_finalize(stmt);
+        Logger::Debug("Scalar query executed: %s", query.c_str());
         return rc == SQLITE_ROW;
-        */
+    }
+
+    std::unique_ptr<Statement> Connection::Prepare(const std::string& query) {
+        if (!isOpen_) {
+            throw DatabaseException("Connection not open");
+        }
+
+        return std::make_unique<Statement>(db_, query);
+    }
 
-        Logger::Debug("Scalar query executed (placeholder): %s", query.c_str());
-        result = ""; // Placeholder
-        return false; // Return false to indicate no schema exists initially
+    int64_t Connection::LastInsertRowId() const {
+        return isOpen_ ? sqlite3_last_insert_rowid(db_) : 0;
+    }
+
+    int Connection::Changes() const {
+        return isOpen_ ? sqlite3_changes(db_) : 0;
+    }
+
+    void Connection::Interrupt() {
+        if (isOpen_) {
+            sqlite3_interrupt(db_);
+        }
+    }
+
+    QueryStats::Counters* Connection::GetExecStats(const std::string& query) {
+        if (!QueryStats::IsEnabled()) {
+            return nullptr;
+        }
+        auto it = execStats_.find(query);
+        if (it != execStats_.end()) {
+            return it->second;
+        }
+        if (execStats_.size() >= kMaxExecStats) {
+            execStats_.clear();
+        }
+        return execStats_.emplace(query, QueryStats::Lookup(query)).first->second;
     }
 
     void Connection::SetLastError(const std::string& error) {
@@ -122,4 +213,55 @@ namespace KeToanApp {
         Logger::Error("Database error: %s", error.c_str());
     }
 
+    QueryGuard::QueryGuard(Connection& connection, const CancellationToken& token,
+                           std::chrono::milliseconds timeout)
+        : db_(connection.GetHandle())
+        , token_(token)
+        , timeout_(timeout)
+        , deadline_(std::chrono::steady_clock::now() + timeout)
+        , registration_(0)
+        , timedOut_(false)
+    {
+        if (!db_) {
+            return;
+        }
+        sqlite3_progress_handler(db_, kProgressInterval, &QueryGuard::OnProgress, this);
+
+        // Stops a long sort or scan without waiting for the next progress check
+        sqlite3* db = db_;
+        registration_ = token_.Register([db] { sqlite3_interrupt(db); });
+    }
+
+    QueryGuard::~QueryGuard() {
+        if (!db_) {
+            return;
+        }
+        // After this no Cancel() can interrupt the connection's next user
+        token_.Unregister(registration_);
+        sqlite3_progress_handler(db_, 0, nullptr, nullptr);
+    }
+
+    std::string QueryGuard::GetReason() const {
+        if (timedOut_) {
+            return StringHelper::Format("Query exceeded its time limit of %lld ms",
+                static_cast<long long>(timeout_.count()));
+        }
+        if (token_.IsCancelled()) {
+            return "Query cancelled";
+        }
+        return std::string();
+    }
+
+    int QueryGuard::OnProgress(void* context) {
+        QueryGuard* guard = static_cast<QueryGuard*>(context);
+        if (guard->token_.IsCancelled()) {
+            return 1;
+        }
+        if (guard->timeout_.count() > 0 && std::chrono::steady_clock::now() >= guard->deadline_) {
+            guard->timedOut_ = true;
+            return 1;
+        }
+        return 0;
+    }
+
 } // namespace KeToanApp
@@ -2,40 +2,110 @@
 
 #include "KeToanApp/Common.h"
 #include "KeToanApp/Types.h"
+#include "Statement.h"
+#include "../Utils/CancellationToken.h"
+#include <chrono>
+#include <unordered_map>
 
 // Forward declaration for SQLite
 struct sqlite3;
 
 namespace KeToanApp {
 
+    enum class ConnectionMode {
+        ReadWrite,      // the single writer: creates the file, sets WAL
+        ReadOnly        // pooled readers for snapshot read views
+    };
+
     class Connection {
     public:
-        explicit Connection(const AppSettings& settings);
+        explicit Connection(const AppSettings& settings,
+                            ConnectionMode mode = ConnectionMode::ReadWrite);
         ~Connection();
 
         // Connection management
         bool Open();
         void Close();
         bool IsOpen() const { return isOpen_; }
+        ConnectionMode GetMode() const { return mode_; }
 
         // Query execution
         bool Execute(const std::string& query);
         bool ExecuteScalar(const std::string& query, std::string& result);
 
-        // Prepared statements support
-        // TODO: Add prepared statement methods
+        // Prepared statements support (throws DatabaseException)
+        std::unique_ptr<Statement> Prepare(const std::string& query);
+        int64_t LastInsertRowId() const;
+        int Changes() const;
+
+        // Stops the statement running on this connection, which then fails
+        // with SQLITE_INTERRUPT. Safe from any thread while the connection is open.
+        void Interrupt();
 
         // Error handling
         std::string GetLastError() const { return lastError_; }
 
+        // Raw handle for SQLite APIs not wrapped here
+        sqlite3* GetHandle() { return db_; }
+
+        // DatabaseManager connection setups applied so far
+        size_t GetSetupLevel() const { return setupLevel_; }
+        void SetSetupLevel(size_t level) { setupLevel_ = level; }
+
     private:
         AppSettings settings_;
+        ConnectionMode mode_;
         sqlite3* db_;
         bool isOpen_;
+        size_t setupLevel_;
         std::string lastError_;
 
+        // QueryStats counters of Execute()/ExecuteScalar() texts, so BEGIN,
+        // SAVEPOINT and COMMIT skip fingerprinting
+        std::unordered_map<std::string, QueryStats::Counters*> execStats_;
+
         // Helper methods
         void SetLastError(const std::string& error);
+        QueryStats::Counters* GetExecStats(const std::string& query);
+    };
+
+    // Cancellation and a time limit for the statements a connection runs
+    // while the guard is alive. The SQLite progress handler checks both every
+    // kProgressInterval VM instructions, and cancelling the token interrupts
+    // the connection straight away from the cancelling thread. The running
+    // statement then fails: Statement throws QueryInterruptedException,
+    // Execute() and ExecuteScalar() return false.
+    //
+    // Create the guard on the thread using the connection, one at a time
+    // per connection, and destroy it before the connection closes.
+    class QueryGuard {
+    public:
+        static const int kProgressInterval = 1000;
+
+        // A zero timeout means no time limit
+        QueryGuard(Connection& connection, const CancellationToken& token,
+                   std::chrono::milliseconds timeout);
+        ~QueryGuard();
+
+        // Non-copyable
+        QueryGuard(const QueryGuard&) = delete;
+        QueryGuard& operator=(const QueryGuard&) = delete;
+
+        bool IsCancelled() const { return token_.IsCancelled(); }
+        bool IsTimedOut() const { return timedOut_; }
+
+        // Why statements were stopped, for error messages; empty if they were not
+        std::string GetReason() const;
+
+    private:
+        sqlite3* db_;
+        CancellationToken token_;
+        std::chrono::milliseconds timeout_;
+        std::chrono::steady_clock::time_point deadline_;
+        uint64_t registration_;
+        bool timedOut_;
+
+        static int OnProgress(void* context);
     };
 
 } // namespace KeToanApp
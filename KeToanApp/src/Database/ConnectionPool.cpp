@@ -0,0 +1,107 @@
+#include "ConnectionPool.h"
+#include "../Utils/Logger.h"
+
+namespace KeToanApp {
+
+    ConnectionPool::ConnectionPool(const AppSettings& settings, size_t maxConnections)
+        : settings_(settings)
+        , maxConnections_(maxConnections > 0 ? maxConnections : 1)
+        , openCount_(0)
+    {
+    }
+
+    ConnectionPool::~ConnectionPool() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (openCount_ != idle_.size()) {
+            Logger::Warning("Connection pool destroyed with %zu connections still in use",
+                openCount_ - idle_.size());
+        }
+        idle_.clear();
+    }
+
+    std::unique_ptr<Connection> ConnectionPool::Acquire(std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        bool ready = available_.wait_for(lock, timeout, [this] {
+            return !idle_.empty() || openCount_ < maxConnections_;
+        });
+        if (!ready) {
+            Logger::Warning("Timed out waiting for a reader connection (%zu in use)", openCount_);
+            return nullptr;
+        }
+
+        if (!idle_.empty()) {
+            std::unique_ptr<Connection> connection = std::move(idle_.back());
+            idle_.pop_back();
+            return connection;
+        }
+
+        // Reserve the slot, then open outside the lock
+        ++openCount_;
+        lock.unlock();
+
+        auto connection = std::make_unique<Connection>(settings_, ConnectionMode::ReadOnly);
+        if (!connection->Open()) {
+            lock.lock();
+            --openCount_;
+            available_.notify_one();
+            return nullptr;
+        }
+
+        return connection;
+    }
+
+    void ConnectionPool::Release(std::unique_ptr<Connection> connection) {
+        if (!connection) {
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (openCount_ > maxConnections_ || !connection->IsOpen()) {
+                --openCount_;
+                connection.reset();
+            } else {
+                idle_.push_back(std::move(connection));
+            }
+        }
+        available_.notify_one();
+    }
+
+    void ConnectionPool::SetMaxConnections(size_t maxConnections) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            maxConnections_ = maxConnections > 0 ? maxConnections : 1;
+            while (openCount_ > maxConnections_ && !idle_.empty()) {
+                idle_.pop_back();
+                --openCount_;
+            }
+        }
+        available_.notify_all();
+    }
+
+    size_t ConnectionPool::GetMaxConnections() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return maxConnections_;
+    }
+
+    size_t ConnectionPool::GetIdleCount() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return idle_.size();
+    }
+
+    size_t ConnectionPool::GetOpenCount() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return openCount_;
+    }
+
+    void ConnectionPool::CloseIdle() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            openCount_ -= idle_.size();
+            idle_.clear();
+        }
+        available_.notify_all();
+    }
+
+} // namespace KeToanApp
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "KeToanApp/Common.h"
+#include "KeToanApp/Types.h"
+#include "Connection.h"
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+namespace KeToanApp {
+
+    // Pool of read-only connections. Connections are opened lazily up to
+    // the configured maximum; Acquire() blocks when all of them are in use.
+    class ConnectionPool {
+    public:
+        ConnectionPool(const AppSettings& settings, size_t maxConnections);
+        ~ConnectionPool();
+
+        // Non-copyable
+        ConnectionPool(const ConnectionPool&) = delete;
+        ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+        // Returns nullptr if no connection became free within the timeout
+        std::unique_ptr<Connection> Acquire(std::chrono::milliseconds timeout);
+        void Release(std::unique_ptr<Connection> connection);
+
+        // Resize live; shrinking closes idle connections as they come back
+        void SetMaxConnections(size_t maxConnections);
+        size_t GetMaxConnections() const;
+        size_t GetIdleCount() const;
+        size_t GetOpenCount() const;
+
+        // Close idle connections (e.g. before a restore replaces the file)
+        void CloseIdle();
+
+    private:
+        AppSettings settings_;
+        mutable std::mutex mutex_;
+        std::condition_variable available_;
+        std::vector<std::unique_ptr<Connection>> idle_;
+        size_t maxConnections_;
+        size_t openCount_;
+    };
+
+} // namespace KeToanApp
@@ -1,5 +1,6 @@
 #include "DatabaseManager.h"
 #include "../Utils/Logger.h"
+#include "../Utils/Trace.h"
 
 namespace KeToanApp {
 
@@ -8,6 +9,8 @@ namespace KeToanApp {
         , connection_(nullptr)
         , connected_(false)
         , inTransaction_(false)
+        , readers_(nullptr)
+        , readerPoolSize_(4)
     {
     }
 
@@ -16,6 +19,7 @@ namespace KeToanApp {
     }
 
     bool DatabaseManager::Connect() {
+        KETOAN_TRACE_SCOPE("db", "Connect");
         if (connected_) {
             return true;
         }
@@ -28,16 +32,35 @@ namespace KeToanApp {
                 return false;
             }
 
+            // Schema helpers go through ExecuteQuery, which requires connected_
+            connected_ = true;
+
             // Check and create schema if needed
             if (!CheckSchema()) {
                 Logger::Info("Database schema not found, creating...");
                 if (!CreateTables()) {
                     Logger::Error("Failed to create database schema");
+                    connected_ = false;
+                    connection_->Close();
                     return false;
                 }
             }
 
-            connected_ = true;
+            if (!UpgradeSchema()) {
+                Logger::Error("Failed to upgrade database schema");
+                connected_ = false;
+                connection_->Close();
+                return false;
+            }
+
+            // Commit sequence identifies read-view snapshots; older files lack the row
+            ExecuteQuery("INSERT OR IGNORE INTO SystemInfo (Key, Value) VALUES ('CommitSeq', '0')");
+
+            readers_ = std::make_unique<ConnectionPool>(settings_, readerPoolSize_);
+
+            // Setups added before a reconnect
+            ApplySetups(*connection_);
+
             Logger::Info("Database connected successfully");
             return true;
         }
@@ -56,6 +79,15 @@ namespace KeToanApp {
             Rollback();
         }
 
+        // Readers must not outlive the writer's view of the file
+        readers_.reset();
+
+        // Statements must be finalized before the connection closes
+        insertChungTuStmt_.reset();
+        insertDinhKhoanStmt_.reset();
+        beginLinesStmt_.reset();
+        endLinesStmt_.reset();
+
         if (connection_) {
             connection_->Close();
         }
@@ -300,7 +332,426 @@ namespace KeToanApp {
         return ExecuteQuery(queryCongNo);
     }
 
+    bool DatabaseManager::CreatePeriodTables() {
+        // Fiscal years and their close state
+        std::string queryKy = R"(
+            CREATE TABLE IF NOT EXISTS KyKeToan (
+                NamTC INTEGER PRIMARY KEY,
+                NgayBatDau TEXT NOT NULL,
+                NgayKetThuc TEXT NOT NULL,
+                TrangThai INTEGER DEFAULT 0,
+                NgayKhoaSo TEXT
+            );
+        )";
+
+        if (!ExecuteQuery(queryKy)) {
+            return false;
+        }
+
+        // Opening account balances carried forward by period close
+        std::string querySoDu = R"(
+            CREATE TABLE IF NOT EXISTS SoDuDauKy (
+                NamTC INTEGER NOT NULL,
+                SoTK TEXT NOT NULL,
+                DuNo REAL DEFAULT 0,
+                DuCo REAL DEFAULT 0,
+                PRIMARY KEY (NamTC, SoTK),
+                FOREIGN KEY (SoTK) REFERENCES TaiKhoanKeToan(SoTK)
+            );
+        )";
+
+        if (!ExecuteQuery(querySoDu)) {
+            return false;
+        }
+
+        // Opening stock carried forward by period close
+        std::string queryTonDau = R"(
+            CREATE TABLE IF NOT EXISTS TonKhoDauKy (
+                NamTC INTEGER NOT NULL,
+                MaSP TEXT NOT NULL,
+                SoLuong REAL DEFAULT 0,
+                GiaTri REAL DEFAULT 0,
+                PRIMARY KEY (NamTC, MaSP),
+                FOREIGN KEY (MaSP) REFERENCES SanPham(MaSP)
+            );
+        )";
+
+        if (!ExecuteQuery(queryTonDau)) {
+            return false;
+        }
+
+        // Date and join indexes used by period queries
+        std::string queryIndexes = R"(
+            CREATE INDEX IF NOT EXISTS IX_ChungTuKeToan_NgayCT ON ChungTuKeToan(NgayCT);
+            CREATE INDEX IF NOT EXISTS IX_DinhKhoan_SoCT ON DinhKhoan(SoCT);
+            CREATE INDEX IF NOT EXISTS IX_PhieuNhap_NgayNhap ON PhieuNhap(NgayNhap);
+            CREATE INDEX IF NOT EXISTS IX_ChiTietPhieuNhap_SoPhieu ON ChiTietPhieuNhap(SoPhieu);
+            CREATE INDEX IF NOT EXISTS IX_PhieuXuat_NgayXuat ON PhieuXuat(NgayXuat);
+            CREATE INDEX IF NOT EXISTS IX_ChiTietPhieuXuat_SoPhieu ON ChiTietPhieuXuat(SoPhieu);
+        )";
+
+        return ExecuteQuery(queryIndexes);
+    }
+
+    bool DatabaseManager::CreateChangeLogTables() {
+        // Append-only change feed of documents. Seq follows commit order since
+        // there is a single writer; Operation is a ChangeOperation value.
+        std::string queryLog = R"(
+            CREATE TABLE IF NOT EXISTS ChangeLog (
+                Seq INTEGER PRIMARY KEY AUTOINCREMENT,
+                TableName TEXT NOT NULL,
+                RowKey TEXT NOT NULL,
+                Operation INTEGER NOT NULL,
+                ChangedAt TEXT DEFAULT CURRENT_TIMESTAMP
+            );
+        )";
+
+        if (!ExecuteQuery(queryLog)) {
+            return false;
+        }
+
+        // Saved positions of ChangeFeed consumers
+        std::string queryCursor = R"(
+            CREATE TABLE IF NOT EXISTS ChangeLogCursor (
+                Consumer TEXT PRIMARY KEY,
+                Seq INTEGER NOT NULL DEFAULT 0,
+                UpdatedAt TEXT DEFAULT CURRENT_TIMESTAMP
+            );
+        )";
+
+        if (!ExecuteQuery(queryCursor)) {
+            return false;
+        }
+
+        // Triggers log every write path in the writer's own transaction
+        struct Document {
+            const char* table;
+            const char* key;
+        };
+        static const Document documents[] = {
+            { "ChungTuKeToan", "SoCT" },
+            { "PhieuNhap", "SoPhieu" },
+            { "PhieuXuat", "SoPhieu" },
+        };
+
+        for (const auto& doc : documents) {
+            std::string table = doc.table;
+            std::string key = doc.key;
+            std::string insertLog = "INSERT INTO ChangeLog (TableName, RowKey, Operation) VALUES ('" + table + "', ";
+
+            std::string triggers =
+                "CREATE TRIGGER IF NOT EXISTS TR_" + table + "_Insert AFTER INSERT ON " + table +
+                " BEGIN " + insertLog + "NEW." + key + ", 1); END;"
+
+                // TrangThai moving to DaXoa is a void, anything else an update
+                "CREATE TRIGGER IF NOT EXISTS TR_" + table + "_Update AFTER UPDATE ON " + table +
+                " BEGIN " + insertLog + "NEW." + key + ", CASE WHEN NEW.TrangThai = 2 AND OLD.TrangThai IS NOT 2 "
+                "THEN 3 ELSE 2 END); END;"
+
+                "CREATE TRIGGER IF NOT EXISTS TR_" + table + "_Delete AFTER DELETE ON " + table +
+                " BEGIN " + insertLog + "OLD." + key + ", 4); END;";
+
+            if (!ExecuteQuery(triggers)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool DatabaseManager::CreateDetailChangeTriggers() {
+        // Documents whose lines are being inserted along with them (see
+        // BeginDocumentLines); rows live only inside the inserting transaction
+        std::string queryPending = R"(
+            CREATE TABLE IF NOT EXISTS ChangeLogPending (
+                TableName TEXT NOT NULL,
+                RowKey TEXT NOT NULL,
+                PRIMARY KEY (TableName, RowKey)
+            ) WITHOUT ROWID;
+        )";
+
+        if (!ExecuteQuery(queryPending)) {
+            return false;
+        }
+
+        // Detail-line changes log an update of the parent document, unless
+        // the document is marked pending: its own Insert entry, written in
+        // the same transaction, covers them. Replaces the 1.2.0 triggers,
+        // which skipped lines whenever the newest entry named the document,
+        // even one committed earlier.
+        struct Detail {
+            const char* table;
+            const char* key;
+            const char* detailTable;
+        };
+        static const Detail details[] = {
+            { "ChungTuKeToan", "SoCT", "DinhKhoan" },
+            { "PhieuNhap", "SoPhieu", "ChiTietPhieuNhap" },
+            { "PhieuXuat", "SoPhieu", "ChiTietPhieuXuat" },
+        };
+
+        for (const auto& doc : details) {
+            std::string table = doc.table;
+            std::string key = doc.key;
+            std::string detail = doc.detailTable;
+            std::string insertLog = "INSERT INTO ChangeLog (TableName, RowKey, Operation) VALUES ('" + table + "', ";
+            std::string notPending = "NOT EXISTS (SELECT 1 FROM ChangeLogPending WHERE TableName = '" + table +
+                                     "' AND RowKey = ";
+
+            std::string triggers =
+                "DROP TRIGGER IF EXISTS TR_" + detail + "_Insert;"
+                "DROP TRIGGER IF EXISTS TR_" + detail + "_Update;"
+                "DROP TRIGGER IF EXISTS TR_" + detail + "_Delete;"
+
+                "CREATE TRIGGER TR_" + detail + "_Insert AFTER INSERT ON " + detail +
+                " WHEN " + notPending + "NEW." + key + ")"
+                " BEGIN " + insertLog + "NEW." + key + ", 2); END;"
+
+                "CREATE TRIGGER TR_" + detail + "_Update AFTER UPDATE ON " + detail +
+                " WHEN " + notPending + "NEW." + key + ")"
+                " BEGIN " + insertLog + "NEW." + key + ", 2); END;"
+
+                "CREATE TRIGGER TR_" + detail + "_Delete AFTER DELETE ON " + detail +
+                " WHEN " + notPending + "OLD." + key + ")"
+                " BEGIN " + insertLog + "OLD." + key + ", 2); END;";
+
+            if (!ExecuteQuery(triggers)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool DatabaseManager::CreateMasterDataTriggers() {
+        // Master data changes go to the same ChangeLog, one entry per row, so
+        // in-memory copies (MasterDataCache) know when to reload. A renamed
+        // code also logs the old code as deleted.
+        struct Master {
+            const char* table;
+            const char* key;
+        };
+        static const Master masters[] = {
+            { "SanPham", "MaSP" },
+            { "TaiKhoanKeToan", "SoTK" },
+        };
+
+        for (const auto& master : masters) {
+            std::string table = master.table;
+            std::string key = master.key;
+            std::string insertLog = "INSERT INTO ChangeLog (TableName, RowKey, Operation) VALUES ('" + table + "', ";
+
+            std::string triggers =
+                "CREATE TRIGGER IF NOT EXISTS TR_" + table + "_Insert AFTER INSERT ON " + table +
+                " BEGIN " + insertLog + "NEW." + key + ", 1); END;"
+
+                "CREATE TRIGGER IF NOT EXISTS TR_" + table + "_Update AFTER UPDATE ON " + table +
+                " BEGIN " + insertLog + "NEW." + key + ", CASE WHEN NEW.TrangThai = 2 AND OLD.TrangThai IS NOT 2 "
+                "THEN 3 ELSE 2 END); END;"
+
+                "CREATE TRIGGER IF NOT EXISTS TR_" + table + "_Rename AFTER UPDATE OF " + key + " ON " + table +
+                " WHEN OLD." + key + " IS NOT NEW." + key +
+                " BEGIN " + insertLog + "OLD." + key + ", 4); END;"
+
+                "CREATE TRIGGER IF NOT EXISTS TR_" + table + "_Delete AFTER DELETE ON " + table +
+                " BEGIN " + insertLog + "OLD." + key + ", 4); END;";
+
+            if (!ExecuteQuery(triggers)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool DatabaseManager::CreateCodeDictionaryTable() {
+        // Dense ids of product, account and counterparty codes, persisted so
+        // they stay the same across runs. Kind is a CodeKind value; ids of
+        // a kind run 0..n-1 and are never reused.
+        std::string query = R"(
+            CREATE TABLE IF NOT EXISTS CodeDictionary (
+                Kind INTEGER NOT NULL,
+                Id INTEGER NOT NULL,
+                Code TEXT NOT NULL,
+                PRIMARY KEY (Kind, Id),
+                UNIQUE (Kind, Code)
+            );
+        )";
+
+        return ExecuteQuery(query);
+    }
+
+    bool DatabaseManager::CreateWarehouseTables() {
+        // Warehouses (kho). Lines from before warehouses existed, and lines
+        // written without one, belong to the default warehouse.
+        std::string queryKho = R"(
+            CREATE TABLE IF NOT EXISTS Kho (
+                MaKho TEXT PRIMARY KEY,
+                TenKho TEXT NOT NULL,
+                DiaChi TEXT,
+                TrangThai INTEGER DEFAULT 1
+            );
+            INSERT OR IGNORE INTO Kho (MaKho, TenKho) VALUES ('KHO01', 'Kho chính');
+        )";
+
+        if (!ExecuteQuery(queryKho)) {
+            return false;
+        }
+
+        // Lots (lô hàng) of a product in a warehouse. SoLuongCon is the
+        // quantity on hand, kept by the triggers below; HanDung NULL means
+        // the lot does not expire. Every write to a lot stamps ChangeSeq
+        // with the ChangeLog head, so in-memory copies re-read only the
+        // lots written since they last looked.
+        std::string queryLo = R"(
+            CREATE TABLE IF NOT EXISTS LoHang (
+                ID INTEGER PRIMARY KEY AUTOINCREMENT,
+                MaSP TEXT NOT NULL,
+                MaKho TEXT NOT NULL,
+                SoLo TEXT NOT NULL,
+                NgaySanXuat TEXT,
+                HanDung TEXT,
+                SoLuongCon REAL NOT NULL DEFAULT 0,
+                ChangeSeq INTEGER NOT NULL DEFAULT 0,
+                UNIQUE (MaSP, MaKho, SoLo),
+                FOREIGN KEY (MaSP) REFERENCES SanPham(MaSP),
+                FOREIGN KEY (MaKho) REFERENCES Kho(MaKho)
+            );
+
+            CREATE INDEX IF NOT EXISTS IX_LoHang_HanDung ON LoHang(MaSP, MaKho, HanDung);
+            CREATE INDEX IF NOT EXISTS IX_LoHang_ChangeSeq ON LoHang(ChangeSeq);
+
+            CREATE TRIGGER IF NOT EXISTS TR_LoHang_Stamp AFTER INSERT ON LoHang
+            BEGIN
+                UPDATE LoHang SET ChangeSeq = (SELECT COALESCE(MAX(Seq), 0) FROM ChangeLog) WHERE ID = NEW.ID;
+            END;
+
+            CREATE TRIGGER IF NOT EXISTS TR_LoHang_Restamp AFTER UPDATE OF MaSP, MaKho, HanDung, SoLuongCon ON LoHang
+            BEGIN
+                UPDATE LoHang SET ChangeSeq = (SELECT COALESCE(MAX(Seq), 0) FROM ChangeLog) WHERE ID = NEW.ID;
+            END;
+        )";
+
+        if (!ExecuteQuery(queryLo)) {
+            return false;
+        }
+
+        // Warehouse and lot of each stock movement. A foreign key column
+        // added to a table must default to NULL, so MaKho is checked by the
+        // application rather than by a constraint. Lines without a lot are
+        // stock of products not tracked by lot.
+        struct Movement {
+            const char* table;
+            const char* detailTable;
+            const char* add;        // sign of a line's effect on its lot
+            const char* reverse;
+        };
+        static const Movement movements[] = {
+            { "PhieuNhap", "ChiTietPhieuNhap", "+", "-" },
+            { "PhieuXuat", "ChiTietPhieuXuat", "-", "+" },
+        };
+
+        for (const auto& movement : movements) {
+            std::string table = movement.table;
+            std::string detail = movement.detailTable;
+            std::string add = movement.add;
+            std::string reverse = movement.reverse;
+            std::string notVoided = "(SELECT TrangThai FROM " + table + " WHERE SoPhieu = ";
+
+            std::string columns =
+                "ALTER TABLE " + detail + " ADD COLUMN MaKho TEXT NOT NULL DEFAULT 'KHO01';"
+                "ALTER TABLE " + detail + " ADD COLUMN LoHangID INTEGER REFERENCES LoHang(ID);"
+                "CREATE INDEX IF NOT EXISTS IX_" + detail + "_LoHangID ON " + detail + "(LoHangID);";
+
+            // Lines of voided documents do not count. Deleting lines leaves
+            // the lots alone: only period close deletes lines, and the stock
+            // on hand carries into the next year as it is.
+            std::string triggers =
+                "CREATE TRIGGER IF NOT EXISTS TR_" + detail + "_LotInsert AFTER INSERT ON " + detail +
+                " WHEN NEW.LoHangID IS NOT NULL AND " + notVoided + "NEW.SoPhieu) IS NOT 2"
+                " BEGIN UPDATE LoHang SET SoLuongCon = SoLuongCon " + add + " NEW.SoLuong WHERE ID = NEW.LoHangID; END;"
+
+                "CREATE TRIGGER IF NOT EXISTS TR_" + detail + "_LotUpdate AFTER UPDATE OF SoPhieu, LoHangID, SoLuong ON " + detail +
+                " BEGIN"
+                " UPDATE LoHang SET SoLuongCon = SoLuongCon " + reverse + " OLD.SoLuong"
+                " WHERE ID = OLD.LoHangID AND " + notVoided + "OLD.SoPhieu) IS NOT 2;"
+                " UPDATE LoHang SET SoLuongCon = SoLuongCon " + add + " NEW.SoLuong"
+                " WHERE ID = NEW.LoHangID AND " + notVoided + "NEW.SoPhieu) IS NOT 2;"
+                " END;"
+
+                // Voiding a document takes its lines off their lots, restoring it puts them back
+                "CREATE TRIGGER IF NOT EXISTS TR_" + table + "_LotVoid AFTER UPDATE OF TrangThai ON " + table +
+                " WHEN (NEW.TrangThai IS 2) <> (OLD.TrangThai IS 2)"
+                " BEGIN UPDATE LoHang SET SoLuongCon = SoLuongCon " + add +
+                " (CASE WHEN NEW.TrangThai IS 2 THEN -1 ELSE 1 END) *"
+                " (SELECT SUM(SoLuong) FROM " + detail + " WHERE SoPhieu = NEW.SoPhieu AND LoHangID = LoHang.ID)"
+                " WHERE ID IN (SELECT LoHangID FROM " + detail + " WHERE SoPhieu = NEW.SoPhieu); END;";
+
+            if (!ExecuteQuery(columns) || !ExecuteQuery(triggers)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool DatabaseManager::CreateStockTakeTables() {
+        // Stock-takes (kiểm kê) and the documents that adjusted the books
+        // to the count; a line per product, warehouse and lot compared
+        std::string query = R"(
+            CREATE TABLE IF NOT EXISTS KiemKe (
+                SoKiemKe TEXT PRIMARY KEY,
+                NgayKiemKe TEXT NOT NULL,
+                DienGiai TEXT,
+                NguoiLap TEXT,
+                SoPhieuNhap TEXT,
+                SoPhieuXuat TEXT,
+                SoCT TEXT,
+                TrangThai INTEGER DEFAULT 1,
+                NgayTao TEXT DEFAULT CURRENT_TIMESTAMP
+            );
+
+            CREATE TABLE IF NOT EXISTS ChiTietKiemKe (
+                ID INTEGER PRIMARY KEY AUTOINCREMENT,
+                SoKiemKe TEXT NOT NULL,
+                MaSP TEXT NOT NULL,
+                MaKho TEXT NOT NULL,
+                LoHangID INTEGER,
+                SoLuongSoSach REAL NOT NULL,
+                SoLuongThucTe REAL NOT NULL,
+                ChenhLech REAL NOT NULL,
+                DonGia REAL DEFAULT 0,
+                GiaTriChenhLech REAL DEFAULT 0,
+                FOREIGN KEY (SoKiemKe) REFERENCES KiemKe(SoKiemKe),
+                FOREIGN KEY (MaSP) REFERENCES SanPham(MaSP),
+                FOREIGN KEY (LoHangID) REFERENCES LoHang(ID)
+            );
+
+            CREATE INDEX IF NOT EXISTS IX_ChiTietKiemKe_SoKiemKe ON ChiTietKiemKe(SoKiemKe);
+        )";
+
+        return ExecuteQuery(query);
+    }
+
+    bool DatabaseManager::CreateNumberingTables() {
+        // Last number given out per document type and period, shared by
+        // every process numbering documents (see DocumentNumberAllocator)
+        std::string query = R"(
+            CREATE TABLE IF NOT EXISTS DemSoChungTu (
+                LoaiCT TEXT NOT NULL,
+                Ky TEXT NOT NULL,
+                SoCuoi INTEGER NOT NULL DEFAULT 0,
+                PRIMARY KEY (LoaiCT, Ky)
+            ) WITHOUT ROWID;
+        )";
+
+        return ExecuteQuery(query);
+    }
+
     bool DatabaseManager::BeginTransaction() {
+        KETOAN_TRACE_SCOPE("db", "BeginTransaction");
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+
         if (inTransaction_) {
             Logger::Warning("Transaction already in progress");
             return false;
@@ -315,11 +766,20 @@ namespace KeToanApp {
     }
 
     bool DatabaseManager::Commit() {
+        KETOAN_TRACE_SCOPE("db", "Commit");
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+
         if (!inTransaction_) {
             Logger::Warning("No transaction to commit");
             return false;
         }
 
+        // Every commit advances the sequence read views report as their snapshot
+        if (!ExecuteQuery("UPDATE SystemInfo SET Value = CAST(Value AS INTEGER) + 1 "
+                          "WHERE Key='CommitSeq'")) {
+            return false;
+        }
+
         if (ExecuteQuery("COMMIT")) {
             inTransaction_ = false;
             return true;
@@ -329,6 +789,9 @@ namespace KeToanApp {
     }
 
     bool DatabaseManager::Rollback() {
+        KETOAN_TRACE_SCOPE("db", "Rollback");
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+
         if (!inTransaction_) {
             Logger::Warning("No transaction to rollback");
             return false;
@@ -343,6 +806,8 @@ namespace KeToanApp {
     }
 
     bool DatabaseManager::ExecuteQuery(const std::string& query) {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+
         if (!connected_ || !connection_) {
             Logger::Error("Database not connected");
             return false;
@@ -352,6 +817,8 @@ namespace KeToanApp {
     }
 
     bool DatabaseManager::ExecuteScalar(const std::string& query, std::string& result) {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+
         if (!connected_ || !connection_) {
             Logger::Error("Database not connected");
             return false;
@@ -360,6 +827,176 @@ namespace KeToanApp {
         return connection_->ExecuteScalar(query, result);
     }
 
+    bool DatabaseManager::Savepoint(const std::string& name) {
+        return ExecuteQuery("SAVEPOINT " + name);
+    }
+
+    bool DatabaseManager::ReleaseSavepoint(const std::string& name) {
+        return ExecuteQuery("RELEASE SAVEPOINT " + name);
+    }
+
+    bool DatabaseManager::RollbackToSavepoint(const std::string& name) {
+        // ROLLBACK TO leaves the savepoint open; release it as well
+        return ExecuteQuery("ROLLBACK TO SAVEPOINT " + name) && ReleaseSavepoint(name);
+    }
+
+    std::unique_ptr<ReadView> DatabaseManager::OpenReadView(std::chrono::milliseconds timeout) {
+        KETOAN_TRACE_SCOPE("db", "OpenReadView");
+        if (!connected_ || !readers_) {
+            Logger::Error("Database not connected");
+            return nullptr;
+        }
+
+        std::unique_ptr<Connection> connection = readers_->Acquire(timeout);
+        if (!connection) {
+            return nullptr;
+        }
+        if (!ApplySetups(*connection)) {
+            readers_->Release(std::move(connection));
+            return nullptr;
+        }
+
+        auto view = std::make_unique<ReadView>(*readers_, std::move(connection));
+        if (!view->Begin()) {
+            Logger::Error("Failed to open read view");
+            return nullptr;
+        }
+        return view;
+    }
+
+    void DatabaseManager::SetReaderPoolSize(size_t size) {
+        readerPoolSize_ = size;
+        if (readers_) {
+            readers_->SetMaxConnections(size);
+        }
+    }
+
+    bool DatabaseManager::AddConnectionSetup(ConnectionSetup setup) {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+        {
+            std::lock_guard<std::mutex> setupLock(setupMutex_);
+            setups_.push_back(std::move(setup));
+        }
+        return !connection_ || !connection_->IsOpen() || ApplySetups(*connection_);
+    }
+
+    bool DatabaseManager::ApplySetups(Connection& connection) {
+        std::lock_guard<std::mutex> lock(setupMutex_);
+        for (size_t i = connection.GetSetupLevel(); i < setups_.size(); ++i) {
+            if (!setups_[i](connection.GetHandle())) {
+                Logger::Error("Connection setup %zu failed", i);
+                return false;
+            }
+            connection.SetSetupLevel(i + 1);
+        }
+        return true;
+    }
+
+    bool DatabaseManager::InsertChungTu(const ChungTu& chungTu) {
+        KETOAN_TRACE_SPAN(span, "db", "InsertChungTu");
+        KETOAN_TRACE_ARG(span, "lines", chungTu.lines.size());
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+        if (!connected_ || !connection_) {
+            Logger::Error("Database not connected");
+            return false;
+        }
+
+        if (!inTransaction_) {
+            Logger::Error("InsertChungTu requires an open transaction");
+            return false;
+        }
+
+        try {
+            if (!insertChungTuStmt_) {
+                insertChungTuStmt_ = connection_->Prepare(
+                    "INSERT INTO ChungTuKeToan (SoCT, NgayCT, LoaiCT, DienGiai, NguoiLap, TrangThai) "
+                    "VALUES (?, ?, ?, ?, ?, ?)");
+                insertDinhKhoanStmt_ = connection_->Prepare(
+                    "INSERT INTO DinhKhoan (SoCT, STT, TKNo, TKCo, SoTien, DienGiai) "
+                    "VALUES (?, ?, ?, ?, ?, ?)");
+            }
+
+            Statement& header = *insertChungTuStmt_;
+            header.Reset();
+            header.BindText(1, chungTu.soCT)
+                  .BindText(2, chungTu.ngayCT)
+                  .BindText(3, chungTu.loaiCT)
+                  .BindText(4, chungTu.dienGiai)
+                  .BindText(5, chungTu.nguoiLap)
+                  .BindInt64(6, static_cast<int64_t>(chungTu.trangThai));
+            header.Execute();
+
+            if (!BeginDocumentLines("ChungTuKeToan", chungTu.soCT)) {
+                return false;
+            }
+            Statement& line = *insertDinhKhoanStmt_;
+            for (const auto& dk : chungTu.lines) {
+                line.Reset();
+                line.BindText(1, chungTu.soCT)
+                    .BindInt64(2, dk.stt)
+                    .BindText(3, dk.tkNo)
+                    .BindText(4, dk.tkCo)
+                    .BindDouble(5, dk.soTien.value)
+                    .BindText(6, dk.dienGiai);
+                line.Execute();
+            }
+
+            return EndDocumentLines("ChungTuKeToan", chungTu.soCT);
+        }
+        catch (const DatabaseException& e) {
+            Logger::Error("Insert ChungTu %s failed: %s", chungTu.soCT.c_str(), e.what());
+            // Callers roll back a failed insert; never leave the mark behind if one does not
+            EndDocumentLines("ChungTuKeToan", chungTu.soCT);
+            return false;
+        }
+    }
+
+    bool DatabaseManager::BeginDocumentLines(const std::string& table, const std::string& key) {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+        if (!inTransaction_) {
+            Logger::Error("BeginDocumentLines requires an open transaction");
+            return false;
+        }
+
+        try {
+            if (!beginLinesStmt_) {
+                beginLinesStmt_ = connection_->Prepare(
+                    "INSERT OR IGNORE INTO ChangeLogPending (TableName, RowKey) VALUES (?, ?)");
+            }
+            beginLinesStmt_->Reset();
+            beginLinesStmt_->BindText(1, table).BindText(2, key);
+            beginLinesStmt_->Execute();
+            return true;
+        }
+        catch (const DatabaseException& e) {
+            Logger::Error("Marking %s %s pending failed: %s", table.c_str(), key.c_str(), e.what());
+            return false;
+        }
+    }
+
+    bool DatabaseManager::EndDocumentLines(const std::string& table, const std::string& key) {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+        if (!connected_ || !connection_) {
+            return false;
+        }
+
+        try {
+            if (!endLinesStmt_) {
+                endLinesStmt_ = connection_->Prepare(
+                    "DELETE FROM ChangeLogPending WHERE TableName = ? AND RowKey = ?");
+            }
+            endLinesStmt_->Reset();
+            endLinesStmt_->BindText(1, table).BindText(2, key);
+            endLinesStmt_->Execute();
+            return true;
+        }
+        catch (const DatabaseException& e) {
+            Logger::Error("Clearing pending %s %s failed: %s", table.c_str(), key.c_str(), e.what());
+            return false;
+        }
+    }
+
     std::string DatabaseManager::GetSchemaVersion() {
         std::string version;
         std::string query = "SELECT Value FROM SystemInfo WHERE Key='SchemaVersion'";
@@ -376,9 +1013,60 @@ namespace KeToanApp {
     }
 
     bool DatabaseManager::UpgradeSchema() {
-        // TODO: Implement schema upgrade logic
-        Logger::Info("Schema upgrade not yet implemented");
+        KETOAN_TRACE_SCOPE("db", "UpgradeSchema");
+
+        // Upgrade steps, oldest first. Each runs in its own transaction and
+        // records its version, so an interrupted upgrade resumes where it stopped.
+        struct UpgradeStep {
+            const char* version;
+            bool (DatabaseManager::*apply)();
+        };
+        static const UpgradeStep steps[] = {
+            { "1.1.0", &DatabaseManager::CreatePeriodTables },
+            { "1.2.0", &DatabaseManager::CreateChangeLogTables },
+            { "1.3.0", &DatabaseManager::CreateMasterDataTriggers },
+            { "1.4.0", &DatabaseManager::CreateCodeDictionaryTable },
+            { "1.5.0", &DatabaseManager::CreateWarehouseTables },
+            { "1.6.0", &DatabaseManager::CreateStockTakeTables },
+            { "1.7.0", &DatabaseManager::CreateNumberingTables },
+            { "1.8.0", &DatabaseManager::CreateDetailChangeTriggers },
+        };
+
+        std::string current = GetSchemaVersion();
+        for (const auto& step : steps) {
+            if (CompareVersions(current, step.version) >= 0) {
+                continue;
+            }
+
+            Logger::Info("Upgrading schema %s -> %s", current.c_str(), step.version);
+            if (!BeginTransaction()) {
+                return false;
+            }
+
+            if (!(this->*step.apply)() || !SetSchemaVersion(step.version) || !Commit()) {
+                Logger::Error("Schema upgrade to %s failed", step.version);
+                Rollback();
+                return false;
+            }
+
+            current = step.version;
+        }
+
         return true;
     }
 
+    int DatabaseManager::CompareVersions(const std::string& a, const std::string& b) {
+        int partsA[3] = { 0, 0, 0 };
+        int partsB[3] = { 0, 0, 0 };
+        sscanf_s(a.c_str(), "%d.%d.%d", &partsA[0], &partsA[1], &partsA[2]);
+        sscanf_s(b.c_str(), "%d.%d.%d", &partsB[0], &partsB[1], &partsB[2]);
+
+        for (int i = 0; i < 3; ++i) {
+            if (partsA[i] != partsB[i]) {
+                return partsA[i] < partsB[i] ? -1 : 1;
+            }
+        }
+        return 0;
+    }
+
 } // namespace KeToanApp
@@ -3,6 +3,11 @@
 #include "KeToanApp/Common.h"
 #include "KeToanApp/Types.h"
 #include "Connection.h"
+#include "ConnectionPool.h"
+#include "ReadView.h"
+#include "../Models/ChungTu.h"
+#include <functional>
+#include <mutex>
 
 namespace KeToanApp {
 
@@ -25,6 +30,40 @@ namespace KeToanApp {
         bool BeginTransaction();
         bool Commit();
         bool Rollback();
+        bool InTransaction() const { return inTransaction_; }
+
+        // Savepoints nest inside a transaction, e.g. one per voucher of a batch
+        bool Savepoint(const std::string& name);
+        bool ReleaseSavepoint(const std::string& name);
+        bool RollbackToSavepoint(const std::string& name);
+
+        // Serializes use of the connection across threads. Hold the lock for
+        // the whole of a multi-statement sequence such as a transaction.
+        std::unique_lock<std::recursive_mutex> Lock() {
+            return std::unique_lock<std::recursive_mutex>(mutex_);
+        }
+
+        // Snapshot-isolated read views on pooled reader connections.
+        // Returns nullptr if no reader became free within the timeout.
+        std::unique_ptr<ReadView> OpenReadView(
+            std::chrono::milliseconds timeout = std::chrono::seconds(30));
+        void SetReaderPoolSize(size_t size);
+
+        // Extra setup for every connection, such as virtual table modules.
+        // Runs on the writer now and on each reader before its next read view.
+        using ConnectionSetup = std::function<bool(sqlite3* db)>;
+        bool AddConnectionSetup(ConnectionSetup setup);
+
+        // Documents. Must be called inside a transaction.
+        bool InsertChungTu(const ChungTu& chungTu);
+
+        // Brackets inserting the lines of a document inserted in the same
+        // transaction: the document's Insert entry in the ChangeLog covers
+        // them, so the line triggers skip their own entries. Always call
+        // EndDocumentLines() before the transaction commits; a rollback
+        // clears the mark as well.
+        bool BeginDocumentLines(const std::string& table, const std::string& key);
+        bool EndDocumentLines(const std::string& table, const std::string& key);
 
         // Query execution
         bool ExecuteQuery(const std::string& query);
@@ -32,21 +71,43 @@ namespace KeToanApp {
 
         // Getters
         Connection* GetConnection() { return connection_.get(); }
+        const AppSettings& GetSettings() const { return settings_; }
 
     private:
         AppSettings settings_;
         std::unique_ptr<Connection> connection_;
         bool connected_;
         bool inTransaction_;
+        std::recursive_mutex mutex_;
+        std::unique_ptr<ConnectionPool> readers_;
+        size_t readerPoolSize_;
+        std::mutex setupMutex_;
+        std::vector<ConnectionSetup> setups_;
+
+        // Cached prepared statements for the posting path
+        std::unique_ptr<Statement> insertChungTuStmt_;
+        std::unique_ptr<Statement> insertDinhKhoanStmt_;
+        std::unique_ptr<Statement> beginLinesStmt_;
+        std::unique_ptr<Statement> endLinesStmt_;
 
         // Schema management
         bool CreateKhoTables();
         bool CreateKeToanTables();
         bool CreateSystemTables();
+        bool CreatePeriodTables();
+        bool CreateChangeLogTables();
+        bool CreateMasterDataTriggers();
+        bool CreateCodeDictionaryTable();
+        bool CreateWarehouseTables();
+        bool CreateStockTakeTables();
+        bool CreateNumberingTables();
+        bool CreateDetailChangeTriggers();
 
         // Helper methods
+        bool ApplySetups(Connection& connection);
         std::string GetSchemaVersion();
         bool SetSchemaVersion(const std::string& version);
+        static int CompareVersions(const std::string& a, const std::string& b);
     };
 
 } // namespace KeToanApp
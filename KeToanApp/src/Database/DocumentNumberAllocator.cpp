@@ -0,0 +1,339 @@
+#include "DocumentNumberAllocator.h"
+#include "../Utils/DateTimeHelper.h"
+#include "../Utils/Logger.h"
+#include "../Utils/StringHelper.h"
+#include <cstdio>
+
+namespace KeToanApp {
+
+    namespace {
+
+        struct TypeInfo {
+            const char* name;               // DemSoChungTu.LoaiCT and the config section
+            const char* defaultPattern;
+        };
+
+        // In DocumentType order
+        const TypeInfo kTypes[] = {
+            { "ChungTuKeToan", "CT{yyyy}-{MM}-{seq:6}" },
+            { "PhieuNhap",     "PN{yyyy}-{MM}-{seq:6}" },
+            { "PhieuXuat",     "PX{yyyy}-{MM}-{seq:6}" },
+        };
+
+        // floor keeps numbers this process has handed out from being
+        // reserved again after a rollback
+        const char* kReserveCounter =
+            "INSERT INTO DemSoChungTu (LoaiCT, Ky, SoCuoi) VALUES (?1, ?2, ?4 + ?3) "
+            "ON CONFLICT (LoaiCT, Ky) DO UPDATE SET SoCuoi = MAX(SoCuoi, ?4) + ?3";
+
+        const char* kCounterQuery =
+            "SELECT SoCuoi FROM DemSoChungTu WHERE LoaiCT = ?1 AND Ky = ?2";
+
+        // Only while the block is still the last one reserved
+        const char* kReturnCounter =
+            "UPDATE DemSoChungTu SET SoCuoi = ?3 WHERE LoaiCT = ?1 AND Ky = ?2 AND SoCuoi = ?4";
+
+        std::string PatternKey(int type) {
+            return std::string("Numbering.") + kTypes[type].name + ".Pattern";
+        }
+
+        std::string PolicyKey(int type) {
+            return std::string("Numbering.") + kTypes[type].name + ".Policy";
+        }
+
+    } // namespace
+
+    DocumentNumberAllocator::DocumentNumberAllocator(DatabaseManager& database, Config& config)
+        : database_(database)
+        , config_(config)
+        , blockSize_(100)
+    {
+        config_.DeclareInt("Numbering.BlockSize", 100, 1, 1000000);
+        blockSize_ = config_.GetInt("Numbering.BlockSize");
+
+        for (int t = 0; t < 3; ++t) {
+            config_.Declare(PatternKey(t), kTypes[t].defaultPattern, [](const std::string& value) {
+                std::vector<Part> parts;
+                Granularity granularity;
+                return ParsePattern(value, parts, granularity);
+            });
+            config_.Declare(PolicyKey(t), "GapAllowed", Config::OneOf({ "GapAllowed", "GapFree" }));
+
+            Sequence& sequence = sequences_[t];
+            if (!ParsePattern(config_.GetString(PatternKey(t)), sequence.parts, sequence.granularity)) {
+                ParsePattern(kTypes[t].defaultPattern, sequence.parts, sequence.granularity);
+            }
+            sequence.policy = config_.GetString(PolicyKey(t)) == "GapFree"
+                ? NumberingPolicy::GapFree : NumberingPolicy::GapAllowed;
+            sequence.current.store(nullptr);
+        }
+    }
+
+    bool DocumentNumberAllocator::ParsePattern(const std::string& pattern, std::vector<Part>& parts,
+        Granularity& granularity) {
+        parts.clear();
+        bool year = false;
+        bool month = false;
+        bool day = false;
+        int sequences = 0;
+
+        std::string text;
+        size_t i = 0;
+        while (i < pattern.size()) {
+            if (pattern[i] != '{') {
+                text += pattern[i++];
+                continue;
+            }
+            const size_t close = pattern.find('}', i);
+            if (close == std::string::npos) {
+                return false;
+            }
+            if (!text.empty()) {
+                parts.push_back({ Field::Text, text, 0 });
+                text.clear();
+            }
+
+            const std::string token = pattern.substr(i + 1, close - i - 1);
+            if (token == "yyyy" || token == "yy") {
+                parts.push_back({ token == "yyyy" ? Field::Year : Field::ShortYear, std::string(), 0 });
+                year = true;
+            }
+            else if (token == "MM") {
+                parts.push_back({ Field::Month, std::string(), 0 });
+                month = true;
+            }
+            else if (token == "dd") {
+                parts.push_back({ Field::Day, std::string(), 0 });
+                day = true;
+            }
+            else if (token == "seq" || token.compare(0, 4, "seq:") == 0) {
+                int64_t width = 1;
+                if (token.size() > 3 && (!Config::ParseInt(token.substr(4), width) || width < 1 || width > 18)) {
+                    return false;
+                }
+                parts.push_back({ Field::Sequence, std::string(), static_cast<int>(width) });
+                ++sequences;
+            }
+            else {
+                return false;
+            }
+            i = close + 1;
+        }
+        if (!text.empty()) {
+            parts.push_back({ Field::Text, text, 0 });
+        }
+
+        // A month without its year would repeat numbers a year later
+        if (sequences != 1 || (month && !year) || (day && !month)) {
+            return false;
+        }
+        granularity = day ? kDay : month ? kMonth : year ? kYear : kNoPeriod;
+        return true;
+    }
+
+    int32_t DocumentNumberAllocator::PeriodOf(Granularity granularity, const Date& date) {
+        switch (granularity) {
+        case kYear:  return date.year;
+        case kMonth: return date.year * 100 + date.month;
+        case kDay:   return date.year * 10000 + date.month * 100 + date.day;
+        default:     return 0;
+        }
+    }
+
+    std::string DocumentNumberAllocator::PeriodKey(Granularity granularity, int32_t period) {
+        switch (granularity) {
+        case kYear:  return StringHelper::Format("%04d", period);
+        case kMonth: return StringHelper::Format("%04d-%02d", period / 100, period % 100);
+        case kDay:   return StringHelper::Format("%04d-%02d-%02d", period / 10000, period / 100 % 100, period % 100);
+        default:     return std::string();
+        }
+    }
+
+    std::string DocumentNumberAllocator::Format(const Sequence& sequence, const Date& date, int64_t value) const {
+        std::string number;
+        char digits[32];
+        for (const auto& part : sequence.parts) {
+            switch (part.field) {
+            case Field::Text:      number += part.text; continue;
+            case Field::Year:      snprintf(digits, sizeof(digits), "%04d", date.year); break;
+            case Field::ShortYear: snprintf(digits, sizeof(digits), "%02d", date.year % 100); break;
+            case Field::Month:     snprintf(digits, sizeof(digits), "%02d", date.month); break;
+            case Field::Day:       snprintf(digits, sizeof(digits), "%02d", date.day); break;
+            case Field::Sequence:  snprintf(digits, sizeof(digits), "%0*lld", part.width, static_cast<long long>(value)); break;
+            }
+            number += digits;
+        }
+        return number;
+    }
+
+    NumberingPolicy DocumentNumberAllocator::GetPolicy(DocumentType type) const {
+        return sequences_[static_cast<int>(type)].policy;
+    }
+
+    bool DocumentNumberAllocator::Next(DocumentType type, DayNumber day, std::string& number) {
+        const Sequence& sequence = sequences_[static_cast<int>(type)];
+        const Date date = DateTimeHelper::FromDayNumber(day);
+        const int32_t period = PeriodOf(sequence.granularity, date);
+        return sequence.policy == NumberingPolicy::GapFree
+            ? NextGapFree(type, period, date, number)
+            : NextFromBlock(type, period, date, number);
+    }
+
+    bool DocumentNumberAllocator::NextFromBlock(DocumentType type, int32_t period, const Date& date,
+        std::string& number) {
+        Sequence& sequence = sequences_[static_cast<int>(type)];
+
+        Block* block = sequence.current.load(std::memory_order_acquire);
+        if (block && block->period == period) {
+            const int64_t value = block->next.fetch_add(1, std::memory_order_relaxed);
+            if (value <= block->last) {
+                number = Format(sequence, date, value);
+                return true;
+            }
+        }
+
+        // Another period, or the block is used up
+        auto databaseLock = database_.Lock();
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (database_.InTransaction()) {
+            Logger::Error("Document numbers: %s blocks are reserved outside transactions; "
+                "take the number before the document's transaction", kTypes[static_cast<int>(type)].name);
+            return false;
+        }
+
+        int64_t floor = 0;
+        auto it = sequence.blocks.find(period);
+        if (it != sequence.blocks.end()) {
+            const int64_t value = it->second->next.fetch_add(1, std::memory_order_relaxed);
+            if (value <= it->second->last) {
+                number = Format(sequence, date, value);
+                return true;
+            }
+            floor = it->second->last;
+        }
+
+        int64_t last = 0;
+        if (!Reserve(type, period, blockSize_, floor, last)) {
+            return false;
+        }
+        const int64_t first = last - blockSize_ + 1;
+        allocated_.emplace_back(period, first + 1, last);
+        Block* reserved = &allocated_.back();
+        sequence.blocks[period] = reserved;
+
+        // Back-dated documents keep the current period's block in place
+        Block* latest = sequence.current.load(std::memory_order_relaxed);
+        if (!latest || period >= latest->period) {
+            sequence.current.store(reserved, std::memory_order_release);
+        }
+
+        number = Format(sequence, date, first);
+        return true;
+    }
+
+    bool DocumentNumberAllocator::NextGapFree(DocumentType type, int32_t period, const Date& date,
+        std::string& number) {
+        auto databaseLock = database_.Lock();
+        if (!database_.InTransaction()) {
+            Logger::Error("Document numbers: %s numbers are gap-free and must be taken in the posting transaction",
+                kTypes[static_cast<int>(type)].name);
+            return false;
+        }
+
+        int64_t last = 0;
+        if (!Reserve(type, period, 1, 0, last)) {
+            return false;
+        }
+        number = Format(sequences_[static_cast<int>(type)], date, last);
+        return true;
+    }
+
+    bool DocumentNumberAllocator::Reserve(DocumentType type, int32_t period, int64_t count, int64_t floor,
+        int64_t& last) {
+        const int t = static_cast<int>(type);
+        const std::string ky = PeriodKey(sequences_[t].granularity, period);
+
+        auto lock = database_.Lock();
+        Connection* connection = database_.GetConnection();
+        if (!connection) {
+            Logger::Error("Document numbers: database not connected");
+            return false;
+        }
+
+        // Inside the caller's transaction the counter moves with it
+        const bool own = !database_.InTransaction();
+        if (own && !database_.BeginTransaction()) {
+            return false;
+        }
+
+        try {
+            auto update = connection->Prepare(kReserveCounter);
+            update->BindText(1, kTypes[t].name).BindText(2, ky).BindInt64(3, count).BindInt64(4, floor);
+            update->Execute();
+
+            auto query = connection->Prepare(kCounterQuery);
+            query->BindText(1, kTypes[t].name).BindText(2, ky);
+            if (!query->Step()) {
+                throw DatabaseException("counter row missing");
+            }
+            last = query->ColumnInt64(0);
+        }
+        catch (const DatabaseException& e) {
+            Logger::Error("Document numbers: reserving %s %s failed: %s", kTypes[t].name, ky.c_str(), e.what());
+            if (own) {
+                database_.Rollback();
+            }
+            return false;
+        }
+
+        if (own && !database_.Commit()) {
+            database_.Rollback();
+            return false;
+        }
+        return true;
+    }
+
+    void DocumentNumberAllocator::ReturnUnused() {
+        auto databaseLock = database_.Lock();
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        Connection* connection = database_.GetConnection();
+        if (!connection) {
+            return;
+        }
+
+        int64_t returned = 0;
+        try {
+            auto update = connection->Prepare(kReturnCounter);
+            for (int t = 0; t < 3; ++t) {
+                for (const auto& entry : sequences_[t].blocks) {
+                    Block* block = entry.second;
+                    // Nothing more is handed out from the block after this
+                    const int64_t next = block->next.exchange(block->last + 1);
+                    if (next > block->last) {
+                        continue;
+                    }
+                    update->Reset();
+                    update->BindText(1, kTypes[t].name)
+                        .BindText(2, PeriodKey(sequences_[t].granularity, entry.first))
+                        .BindInt64(3, next - 1)
+                        .BindInt64(4, block->last);
+                    update->Execute();
+                    if (connection->Changes() > 0) {
+                        returned += block->last - next + 1;
+                    }
+                }
+            }
+        }
+        catch (const DatabaseException& e) {
+            Logger::Error("Document numbers: returning unused numbers failed: %s", e.what());
+            return;
+        }
+
+        if (returned > 0) {
+            Logger::Info("Document numbers: %lld unused numbers returned", static_cast<long long>(returned));
+        }
+    }
+
+} // namespace KeToanApp
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "KeToanApp/Common.h"
+#include "KeToanApp/Types.h"
+#include "DatabaseManager.h"
+#include "../Core/Config.h"
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+
+namespace KeToanApp {
+
+    enum class NumberingPolicy : uint8_t {
+        GapAllowed = 0,     // numbers handed out from blocks reserved ahead
+        GapFree = 1         // each number taken in the document's own transaction
+    };
+
+    // Numbers for ChungTuKeToan.SoCT, PhieuNhap.SoPhieu and PhieuXuat.SoPhieu,
+    // one sequence per document type and period.
+    //
+    // Numbering.<Type>.Pattern lays a number out: "PN{yyyy}-{MM}-{seq:6}"
+    // gives PN2026-10-000123 for the 123rd receipt of October 2026. The
+    // finest date field present ({yyyy}, {yy}, {MM}, {dd}) sets the period
+    // the sequence restarts in; {seq:N} is the number, zero-padded to N
+    // digits. The last number of each sequence is kept in DemSoChungTu,
+    // keyed by type and period (Ky: "2026-10", "2026" or "" when the
+    // pattern has no date), so every process continues the same sequence.
+    //
+    // GapAllowed reserves Numbering.BlockSize numbers with one counter
+    // update and hands them out with an atomic increment, so entering a
+    // document never waits on the database for its number. A number whose
+    // document is not saved is skipped, as is the rest of a block when the
+    // process ends; ReturnUnused() gives the rest back if no other process
+    // has reserved since. A block is reserved in a transaction of its own:
+    // reserved inside the caller's, a rollback would give the numbers back
+    // to other processes while this one still hands them out. Take these
+    // numbers before opening the document's transaction.
+    //
+    // GapFree updates the counter for each number inside the caller's
+    // transaction: a document rolled back gives its number back, and
+    // documents of that type are serialized on the counter row until the
+    // transaction ends, which a gap-free sequence needs anyway.
+    //
+    // Patterns and policies are read at construction.
+    class DocumentNumberAllocator {
+    public:
+        DocumentNumberAllocator(DatabaseManager& database, Config& config);
+        ~DocumentNumberAllocator() = default;
+
+        // Non-copyable
+        DocumentNumberAllocator(const DocumentNumberAllocator&) = delete;
+        DocumentNumberAllocator& operator=(const DocumentNumberAllocator&) = delete;
+
+        // Next number of type for a document dated day. A GapFree type is
+        // numbered under database.Lock() in the transaction inserting the
+        // document; false if none is open. A GapAllowed type is numbered
+        // outside any transaction; false inside one if a block is needed.
+        bool Next(DocumentType type, DayNumber day, std::string& number);
+
+        NumberingPolicy GetPolicy(DocumentType type) const;
+
+        // Gives back what is left of the reserved blocks, e.g. at shutdown
+        void ReturnUnused();
+
+    private:
+        enum class Field : uint8_t { Text, Year, ShortYear, Month, Day, Sequence };
+
+        struct Part {
+            Field field;
+            std::string text;       // Text
+            int width;              // Sequence, digits
+        };
+
+        enum Granularity : uint8_t { kNoPeriod = 0, kYear = 1, kMonth = 2, kDay = 3 };
+
+        // Numbers [next, last] reserved for one period; next runs past last
+        // once the block is used up
+        struct Block {
+            int32_t period;
+            int64_t last;
+            std::atomic<int64_t> next;
+
+            Block(int32_t period_, int64_t first, int64_t last_) : period(period_), last(last_), next(first) {}
+        };
+
+        struct Sequence {
+            std::vector<Part> parts;
+            Granularity granularity;
+            NumberingPolicy policy;
+            std::atomic<Block*> current;            // latest period's block, read without the lock
+            std::map<int32_t, Block*> blocks;       // by period, under mutex_
+        };
+
+        DatabaseManager& database_;
+        Config& config_;
+        int64_t blockSize_;
+        Sequence sequences_[3];         // by DocumentType
+
+        // Taken after database_.Lock() when both are held
+        std::mutex mutex_;
+        std::deque<Block> allocated_;   // every block reserved; addresses stay valid
+
+        bool NextFromBlock(DocumentType type, int32_t period, const Date& date, std::string& number);
+        bool NextGapFree(DocumentType type, int32_t period, const Date& date, std::string& number);
+        // Adds count to the counter, no lower than floor first; returns the new last number
+        bool Reserve(DocumentType type, int32_t period, int64_t count, int64_t floor, int64_t& last);
+        std::string Format(const Sequence& sequence, const Date& date, int64_t value) const;
+
+        static bool ParsePattern(const std::string& pattern, std::vector<Part>& parts, Granularity& granularity);
+        static int32_t PeriodOf(Granularity granularity, const Date& date);
+        static std::string PeriodKey(Granularity granularity, int32_t period);
+    };
+
+} // namespace KeToanApp
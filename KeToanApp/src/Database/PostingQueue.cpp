@@ -0,0 +1,303 @@
+#include "PostingQueue.h"
+#include "../Utils/DateTimeHelper.h"
+#include "../Utils/Logger.h"
+#include "../Utils/Trace.h"
+#include <algorithm>
+
+namespace KeToanApp {
+
+    namespace {
+
+        using Clock = std::chrono::steady_clock;
+
+        uint64_t MicrosSince(Clock::time_point start) {
+            return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+                Clock::now() - start).count());
+        }
+
+    } // namespace
+
+    PostingQueue::PostingQueue(DatabaseManager& database, Config& config, DocumentNumberAllocator* numbers)
+        : database_(database)
+        , config_(config)
+        , numbers_(numbers)
+        , stopping_(false)
+        , running_(false)
+        , windowMicros_(0)
+        , maxBatchSize_(1)
+        , windowSubscription_(0)
+        , batchSubscription_(0)
+        , submitted_(0)
+        , committed_(0)
+        , failed_(0)
+        , batches_(0)
+        , statsStart_(Clock::now().time_since_epoch().count())
+    {
+        config_.DeclareInt("Posting.GroupCommitWindowUs", 2000, 0, 1000000);
+        config_.DeclareInt("Posting.MaxBatchSize", 256, 1, 100000);
+
+        windowMicros_ = config_.GetInt("Posting.GroupCommitWindowUs");
+        maxBatchSize_ = static_cast<size_t>(config_.GetInt("Posting.MaxBatchSize"));
+
+        windowSubscription_ = config_.Subscribe("Posting.GroupCommitWindowUs",
+            [this](const std::string&, const std::string&) {
+                windowMicros_ = config_.GetInt("Posting.GroupCommitWindowUs");
+            });
+        batchSubscription_ = config_.Subscribe("Posting.MaxBatchSize",
+            [this](const std::string&, const std::string&) {
+                maxBatchSize_ = static_cast<size_t>(config_.GetInt("Posting.MaxBatchSize"));
+            });
+    }
+
+    PostingQueue::~PostingQueue() {
+        Stop();
+        config_.Unsubscribe(windowSubscription_);
+        config_.Unsubscribe(batchSubscription_);
+    }
+
+    bool PostingQueue::Start() {
+        if (running_) {
+            return true;
+        }
+
+        if (!database_.IsConnected()) {
+            Logger::Error("Posting queue requires a connected database");
+            return false;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = false;
+        }
+
+        running_ = true;
+        worker_ = std::thread(&PostingQueue::Run, this);
+        Logger::Info("Posting queue started (window %lld us, max batch %zu)",
+            static_cast<long long>(windowMicros_.load()), maxBatchSize_.load());
+        return true;
+    }
+
+    void PostingQueue::Stop() {
+        if (!running_) {
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wakeup_.notify_one();
+
+        if (worker_.joinable()) {
+            worker_.join();
+        }
+
+        running_ = false;
+        LogStats();
+        Logger::Info("Posting queue stopped");
+    }
+
+    std::future<PostingResult> PostingQueue::Post(ChungTu chungTu) {
+        Request request;
+        request.chungTu = std::move(chungTu);
+        request.enqueued = Clock::now();
+        std::future<PostingResult> future = request.promise.get_future();
+
+        bool notify = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!running_ || stopping_) {
+                Resolve(request, false, "Posting queue is not running");
+                return future;
+            }
+
+            queue_.push_back(std::move(request));
+
+            // Wake the worker for the first voucher of a batch or a full batch;
+            // vouchers in between are picked up when the window closes.
+            notify = queue_.size() == 1 || queue_.size() >= maxBatchSize_.load();
+        }
+
+        submitted_.fetch_add(1, std::memory_order_relaxed);
+        if (notify) {
+            wakeup_.notify_one();
+        }
+        return future;
+    }
+
+    void PostingQueue::Run() {
+        Trace::SetThreadName("PostingQueue");
+        std::vector<Request> batch;
+
+        for (;;) {
+            batch.clear();
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wakeup_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+
+                if (queue_.empty()) {
+                    break;  // stopping and drained
+                }
+
+                // Hold the batch open until the window measured from its first
+                // voucher closes, or it is full. Requests that arrive while the
+                // previous batch was committing are already waiting here.
+                size_t maxBatch = maxBatchSize_.load();
+                auto deadline = queue_.front().enqueued
+                              + std::chrono::microseconds(windowMicros_.load());
+                while (!stopping_ && queue_.size() < maxBatch &&
+                       wakeup_.wait_until(lock, deadline) == std::cv_status::no_timeout) {
+                }
+
+                size_t take = std::min(queue_.size(), maxBatch);
+                batch.reserve(take);
+                for (size_t i = 0; i < take; ++i) {
+                    batch.push_back(std::move(queue_.front()));
+                    queue_.pop_front();
+                }
+            }
+
+            CommitBatch(batch);
+        }
+    }
+
+    void PostingQueue::CommitBatch(std::vector<Request>& batch) {
+        KETOAN_TRACE_SPAN(span, "posting", "CommitBatch");
+        KETOAN_TRACE_ARG(span, "vouchers", batch.size());
+        auto lock = database_.Lock();
+
+        // Vouchers the queue numbers. A GapAllowed block reserved inside the
+        // batch would be undone by a rollback while still handed out, so
+        // those numbers are taken first; GapFree ones under the savepoint.
+        const bool gapFree = numbers_
+            && numbers_->GetPolicy(DocumentType::ChungTuKeToan) == NumberingPolicy::GapFree;
+        std::vector<bool> assigned(batch.size(), false);
+        for (size_t i = 0; i < batch.size(); ++i) {
+            assigned[i] = numbers_ && batch[i].chungTu.soCT.empty();
+            if (assigned[i] && !gapFree) {
+                Number(batch[i].chungTu);
+            }
+        }
+
+        if (!database_.BeginTransaction()) {
+            for (auto& request : batch) {
+                Resolve(request, false, "Failed to begin posting transaction");
+            }
+            failed_.fetch_add(batch.size(), std::memory_order_relaxed);
+            return;
+        }
+
+        std::vector<bool> inserted(batch.size(), false);
+        for (size_t i = 0; i < batch.size(); ++i) {
+            if (!database_.Savepoint("posting")) {
+                continue;
+            }
+
+            // A gap-free number is taken inside the savepoint, so a
+            // rejected voucher gives it back
+            ChungTu& chungTu = batch[i].chungTu;
+            const bool numbered = assigned[i] && gapFree ? Number(chungTu) : !chungTu.soCT.empty();
+
+            if (numbered && database_.InsertChungTu(chungTu)) {
+                inserted[i] = database_.ReleaseSavepoint("posting");
+            } else {
+                database_.RollbackToSavepoint("posting");
+                if (assigned[i]) {
+                    chungTu.soCT.clear();
+                }
+            }
+        }
+
+        auto commitStart = Clock::now();
+        bool durable = database_.Commit();
+        commitLatency_.Record(MicrosSince(commitStart));
+
+        if (!durable) {
+            database_.Rollback();
+        }
+
+        // Update counters before resolving so callers see consistent stats
+        uint64_t ok = durable ? static_cast<uint64_t>(std::count(inserted.begin(), inserted.end(), true)) : 0;
+        committed_.fetch_add(ok, std::memory_order_relaxed);
+        failed_.fetch_add(batch.size() - ok, std::memory_order_relaxed);
+        batches_.fetch_add(1, std::memory_order_relaxed);
+
+        for (size_t i = 0; i < batch.size(); ++i) {
+            bool success = durable && inserted[i];
+            latency_.Record(MicrosSince(batch[i].enqueued));
+            Resolve(batch[i], success,
+                success ? "" : (durable ? "Voucher rejected by database" : "Batch commit failed"));
+        }
+
+        if (ok > 0 && commitListener_) {
+            commitListener_();
+        }
+    }
+
+    bool PostingQueue::Number(ChungTu& chungTu) {
+        DayNumber day = 0;
+        return DateTimeHelper::ParseDayNumber(chungTu.ngayCT.c_str(), chungTu.ngayCT.size(), day) &&
+            numbers_->Next(DocumentType::ChungTuKeToan, day, chungTu.soCT);
+    }
+
+    void PostingQueue::Resolve(Request& request, bool success, const std::string& error) {
+        PostingResult result;
+        result.success = success;
+        result.soCT = request.chungTu.soCT;
+        result.error = error;
+        request.promise.set_value(std::move(result));
+    }
+
+    PostingStats PostingQueue::GetStats() const {
+        PostingStats stats;
+        stats.submitted = submitted_.load(std::memory_order_relaxed);
+        stats.committed = committed_.load(std::memory_order_relaxed);
+        stats.failed = failed_.load(std::memory_order_relaxed);
+        stats.batches = batches_.load(std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stats.queueDepth = queue_.size();
+        }
+
+        stats.averageBatchSize = stats.batches
+            ? static_cast<double>(stats.committed + stats.failed) / static_cast<double>(stats.batches)
+            : 0.0;
+
+        Clock::time_point start{ Clock::duration(statsStart_.load()) };
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        stats.throughputPerSecond = seconds > 0.0 ? static_cast<double>(stats.committed) / seconds : 0.0;
+
+        stats.latencyP50 = latency_.Percentile(50);
+        stats.latencyP99 = latency_.Percentile(99);
+        stats.latencyMax = latency_.Max();
+        stats.commitP50 = commitLatency_.Percentile(50);
+        stats.commitP99 = commitLatency_.Percentile(99);
+        return stats;
+    }
+
+    void PostingQueue::ResetStats() {
+        submitted_ = 0;
+        committed_ = 0;
+        failed_ = 0;
+        batches_ = 0;
+        statsStart_ = Clock::now().time_since_epoch().count();
+        latency_.Reset();
+        commitLatency_.Reset();
+    }
+
+    void PostingQueue::LogStats() const {
+        PostingStats stats = GetStats();
+        Logger::Info("Posting: %llu committed, %llu failed, %llu batches (avg %.1f), %.1f vouchers/s",
+            static_cast<unsigned long long>(stats.committed),
+            static_cast<unsigned long long>(stats.failed),
+            static_cast<unsigned long long>(stats.batches),
+            stats.averageBatchSize, stats.throughputPerSecond);
+        Logger::Info("Posting latency p50 %llu us, p99 %llu us, max %llu us; commit p50 %llu us, p99 %llu us",
+            static_cast<unsigned long long>(stats.latencyP50),
+            static_cast<unsigned long long>(stats.latencyP99),
+            static_cast<unsigned long long>(stats.latencyMax),
+            static_cast<unsigned long long>(stats.commitP50),
+            static_cast<unsigned long long>(stats.commitP99));
+    }
+
+} // namespace KeToanApp
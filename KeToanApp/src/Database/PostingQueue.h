@@ -0,0 +1,128 @@
+#pragma once
+
+#include "KeToanApp/Common.h"
+#include "KeToanApp/Types.h"
+#include "DatabaseManager.h"
+#include "DocumentNumberAllocator.h"
+#include "../Core/Config.h"
+#include "../Models/ChungTu.h"
+#include "../Utils/LatencyHistogram.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+
+namespace KeToanApp {
+
+    struct PostingResult {
+        bool success;
+        std::string soCT;       // as numbered by the queue if the voucher came without one
+        std::string error;
+
+        PostingResult() : success(false) {}
+    };
+
+    struct PostingStats {
+        uint64_t submitted;
+        uint64_t committed;
+        uint64_t failed;
+        uint64_t batches;
+        size_t queueDepth;
+        double averageBatchSize;
+        double throughputPerSecond;     // committed vouchers / second since start
+
+        // Submit-to-durable latency, microseconds
+        uint64_t latencyP50;
+        uint64_t latencyP99;
+        uint64_t latencyMax;
+
+        // COMMIT (fsync) duration per batch, microseconds
+        uint64_t commitP50;
+        uint64_t commitP99;
+    };
+
+    // Group-commit queue for voucher posting.
+    //
+    // Concurrent Post() calls are collected for up to Posting.GroupCommitWindowUs
+    // (or until Posting.MaxBatchSize vouchers are waiting) and written in a
+    // single transaction, so one fsync covers the whole batch. Each voucher is
+    // inserted under its own savepoint: a failing voucher is rolled back alone
+    // and the rest of the batch still commits. A caller's future resolves only
+    // after the COMMIT carrying its voucher has returned.
+    //
+    // A voucher posted with an empty SoCT is numbered from the allocator,
+    // if there is one: before the batch's transaction for a GapAllowed
+    // sequence, under the voucher's savepoint for a GapFree one.
+    class PostingQueue {
+    public:
+        using CommitListener = std::function<void()>;
+
+        PostingQueue(DatabaseManager& database, Config& config, DocumentNumberAllocator* numbers = nullptr);
+        ~PostingQueue();
+
+        // Non-copyable
+        PostingQueue(const PostingQueue&) = delete;
+        PostingQueue& operator=(const PostingQueue&) = delete;
+
+        // Worker lifecycle. Stop() drains vouchers already queued.
+        bool Start();
+        void Stop();
+        bool IsRunning() const { return running_; }
+
+        // Enqueue a voucher; the future resolves once it is durable (or failed)
+        std::future<PostingResult> Post(ChungTu chungTu);
+
+        // Called on the worker thread after each batch that committed a
+        // voucher, once its futures are resolved. Set before Start().
+        void SetCommitListener(CommitListener listener) { commitListener_ = std::move(listener); }
+
+        // Metrics
+        PostingStats GetStats() const;
+        void ResetStats();
+        void LogStats() const;
+
+    private:
+        struct Request {
+            ChungTu chungTu;
+            std::promise<PostingResult> promise;
+            std::chrono::steady_clock::time_point enqueued;
+        };
+
+        DatabaseManager& database_;
+        Config& config_;
+        DocumentNumberAllocator* numbers_;
+        CommitListener commitListener_;
+
+        mutable std::mutex mutex_;
+        std::condition_variable wakeup_;
+        std::deque<Request> queue_;
+        std::thread worker_;
+        bool stopping_;
+        std::atomic<bool> running_;
+
+        // Tuning, updated live from config
+        std::atomic<int64_t> windowMicros_;
+        std::atomic<size_t> maxBatchSize_;
+        Config::SubscriptionId windowSubscription_;
+        Config::SubscriptionId batchSubscription_;
+
+        // Metrics
+        std::atomic<uint64_t> submitted_;
+        std::atomic<uint64_t> committed_;
+        std::atomic<uint64_t> failed_;
+        std::atomic<uint64_t> batches_;
+        std::atomic<int64_t> statsStart_;   // steady_clock ticks
+        LatencyHistogram latency_;
+        LatencyHistogram commitLatency_;
+
+        void Run();
+        void CommitBatch(std::vector<Request>& batch);
+        bool Number(ChungTu& chungTu);
+        static void Resolve(Request& request, bool success, const std::string& error);
+    };
+
+} // namespace KeToanApp
@@ -0,0 +1,369 @@
+#include "QueryStats.h"
+#include "../Utils/DateTimeHelper.h"
+#include "../Utils/LatencyHistogram.h"
+#include "../Utils/Logger.h"
+#include "../Utils/StringHelper.h"
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+
+namespace KeToanApp {
+
+    struct QueryStats::Counters {
+        std::string fingerprint;
+        std::atomic<uint64_t> rows{ 0 };
+        std::atomic<uint64_t> errors{ 0 };
+        std::atomic<uint64_t> slow{ 0 };
+        LatencyHistogram latency;   // its count is the call count
+    };
+
+    std::atomic<bool> QueryStats::enabled_{ true };
+    std::atomic<uint64_t> QueryStats::slowMicros_{ 200000 };
+    std::mutex QueryStats::mutex_;
+    std::unordered_map<std::string, std::unique_ptr<QueryStats::Counters>> QueryStats::counters_;
+    std::vector<SlowQuery> QueryStats::slowQueries_;
+    size_t QueryStats::slowNext_ = 0;
+    size_t QueryStats::slowKeep_ = 50;
+
+    namespace {
+
+        // Ad-hoc SQL with identifiers built in could grow the map without end
+        const size_t kMaxFingerprints = 4096;
+        const char* kOtherFingerprint = "(other)";
+
+        // Slow-query log lines and ring entries
+        const size_t kMaxLoggedSql = 2000;
+
+        bool IsWordChar(char c) {
+            return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '$'
+                || static_cast<unsigned char>(c) >= 0x80;
+        }
+
+        bool EndsWith(const std::string& text, const char* suffix) {
+            const size_t length = std::char_traits<char>::length(suffix);
+            return text.size() >= length && text.compare(text.size() - length, length, suffix) == 0;
+        }
+
+        std::string Truncate(const std::string& sql) {
+            return sql.size() <= kMaxLoggedSql ? sql : sql.substr(0, kMaxLoggedSql) + "...";
+        }
+
+    } // namespace
+
+    void QueryStats::SetEnabled(bool enabled) {
+        enabled_.store(enabled, std::memory_order_relaxed);
+    }
+
+    void QueryStats::SetSlowThreshold(uint64_t micros) {
+        slowMicros_.store(micros, std::memory_order_relaxed);
+    }
+
+    void QueryStats::SetSlowQueryKeep(size_t count) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (count == slowKeep_) {
+            return;
+        }
+        // Re-linearize oldest first and keep the newest
+        std::vector<SlowQuery> ordered;
+        ordered.reserve(slowQueries_.size());
+        for (size_t i = 0; i < slowQueries_.size(); ++i) {
+            ordered.push_back(std::move(slowQueries_[(slowNext_ + i) % slowQueries_.size()]));
+        }
+        if (ordered.size() > count) {
+            ordered.erase(ordered.begin(), ordered.end() - static_cast<ptrdiff_t>(count));
+        }
+        slowQueries_ = std::move(ordered);
+        slowNext_ = 0;
+        slowKeep_ = count;
+    }
+
+    QueryStats::Counters* QueryStats::Lookup(std::string_view sql) {
+        std::string fingerprint = Fingerprint(sql);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = counters_.find(fingerprint);
+        if (it != counters_.end()) {
+            return it->second.get();
+        }
+        if (counters_.size() >= kMaxFingerprints) {
+            fingerprint = kOtherFingerprint;
+            it = counters_.find(fingerprint);
+            if (it != counters_.end()) {
+                return it->second.get();
+            }
+        }
+
+        auto counters = std::make_unique<Counters>();
+        counters->fingerprint = fingerprint;
+        Counters* found = counters.get();
+        counters_.emplace(std::move(fingerprint), std::move(counters));
+        return found;
+    }
+
+    bool QueryStats::Record(Counters* counters, uint64_t micros, uint64_t rows, bool failed) {
+        counters->latency.Record(micros);
+        if (rows) {
+            counters->rows.fetch_add(rows, std::memory_order_relaxed);
+        }
+        if (failed) {
+            counters->errors.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        const uint64_t threshold = slowMicros_.load(std::memory_order_relaxed);
+        if (threshold == 0 || micros < threshold) {
+            return false;
+        }
+        counters->slow.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    void QueryStats::RecordSlow(const std::string& sql, uint64_t micros, uint64_t rows) {
+        SlowQuery query;
+        query.time = DateTimeHelper::CurrentDateTimeString();
+        query.sql = Truncate(sql);
+        query.micros = micros;
+        query.rows = rows;
+
+        Logger::Warning("Slow query: %.1f ms, %llu rows: %s", static_cast<double>(micros) / 1000.0,
+            static_cast<unsigned long long>(rows), query.sql.c_str());
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (slowKeep_ == 0) {
+            return;
+        }
+        if (slowQueries_.size() < slowKeep_) {
+            slowQueries_.push_back(std::move(query));
+        }
+        else {
+            slowQueries_[slowNext_] = std::move(query);
+            slowNext_ = (slowNext_ + 1) % slowKeep_;
+        }
+    }
+
+    std::vector<QueryStatsRow> QueryStats::Snapshot() {
+        std::vector<QueryStatsRow> rows;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            rows.reserve(counters_.size());
+            for (const auto& entry : counters_) {
+                const Counters& counters = *entry.second;
+                if (counters.latency.Count() == 0) {
+                    continue;
+                }
+                QueryStatsRow row;
+                row.fingerprint = counters.fingerprint;
+                row.calls = counters.latency.Count();
+                row.rows = counters.rows.load(std::memory_order_relaxed);
+                row.errors = counters.errors.load(std::memory_order_relaxed);
+                row.slow = counters.slow.load(std::memory_order_relaxed);
+                row.totalMicros = counters.latency.Sum();
+                row.meanMicros = counters.latency.Mean();
+                row.p50Micros = counters.latency.Percentile(50);
+                row.p95Micros = counters.latency.Percentile(95);
+                row.p99Micros = counters.latency.Percentile(99);
+                row.maxMicros = counters.latency.Max();
+                rows.push_back(std::move(row));
+            }
+        }
+
+        std::sort(rows.begin(), rows.end(), [](const QueryStatsRow& a, const QueryStatsRow& b) {
+            return a.totalMicros != b.totalMicros ? a.totalMicros > b.totalMicros : a.fingerprint < b.fingerprint;
+        });
+        return rows;
+    }
+
+    std::vector<SlowQuery> QueryStats::GetSlowQueries() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<SlowQuery> queries;
+        queries.reserve(slowQueries_.size());
+        for (size_t i = 0; i < slowQueries_.size(); ++i) {
+            queries.push_back(slowQueries_[(slowNext_ + i) % slowQueries_.size()]);
+        }
+        return queries;
+    }
+
+    void QueryStats::Reset() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // Counters stay allocated: prepared statements hold them
+        for (auto& entry : counters_) {
+            Counters& counters = *entry.second;
+            counters.latency.Reset();
+            counters.rows.store(0, std::memory_order_relaxed);
+            counters.errors.store(0, std::memory_order_relaxed);
+            counters.slow.store(0, std::memory_order_relaxed);
+        }
+        slowQueries_.clear();
+        slowNext_ = 0;
+    }
+
+    std::string QueryStats::ToJson() {
+        const std::vector<QueryStatsRow> rows = Snapshot();
+        const std::vector<SlowQuery> slowQueries = GetSlowQueries();
+
+        std::string json = "{\n  \"generated\": ";
+        StringHelper::AppendJsonString(json, DateTimeHelper::CurrentDateTimeString());
+        json += StringHelper::Format(",\n  \"slowQueryUs\": %llu,\n  \"statements\": [",
+            static_cast<unsigned long long>(slowMicros_.load(std::memory_order_relaxed)));
+
+        for (size_t i = 0; i < rows.size(); ++i) {
+            const QueryStatsRow& row = rows[i];
+            json += i ? ",\n    {\"sql\": " : "\n    {\"sql\": ";
+            StringHelper::AppendJsonString(json, row.fingerprint);
+            json += StringHelper::Format(
+                ", \"calls\": %llu, \"rows\": %llu, \"errors\": %llu, \"slow\": %llu, \"totalUs\": %llu, "
+                "\"meanUs\": %.1f, \"p50Us\": %llu, \"p95Us\": %llu, \"p99Us\": %llu, \"maxUs\": %llu}",
+                static_cast<unsigned long long>(row.calls), static_cast<unsigned long long>(row.rows),
+                static_cast<unsigned long long>(row.errors), static_cast<unsigned long long>(row.slow),
+                static_cast<unsigned long long>(row.totalMicros), row.meanMicros,
+                static_cast<unsigned long long>(row.p50Micros), static_cast<unsigned long long>(row.p95Micros),
+                static_cast<unsigned long long>(row.p99Micros), static_cast<unsigned long long>(row.maxMicros));
+        }
+        json += rows.empty() ? "],\n  \"slowQueries\": [" : "\n  ],\n  \"slowQueries\": [";
+
+        for (size_t i = 0; i < slowQueries.size(); ++i) {
+            const SlowQuery& query = slowQueries[i];
+            json += i ? ",\n    {\"time\": " : "\n    {\"time\": ";
+            StringHelper::AppendJsonString(json, query.time);
+            json += StringHelper::Format(", \"us\": %llu, \"rows\": %llu, \"sql\": ",
+                static_cast<unsigned long long>(query.micros), static_cast<unsigned long long>(query.rows));
+            StringHelper::AppendJsonString(json, query.sql);
+            json += '}';
+        }
+        json += slowQueries.empty() ? "]\n}\n" : "\n  ]\n}\n";
+        return json;
+    }
+
+    bool QueryStats::WriteJson(const std::string& path) {
+        std::ofstream file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!file) {
+            Logger::Error("Query stats: cannot write %s", path.c_str());
+            return false;
+        }
+        const std::string json = ToJson();
+        file.write(json.data(), static_cast<std::streamsize>(json.size()));
+        if (!file) {
+            Logger::Error("Query stats: writing %s failed", path.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    void QueryStats::LogSummary(size_t top) {
+        const std::vector<QueryStatsRow> rows = Snapshot();
+        if (rows.empty()) {
+            return;
+        }
+        Logger::Info("Query stats: %zu statements, busiest first", rows.size());
+        for (size_t i = 0; i < rows.size() && i < top; ++i) {
+            const QueryStatsRow& row = rows[i];
+            Logger::Info("  %llu calls, %.1f ms total, p50 %llu us, p99 %llu us, max %llu us, %llu rows, %llu slow: %s",
+                static_cast<unsigned long long>(row.calls), static_cast<double>(row.totalMicros) / 1000.0,
+                static_cast<unsigned long long>(row.p50Micros), static_cast<unsigned long long>(row.p99Micros),
+                static_cast<unsigned long long>(row.maxMicros), static_cast<unsigned long long>(row.rows),
+                static_cast<unsigned long long>(row.slow), Truncate(row.fingerprint).c_str());
+        }
+    }
+
+    std::string QueryStats::Fingerprint(std::string_view sql) {
+        std::string out;
+        out.reserve(sql.size());
+        bool space = false;     // whitespace or a comment since the last token
+
+        auto emit = [&](std::string_view token) {
+            // A run of ? folds to one: IN (?, ?, ?) -> IN (?)
+            if (token == "?" && EndsWith(out, "?,")) {
+                out.pop_back();
+                space = false;
+                return;
+            }
+            // and a run of (?) groups too: VALUES (?), (?) -> VALUES (?)
+            if (token == ")" && EndsWith(out, "(?), (?")) {
+                out.resize(out.size() - 4);
+                space = false;
+                return;
+            }
+            if (!out.empty() && token != ")" && token != ",") {
+                const char last = out.back();
+                if (last == ',' || (space && last != '(')) {
+                    out += ' ';
+                }
+            }
+            out += token;
+            space = false;
+        };
+
+        const size_t n = sql.size();
+        size_t i = 0;
+        while (i < n) {
+            const char c = sql[i];
+            if (std::isspace(static_cast<unsigned char>(c))) {
+                space = true;
+                ++i;
+            }
+            else if (c == '-' && i + 1 < n && sql[i + 1] == '-') {
+                while (i < n && sql[i] != '\n') ++i;
+                space = true;
+            }
+            else if (c == '/' && i + 1 < n && sql[i + 1] == '*') {
+                const size_t close = sql.find("*/", i + 2);
+                i = close == std::string_view::npos ? n : close + 2;
+                space = true;
+            }
+            else if (c == '\'' || ((c == 'x' || c == 'X') && i + 1 < n && sql[i + 1] == '\'')) {
+                // String or blob literal; '' is an escaped quote
+                i += c == '\'' ? 1 : 2;
+                while (i < n) {
+                    if (sql[i] == '\'') {
+                        if (i + 1 < n && sql[i + 1] == '\'') {
+                            i += 2;
+                            continue;
+                        }
+                        ++i;
+                        break;
+                    }
+                    ++i;
+                }
+                emit("?");
+            }
+            else if (c == '"' || c == '`' || c == '[') {
+                // Quoted identifier, kept as written
+                const char close = c == '[' ? ']' : c;
+                const size_t start = i++;
+                while (i < n && sql[i] != close) ++i;
+                i = i < n ? i + 1 : n;
+                emit(sql.substr(start, i - start));
+            }
+            else if (std::isdigit(static_cast<unsigned char>(c)) ||
+                     (c == '.' && i + 1 < n && std::isdigit(static_cast<unsigned char>(sql[i + 1])))) {
+                // Number, including 1.5e-3 and 0x1F
+                while (i < n && (IsWordChar(sql[i]) || sql[i] == '.' ||
+                       ((sql[i] == '+' || sql[i] == '-') && (sql[i - 1] == 'e' || sql[i - 1] == 'E')))) {
+                    ++i;
+                }
+                emit("?");
+            }
+            else if (c == '?' || ((c == ':' || c == '@' || c == '$') && i + 1 < n && IsWordChar(sql[i + 1]))) {
+                // ?, ?NNN, :name, @name, $name
+                ++i;
+                while (i < n && IsWordChar(sql[i])) ++i;
+                emit("?");
+            }
+            else if (IsWordChar(c)) {
+                const size_t start = i;
+                while (i < n && IsWordChar(sql[i])) ++i;
+                emit(sql.substr(start, i - start));
+            }
+            else {
+                emit(sql.substr(i, 1));
+                ++i;
+            }
+        }
+
+        // Trailing ; makes no difference to the statement
+        while (!out.empty() && out.back() == ';') {
+            out.pop_back();
+        }
+        return out;
+    }
+
+} // namespace KeToanApp
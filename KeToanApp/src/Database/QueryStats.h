@@ -0,0 +1,87 @@
+#pragma once
+
+#include "KeToanApp/Common.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+
+namespace KeToanApp {
+
+    // Totals for one fingerprint, as of a Snapshot()
+    struct QueryStatsRow {
+        std::string fingerprint;
+        uint64_t calls;
+        uint64_t rows;          // rows returned
+        uint64_t errors;
+        uint64_t slow;          // calls at or over the slow-query threshold
+        uint64_t totalMicros;
+        double meanMicros;
+        uint64_t p50Micros;
+        uint64_t p95Micros;
+        uint64_t p99Micros;
+        uint64_t maxMicros;
+    };
+
+    struct SlowQuery {
+        std::string time;
+        std::string sql;        // with its bound values
+        uint64_t micros;
+        uint64_t rows;
+    };
+
+    // Process-wide statement statistics, keyed by SQL fingerprint: the text
+    // with literals and parameters replaced by ?, lists of them folded to one
+    // (IN (?) and VALUES (?)), comments dropped and whitespace collapsed.
+    //
+    // A Statement looks its counters up once when prepared; each execution
+    // (first Step() to SQLITE_DONE, an error, Reset() or finalize, time the
+    // caller spends between rows included) then costs two clock reads and a
+    // few relaxed atomic adds. Connection::Execute() and ExecuteScalar() are
+    // timed the same way.
+    //
+    // Executions at or over the slow-query threshold are logged as warnings
+    // with their bound values and kept in a ring of the most recent ones.
+    class QueryStats {
+    public:
+        struct Counters;
+
+        static void SetEnabled(bool enabled);
+        static bool IsEnabled() { return enabled_.load(std::memory_order_relaxed); }
+
+        // 0 turns the slow-query log off
+        static void SetSlowThreshold(uint64_t micros);
+        static void SetSlowQueryKeep(size_t count);
+
+        // Counters for the statement's fingerprint; never null, valid until exit
+        static Counters* Lookup(std::string_view sql);
+
+        // One finished execution. Returns true if it was slow; the caller then
+        // passes the text to RecordSlow().
+        static bool Record(Counters* counters, uint64_t micros, uint64_t rows, bool failed);
+        static void RecordSlow(const std::string& sql, uint64_t micros, uint64_t rows);
+
+        // Runtime queries, busiest (total time) first
+        static std::vector<QueryStatsRow> Snapshot();
+        static std::vector<SlowQuery> GetSlowQueries();
+        static void Reset();
+
+        static std::string ToJson();
+        static bool WriteJson(const std::string& path);
+        static void LogSummary(size_t top);
+
+        static std::string Fingerprint(std::string_view sql);
+
+    private:
+        static std::atomic<bool> enabled_;
+        static std::atomic<uint64_t> slowMicros_;
+        static std::mutex mutex_;
+        static std::unordered_map<std::string, std::unique_ptr<Counters>> counters_;
+        static std::vector<SlowQuery> slowQueries_;     // ring, oldest at slowNext_ once full
+        static size_t slowNext_;
+        static size_t slowKeep_;
+    };
+
+} // namespace KeToanApp
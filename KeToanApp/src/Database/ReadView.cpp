@@ -0,0 +1,88 @@
+#include "ReadView.h"
+#include "../Utils/DateTimeHelper.h"
+#include "../Utils/Logger.h"
+#include <sqlite3.h>
+#include <cstdlib>
+
+namespace KeToanApp {
+
+    ReadView::ReadView(ConnectionPool& pool, std::unique_ptr<Connection> connection)
+        : pool_(pool)
+        , connection_(std::move(connection))
+        , active_(false)
+        , commitSequence_(0)
+        , pinnedAt_()
+    {
+    }
+
+    ReadView::~ReadView() {
+        End();
+        pool_.Release(std::move(connection_));
+    }
+
+    bool ReadView::Begin() {
+        if (active_) {
+            return true;
+        }
+
+        if (!connection_ || !connection_->Execute("BEGIN DEFERRED")) {
+            return false;
+        }
+
+        // A deferred transaction takes its WAL snapshot at the first read;
+        // reading the commit sequence both pins the snapshot and identifies it.
+        std::string value;
+        if (!connection_->ExecuteScalar(
+                "SELECT Value FROM SystemInfo WHERE Key='CommitSeq'", value)) {
+            value = "0";
+        }
+
+        commitSequence_ = std::atoll(value.c_str());
+        pinnedAt_ = DateTimeHelper::CurrentDateTimeString();
+        active_ = true;
+
+        Logger::Debug("Read view opened at snapshot %s", GetSnapshotId().c_str());
+        return true;
+    }
+
+    void ReadView::End() {
+        if (!active_) {
+            return;
+        }
+
+        // Reset any statement the caller still holds so COMMIT can end the read
+        sqlite3* db = connection_->GetHandle();
+        for (sqlite3_stmt* stmt = sqlite3_next_stmt(db, nullptr); stmt;
+             stmt = sqlite3_next_stmt(db, stmt)) {
+            sqlite3_reset(stmt);
+        }
+
+        // An interrupted statement may already have ended the transaction
+        if (!sqlite3_get_autocommit(db) && !connection_->Execute("COMMIT")) {
+            // Leave no transaction open on a pooled connection
+            connection_->Close();
+        }
+
+        active_ = false;
+    }
+
+    std::unique_ptr<Statement> ReadView::Prepare(const std::string& query) {
+        if (!active_) {
+            throw DatabaseException("Read view is not active");
+        }
+        return connection_->Prepare(query);
+    }
+
+    bool ReadView::ExecuteScalar(const std::string& query, std::string& result) {
+        if (!active_) {
+            Logger::Error("Read view is not active");
+            return false;
+        }
+        return connection_->ExecuteScalar(query, result);
+    }
+
+    std::string ReadView::GetSnapshotId() const {
+        return "S" + std::to_string(commitSequence_);
+    }
+
+} // namespace KeToanApp
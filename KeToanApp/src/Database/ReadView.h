@@ -0,0 +1,54 @@
+#pragma once
+
+#include "KeToanApp/Common.h"
+#include "KeToanApp/Types.h"
+#include "Connection.h"
+#include "ConnectionPool.h"
+#include <cstdint>
+
+namespace KeToanApp {
+
+    // Consistent read-only view of the database for multi-query reports.
+    //
+    // Holds an open WAL read transaction on a pooled reader connection, so
+    // every query run through the view sees the database as of the moment it
+    // was opened, while the writer keeps committing. The snapshot identifier
+    // is the commit sequence at that moment and can be printed on the report.
+    //
+    // Statements prepared through the view must be destroyed before it.
+    // Long-lived views hold back WAL checkpoints; close them promptly, or
+    // bound their queries with a QueryGuard on GetConnection().
+    class ReadView {
+    public:
+        ReadView(ConnectionPool& pool, std::unique_ptr<Connection> connection);
+        ~ReadView();
+
+        // Non-copyable
+        ReadView(const ReadView&) = delete;
+        ReadView& operator=(const ReadView&) = delete;
+
+        // Starts the read transaction and pins the snapshot
+        bool Begin();
+        void End();
+        bool IsActive() const { return active_; }
+
+        // Queries against the pinned snapshot
+        std::unique_ptr<Statement> Prepare(const std::string& query);
+        bool ExecuteScalar(const std::string& query, std::string& result);
+
+        // Snapshot identification for report output
+        int64_t GetCommitSequence() const { return commitSequence_; }
+        std::string GetSnapshotId() const;
+        const std::string& GetPinnedAt() const { return pinnedAt_; }
+
+        Connection& GetConnection() { return *connection_; }
+
+    private:
+        ConnectionPool& pool_;
+        std::unique_ptr<Connection> connection_;
+        bool active_;
+        int64_t commitSequence_;
+        std::string pinnedAt_;
+    };
+
+} // namespace KeToanApp
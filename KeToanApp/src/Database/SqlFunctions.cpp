@@ -0,0 +1,233 @@
+#include "SqlFunctions.h"
+#include "KeToanApp/Types.h"
+#include "../Utils/DateTimeHelper.h"
+#include "../Utils/Logger.h"
+#include <sqlite3.h>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace KeToanApp {
+namespace SqlFunctions {
+
+    namespace {
+
+#ifdef SQLITE_INNOCUOUS
+        const int kFlags = SQLITE_UTF8 | SQLITE_DETERMINISTIC | SQLITE_INNOCUOUS;
+#else
+        const int kFlags = SQLITE_UTF8 | SQLITE_DETERMINISTIC;
+#endif
+
+        // Largest amount whose units fit an int64
+        const double kMaxMoney = 9.2e14;
+
+        struct MoneySum {
+            int64_t units;
+            int64_t count;      // non-NULL values in the frame
+            bool overflow;
+        };
+
+        bool AddUnits(int64_t& total, int64_t units) {
+            if ((units > 0 && total > INT64_MAX - units) || (units < 0 && total < INT64_MIN - units)) {
+                return false;
+            }
+            total += units;
+            return true;
+        }
+
+        // Units of a value; text that is not a number counts as 0, as in SUM()
+        bool ToUnits(sqlite3_value* value, int64_t& units) {
+            switch (sqlite3_value_numeric_type(value)) {
+            case SQLITE_INTEGER: {
+                const int64_t whole = sqlite3_value_int64(value);
+                if (whole > INT64_MAX / Money::kScale || whole < INT64_MIN / Money::kScale) {
+                    return false;
+                }
+                units = whole * Money::kScale;
+                return true;
+            }
+            case SQLITE_FLOAT: {
+                const double amount = sqlite3_value_double(value);
+                if (!(std::fabs(amount) < kMaxMoney)) {
+                    return false;
+                }
+                units = Money::FromDouble(amount).units;
+                return true;
+            }
+            default:
+                units = 0;
+                return true;
+            }
+        }
+
+        void MoneyStep(sqlite3_context* context, int, sqlite3_value** argv) {
+            if (sqlite3_value_type(argv[0]) == SQLITE_NULL) {
+                return;
+            }
+            auto* sum = static_cast<MoneySum*>(sqlite3_aggregate_context(context, sizeof(MoneySum)));
+            if (!sum) {
+                sqlite3_result_error_nomem(context);
+                return;
+            }
+            int64_t units = 0;
+            if (!ToUnits(argv[0], units) || !AddUnits(sum->units, units)) {
+                sum->overflow = true;
+            }
+            ++sum->count;
+        }
+
+        void MoneyInverse(sqlite3_context* context, int, sqlite3_value** argv) {
+            if (sqlite3_value_type(argv[0]) == SQLITE_NULL) {
+                return;
+            }
+            auto* sum = static_cast<MoneySum*>(sqlite3_aggregate_context(context, sizeof(MoneySum)));
+            if (!sum) {
+                sqlite3_result_error_nomem(context);
+                return;
+            }
+            int64_t units = 0;
+            if (!ToUnits(argv[0], units) || !AddUnits(sum->units, -units)) {
+                sum->overflow = true;
+            }
+            --sum->count;
+        }
+
+        void MoneyResult(sqlite3_context* context, const MoneySum* sum) {
+            if (!sum || sum->count == 0) {
+                sqlite3_result_null(context);
+            }
+            else if (sum->overflow) {
+                sqlite3_result_error(context, "money_sum overflow", -1);
+            }
+            else {
+                sqlite3_result_double(context, Money::FromUnits(sum->units).ToDouble());
+            }
+        }
+
+        void MoneyValue(sqlite3_context* context) {
+            MoneyResult(context, static_cast<MoneySum*>(sqlite3_aggregate_context(context, 0)));
+        }
+
+        void MoneyFinal(sqlite3_context* context) {
+            MoneyResult(context, static_cast<MoneySum*>(sqlite3_aggregate_context(context, 0)));
+        }
+
+        void DayNum(sqlite3_context* context, int, sqlite3_value** argv) {
+            DayNumber day = 0;
+            if (ToDayNumber(argv[0], day)) {
+                sqlite3_result_int(context, day);
+            }
+            else {
+                sqlite3_result_null(context);
+            }
+        }
+
+        void PeriodOf(sqlite3_context* context, int, sqlite3_value** argv) {
+            const char* unit = reinterpret_cast<const char*>(sqlite3_value_text(argv[1]));
+            DayNumber day = 0;
+            if (!unit || !ToDayNumber(argv[0], day)) {
+                sqlite3_result_null(context);
+                return;
+            }
+
+            const Date date = DateTimeHelper::FromDayNumber(day);
+            char key[16];
+            int length;
+            if (std::strcmp(unit, "month") == 0) {
+                length = snprintf(key, sizeof(key), "%04d-%02d", date.year, date.month);
+            }
+            else if (std::strcmp(unit, "year") == 0) {
+                length = snprintf(key, sizeof(key), "%04d", date.year);
+            }
+            else if (std::strcmp(unit, "quarter") == 0) {
+                length = snprintf(key, sizeof(key), "%04d-Q%d", date.year, (date.month + 2) / 3);
+            }
+            else if (std::strcmp(unit, "day") == 0) {
+                length = snprintf(key, sizeof(key), "%04d-%02d-%02d", date.year, date.month, date.day);
+            }
+            else {
+                sqlite3_result_error(context, "period_of: unit must be 'day', 'month', 'quarter' or 'year'", -1);
+                return;
+            }
+            sqlite3_result_text(context, key, length, SQLITE_TRANSIENT);
+        }
+
+        void AccountRoot(sqlite3_context* context, int, sqlite3_value** argv) {
+            if (sqlite3_value_type(argv[0]) == SQLITE_NULL) {
+                sqlite3_result_null(context);
+                return;
+            }
+            const unsigned char* account = sqlite3_value_text(argv[0]);
+            const int length = sqlite3_value_bytes(argv[0]);
+            const int64_t digits = sqlite3_value_int64(argv[1]);
+            const int taken = digits < 0 ? 0 : digits < length ? static_cast<int>(digits) : length;
+            sqlite3_result_text(context, reinterpret_cast<const char*>(account), taken, SQLITE_TRANSIENT);
+        }
+
+        struct ScalarFunction {
+            const char* name;
+            int arguments;
+            void (*function)(sqlite3_context*, int, sqlite3_value**);
+        };
+
+        const ScalarFunction kScalarFunctions[] = {
+            { "daynum",        1, DayNum },
+            { "period_of",     2, PeriodOf },
+            { "account_under", 2, AccountUnder },
+            { "account_root",  2, AccountRoot },
+        };
+
+    } // namespace
+
+    bool ToDayNumber(sqlite3_value* value, DayNumber& day) {
+        switch (sqlite3_value_type(value)) {
+        case SQLITE_INTEGER: {
+            const int64_t number = sqlite3_value_int64(value);
+            if (number < INT32_MIN || number > INT32_MAX) {
+                return false;
+            }
+            day = static_cast<DayNumber>(number);
+            return true;
+        }
+        case SQLITE_TEXT:
+            return DateTimeHelper::ParseDayNumber(reinterpret_cast<const char*>(sqlite3_value_text(value)),
+                static_cast<size_t>(sqlite3_value_bytes(value)), day);
+        default:
+            return false;
+        }
+    }
+
+    void AccountUnder(sqlite3_context* context, int, sqlite3_value** argv) {
+        if (sqlite3_value_type(argv[0]) == SQLITE_NULL || sqlite3_value_type(argv[1]) == SQLITE_NULL) {
+            sqlite3_result_null(context);
+            return;
+        }
+        const unsigned char* account = sqlite3_value_text(argv[0]);
+        const int accountLength = sqlite3_value_bytes(argv[0]);
+        const unsigned char* root = sqlite3_value_text(argv[1]);
+        const int rootLength = sqlite3_value_bytes(argv[1]);
+        sqlite3_result_int(context,
+            accountLength >= rootLength && std::memcmp(account, root, static_cast<size_t>(rootLength)) == 0);
+    }
+
+    bool Register(sqlite3* db) {
+        int rc = sqlite3_create_window_function(db, "money_sum", 1, kFlags, nullptr,
+            MoneyStep, MoneyFinal, MoneyValue, MoneyInverse, nullptr);
+        if (rc != SQLITE_OK) {
+            Logger::Error("Registering SQL function money_sum failed: %s", sqlite3_errmsg(db));
+            return false;
+        }
+
+        for (const auto& function : kScalarFunctions) {
+            rc = sqlite3_create_function_v2(db, function.name, function.arguments, kFlags, nullptr,
+                function.function, nullptr, nullptr, nullptr);
+            if (rc != SQLITE_OK) {
+                Logger::Error("Registering SQL function %s failed: %s", function.name, sqlite3_errmsg(db));
+                return false;
+            }
+        }
+        return true;
+    }
+
+} // namespace SqlFunctions
+} // namespace KeToanApp
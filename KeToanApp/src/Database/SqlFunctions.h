@@ -0,0 +1,38 @@
+#pragma once
+
+#include "KeToanApp/Common.h"
+#include "KeToanApp/Types.h"
+
+// Forward declarations for SQLite
+struct sqlite3;
+struct sqlite3_context;
+struct sqlite3_value;
+
+namespace KeToanApp {
+namespace SqlFunctions {
+
+    // Registers the application's SQL functions on a connection. All are
+    // deterministic, so they may appear in indexes on expressions and in
+    // views, triggers and CHECK constraints.
+    //
+    //   money_sum(x)            exact SUM over Money units (1/10000); NULL
+    //                           when every x is NULL. Also a window function.
+    //   daynum(date)            DayNumber of a yyyy-mm-dd[...] or dd/MM/yyyy
+    //                           date; integers pass through; NULL if invalid
+    //   period_of(date, unit)   'yyyy', 'yyyy-Qn', 'yyyy-MM' or 'yyyy-MM-dd'
+    //                           for unit 'year', 'quarter', 'month' or 'day';
+    //                           date as for daynum()
+    //   account_under(tk, root) 1 if account tk is root or one of its
+    //                           sub-accounts (TKNo LIKE '131%'), else 0
+    //   account_root(tk, n)     the first n characters of tk, the level of
+    //                           account to roll up to (3 for 131 from 1311)
+    bool Register(sqlite3* db);
+
+    // Date argument as daynum() reads it; false for NULL or an invalid date
+    bool ToDayNumber(sqlite3_value* value, DayNumber& day);
+
+    // account_under() itself, for virtual tables taking it as a constraint
+    void AccountUnder(sqlite3_context* context, int argc, sqlite3_value** argv);
+
+} // namespace SqlFunctions
+} // namespace KeToanApp
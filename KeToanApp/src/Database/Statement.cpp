@@ -0,0 +1,160 @@
+#include "Statement.h"
+#include <sqlite3.h>
+
+namespace KeToanApp {
+
+    Statement::Statement(sqlite3* db, const std::string& sql)
+        : db_(db)
+        , stmt_(nullptr)
+        , sql_(sql)
+        , stats_(nullptr)
+        , rows_(0)
+        , running_(false)
+    {
+        int rc = sqlite3_prepare_v2(db_, sql_.c_str(), static_cast<int>(sql_.size()), &stmt_, nullptr);
+        if (rc != SQLITE_OK) {
+            std::string error = sqlite3_errmsg(db_);
+            sqlite3_finalize(stmt_);
+            stmt_ = nullptr;
+            throw DatabaseException("Prepare failed: " + error + " [" + sql_ + "]");
+        }
+    }
+
+    Statement::~Statement() {
+        if (running_) {
+            Finish(false);
+        }
+        if (stmt_) {
+            sqlite3_finalize(stmt_);
+        }
+    }
+
+    Statement& Statement::BindInt64(int index, int64_t value) {
+        Check(sqlite3_bind_int64(stmt_, index, value), "bind");
+        return *this;
+    }
+
+    Statement& Statement::BindDouble(int index, double value) {
+        Check(sqlite3_bind_double(stmt_, index, value), "bind");
+        return *this;
+    }
+
+    Statement& Statement::BindText(int index, std::string_view value) {
+        // A null pointer would bind SQL NULL; an empty view is an empty string
+        Check(sqlite3_bind_text(stmt_, index, value.data() ? value.data() : "", static_cast<int>(value.size()),
+            SQLITE_TRANSIENT), "bind");
+        return *this;
+    }
+
+    Statement& Statement::BindNull(int index) {
+        Check(sqlite3_bind_null(stmt_, index), "bind");
+        return *this;
+    }
+
+    int Statement::ParameterCount() const {
+        return sqlite3_bind_parameter_count(stmt_);
+    }
+
+    bool Statement::Step() {
+        if (!running_ && QueryStats::IsEnabled()) {
+            // Fingerprinted on first timed use: most statements run while
+            // statistics are off and never pay for it
+            if (!stats_) {
+                stats_ = QueryStats::Lookup(sql_);
+            }
+            started_ = std::chrono::steady_clock::now();
+            rows_ = 0;
+            running_ = true;
+        }
+
+        int rc = sqlite3_step(stmt_);
+        if (rc == SQLITE_ROW) {
+            ++rows_;
+            return true;
+        }
+        if (running_) {
+            Finish(rc != SQLITE_DONE);
+        }
+        if (rc == SQLITE_DONE) {
+            return false;
+        }
+        Check(rc, "step");
+        return false;
+    }
+
+    void Statement::Execute() {
+        while (Step()) {
+        }
+    }
+
+    void Statement::Reset() {
+        // A statement reset before SQLITE_DONE, e.g. after its one row
+        if (running_) {
+            Finish(false);
+        }
+        sqlite3_reset(stmt_);
+        sqlite3_clear_bindings(stmt_);
+    }
+
+    int Statement::ColumnCount() const {
+        return sqlite3_column_count(stmt_);
+    }
+
+    std::string Statement::ColumnName(int column) const {
+        const char* name = sqlite3_column_name(stmt_, column);
+        return name ? name : "";
+    }
+
+    bool Statement::ColumnIsNull(int column) const {
+        return sqlite3_column_type(stmt_, column) == SQLITE_NULL;
+    }
+
+    int64_t Statement::ColumnInt64(int column) const {
+        return sqlite3_column_int64(stmt_, column);
+    }
+
+    double Statement::ColumnDouble(int column) const {
+        return sqlite3_column_double(stmt_, column);
+    }
+
+    std::string Statement::ColumnText(int column) const {
+        const char* text = reinterpret_cast<const char*>(sqlite3_column_text(stmt_, column));
+        if (!text) {
+            return std::string();
+        }
+        return std::string(text, static_cast<size_t>(sqlite3_column_bytes(stmt_, column)));
+    }
+
+    std::string_view Statement::ColumnTextView(int column) const {
+        const char* text = reinterpret_cast<const char*>(sqlite3_column_text(stmt_, column));
+        if (!text) {
+            return std::string_view();
+        }
+        return std::string_view(text, static_cast<size_t>(sqlite3_column_bytes(stmt_, column)));
+    }
+
+    void Statement::Finish(bool failed) {
+        running_ = false;
+        const uint64_t micros = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - started_).count());
+        if (!QueryStats::Record(stats_, micros, rows_, failed)) {
+            return;
+        }
+
+        // Slow: log it with the values bound
+        char* expanded = sqlite3_expanded_sql(stmt_);
+        QueryStats::RecordSlow(expanded ? std::string(expanded) : sql_, micros, rows_);
+        sqlite3_free(expanded);
+    }
+
+    void Statement::Check(int rc, const char* operation) const {
+        if (rc == SQLITE_INTERRUPT) {
+            throw QueryInterruptedException(std::string(operation) + " interrupted [" + sql_ + "]");
+        }
+        if (rc != SQLITE_OK) {
+            throw DatabaseException(std::string(operation) + " failed: " + sqlite3_errmsg(db_)
+                + " [" + sql_ + "]");
+        }
+    }
+
+} // namespace KeToanApp
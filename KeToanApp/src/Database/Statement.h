@@ -0,0 +1,71 @@
+#pragma once
+
+#include "KeToanApp/Common.h"
+#include "KeToanApp/Types.h"
+#include "QueryStats.h"
+#include <chrono>
+#include <cstdint>
+#include <string_view>
+
+// Forward declarations for SQLite
+struct sqlite3;
+struct sqlite3_stmt;
+
+namespace KeToanApp {
+
+    // RAII wrapper around a prepared SQLite statement.
+    // Parameter indexes are 1-based, column indexes 0-based (SQLite convention).
+    // Errors throw DatabaseException, or QueryInterruptedException when a
+    // QueryGuard stops the statement. Each execution is timed into QueryStats.
+    class Statement {
+    public:
+        Statement(sqlite3* db, const std::string& sql);
+        ~Statement();
+
+        // Non-copyable
+        Statement(const Statement&) = delete;
+        Statement& operator=(const Statement&) = delete;
+
+        // Parameter binding
+        Statement& BindInt64(int index, int64_t value);
+        Statement& BindDouble(int index, double value);
+        Statement& BindText(int index, std::string_view value);
+        Statement& BindNull(int index);
+
+        int ParameterCount() const;
+
+        // Execution. Step() returns true while rows are available.
+        bool Step();
+        void Execute();     // Step to completion, discarding rows
+        void Reset();       // Reset and clear bindings for reuse
+
+        // Column access for the current row
+        int ColumnCount() const;
+        std::string ColumnName(int column) const;           // alias, or the expression text
+        bool ColumnIsNull(int column) const;
+        int64_t ColumnInt64(int column) const;
+        double ColumnDouble(int column) const;
+        std::string ColumnText(int column) const;
+        std::string_view ColumnTextView(int column) const;  // valid until the next Step/Reset
+
+        // Getters
+        sqlite3_stmt* GetHandle() { return stmt_; }
+        const std::string& GetSql() const { return sql_; }
+
+    private:
+        sqlite3* db_;
+        sqlite3_stmt* stmt_;
+        std::string sql_;
+
+        // Execution in progress, for QueryStats. Counters are looked up
+        // by the first execution timed.
+        QueryStats::Counters* stats_;
+        std::chrono::steady_clock::time_point started_;
+        uint64_t rows_;
+        bool running_;
+
+        void Check(int rc, const char* operation) const;
+        void Finish(bool failed);
+    };
+
+} // namespace KeToanApp
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "KeToanApp/Common.h"
+#include "KeToanApp/Types.h"
+
+namespace KeToanApp {
+
+    // One debit/credit line of a voucher (DinhKhoan row)
+    struct DinhKhoan {
+        int stt;
+        std::string tkNo;
+        std::string tkCo;
+        Decimal soTien;
+        std::string dienGiai;
+
+        DinhKhoan() : stt(0) {}
+        DinhKhoan(int stt_, const std::string& no, const std::string& co,
+                  Decimal amount, const std::string& text = "")
+            : stt(stt_), tkNo(no), tkCo(co), soTien(amount), dienGiai(text) {}
+    };
+
+    // Accounting voucher header with its lines (ChungTuKeToan + DinhKhoan)
+    struct ChungTu {
+        std::string soCT;
+        std::string ngayCT;
+        std::string loaiCT;
+        std::string dienGiai;
+        std::string nguoiLap;
+        TrangThai trangThai;
+        std::vector<DinhKhoan> lines;
+
+        ChungTu() : trangThai(TrangThai::HoatDong) {}
+    };
+
+} // namespace KeToanApp
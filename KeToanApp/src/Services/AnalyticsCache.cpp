@@ -0,0 +1,520 @@
+#include "AnalyticsCache.h"
+#include "../Database/ChangeFeed.h"
+#include "../Utils/DateTimeHelper.h"
+#include "../Utils/Logger.h"
+#include "../Utils/Trace.h"
+#include <algorithm>
+#include <chrono>
+
+namespace KeToanApp {
+
+    namespace {
+
+        const char* kLedgerQuery =
+            "SELECT d.ID, c.NgayCT, d.TKNo, d.TKCo, d.SoTien, COALESCE(c.TrangThai, 1) "
+            "FROM DinhKhoan d JOIN ChungTuKeToan c ON c.SoCT = d.SoCT "
+            "WHERE d.ID > ?1 ORDER BY d.ID";
+
+        const char* kSalesQuery =
+            "SELECT d.ID, p.NgayXuat, d.MaSP, d.ThanhTien, d.SoLuong, COALESCE(p.TrangThai, 1) "
+            "FROM ChiTietPhieuXuat d JOIN PhieuXuat p ON p.SoPhieu = d.SoPhieu "
+            "WHERE d.ID > ?1 ORDER BY d.ID";
+
+        // Lines of a voided document that an earlier refresh loaded (ID <= ?2)
+        const char* kLedgerVoidQuery =
+            "SELECT c.NgayCT, d.TKNo, d.TKCo, d.SoTien FROM DinhKhoan d "
+            "JOIN ChungTuKeToan c ON c.SoCT = d.SoCT WHERE d.SoCT = ?1 AND d.ID <= ?2";
+
+        const char* kSalesVoidQuery =
+            "SELECT p.NgayXuat, d.MaSP, d.ThanhTien, d.SoLuong FROM ChiTietPhieuXuat d "
+            "JOIN PhieuXuat p ON p.SoPhieu = d.SoPhieu WHERE d.SoPhieu = ?1 AND d.ID <= ?2";
+
+        const size_t kChangeBatch = 1000;
+
+        const int64_t kVoided = static_cast<int64_t>(TrangThai::DaXoa);
+
+        // Dense account x account matrices above this size use a hash map instead
+        const size_t kMaxDenseCells = size_t(1) << 22;
+
+        // Branch-free selection of rows with day in [from, to]. No
+        // data-dependent branches, so the loop pipelines and vectorizes.
+        size_t SelectDays(const DayNumber* day, size_t count, DayNumber from, DayNumber to,
+            uint32_t* selection)
+        {
+            const uint32_t span = static_cast<uint32_t>(to - from);
+            size_t selected = 0;
+            for (size_t i = 0; i < count; ++i) {
+                selection[selected] = static_cast<uint32_t>(i);
+                selected += static_cast<uint32_t>(day[i] - from) <= span;
+            }
+            return selected;
+        }
+
+        // Calls accumulate(row) for each row with day in [from, to]: blocks
+        // outside the range are skipped, blocks inside it taken whole, the
+        // rest filtered through a selection vector.
+        template <typename Blocks, typename Accumulate>
+        void ScanDays(const std::vector<DayNumber>& day, const Blocks& blocks,
+            DayNumber from, DayNumber to, Accumulate&& accumulate)
+        {
+            uint32_t selection[AnalyticsCache::kBlockSize];
+            const size_t rows = day.size();
+
+            for (size_t block = 0; block < blocks.size(); ++block) {
+                if (blocks[block].maxDay < from || blocks[block].minDay > to) {
+                    continue;
+                }
+
+                const size_t begin = block * AnalyticsCache::kBlockSize;
+                const size_t end = (std::min)(begin + AnalyticsCache::kBlockSize, rows);
+
+                if (blocks[block].minDay >= from && blocks[block].maxDay <= to) {
+                    for (size_t row = begin; row < end; ++row) {
+                        accumulate(row);
+                    }
+                    continue;
+                }
+
+                const size_t selected = SelectDays(day.data() + begin, end - begin, from, to, selection);
+                for (size_t i = 0; i < selected; ++i) {
+                    accumulate(begin + selection[i]);
+                }
+            }
+        }
+
+        // Drops all-zero rows and columns from a dense pivot
+        void CompactPivot(PivotTable& pivot, bool compactColumns) {
+            const size_t rows = pivot.rowLabels.size();
+            const size_t columns = pivot.columnLabels.size();
+
+            std::vector<bool> keepRow(rows, false);
+            std::vector<bool> keepColumn(columns, !compactColumns);
+            for (size_t r = 0; r < rows; ++r) {
+                for (size_t c = 0; c < columns; ++c) {
+                    if (pivot.cells[r * columns + c] != 0) {
+                        keepRow[r] = true;
+                        keepColumn[c] = true;
+                    }
+                }
+            }
+
+            PivotTable compact;
+            for (size_t c = 0; c < columns; ++c) {
+                if (keepColumn[c]) compact.columnLabels.push_back(pivot.columnLabels[c]);
+            }
+            for (size_t r = 0; r < rows; ++r) {
+                if (!keepRow[r]) continue;
+                compact.rowLabels.push_back(pivot.rowLabels[r]);
+                for (size_t c = 0; c < columns; ++c) {
+                    if (keepColumn[c]) compact.cells.push_back(pivot.cells[r * columns + c]);
+                }
+            }
+            pivot = std::move(compact);
+        }
+
+    } // namespace
+
+    Money PivotTable::RowTotal(size_t row) const {
+        Money total;
+        for (size_t c = 0; c < columnLabels.size(); ++c) {
+            total += Cell(row, c);
+        }
+        return total;
+    }
+
+    Money PivotTable::Total() const {
+        Money total;
+        for (int64_t cell : cells) {
+            total.units += cell;
+        }
+        return total;
+    }
+
+    uint32_t AnalyticsCache::Dictionary::Intern(std::string_view code) {
+        scratch.assign(code.data(), code.size());
+        auto it = index.find(scratch);
+        if (it != index.end()) {
+            return it->second;
+        }
+        uint32_t id = static_cast<uint32_t>(codes.size());
+        codes.push_back(scratch);
+        index.emplace(scratch, id);
+        return id;
+    }
+
+    AnalyticsCache::AnalyticsCache(DatabaseManager& database, CodeDictionary& codes)
+        : database_(database)
+        , codes_(codes)
+        , ledgerHighWater_(0)
+        , salesHighWater_(0)
+        , changeSeq_(-1)
+        , cursor_(database)
+    {
+        Clear();
+    }
+
+    void AnalyticsCache::Clear() {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        groups_ = Dictionary();
+        groups_.Intern("");     // id 0: products without NhomHang
+        productGroup_.clear();
+        ledger_ = LedgerColumns();
+        sales_ = SalesColumns();
+        ledgerHighWater_ = 0;
+        salesHighWater_ = 0;
+        changeSeq_ = -1;
+        cursor_.Reset();
+    }
+
+    bool AnalyticsCache::Refresh() {
+        KETOAN_TRACE_SCOPE("engine", "AnalyticsCache.Refresh");
+        std::lock_guard<std::mutex> refreshLock(refreshMutex_);
+        auto started = std::chrono::steady_clock::now();
+
+        std::unique_ptr<ReadView> view = database_.OpenReadView();
+        if (!view) {
+            Logger::Error("Analytics refresh: no read view available");
+            return false;
+        }
+
+        size_t ledgerRows = 0;
+        size_t salesRows = 0;
+        bool loaded;
+        {
+            std::unique_lock<std::shared_mutex> lock(mutex_);
+            const size_t firstLedgerRow = ledger_.day.size();
+            const size_t firstSalesRow = sales_.day.size();
+
+            // Voids of rows loaded earlier first, while the high-water marks
+            // still separate those rows from the ones about to be loaded
+            if (changeSeq_ < 0) {
+                changeSeq_ = ChangeFeed::GetHeadSequence(*view);
+                loaded = true;
+            } else {
+                loaded = ApplyVoids(*view);
+            }
+            cursor_.Set(changeSeq_);
+
+            loaded = loaded && LoadLedger(*view) && LoadSales(*view) && LoadProductGroups(*view);
+
+            ExtendBlocks(ledger_.blocks, ledger_.day, firstLedgerRow);
+            ExtendBlocks(sales_.blocks, sales_.day, firstSalesRow);
+            ledgerRows = ledger_.day.size() - firstLedgerRow;
+            salesRows = sales_.day.size() - firstSalesRow;
+        }
+
+        if (!loaded) {
+            return false;
+        }
+
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - started);
+        Logger::Debug("Analytics refresh at %s: +%zu ledger, +%zu sales rows in %lld ms",
+            view->GetSnapshotId().c_str(), ledgerRows, salesRows, static_cast<long long>(elapsed.count()));
+        return true;
+    }
+
+    bool AnalyticsCache::LoadLedger(ReadView& view) {
+        try {
+            auto stmt = view.Prepare(kLedgerQuery);
+            if (!stmt) return false;
+            stmt->BindInt64(1, ledgerHighWater_);
+
+            while (stmt->Step()) {
+                ledgerHighWater_ = stmt->ColumnInt64(0);
+                if (stmt->ColumnInt64(5) == kVoided) {
+                    continue;
+                }
+
+                std::string_view date = stmt->ColumnTextView(1);
+                DayNumber day;
+                if (!DateTimeHelper::ParseDayNumber(date.data(), date.size(), day)) {
+                    Logger::Warning("Analytics: skipping DinhKhoan %lld with bad date '%.*s'",
+                        static_cast<long long>(ledgerHighWater_), static_cast<int>(date.size()), date.data());
+                    continue;
+                }
+
+                ledger_.day.push_back(day);
+                ledger_.debit.push_back(codes_.Intern(CodeKind::Account, stmt->ColumnTextView(2)));
+                ledger_.credit.push_back(codes_.Intern(CodeKind::Account, stmt->ColumnTextView(3)));
+                ledger_.amount.push_back(Money::FromDouble(stmt->ColumnDouble(4)).units);
+            }
+        }
+        catch (const DatabaseException& e) {
+            // Rows read so far stay loaded; the high-water mark matches them
+            Logger::Error("Analytics ledger load failed: %s", e.what());
+            return false;
+        }
+        return true;
+    }
+
+    bool AnalyticsCache::LoadSales(ReadView& view) {
+        try {
+            auto stmt = view.Prepare(kSalesQuery);
+            if (!stmt) return false;
+            stmt->BindInt64(1, salesHighWater_);
+
+            while (stmt->Step()) {
+                salesHighWater_ = stmt->ColumnInt64(0);
+                if (stmt->ColumnInt64(5) == kVoided) {
+                    continue;
+                }
+
+                std::string_view date = stmt->ColumnTextView(1);
+                DayNumber day;
+                if (!DateTimeHelper::ParseDayNumber(date.data(), date.size(), day)) {
+                    Logger::Warning("Analytics: skipping ChiTietPhieuXuat %lld with bad date '%.*s'",
+                        static_cast<long long>(salesHighWater_), static_cast<int>(date.size()), date.data());
+                    continue;
+                }
+
+                sales_.day.push_back(day);
+                sales_.product.push_back(codes_.Intern(CodeKind::Product, stmt->ColumnTextView(2)));
+                sales_.amount.push_back(Money::FromDouble(stmt->ColumnDouble(3)).units);
+                sales_.quantity.push_back(stmt->ColumnDouble(4));
+            }
+        }
+        catch (const DatabaseException& e) {
+            // Rows read so far stay loaded; the high-water mark matches them
+            Logger::Error("Analytics sales load failed: %s", e.what());
+            return false;
+        }
+        return true;
+    }
+
+    bool AnalyticsCache::ApplyVoids(ReadView& view) {
+        // A void appends the document's loaded lines negated, so every pivot
+        // nets it out without rewriting columns. Lines loaded later were
+        // already skipped as voided. Other edits of posted documents are not
+        // tracked; vouchers are corrected by voiding and re-entering them.
+        std::vector<ChangeRecord> changes;
+        try {
+            do {
+                changes.clear();
+                if (!ChangeFeed::ReadChanges(view, changeSeq_, kChangeBatch, changes)) {
+                    return false;
+                }
+
+                for (const auto& change : changes) {
+                    if (change.operation == ChangeOperation::Void) {
+                        if (change.tableName == "ChungTuKeToan") {
+                            ReverseLedger(view, change.rowKey);
+                        } else if (change.tableName == "PhieuXuat") {
+                            ReverseSales(view, change.rowKey);
+                        }
+                    }
+                    changeSeq_ = change.seq;
+                }
+            } while (changes.size() == kChangeBatch);
+        }
+        catch (const DatabaseException& e) {
+            Logger::Error("Analytics void replay failed: %s", e.what());
+            return false;
+        }
+        return true;
+    }
+
+    void AnalyticsCache::ReverseLedger(ReadView& view, const std::string& soCT) {
+        auto stmt = view.Prepare(kLedgerVoidQuery);
+        stmt->BindText(1, soCT).BindInt64(2, ledgerHighWater_);
+
+        while (stmt->Step()) {
+            std::string_view date = stmt->ColumnTextView(0);
+            DayNumber day;
+            if (!DateTimeHelper::ParseDayNumber(date.data(), date.size(), day)) {
+                continue;   // skipped when loaded as well
+            }
+            ledger_.day.push_back(day);
+            ledger_.debit.push_back(codes_.Intern(CodeKind::Account, stmt->ColumnTextView(1)));
+            ledger_.credit.push_back(codes_.Intern(CodeKind::Account, stmt->ColumnTextView(2)));
+            ledger_.amount.push_back(-Money::FromDouble(stmt->ColumnDouble(3)).units);
+        }
+    }
+
+    void AnalyticsCache::ReverseSales(ReadView& view, const std::string& soPhieu) {
+        auto stmt = view.Prepare(kSalesVoidQuery);
+        stmt->BindText(1, soPhieu).BindInt64(2, salesHighWater_);
+
+        while (stmt->Step()) {
+            std::string_view date = stmt->ColumnTextView(0);
+            DayNumber day;
+            if (!DateTimeHelper::ParseDayNumber(date.data(), date.size(), day)) {
+                continue;
+            }
+            sales_.day.push_back(day);
+            sales_.product.push_back(codes_.Intern(CodeKind::Product, stmt->ColumnTextView(1)));
+            sales_.amount.push_back(-Money::FromDouble(stmt->ColumnDouble(2)).units);
+            sales_.quantity.push_back(-stmt->ColumnDouble(3));
+        }
+    }
+
+    bool AnalyticsCache::LoadProductGroups(ReadView& view) {
+        // The product table is small; reload it so regrouping takes effect
+        try {
+            auto stmt = view.Prepare("SELECT MaSP, COALESCE(NhomHang, '') FROM SanPham");
+            if (!stmt) return false;
+
+            productGroup_.assign(codes_.GetCount(CodeKind::Product), 0);
+            while (stmt->Step()) {
+                uint32_t product = codes_.Intern(CodeKind::Product, stmt->ColumnTextView(0));
+                if (product >= productGroup_.size()) {
+                    productGroup_.resize(product + 1, 0);
+                }
+                productGroup_[product] = groups_.Intern(stmt->ColumnTextView(1));
+            }
+        }
+        catch (const DatabaseException& e) {
+            Logger::Error("Analytics product group load failed: %s", e.what());
+            return false;
+        }
+        return true;
+    }
+
+    void AnalyticsCache::ExtendBlocks(std::vector<BlockRange>& blocks, const std::vector<DayNumber>& day,
+        size_t firstNewRow)
+    {
+        // The last block may have been partial; recompute it with the new rows
+        size_t block = firstNewRow / kBlockSize;
+        blocks.resize(block);
+
+        for (size_t begin = block * kBlockSize; begin < day.size(); begin += kBlockSize) {
+            const size_t end = (std::min)(begin + kBlockSize, day.size());
+            auto bounds = std::minmax_element(day.begin() + begin, day.begin() + end);
+            blocks.push_back({ *bounds.first, *bounds.second });
+        }
+    }
+
+    size_t AnalyticsCache::GetLedgerRowCount() const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        return ledger_.day.size();
+    }
+
+    size_t AnalyticsCache::GetSalesRowCount() const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        return sales_.day.size();
+    }
+
+    PivotTable AnalyticsCache::RevenueByGroupMonth(DayNumber from, DayNumber to) const {
+        PivotTable pivot;
+        if (to < from) {
+            return pivot;
+        }
+
+        // One column per month and a column index per day: bound the range
+        // before allocating for it
+        Date first = DateTimeHelper::FromDayNumber(from);
+        Date last = DateTimeHelper::FromDayNumber(to);
+        const int months = (last.year - first.year) * 12 + last.month - first.month + 1;
+        if (months > kMaxPivotMonths) {
+            Logger::Warning("Analytics: revenue pivot over %d months refused (at most %d)", months, kMaxPivotMonths);
+            return pivot;
+        }
+
+        // Month column of every day in range, so the kernel never converts dates
+        std::vector<uint16_t> monthOfDay(static_cast<size_t>(to - from) + 1);
+        int month = first.month;
+        int year = first.year;
+        for (DayNumber monthStart = from; monthStart <= to; ) {
+            DayNumber nextMonth = month == 12
+                ? DateTimeHelper::ToDayNumber(1, 1, year + 1)
+                : DateTimeHelper::ToDayNumber(1, month + 1, year);
+
+            const uint16_t column = static_cast<uint16_t>(pivot.columnLabels.size());
+            for (DayNumber day = monthStart; day < nextMonth && day <= to; ++day) {
+                monthOfDay[static_cast<size_t>(day - from)] = column;
+            }
+
+            char label[16];
+            sprintf_s(label, "%02d/%04d", month, year);
+            pivot.columnLabels.push_back(label);
+
+            monthStart = nextMonth;
+            if (++month > 12) {
+                month = 1;
+                ++year;
+            }
+        }
+
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+
+        const size_t columns = pivot.columnLabels.size();
+        pivot.rowLabels = groups_.codes;
+        pivot.cells.assign(pivot.rowLabels.size() * columns, 0);
+
+        int64_t* cells = pivot.cells.data();
+        const DayNumber* day = sales_.day.data();
+        const uint32_t* product = sales_.product.data();
+        const int64_t* amount = sales_.amount.data();
+        const uint32_t* productGroup = productGroup_.data();
+        const uint16_t* monthColumn = monthOfDay.data();
+
+        ScanDays(sales_.day, sales_.blocks, from, to, [&](size_t row) {
+            cells[productGroup[product[row]] * columns + monthColumn[day[row] - from]] += amount[row];
+        });
+
+        lock.unlock();
+        CompactPivot(pivot, false);
+        return pivot;
+    }
+
+    PivotTable AnalyticsCache::PostingsByAccountPair(DayNumber from, DayNumber to) const {
+        PivotTable pivot;
+        if (to < from) {
+            return pivot;
+        }
+
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+
+        // Every id in the ledger was interned before it was loaded, so all
+        // are below the count read here
+        std::vector<std::string> codes = codes_.GetCodes(CodeKind::Account);
+        const size_t accounts = codes.size();
+
+        const uint32_t* debit = ledger_.debit.data();
+        const uint32_t* credit = ledger_.credit.data();
+        const int64_t* amount = ledger_.amount.data();
+
+        if (accounts * accounts <= kMaxDenseCells) {
+            pivot.rowLabels = codes;
+            pivot.columnLabels = std::move(codes);
+            pivot.cells.assign(accounts * accounts, 0);
+            int64_t* cells = pivot.cells.data();
+            ScanDays(ledger_.day, ledger_.blocks, from, to, [&](size_t row) {
+                cells[debit[row] * accounts + credit[row]] += amount[row];
+            });
+        } else {
+            // Very large charts of accounts: sparse accumulation, then densify
+            // only the accounts that occur
+            std::unordered_map<uint64_t, int64_t> sums;
+            ScanDays(ledger_.day, ledger_.blocks, from, to, [&](size_t row) {
+                sums[(static_cast<uint64_t>(debit[row]) << 32) | credit[row]] += amount[row];
+            });
+
+            std::vector<uint32_t> rowIds, columnIds;
+            for (const auto& sum : sums) {
+                rowIds.push_back(static_cast<uint32_t>(sum.first >> 32));
+                columnIds.push_back(static_cast<uint32_t>(sum.first));
+            }
+            for (auto* ids : { &rowIds, &columnIds }) {
+                std::sort(ids->begin(), ids->end());
+                ids->erase(std::unique(ids->begin(), ids->end()), ids->end());
+            }
+
+            for (uint32_t id : rowIds) pivot.rowLabels.push_back(codes[id]);
+            for (uint32_t id : columnIds) pivot.columnLabels.push_back(codes[id]);
+            pivot.cells.assign(rowIds.size() * columnIds.size(), 0);
+            for (const auto& sum : sums) {
+                size_t r = std::lower_bound(rowIds.begin(), rowIds.end(),
+                    static_cast<uint32_t>(sum.first >> 32)) - rowIds.begin();
+                size_t c = std::lower_bound(columnIds.begin(), columnIds.end(),
+                    static_cast<uint32_t>(sum.first)) - columnIds.begin();
+                pivot.cells[r * columnIds.size() + c] = sum.second;
+            }
+        }
+
+        lock.unlock();
+        CompactPivot(pivot, true);
+        return pivot;
+    }
+
+} // namespace KeToanApp
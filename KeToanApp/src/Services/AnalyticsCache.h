@@ -0,0 +1,129 @@
+#pragma once
+
+#include "KeToanApp/Common.h"
+#include "KeToanApp/Types.h"
+#include "../Database/ChangeFeed.h"
+#include "../Database/DatabaseManager.h"
+#include "CodeDictionary.h"
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <string_view>
+#include <unordered_map>
+
+namespace KeToanApp {
+
+    // Dense pivot result, cells row-major in Money units
+    struct PivotTable {
+        std::vector<std::string> rowLabels;
+        std::vector<std::string> columnLabels;
+        std::vector<int64_t> cells;
+
+        Money Cell(size_t row, size_t column) const {
+            return Money::FromUnits(cells[row * columnLabels.size() + column]);
+        }
+        Money RowTotal(size_t row) const;
+        Money Total() const;
+    };
+
+    // Optional in-memory columnar copy of DinhKhoan and ChiTietPhieuXuat for
+    // ad-hoc pivot reports.
+    //
+    // Each table is held as parallel column vectors: dates as day numbers,
+    // account/product codes as CodeDictionary ids, amounts as Money units. Pivot
+    // kernels run block-at-a-time: a per-block min/max day prunes or accepts
+    // whole blocks, a branch-free pass builds a selection vector for the
+    // rest, and sums scatter into a dense group x group array.
+    //
+    // Refresh() appends rows above the last loaded ID (the detail tables are
+    // append-only through PostingQueue) and replays voids from the ChangeLog
+    // as negated rows, reading through a read view so the writer is never
+    // blocked. Queries take a shared lock; Refresh an exclusive one.
+    class AnalyticsCache {
+    public:
+        static const size_t kBlockSize = 1024;
+        static const int kMaxPivotMonths = 240;     // longest month range a pivot spans
+
+        AnalyticsCache(DatabaseManager& database, CodeDictionary& codes);
+        ~AnalyticsCache() = default;
+
+        // Non-copyable
+        AnalyticsCache(const AnalyticsCache&) = delete;
+        AnalyticsCache& operator=(const AnalyticsCache&) = delete;
+
+        // Loads rows committed since the last refresh
+        bool Refresh();
+        void Clear();
+
+        size_t GetLedgerRowCount() const;
+        size_t GetSalesRowCount() const;
+
+        // Revenue (ThanhTien) by product group (NhomHang) x month over
+        // [from, to]. Column labels are "MM/yyyy". Empty if the range spans
+        // more than kMaxPivotMonths months.
+        PivotTable RevenueByGroupMonth(DayNumber from, DayNumber to) const;
+
+        // Posted amounts by debit account x contra (credit) account over
+        // [from, to]. Only accounts with postings in range are listed.
+        PivotTable PostingsByAccountPair(DayNumber from, DayNumber to) const;
+
+    private:
+        // NhomHang -> dense id; ids are stable for the life of the cache
+        struct Dictionary {
+            std::unordered_map<std::string, uint32_t> index;
+            std::vector<std::string> codes;
+            std::string scratch;
+
+            uint32_t Intern(std::string_view code);
+        };
+
+        // Per-block day bounds for pruning
+        struct BlockRange {
+            DayNumber minDay;
+            DayNumber maxDay;
+        };
+
+        struct LedgerColumns {
+            std::vector<DayNumber> day;
+            std::vector<uint32_t> debit;       // CodeKind::Account id of TKNo
+            std::vector<uint32_t> credit;      // CodeKind::Account id of TKCo
+            std::vector<int64_t> amount;
+            std::vector<BlockRange> blocks;
+        };
+
+        struct SalesColumns {
+            std::vector<DayNumber> day;
+            std::vector<uint32_t> product;     // CodeKind::Product id of MaSP
+            std::vector<int64_t> amount;
+            std::vector<double> quantity;
+            std::vector<BlockRange> blocks;
+        };
+
+        DatabaseManager& database_;
+        CodeDictionary& codes_;
+
+        mutable std::shared_mutex mutex_;
+        std::mutex refreshMutex_;
+
+        Dictionary groups_;
+        std::vector<uint32_t> productGroup_;   // product id -> groups_ id
+
+        LedgerColumns ledger_;
+        SalesColumns sales_;
+        int64_t ledgerHighWater_;
+        int64_t salesHighWater_;
+        int64_t changeSeq_;     // ChangeLog position; -1 before the first load
+        ChangeCursor cursor_;   // voids it has not replayed stay in the ChangeLog
+
+        bool ApplyVoids(ReadView& view);
+        void ReverseLedger(ReadView& view, const std::string& soCT);
+        void ReverseSales(ReadView& view, const std::string& soPhieu);
+        bool LoadProductGroups(ReadView& view);
+        bool LoadLedger(ReadView& view);
+        bool LoadSales(ReadView& view);
+
+        static void ExtendBlocks(std::vector<BlockRange>& blocks, const std::vector<DayNumber>& day,
+            size_t firstNewRow);
+    };
+
+} // namespace KeToanApp
@@ -0,0 +1,811 @@
+#include "BackupService.h"
+#include "../Utils/Crc32.h"
+#include "../Utils/Logger.h"
+#include <sqlite3.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#ifdef KETOAN_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace KeToanApp {
+
+    namespace {
+
+        const char kMagic[8] = { 'K', 'T', 'B', 'A', 'C', 'K', 'U', 'P' };
+        // Version 1 bodies hold pages in order; version 2 bodies hold each page
+        // once in any order
+        const uint32_t kVersion = 2;
+        const uint32_t kFlagZstd = 1;
+        const size_t kHeaderSize = 36;
+
+        const int kInitialStepPages = 64;
+        const int kMaxStepPages = 16384;
+
+        void PutU32(unsigned char* p, uint32_t v) {
+            p[0] = static_cast<unsigned char>(v);
+            p[1] = static_cast<unsigned char>(v >> 8);
+            p[2] = static_cast<unsigned char>(v >> 16);
+            p[3] = static_cast<unsigned char>(v >> 24);
+        }
+
+        uint32_t GetU32(const unsigned char* p) {
+            return static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8
+                | static_cast<uint32_t>(p[2]) << 16 | static_cast<uint32_t>(p[3]) << 24;
+        }
+
+        void PutU64(unsigned char* p, uint64_t v) {
+            PutU32(p, static_cast<uint32_t>(v));
+            PutU32(p + 4, static_cast<uint32_t>(v >> 32));
+        }
+
+        uint64_t GetU64(const unsigned char* p) {
+            return static_cast<uint64_t>(GetU32(p)) | static_cast<uint64_t>(GetU32(p + 4)) << 32;
+        }
+
+        std::filesystem::path FsPath(const std::string& utf8) {
+            return std::filesystem::u8path(utf8);
+        }
+
+        void RemoveFile(const std::string& path) {
+            std::error_code ec;
+            std::filesystem::remove(FsPath(path), ec);
+        }
+
+        // Body of the backup stream, optionally zstd-compressed
+        class BodyWriter {
+        public:
+            BodyWriter(std::ofstream& out, bool compress, int level)
+                : out_(out)
+#ifdef KETOAN_HAVE_ZSTD
+                , cctx_(nullptr)
+#endif
+            {
+#ifdef KETOAN_HAVE_ZSTD
+                if (compress) {
+                    cctx_ = ZSTD_createCCtx();
+                    ZSTD_CCtx_setParameter(cctx_, ZSTD_c_compressionLevel, level);
+                    ZSTD_CCtx_setParameter(cctx_, ZSTD_c_checksumFlag, 1);
+                    buffer_.resize(ZSTD_CStreamOutSize());
+                }
+#else
+                KETOAN_UNUSED(compress);
+                KETOAN_UNUSED(level);
+#endif
+            }
+
+            ~BodyWriter() {
+#ifdef KETOAN_HAVE_ZSTD
+                ZSTD_freeCCtx(cctx_);
+#endif
+            }
+
+            bool Write(const void* data, size_t size) {
+#ifdef KETOAN_HAVE_ZSTD
+                if (cctx_) {
+                    ZSTD_inBuffer input = { data, size, 0 };
+                    while (input.pos < input.size) {
+                        if (!Drain(&input, ZSTD_e_continue)) {
+                            return false;
+                        }
+                    }
+                    return true;
+                }
+#endif
+                out_.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+                return out_.good();
+            }
+
+            bool Finish() {
+#ifdef KETOAN_HAVE_ZSTD
+                if (cctx_) {
+                    ZSTD_inBuffer input = { nullptr, 0, 0 };
+                    size_t remaining;
+                    do {
+                        remaining = 0;
+                        if (!Drain(&input, ZSTD_e_end, &remaining)) {
+                            return false;
+                        }
+                    } while (remaining != 0);
+                }
+#endif
+                out_.flush();
+                return out_.good();
+            }
+
+        private:
+            std::ofstream& out_;
+            std::vector<char> buffer_;
+#ifdef KETOAN_HAVE_ZSTD
+            ZSTD_CCtx* cctx_;
+
+            bool Drain(ZSTD_inBuffer* input, ZSTD_EndDirective mode, size_t* remaining = nullptr) {
+                ZSTD_outBuffer output = { buffer_.data(), buffer_.size(), 0 };
+                size_t rc = ZSTD_compressStream2(cctx_, &output, input, mode);
+                if (ZSTD_isError(rc)) {
+                    Logger::Error("Backup compression failed: %s", ZSTD_getErrorName(rc));
+                    return false;
+                }
+                if (remaining) {
+                    *remaining = rc;
+                }
+                out_.write(buffer_.data(), static_cast<std::streamsize>(output.pos));
+                return out_.good();
+            }
+#endif
+        };
+
+        // Destination of the page copy. SQLite writes the copy into a file
+        // of the "ktbackup-sink" VFS below; each page written becomes a frame
+        // of the backup body at once, so the copy is never stored anywhere.
+        // The backup writes every page exactly once, in cache-eviction order;
+        // page 1 is held by the destination b-tree until commit.
+        class PageSink {
+        public:
+            PageSink(BodyWriter& body, uint32_t pageSize, uint32_t pageCount)
+                : body_(body)
+                , pageSize_(pageSize)
+                , pageCount_(pageCount)
+                , written_(pageCount, false)
+                , pagesWritten_(0)
+                , size_(0)
+            {
+            }
+
+            int Write(const void* data, int amount, sqlite3_int64 offset) {
+                if (static_cast<uint32_t>(amount) != pageSize_ || offset % pageSize_ != 0) {
+                    return Fail("Backup copy wrote a partial page", SQLITE_IOERR_WRITE);
+                }
+                const uint64_t pageNo = static_cast<uint64_t>(offset / pageSize_) + 1;
+                if (pageNo > pageCount_ || written_[pageNo - 1]) {
+                    return Fail("Backup copy rewrote page " + std::to_string(pageNo), SQLITE_IOERR_WRITE);
+                }
+                if (!Emit(static_cast<uint32_t>(pageNo), data)) {
+                    return Fail("Writing the backup failed", SQLITE_IOERR_WRITE);
+                }
+                size_ = (std::max)(size_, offset + amount);
+                return SQLITE_OK;
+            }
+
+            // Pages already sent cannot be read back; SQLite only reads the
+            // header of the new, empty file
+            int Read(void* data, int amount, sqlite3_int64 offset) {
+                if (offset + amount <= size_ && amount > 0) {
+                    return Fail("Backup copy read back a written page", SQLITE_IOERR_READ);
+                }
+                memset(data, 0, static_cast<size_t>(amount));
+                return offset < size_ ? SQLITE_IOERR_READ : SQLITE_IOERR_SHORT_READ;
+            }
+
+            sqlite3_int64 Size() const { return size_; }
+
+            // Adds the lock-byte page SQLite never writes, then the end frame
+            bool Finish() {
+                const uint64_t lockPage = kPendingByte / pageSize_ + 1;
+                if (lockPage <= pageCount_ && !written_[lockPage - 1]) {
+                    std::vector<unsigned char> zero(pageSize_, 0);
+                    if (!Emit(static_cast<uint32_t>(lockPage), zero.data())) {
+                        Fail("Writing the backup failed", SQLITE_IOERR_WRITE);
+                        return false;
+                    }
+                }
+                if (pagesWritten_ != pageCount_) {
+                    Fail("Backup copy has " + std::to_string(pagesWritten_) + " of "
+                        + std::to_string(pageCount_) + " pages", SQLITE_IOERR);
+                    return false;
+                }
+                unsigned char frame[8];
+                PutU32(frame, 0);
+                PutU32(frame + 4, pageCount_);
+                if (!body_.Write(frame, sizeof(frame)) || !body_.Finish()) {
+                    Fail("Writing the backup failed", SQLITE_IOERR_WRITE);
+                    return false;
+                }
+                return true;
+            }
+
+            const std::string& GetError() const { return error_; }
+
+        private:
+            static const uint64_t kPendingByte = 0x40000000;
+
+            BodyWriter& body_;
+            uint32_t pageSize_;
+            uint32_t pageCount_;
+            std::vector<bool> written_;
+            uint32_t pagesWritten_;
+            sqlite3_int64 size_;
+            std::string error_;
+
+            bool Emit(uint32_t pageNo, const void* data) {
+                unsigned char frame[8];
+                PutU32(frame, pageNo);
+                PutU32(frame + 4, Crc32::Compute(data, pageSize_));
+                if (!body_.Write(frame, sizeof(frame)) || !body_.Write(data, pageSize_)) {
+                    return false;
+                }
+                written_[pageNo - 1] = true;
+                ++pagesWritten_;
+                return true;
+            }
+
+            int Fail(const std::string& error, int rc) {
+                if (error_.empty()) {
+                    error_ = error;
+                }
+                return rc;
+            }
+        };
+
+        // Write-only VFS whose main database file is a registered PageSink.
+        // Other files (journals) cannot be opened: the copy runs with
+        // journal_mode=OFF.
+        const char kSinkVfsName[] = "ktbackup-sink";
+
+        std::mutex sinkMutex;
+        std::map<std::string, PageSink*> sinks;
+
+        struct SinkFile {
+            sqlite3_file base;
+            PageSink* sink;
+        };
+
+        PageSink* SinkOf(sqlite3_file* file) {
+            return reinterpret_cast<SinkFile*>(file)->sink;
+        }
+
+        int SinkClose(sqlite3_file*) { return SQLITE_OK; }
+
+        int SinkRead(sqlite3_file* file, void* data, int amount, sqlite3_int64 offset) {
+            return SinkOf(file)->Read(data, amount, offset);
+        }
+
+        int SinkWrite(sqlite3_file* file, const void* data, int amount, sqlite3_int64 offset) {
+            return SinkOf(file)->Write(data, amount, offset);
+        }
+
+        int SinkTruncate(sqlite3_file* file, sqlite3_int64 size) {
+            return size >= SinkOf(file)->Size() ? SQLITE_OK : SQLITE_IOERR_TRUNCATE;
+        }
+
+        int SinkSync(sqlite3_file*, int) { return SQLITE_OK; }
+
+        int SinkFileSize(sqlite3_file* file, sqlite3_int64* size) {
+            *size = SinkOf(file)->Size();
+            return SQLITE_OK;
+        }
+
+        int SinkLock(sqlite3_file*, int) { return SQLITE_OK; }
+
+        int SinkCheckReservedLock(sqlite3_file*, int* reserved) {
+            *reserved = 0;
+            return SQLITE_OK;
+        }
+
+        int SinkFileControl(sqlite3_file*, int, void*) { return SQLITE_NOTFOUND; }
+        int SinkSectorSize(sqlite3_file*) { return 512; }
+        int SinkDeviceCharacteristics(sqlite3_file*) { return 0; }
+
+        const sqlite3_io_methods kSinkMethods = {
+            1,
+            SinkClose, SinkRead, SinkWrite, SinkTruncate, SinkSync, SinkFileSize,
+            SinkLock, SinkLock, SinkCheckReservedLock, SinkFileControl,
+            SinkSectorSize, SinkDeviceCharacteristics,
+            nullptr, nullptr, nullptr, nullptr, nullptr, nullptr
+        };
+
+        sqlite3_vfs* DefaultVfs() {
+            static sqlite3_vfs* vfs = sqlite3_vfs_find(nullptr);
+            return vfs;
+        }
+
+        int SinkOpen(sqlite3_vfs*, const char* name, sqlite3_file* file, int flags, int* outFlags) {
+            file->pMethods = nullptr;
+            if (!name || !(flags & SQLITE_OPEN_MAIN_DB)) {
+                return SQLITE_CANTOPEN;
+            }
+            std::lock_guard<std::mutex> lock(sinkMutex);
+            auto it = sinks.find(name);
+            if (it == sinks.end()) {
+                return SQLITE_CANTOPEN;
+            }
+            reinterpret_cast<SinkFile*>(file)->sink = it->second;
+            file->pMethods = &kSinkMethods;
+            if (outFlags) {
+                *outFlags = flags;
+            }
+            return SQLITE_OK;
+        }
+
+        int SinkDelete(sqlite3_vfs*, const char*, int) { return SQLITE_OK; }
+
+        int SinkAccess(sqlite3_vfs*, const char*, int, int* result) {
+            *result = 0;
+            return SQLITE_OK;
+        }
+
+        int SinkFullPathname(sqlite3_vfs*, const char* name, int size, char* out) {
+            sqlite3_snprintf(size, out, "%s", name);
+            return SQLITE_OK;
+        }
+
+        int SinkRandomness(sqlite3_vfs*, int size, char* out) {
+            return DefaultVfs()->xRandomness(DefaultVfs(), size, out);
+        }
+
+        int SinkSleep(sqlite3_vfs*, int micros) {
+            return DefaultVfs()->xSleep(DefaultVfs(), micros);
+        }
+
+        int SinkCurrentTime(sqlite3_vfs*, double* now) {
+            return DefaultVfs()->xCurrentTime(DefaultVfs(), now);
+        }
+
+        int SinkGetLastError(sqlite3_vfs*, int, char*) { return 0; }
+
+        bool RegisterSinkVfs() {
+            static sqlite3_vfs vfs = {
+                1, static_cast<int>(sizeof(SinkFile)), 512, nullptr, kSinkVfsName, nullptr,
+                SinkOpen, SinkDelete, SinkAccess, SinkFullPathname,
+                nullptr, nullptr, nullptr, nullptr,
+                SinkRandomness, SinkSleep, SinkCurrentTime, SinkGetLastError,
+                nullptr, nullptr, nullptr, nullptr
+            };
+            static const bool registered = sqlite3_vfs_register(&vfs, 0) == SQLITE_OK;
+            return registered;
+        }
+
+        // Makes a sink openable under a unique name for the life of the scope
+        class SinkRegistration {
+        public:
+            explicit SinkRegistration(PageSink& sink) {
+                static std::atomic<uint64_t> lastId(0);
+                name_ = "ktbackup-" + std::to_string(++lastId);
+                std::lock_guard<std::mutex> lock(sinkMutex);
+                sinks[name_] = &sink;
+            }
+
+            ~SinkRegistration() {
+                std::lock_guard<std::mutex> lock(sinkMutex);
+                sinks.erase(name_);
+            }
+
+            // Non-copyable
+            SinkRegistration(const SinkRegistration&) = delete;
+            SinkRegistration& operator=(const SinkRegistration&) = delete;
+
+            const std::string& GetName() const { return name_; }
+
+        private:
+            std::string name_;
+        };
+
+        class BodyReader {
+        public:
+            BodyReader(std::ifstream& in, bool compressed)
+                : in_(in)
+#ifdef KETOAN_HAVE_ZSTD
+                , dctx_(nullptr)
+                , input_{ nullptr, 0, 0 }
+#endif
+            {
+#ifdef KETOAN_HAVE_ZSTD
+                if (compressed) {
+                    dctx_ = ZSTD_createDCtx();
+                    buffer_.resize(ZSTD_DStreamInSize());
+                }
+#else
+                KETOAN_UNUSED(compressed);
+#endif
+            }
+
+            ~BodyReader() {
+#ifdef KETOAN_HAVE_ZSTD
+                ZSTD_freeDCtx(dctx_);
+#endif
+            }
+
+            // Reads exactly size bytes; false on end of stream or corruption
+            bool Read(void* data, size_t size) {
+#ifdef KETOAN_HAVE_ZSTD
+                if (dctx_) {
+                    ZSTD_outBuffer output = { data, size, 0 };
+                    while (output.pos < output.size) {
+                        if (input_.pos == input_.size) {
+                            in_.read(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+                            size_t got = static_cast<size_t>(in_.gcount());
+                            if (got == 0) {
+                                return false;
+                            }
+                            input_ = { buffer_.data(), got, 0 };
+                        }
+                        size_t rc = ZSTD_decompressStream(dctx_, &output, &input_);
+                        if (ZSTD_isError(rc)) {
+                            Logger::Error("Backup decompression failed: %s", ZSTD_getErrorName(rc));
+                            return false;
+                        }
+                    }
+                    return true;
+                }
+#endif
+                in_.read(static_cast<char*>(data), static_cast<std::streamsize>(size));
+                return static_cast<size_t>(in_.gcount()) == size;
+            }
+
+        private:
+            std::ifstream& in_;
+            std::vector<char> buffer_;
+#ifdef KETOAN_HAVE_ZSTD
+            ZSTD_DCtx* dctx_;
+            ZSTD_inBuffer input_;
+#endif
+        };
+
+    } // namespace
+
+    BackupService::BackupService(DatabaseManager& database, Config& config)
+        : database_(database)
+        , config_(config)
+    {
+        config_.DeclareInt("Backup.MaxStallMs", 5, 1, 1000);
+        config_.DeclareInt("Backup.PauseMs", 10, 0, 10000);
+        config_.DeclareBool("Backup.Compress", true);
+        config_.DeclareInt("Backup.CompressionLevel", 3, 1, 19);
+    }
+
+    bool BackupService::IsCompressionAvailable() {
+#ifdef KETOAN_HAVE_ZSTD
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    void BackupService::Cancel() {
+        std::lock_guard<std::mutex> lock(cancelMutex_);
+        cancel_.Cancel();
+        cancel_ = CancellationToken();
+        Logger::Info("Running backups cancelled");
+    }
+
+    BackupResult BackupService::Backup(const std::string& outputPath, ProgressCallback progress,
+        CancellationToken cancel)
+    {
+        BackupResult result;
+        result.path = outputPath;
+        auto started = std::chrono::steady_clock::now();
+
+        // Cancel() reaches this backup through its own token
+        CancellationToken running;
+        {
+            std::lock_guard<std::mutex> lock(cancelMutex_);
+            running = cancel_;
+        }
+        const uint64_t forward = running.Register([cancel]() mutable { cancel.Cancel(); });
+        if (running.IsCancelled()) {
+            cancel.Cancel();
+        }
+
+        // Written under a temporary name so a partial file is never mistaken for a backup
+        std::string partPath = outputPath + ".part";
+        bool ok = WriteStream(partPath, result, progress, cancel);
+        running.Unregister(forward);
+        if (ok) {
+            std::error_code ec;
+            std::filesystem::rename(FsPath(partPath), FsPath(outputPath), ec);
+            if (ec) {
+                result.error = "Cannot rename backup: " + ec.message();
+                ok = false;
+            }
+        }
+        if (!ok) {
+            RemoveFile(partPath);
+        }
+
+        result.success = ok;
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+        if (ok) {
+            Logger::Info("Backup %s: %lld pages, %lld bytes, snapshot S%lld, max step %llu us, %.1f s",
+                outputPath.c_str(), static_cast<long long>(result.pages),
+                static_cast<long long>(result.bytesWritten), static_cast<long long>(result.commitSequence),
+                static_cast<unsigned long long>(result.maxStallMicros), result.seconds);
+        } else {
+            Logger::Error("Backup %s failed: %s", outputPath.c_str(), result.error.c_str());
+        }
+        return result;
+    }
+
+    bool BackupService::WriteStream(const std::string& partPath, BackupResult& result,
+        ProgressCallback& progress, const CancellationToken& cancel)
+    {
+        if (!RegisterSinkVfs()) {
+            result.error = "Cannot register the backup VFS";
+            return false;
+        }
+
+        auto view = database_.OpenReadView();
+        if (!view) {
+            result.error = "No reader connection available";
+            return false;
+        }
+
+        std::string pageSizeText, pageCountText;
+        if (!view->ExecuteScalar("PRAGMA page_size", pageSizeText)
+            || !view->ExecuteScalar("PRAGMA page_count", pageCountText)) {
+            result.error = "Cannot read the database page layout";
+            return false;
+        }
+        const uint32_t pageSize = static_cast<uint32_t>(std::stoul(pageSizeText));
+        const uint32_t pageCount = static_cast<uint32_t>(std::stoul(pageCountText));
+        result.pages = pageCount;
+        result.commitSequence = view->GetCommitSequence();
+        result.compressed = config_.GetBool("Backup.Compress") && IsCompressionAvailable();
+
+        std::ofstream out(FsPath(partPath), std::ios::binary | std::ios::trunc);
+        if (!out) {
+            result.error = "Cannot create " + partPath;
+            return false;
+        }
+
+        unsigned char header[kHeaderSize];
+        memcpy(header, kMagic, sizeof(kMagic));
+        PutU32(header + 8, kVersion);
+        PutU32(header + 12, result.compressed ? kFlagZstd : 0);
+        PutU32(header + 16, pageSize);
+        PutU32(header + 20, pageCount);
+        PutU64(header + 24, static_cast<uint64_t>(result.commitSequence));
+        PutU32(header + 32, Crc32::Compute(header, 32));
+        out.write(reinterpret_cast<const char*>(header), kHeaderSize);
+
+        BodyWriter body(out, result.compressed, config_.GetInt("Backup.CompressionLevel"));
+        PageSink sink(body, pageSize, pageCount);
+        SinkRegistration registration(sink);
+
+        sqlite3* dest = nullptr;
+        if (sqlite3_open_v2(registration.GetName().c_str(), &dest,
+                SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, kSinkVfsName) != SQLITE_OK) {
+            result.error = dest ? sqlite3_errmsg(dest) : "cannot open backup sink";
+            sqlite3_close(dest);
+            return false;
+        }
+        sqlite3_exec(dest, "PRAGMA journal_mode=OFF", nullptr, nullptr, nullptr);
+
+        sqlite3_backup* backup = sqlite3_backup_init(dest, "main", view->GetConnection().GetHandle(), "main");
+        if (!backup) {
+            result.error = sqlite3_errmsg(dest);
+            sqlite3_close(dest);
+            return false;
+        }
+
+        const auto stepBudget = std::chrono::microseconds(
+            static_cast<int64_t>(config_.GetInt("Backup.MaxStallMs")) * 1000);
+        const auto pause = std::chrono::milliseconds(config_.GetInt("Backup.PauseMs"));
+
+        // The source is the view's pinned snapshot on a reader connection:
+        // the writer is never locked, and commits made meanwhile neither
+        // reach the copy nor restart it. Steps stay short so Cancel() and
+        // the pause between steps take effect promptly.
+        int stepPages = kInitialStepPages;
+        int rc = SQLITE_OK;
+        for (;;) {
+            if (cancel.IsCancelled()) {
+                result.error = "Backup cancelled";
+                break;
+            }
+
+            auto stepStart = std::chrono::steady_clock::now();
+            rc = sqlite3_backup_step(backup, stepPages);
+            auto held = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - stepStart);
+
+            result.maxStallMicros = (std::max)(result.maxStallMicros, static_cast<uint64_t>(held.count()));
+
+            if (rc == SQLITE_DONE) {
+                break;
+            }
+            if (rc != SQLITE_OK && rc != SQLITE_BUSY && rc != SQLITE_LOCKED) {
+                result.error = sink.GetError().empty() ? sqlite3_errstr(rc) : sink.GetError();
+                break;
+            }
+
+            if (held > stepBudget) {
+                stepPages = (std::max)(1, stepPages / 2);
+            } else if (held * 2 < stepBudget) {
+                stepPages = (std::min)(kMaxStepPages, stepPages * 2);
+            }
+
+            if (progress) {
+                int total = sqlite3_backup_pagecount(backup);
+                progress(total - sqlite3_backup_remaining(backup), total);
+            }
+
+            std::this_thread::sleep_for(pause);
+        }
+
+        sqlite3_backup_finish(backup);
+        sqlite3_close(dest);
+        view.reset();
+
+        if (rc != SQLITE_DONE || !result.error.empty()) {
+            return false;
+        }
+        if (!sink.Finish()) {
+            result.error = sink.GetError();
+            return false;
+        }
+        result.bytesWritten = static_cast<int64_t>(out.tellp());
+        return true;
+    }
+
+    bool BackupService::Unpack(const std::string& backupPath, const std::string* outputPath,
+        RestoreResult& result)
+    {
+        std::ifstream in(FsPath(backupPath), std::ios::binary);
+        if (!in) {
+            result.error = "Cannot open " + backupPath;
+            return false;
+        }
+
+        unsigned char header[kHeaderSize];
+        in.read(reinterpret_cast<char*>(header), kHeaderSize);
+        if (static_cast<size_t>(in.gcount()) != kHeaderSize || memcmp(header, kMagic, sizeof(kMagic)) != 0) {
+            result.error = "Not a backup file";
+            return false;
+        }
+        if (GetU32(header + 32) != Crc32::Compute(header, 32)) {
+            result.error = "Backup header checksum mismatch";
+            return false;
+        }
+        const uint32_t version = GetU32(header + 8);
+        if (version < 1 || version > kVersion) {
+            result.error = "Unsupported backup version";
+            return false;
+        }
+
+        const bool compressed = (GetU32(header + 12) & kFlagZstd) != 0;
+        const uint32_t pageSize = GetU32(header + 16);
+        const uint32_t pageCount = GetU32(header + 20);
+        result.commitSequence = static_cast<int64_t>(GetU64(header + 24));
+
+        if (compressed && !IsCompressionAvailable()) {
+            result.error = "Backup is zstd-compressed; this build has no zstd support";
+            return false;
+        }
+        if (pageSize < 512 || pageSize > 65536) {
+            result.error = "Backup header has an invalid page size";
+            return false;
+        }
+
+        std::ofstream out;
+        if (outputPath) {
+            out.open(FsPath(*outputPath), std::ios::binary | std::ios::trunc);
+            if (!out) {
+                result.error = "Cannot create " + *outputPath;
+                return false;
+            }
+        }
+
+        BodyReader body(in, compressed);
+        std::vector<unsigned char> page(pageSize);
+        unsigned char frame[8];
+
+        // Version 1 streams pages in order; version 2 in any order, each once
+        std::vector<bool> seen(pageCount, false);
+        for (;;) {
+            if (!body.Read(frame, sizeof(frame))) {
+                result.error = "Backup is truncated after " + std::to_string(result.pages) + " pages";
+                return false;
+            }
+            const uint32_t pageNo = GetU32(frame);
+            if (pageNo == 0) {
+                break;
+            }
+            if (pageNo > pageCount || seen[pageNo - 1]
+                || (version == 1 && pageNo != result.pages + 1)) {
+                result.error = "Backup page " + std::to_string(pageNo) + " is out of sequence";
+                return false;
+            }
+            if (!body.Read(page.data(), pageSize)) {
+                result.error = "Backup is truncated at page " + std::to_string(pageNo);
+                return false;
+            }
+            if (GetU32(frame + 4) != Crc32::Compute(page.data(), pageSize)) {
+                result.error = "Checksum mismatch on page " + std::to_string(pageNo);
+                return false;
+            }
+            if (outputPath) {
+                out.seekp(static_cast<std::streamoff>(pageNo - 1) * pageSize);
+                out.write(reinterpret_cast<const char*>(page.data()), pageSize);
+                if (!out) {
+                    result.error = "Writing " + *outputPath + " failed";
+                    return false;
+                }
+            }
+            seen[pageNo - 1] = true;
+            ++result.pages;
+        }
+
+        if (result.pages != pageCount || GetU32(frame + 4) != pageCount) {
+            result.error = "Backup end marker missing";
+            return false;
+        }
+
+        if (outputPath) {
+            out.flush();
+            if (!out) {
+                result.error = "Writing " + *outputPath + " failed";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool BackupService::Verify(const std::string& backupPath, RestoreResult& result) {
+        result.path = backupPath;
+        result.success = Unpack(backupPath, nullptr, result);
+        return result.success;
+    }
+
+    RestoreResult BackupService::Restore(const std::string& backupPath, const std::string& targetPath) {
+        RestoreResult result;
+        result.path = targetPath;
+
+        std::string restorePath = targetPath + ".restore";
+        RemoveFile(restorePath);
+
+        if (!Unpack(backupPath, &restorePath, result)) {
+            RemoveFile(restorePath);
+            Logger::Error("Restore from %s failed: %s", backupPath.c_str(), result.error.c_str());
+            return result;
+        }
+
+        // Pages are intact; let SQLite confirm the file is a consistent database
+        sqlite3* db = nullptr;
+        std::string check;
+        if (sqlite3_open_v2(restorePath.c_str(), &db, SQLITE_OPEN_READWRITE, nullptr) == SQLITE_OK) {
+            sqlite3_stmt* stmt = nullptr;
+            if (sqlite3_prepare_v2(db, "PRAGMA integrity_check", -1, &stmt, nullptr) == SQLITE_OK
+                && sqlite3_step(stmt) == SQLITE_ROW) {
+                const unsigned char* text = sqlite3_column_text(stmt, 0);
+                check = text ? reinterpret_cast<const char*>(text) : "";
+            }
+            sqlite3_finalize(stmt);
+        }
+        sqlite3_close(db);
+
+        if (check != "ok") {
+            result.error = "Integrity check failed: " + (check.empty() ? std::string("cannot open") : check);
+            RemoveFile(restorePath);
+            Logger::Error("Restore from %s failed: %s", backupPath.c_str(), result.error.c_str());
+            return result;
+        }
+
+        // A stale WAL of the old file would be replayed over the restored pages
+        RemoveFile(targetPath + "-wal");
+        RemoveFile(targetPath + "-shm");
+
+        std::error_code ec;
+        std::filesystem::rename(FsPath(restorePath), FsPath(targetPath), ec);
+        if (ec) {
+            result.error = "Cannot replace " + targetPath + ": " + ec.message();
+            RemoveFile(restorePath);
+            Logger::Error("Restore from %s failed: %s", backupPath.c_str(), result.error.c_str());
+            return result;
+        }
+
+        result.success = true;
+        Logger::Info("Restored %s from %s: %lld pages, snapshot S%lld", targetPath.c_str(),
+            backupPath.c_str(), static_cast<long long>(result.pages),
+            static_cast<long long>(result.commitSequence));
+        return result;
+    }
+
+} // namespace KeToanApp
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "KeToanApp/Common.h"
+#include "KeToanApp/Types.h"
+#include "../Core/Config.h"
+#include "../Database/DatabaseManager.h"
+#include "../Utils/CancellationToken.h"
+#include <cstdint>
+#include <functional>
+#include <mutex>
+
+namespace KeToanApp {
+
+    struct BackupResult {
+        bool success;
+        std::string path;
+        int64_t pages;
+        int64_t bytesWritten;
+        int64_t commitSequence;     // CommitSeq captured in the backup
+        bool compressed;
+        uint64_t maxStallMicros;    // longest single copy step (the writer is not blocked)
+        double seconds;
+        std::string error;
+
+        BackupResult()
+            : success(false), pages(0), bytesWritten(0), commitSequence(0)
+            , compressed(false), maxStallMicros(0), seconds(0.0) {}
+    };
+
+    struct RestoreResult {
+        bool success;
+        std::string path;
+        int64_t pages;
+        int64_t commitSequence;
+        std::string error;
+
+        RestoreResult() : success(false), pages(0), commitSequence(0) {}
+    };
+
+    // Online backup and validated restore.
+    //
+    // Backup() copies a pinned read-view snapshot with the SQLite backup API
+    // on a reader connection, so posting continues throughout and the copy
+    // never restarts; the backup holds the state as of CommitSeq at its
+    // start. The copy is written through a sink VFS straight into the .ktb
+    // stream, without a temporary copy of the database. Pages per step
+    // adapt so a step stays within Backup.MaxStallMs; Backup.PauseMs
+    // separates steps.
+    //
+    //   header  "KTBACKUP" u32 version, u32 flags, u32 pageSize, u32 pageCount,
+    //           u64 commitSeq, u32 crc32(header)
+    //   body    per page: u32 pageNo, u32 crc32(page), page bytes
+    //           end:      u32 0, u32 pageCount
+    //
+    // integers little-endian. Version 2 stores each page once in any order
+    // (version 1, still readable, in page order). With Backup.Compress the
+    // body is one zstd stream (available when built with KETOAN_HAVE_ZSTD).
+    // Restore() checks every page checksum and SQLite's integrity check
+    // before replacing the target, which must not be open.
+    class BackupService {
+    public:
+        // (pages copied, total pages)
+        using ProgressCallback = std::function<void(int64_t, int64_t)>;
+
+        BackupService(DatabaseManager& database, Config& config);
+        ~BackupService() = default;
+
+        // Non-copyable
+        BackupService(const BackupService&) = delete;
+        BackupService& operator=(const BackupService&) = delete;
+
+        // cancel stops this backup after its current step. The caller makes
+        // the token when it sets the backup up, so a cancel that comes before
+        // Backup() runs is still honoured.
+        BackupResult Backup(const std::string& outputPath, ProgressCallback progress = nullptr,
+            CancellationToken cancel = CancellationToken());
+        RestoreResult Restore(const std::string& backupPath, const std::string& targetPath);
+
+        // Checks all checksums of a backup without writing anything
+        static bool Verify(const std::string& backupPath, RestoreResult& result);
+
+        // Stops every Backup() running now after its current step, from any
+        // thread. Backups started later are unaffected.
+        void Cancel();
+
+        static bool IsCompressionAvailable();
+
+    private:
+        DatabaseManager& database_;
+        Config& config_;
+        // Shared by the backups running now; Cancel() replaces it
+        std::mutex cancelMutex_;
+        CancellationToken cancel_;
+
+        bool WriteStream(const std::string& partPath, BackupResult& result, ProgressCallback& progress,
+            const CancellationToken& cancel);
+        static bool Unpack(const std::string& backupPath, const std::string* outputPath,
+            RestoreResult& result);
+    };
+
+} // namespace KeToanApp
@@ -0,0 +1,508 @@
+#include "BalanceIndex.h"
+#include "../Database/ChangeFeed.h"
+#include "../Utils/DateTimeHelper.h"
+#include "../Utils/Logger.h"
+#include "../Utils/Trace.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+namespace KeToanApp {
+
+    namespace {
+
+        const char* kLinesQuery =
+            "SELECT d.ID, c.NgayCT, d.TKNo, d.TKCo, d.SoTien "
+            "FROM DinhKhoan d JOIN ChungTuKeToan c ON c.SoCT = d.SoCT "
+            "WHERE d.ID BETWEEN ?1 AND ?2 AND COALESCE(c.TrangThai, 1) <> 2";
+
+        // Lines of a voided document that were applied earlier (ID <= ?2)
+        const char* kVoidQuery =
+            "SELECT d.ID, c.NgayCT, d.TKNo, d.TKCo, d.SoTien "
+            "FROM DinhKhoan d JOIN ChungTuKeToan c ON c.SoCT = d.SoCT "
+            "WHERE d.SoCT = ?1 AND d.ID <= ?2";
+
+        const size_t kChangeBatch = 1000;
+
+        // Room for later postings past the last loaded day before the
+        // trees have to grow
+        const size_t kSlackDays = 366;
+
+    } // namespace
+
+    BalanceIndex::BalanceIndex(DatabaseManager& database, Config& config, CodeDictionary& codes)
+        : database_(database)
+        , config_(config)
+        , codes_(codes)
+        , built_(false)
+        , highWater_(0)
+        , changeSeq_(0)
+        , cursor_(database)
+    {
+        config_.DeclareInt("Balances.BuildThreads", 0, 0, 64);
+    }
+
+    bool BalanceIndex::Build() {
+        KETOAN_TRACE_SCOPE("engine", "BalanceIndex.Build");
+        std::lock_guard<std::mutex> refreshLock(refreshMutex_);
+        return Rebuild();
+    }
+
+    bool BalanceIndex::Rebuild() {
+        auto started = std::chrono::steady_clock::now();
+
+        size_t threads = static_cast<size_t>(config_.GetInt("Balances.BuildThreads"));
+        if (threads == 0) {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+
+        // One view per thread, all at the same ChangeLog position. Extra
+        // views are taken only if a reader is free, and dropped if a commit
+        // slipped in between; the build then runs on fewer threads.
+        std::vector<std::unique_ptr<ReadView>> views;
+        views.push_back(database_.OpenReadView());
+        if (!views[0]) {
+            Logger::Error("Balance index: no read view available");
+            return false;
+        }
+        const int64_t head = ChangeFeed::GetHeadSequence(*views[0]);
+        while (views.size() < threads) {
+            std::unique_ptr<ReadView> view = database_.OpenReadView(std::chrono::milliseconds(0));
+            if (!view || ChangeFeed::GetHeadSequence(*view) != head) {
+                break;
+            }
+            views.push_back(std::move(view));
+        }
+
+        State state;
+        int64_t firstId = 0;
+        int64_t lastId = 0;
+        try {
+            ReadView& view = *views[0];
+            auto range = view.Prepare("SELECT COALESCE(MIN(ID), 0), COALESCE(MAX(ID), 0) FROM DinhKhoan");
+            if (range->Step()) {
+                firstId = range->ColumnInt64(0);
+                lastId = range->ColumnInt64(1);
+            }
+
+            // Balances carried into the first open year
+            auto year = view.Prepare("SELECT MAX(NamTC) FROM SoDuDauKy");
+            if (year->Step() && !year->ColumnIsNull(0)) {
+                const int namTC = static_cast<int>(year->ColumnInt64(0));
+                state.openingDay = DateTimeHelper::ToDayNumber(1, 1, namTC);
+
+                auto opening = view.Prepare("SELECT SoTK, DuNo, DuCo FROM SoDuDauKy WHERE NamTC = ?1");
+                opening->BindInt64(1, namTC);
+                while (opening->Step()) {
+                    const uint32_t account = codes_.Intern(CodeKind::Account, opening->ColumnTextView(0));
+                    if (account >= state.opening.size()) {
+                        state.opening.resize(account + 1);
+                    }
+                    state.opening[account].debit += Money::FromDouble(opening->ColumnDouble(1));
+                    state.opening[account].credit += Money::FromDouble(opening->ColumnDouble(2));
+                }
+            }
+        }
+        catch (const DatabaseException& e) {
+            Logger::Error("Balance index: reading opening balances failed: %s", e.what());
+            return false;
+        }
+
+        // Read: one slice of IDs per view
+        const size_t slices = views.size();
+        std::vector<std::vector<Line>> lines(slices);
+        std::vector<std::thread> workers;
+        std::atomic<bool> failed(false);
+        const int64_t span = lastId - firstId + 1;
+        for (size_t slice = 0; slice < slices; ++slice) {
+            const int64_t begin = firstId + span * static_cast<int64_t>(slice) / static_cast<int64_t>(slices);
+            const int64_t end = firstId + span * static_cast<int64_t>(slice + 1) / static_cast<int64_t>(slices) - 1;
+            workers.emplace_back([&, slice, begin, end] {
+                if (lastId > 0 && !ReadLines(*views[slice], begin, end, lines[slice])) {
+                    failed = true;
+                }
+                views[slice].reset();
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        workers.clear();
+        if (failed) {
+            return false;
+        }
+
+        // Day range: from the opening year, or the first year with lines
+        DayNumber first = state.openingDay;
+        DayNumber last = state.openingDay;
+        for (const auto& slice : lines) {
+            for (const auto& line : slice) {
+                first = first == kNoDay ? line.day : (std::min)(first, line.day);
+                last = last == kNoDay ? line.day : (std::max)(last, line.day);
+            }
+        }
+        if (first == kNoDay) {
+            first = last = DateTimeHelper::ToDayNumber(DateTimeHelper::Today());
+        }
+        state.baseDay = DateTimeHelper::ToDayNumber(1, 1, DateTimeHelper::FromDayNumber(first).year);
+        state.capacity = CapacityFor(static_cast<size_t>(last - state.baseDay) + 1 + kSlackDays);
+
+        // Fill: each thread owns the accounts with id % threads == its
+        // index, so trees are written without locks
+        const size_t accounts = codes_.GetCount(CodeKind::Account);
+        state.trees.resize(accounts);
+        state.opening.resize(accounts);
+        for (size_t part = 0; part < slices; ++part) {
+            workers.emplace_back([&, part] {
+                auto add = [&](uint32_t account, std::vector<int64_t> Tree::*side, size_t position, int64_t amount) {
+                    if (account == CodeDictionary::kNotFound || account % slices != part) {
+                        return;
+                    }
+                    Tree& tree = state.trees[account];
+                    if (tree.debit.empty()) {
+                        tree.debit.assign(state.capacity + 1, 0);
+                        tree.credit.assign(state.capacity + 1, 0);
+                    }
+                    (tree.*side)[position] += amount;
+                };
+                for (const auto& slice : lines) {
+                    for (const auto& line : slice) {
+                        const size_t position = static_cast<size_t>(line.day - state.baseDay) + 1;
+                        add(line.debit, &Tree::debit, position, line.amount);
+                        add(line.credit, &Tree::credit, position, line.amount);
+                    }
+                }
+                for (size_t account = part; account < accounts; account += slices) {
+                    ToTree(state.trees[account].debit);
+                    ToTree(state.trees[account].credit);
+                }
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+
+        size_t lineCount = 0;
+        for (const auto& slice : lines) {
+            lineCount += slice.size();
+        }
+
+        {
+            std::unique_lock<std::shared_mutex> lock(mutex_);
+            state_ = std::move(state);
+            highWater_ = lastId;
+            changeSeq_ = head;
+            cursor_.Set(head);
+            built_ = true;
+        }
+
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - started);
+        Logger::Info("Balance index built: %zu lines, %zu accounts, %zu threads in %lld ms",
+            lineCount, accounts, slices, static_cast<long long>(elapsed.count()));
+        return true;
+    }
+
+    bool BalanceIndex::ReadLines(ReadView& view, int64_t firstId, int64_t lastId, std::vector<Line>& lines) {
+        try {
+            auto stmt = view.Prepare(kLinesQuery);
+            stmt->BindInt64(1, firstId).BindInt64(2, lastId);
+
+            while (stmt->Step()) {
+                std::string_view date = stmt->ColumnTextView(1);
+                Line line;
+                if (!DateTimeHelper::ParseDayNumber(date.data(), date.size(), line.day)) {
+                    Logger::Warning("Balance index: skipping DinhKhoan %lld with bad date '%.*s'",
+                        static_cast<long long>(stmt->ColumnInt64(0)), static_cast<int>(date.size()), date.data());
+                    continue;
+                }
+                std::string_view debit = stmt->ColumnTextView(2);
+                std::string_view credit = stmt->ColumnTextView(3);
+                line.debit = debit.empty() ? CodeDictionary::kNotFound : codes_.Intern(CodeKind::Account, debit);
+                line.credit = credit.empty() ? CodeDictionary::kNotFound : codes_.Intern(CodeKind::Account, credit);
+                line.amount = Money::FromDouble(stmt->ColumnDouble(4)).units;
+                lines.push_back(line);
+            }
+        }
+        catch (const DatabaseException& e) {
+            Logger::Error("Balance index: reading lines failed: %s", e.what());
+            return false;
+        }
+        return true;
+    }
+
+    bool BalanceIndex::Refresh() {
+        KETOAN_TRACE_SCOPE("engine", "BalanceIndex.Refresh");
+        std::lock_guard<std::mutex> refreshLock(refreshMutex_);
+        if (!built_) {
+            return Rebuild();
+        }
+
+        std::unique_ptr<ReadView> view = database_.OpenReadView();
+        if (!view) {
+            Logger::Error("Balance index: no read view available");
+            return false;
+        }
+        const int64_t head = ChangeFeed::GetHeadSequence(*view);
+        if (head == changeSeq_) {
+            return true;
+        }
+
+        // Read outside the index lock; queries go on meanwhile
+        std::vector<Line> lines;
+        int64_t lastId = highWater_;
+        bool rebuild = false;
+        try {
+            // Entries purged before this index saw them
+            auto first = view->Prepare("SELECT MIN(Seq) FROM ChangeLog WHERE Seq > ?1");
+            first->BindInt64(1, changeSeq_);
+            rebuild = first->Step() && !first->ColumnIsNull(0) && first->ColumnInt64(0) > changeSeq_ + 1;
+
+            // Voids reverse the lines applied earlier; lines posted since are
+            // read below and skip voided documents already
+            std::vector<ChangeRecord> changes;
+            int64_t seq = changeSeq_;
+            do {
+                changes.clear();
+                if (rebuild || !ChangeFeed::ReadChanges(*view, seq, kChangeBatch, changes)) {
+                    break;
+                }
+                for (const auto& change : changes) {
+                    seq = change.seq;
+                    if (change.tableName != "ChungTuKeToan") {
+                        continue;
+                    }
+                    if (change.operation == ChangeOperation::Delete) {
+                        rebuild = true;
+                        break;
+                    }
+                    if (change.operation == ChangeOperation::Void) {
+                        const size_t firstReversed = lines.size();
+                        auto stmt = view->Prepare(kVoidQuery);
+                        stmt->BindText(1, change.rowKey).BindInt64(2, highWater_);
+                        while (stmt->Step()) {
+                            std::string_view date = stmt->ColumnTextView(1);
+                            Line line;
+                            if (!DateTimeHelper::ParseDayNumber(date.data(), date.size(), line.day)) {
+                                continue;   // skipped when loaded as well
+                            }
+                            std::string_view debit = stmt->ColumnTextView(2);
+                            std::string_view credit = stmt->ColumnTextView(3);
+                            line.debit = debit.empty() ? CodeDictionary::kNotFound : codes_.Intern(CodeKind::Account, debit);
+                            line.credit = credit.empty() ? CodeDictionary::kNotFound : codes_.Intern(CodeKind::Account, credit);
+                            line.amount = -Money::FromDouble(stmt->ColumnDouble(4)).units;
+                            lines.push_back(line);
+                        }
+                        Logger::Debug("Balance index: reversing %zu lines of %s",
+                            lines.size() - firstReversed, change.rowKey.c_str());
+                    }
+                }
+            } while (!rebuild && changes.size() == kChangeBatch);
+
+            if (!rebuild) {
+                std::string maxId;
+                if (view->ExecuteScalar("SELECT COALESCE(MAX(ID), 0) FROM DinhKhoan", maxId)) {
+                    lastId = std::atoll(maxId.c_str());
+                }
+                if (lastId > highWater_ && !ReadLines(*view, highWater_ + 1, lastId, lines)) {
+                    return false;
+                }
+            }
+        }
+        catch (const DatabaseException& e) {
+            Logger::Error("Balance index: refresh failed: %s", e.what());
+            return false;
+        }
+        view.reset();
+
+        if (rebuild) {
+            Logger::Info("Balance index: vouchers deleted or change log purged, rebuilding");
+            return Rebuild();
+        }
+
+        {
+            std::unique_lock<std::shared_mutex> lock(mutex_);
+            Apply(lines);
+            highWater_ = lastId;
+            changeSeq_ = head;
+            cursor_.Set(head);
+        }
+        Logger::Debug("Balance index refresh: %zu lines applied", lines.size());
+        return true;
+    }
+
+    void BalanceIndex::Apply(const std::vector<Line>& lines) {
+        if (lines.empty()) {
+            return;
+        }
+
+        DayNumber first = lines[0].day;
+        DayNumber last = lines[0].day;
+        for (const auto& line : lines) {
+            first = (std::min)(first, line.day);
+            last = (std::max)(last, line.day);
+        }
+        Cover(first, last);
+
+        const size_t accounts = codes_.GetCount(CodeKind::Account);
+        if (state_.trees.size() < accounts) {
+            state_.trees.resize(accounts);
+            state_.opening.resize(accounts);
+        }
+
+        auto add = [this](uint32_t account, std::vector<int64_t> Tree::*side, size_t position, int64_t amount) {
+            if (account == CodeDictionary::kNotFound) {
+                return;
+            }
+            Tree& tree = state_.trees[account];
+            if (tree.debit.empty()) {
+                tree.debit.assign(state_.capacity + 1, 0);
+                tree.credit.assign(state_.capacity + 1, 0);
+            }
+            Add(tree.*side, position, amount);
+        };
+        for (const auto& line : lines) {
+            const size_t position = static_cast<size_t>(line.day - state_.baseDay) + 1;
+            add(line.debit, &Tree::debit, position, line.amount);
+            add(line.credit, &Tree::credit, position, line.amount);
+        }
+    }
+
+    void BalanceIndex::Cover(DayNumber first, DayNumber last) {
+        const DayNumber end = state_.baseDay + static_cast<DayNumber>(state_.capacity);
+        if (first >= state_.baseDay && last < end) {
+            return;
+        }
+
+        // Grow to a new base and capacity; every tree is unpacked to per-day
+        // values, shifted and rebuilt. Rare: a year of slack is kept ahead.
+        const DayNumber baseDay = (std::min)(state_.baseDay,
+            DateTimeHelper::ToDayNumber(1, 1, DateTimeHelper::FromDayNumber(first).year));
+        const DayNumber lastDay = (std::max)(end - 1, last);
+        const size_t capacity = CapacityFor(static_cast<size_t>(lastDay - baseDay) + 1 + kSlackDays);
+        const size_t shift = static_cast<size_t>(state_.baseDay - baseDay);
+
+        for (auto& tree : state_.trees) {
+            for (auto* side : { &tree.debit, &tree.credit }) {
+                if (side->empty()) {
+                    continue;
+                }
+                ToValues(*side);
+                std::vector<int64_t> values(capacity + 1, 0);
+                std::copy(side->begin() + 1, side->end(), values.begin() + 1 + shift);
+                ToTree(values);
+                side->swap(values);
+            }
+        }
+
+        Logger::Debug("Balance index: range grown to %zu days", capacity);
+        state_.baseDay = baseDay;
+        state_.capacity = capacity;
+    }
+
+    bool BalanceIndex::GetBalance(std::string_view soTK, DayNumber asOf, AccountMovement& balance) const {
+        return GetBalance(codes_.Find(CodeKind::Account, soTK), asOf, balance);
+    }
+
+    bool BalanceIndex::GetBalance(uint32_t account, DayNumber asOf, AccountMovement& balance) const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        balance = AccountMovement();
+        if (!built_ || (state_.openingDay != kNoDay && asOf < state_.openingDay - 1)) {
+            return false;
+        }
+        if (account >= state_.trees.size()) {
+            return true;
+        }
+
+        balance = state_.opening[account];
+        const Tree& tree = state_.trees[account];
+        if (!tree.debit.empty()) {
+            const size_t position = Position(state_, asOf);
+            balance.debit.units += Prefix(tree.debit, position);
+            balance.credit.units += Prefix(tree.credit, position);
+        }
+        return true;
+    }
+
+    bool BalanceIndex::GetMovement(std::string_view soTK, DayNumber from, DayNumber to,
+        AccountMovement& movement) const
+    {
+        return GetMovement(codes_.Find(CodeKind::Account, soTK), from, to, movement);
+    }
+
+    bool BalanceIndex::GetMovement(uint32_t account, DayNumber from, DayNumber to, AccountMovement& movement) const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        movement = AccountMovement();
+        if (!built_ || (state_.openingDay != kNoDay && from < state_.openingDay)) {
+            return false;
+        }
+        if (account >= state_.trees.size() || to < from) {
+            return true;
+        }
+
+        const Tree& tree = state_.trees[account];
+        if (!tree.debit.empty()) {
+            const size_t begin = Position(state_, from - 1);
+            const size_t end = Position(state_, to);
+            movement.debit.units = Prefix(tree.debit, end) - Prefix(tree.debit, begin);
+            movement.credit.units = Prefix(tree.credit, end) - Prefix(tree.credit, begin);
+        }
+        return true;
+    }
+
+    DayNumber BalanceIndex::GetOpeningDay() const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        return state_.openingDay;
+    }
+
+    void BalanceIndex::Add(std::vector<int64_t>& tree, size_t position, int64_t value) {
+        for (; position < tree.size(); position += position & (~position + 1)) {
+            tree[position] += value;
+        }
+    }
+
+    int64_t BalanceIndex::Prefix(const std::vector<int64_t>& tree, size_t position) {
+        int64_t sum = 0;
+        for (; position > 0; position &= position - 1) {
+            sum += tree[position];
+        }
+        return sum;
+    }
+
+    void BalanceIndex::ToTree(std::vector<int64_t>& values) {
+        // Each node passes its sum to its parent: O(n) instead of n updates
+        for (size_t position = 1; position < values.size(); ++position) {
+            const size_t parent = position + (position & (~position + 1));
+            if (parent < values.size()) {
+                values[parent] += values[position];
+            }
+        }
+    }
+
+    void BalanceIndex::ToValues(std::vector<int64_t>& tree) {
+        // ToTree in reverse
+        for (size_t position = tree.size() - 1; position > 0; --position) {
+            const size_t parent = position + (position & (~position + 1));
+            if (parent < tree.size()) {
+                tree[parent] -= tree[position];
+            }
+        }
+    }
+
+    size_t BalanceIndex::Position(const State& state, DayNumber day) {
+        if (day < state.baseDay) {
+            return 0;
+        }
+        return (std::min)(static_cast<size_t>(day - state.baseDay) + 1, state.capacity);
+    }
+
+    size_t BalanceIndex::CapacityFor(size_t days) {
+        size_t capacity = 512;
+        while (capacity < days) {
+            capacity <<= 1;
+        }
+        return capacity;
+    }
+
+} // namespace KeToanApp
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "KeToanApp/Common.h"
+#include "KeToanApp/Types.h"
+#include "../Core/Config.h"
+#include "../Database/ChangeFeed.h"
+#include "../Database/DatabaseManager.h"
+#include "CodeDictionary.h"
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <string_view>
+
+namespace KeToanApp {
+
+    // Debit and credit totals of one account
+    struct AccountMovement {
+        Money debit;
+        Money credit;
+
+        // Debit balance when positive, credit balance when negative
+        Money Net() const { return debit - credit; }
+    };
+
+    // As-of-date balances and period movements of posted accounts.
+    //
+    // Debits and credits of each account are held in two Fenwick trees over
+    // day numbers from a common base day: the balance as of a date, the
+    // movement between two dates and posting a line on any date, back-dated
+    // or not, are all O(log days). Balances start from the opening balances
+    // period close carried to SoDuDauKy for the first open year; there is
+    // no balance before that. Lines are kept per posted account, so the
+    // balance of a parent account is the sum of its sub-accounts.
+    //
+    // Build() loads DinhKhoan on Balances.BuildThreads threads, each reading
+    // a slice of IDs through its own read view; only views at the same
+    // ChangeLog position are used, so the slices come from one state.
+    // Refresh() applies lines posted since and voids from the ChangeLog,
+    // reading through a read view so the writer is never blocked. Other
+    // edits of posted documents are not tracked: vouchers are corrected by
+    // voiding and re-entering them. A deleted voucher (period close) or a
+    // gap in the ChangeLog rebuilds the index. Queries take a shared lock.
+    class BalanceIndex {
+    public:
+        BalanceIndex(DatabaseManager& database, Config& config, CodeDictionary& codes);
+        ~BalanceIndex() = default;
+
+        // Non-copyable
+        BalanceIndex(const BalanceIndex&) = delete;
+        BalanceIndex& operator=(const BalanceIndex&) = delete;
+
+        bool Build();
+        // Applies changes committed since the last Build() or Refresh();
+        // builds the index if it has not been built
+        bool Refresh();
+
+        // Opening balance plus movement up to and including asOf. False if
+        // asOf is before the opening balances or the index is not built.
+        bool GetBalance(std::string_view soTK, DayNumber asOf, AccountMovement& balance) const;
+        bool GetBalance(uint32_t account, DayNumber asOf, AccountMovement& balance) const;
+
+        // Movement over [from, to]. False if from is before the first open
+        // year or the index is not built.
+        bool GetMovement(std::string_view soTK, DayNumber from, DayNumber to, AccountMovement& movement) const;
+        bool GetMovement(uint32_t account, DayNumber from, DayNumber to, AccountMovement& movement) const;
+
+        // First day of the first open year; INT32_MIN without opening balances
+        DayNumber GetOpeningDay() const;
+
+    private:
+        static const DayNumber kNoDay = INT32_MIN;
+
+        // One DinhKhoan line; kNotFound for the missing side of a compound entry
+        struct Line {
+            uint32_t debit;
+            uint32_t credit;
+            DayNumber day;
+            int64_t amount;     // Money units, negated to reverse a void
+        };
+
+        // Fenwick trees, 1-based, position p = day baseDay_ + p - 1.
+        // Empty for accounts without lines.
+        struct Tree {
+            std::vector<int64_t> debit;
+            std::vector<int64_t> credit;
+        };
+
+        // State a build produces, swapped in whole
+        struct State {
+            std::vector<Tree> trees;                // by CodeKind::Account id
+            std::vector<AccountMovement> opening;   // by CodeKind::Account id
+            DayNumber baseDay = 0;
+            size_t capacity = 0;                    // days covered, a power of two
+            DayNumber openingDay = kNoDay;
+        };
+
+        DatabaseManager& database_;
+        Config& config_;
+        CodeDictionary& codes_;
+
+        mutable std::shared_mutex mutex_;
+        std::mutex refreshMutex_;
+
+        State state_;
+        bool built_;
+        int64_t highWater_;     // last DinhKhoan ID applied
+        int64_t changeSeq_;     // ChangeLog position applied
+        ChangeCursor cursor_;   // changeSeq_, published to ChangeFeed::Purge()
+
+        bool Rebuild();
+        bool ReadLines(ReadView& view, int64_t firstId, int64_t lastId, std::vector<Line>& lines);
+        void Apply(const std::vector<Line>& lines);
+        void Cover(DayNumber first, DayNumber last);
+
+        static void Add(std::vector<int64_t>& tree, size_t position, int64_t value);
+        static int64_t Prefix(const std::vector<int64_t>& tree, size_t position);
+        // In-place conversion between per-day values and a Fenwick tree
+        static void ToTree(std::vector<int64_t>& values);
+        static void ToValues(std::vector<int64_t>& tree);
+        // Positions up to and including day, clamped to [0, capacity]
+        static size_t Position(const State& state, DayNumber day);
+        static size_t CapacityFor(size_t days);
+    };
+
+} // namespace KeToanApp
@@ -0,0 +1,621 @@
+#include "BatchPrintService.h"
+#include "../Utils/Logger.h"
+#include "../Utils/StringHelper.h"
+#include "../Utils/Trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+namespace KeToanApp {
+
+    namespace {
+
+        const char kCheckpointFile[] = "batch.checkpoint";
+
+        // A5 portrait vouchers; 363 pt between the margins
+        const char* const kPhieuNhapTemplate =
+            "[Report]\n"
+            "Title=Phiếu nhập kho {1}\n"
+            "Query=SELECT p.SoPhieu AS SoPhieu, p.NgayNhap AS NgayNhap, p.NhaCungCap AS NhaCungCap,\n"
+            "Query=p.GhiChu AS GhiChu, c.MaSP AS MaSP, s.TenSP AS TenSP, s.DonViTinh AS DonViTinh,\n"
+            "Query=c.SoLuong AS SoLuong, c.DonGia AS DonGia, c.ThanhTien AS ThanhTien\n"
+            "Query=FROM PhieuNhap p LEFT JOIN ChiTietPhieuNhap c ON c.SoPhieu = p.SoPhieu\n"
+            "Query=LEFT JOIN SanPham s ON s.MaSP = c.MaSP\n"
+            "Query=WHERE p.SoPhieu BETWEEN ?1 AND ?2 ORDER BY p.SoPhieu, c.ID\n"
+            "DocumentKey=SoPhieu\n"
+            "PageSize=419.53 595.28\n"
+            "FontSize=8\n"
+            "\n"
+            "[ReportHeader]\n"
+            "Height=76\n"
+            "Label=0 363 center bold size=13 top=0 | PHIẾU NHẬP KHO\n"
+            "Label=0 363 center top=18 | Số: {1}\n"
+            "Label=0 80 top=36 | Ngày nhập:\n"
+            "Field=80 283 NgayNhap date top=36\n"
+            "Label=0 80 top=48 | Nhà cung cấp:\n"
+            "Field=80 283 NhaCungCap top=48\n"
+            "Label=0 80 top=60 | Ghi chú:\n"
+            "Field=80 283 GhiChu top=60\n"
+            "\n"
+            "[PageHeader]\n"
+            "Height=16\n"
+            "Rules=above below\n"
+            "Label=0 50 bold | Mã hàng\n"
+            "Label=50 118 bold | Tên hàng\n"
+            "Label=168 30 center bold | ĐVT\n"
+            "Label=198 45 right bold | Số lượng\n"
+            "Label=243 55 right bold | Đơn giá\n"
+            "Label=298 65 right bold | Thành tiền\n"
+            "\n"
+            "[Detail]\n"
+            "Height=13\n"
+            "Field=0 50 MaSP\n"
+            "Field=50 118 TenSP\n"
+            "Field=168 30 DonViTinh center\n"
+            "Field=198 45 SoLuong number right\n"
+            "Field=243 55 DonGia money right\n"
+            "Field=298 65 ThanhTien money right\n"
+            "\n"
+            "[PageFooter]\n"
+            "Height=14\n"
+            "Label=0 363 right | Trang {page}\n"
+            "\n"
+            "[ReportFooter]\n"
+            "Height=80\n"
+            "Rules=above\n"
+            "Label=168 75 bold top=3 | Cộng\n"
+            "Sum=298 65 ThanhTien top=3\n"
+            "Label=0 121 center bold top=30 | Người lập phiếu\n"
+            "Label=121 121 center bold top=30 | Người giao hàng\n"
+            "Label=242 121 center bold top=30 | Thủ kho\n"
+            "Label=0 121 center top=42 | (Ký, họ tên)\n"
+            "Label=121 121 center top=42 | (Ký, họ tên)\n"
+            "Label=242 121 center top=42 | (Ký, họ tên)\n";
+
+        const char* const kPhieuXuatTemplate =
+            "[Report]\n"
+            "Title=Phiếu xuất kho {1}\n"
+            "Query=SELECT p.SoPhieu AS SoPhieu, p.NgayXuat AS NgayXuat, p.KhachHang AS KhachHang,\n"
+            "Query=p.GhiChu AS GhiChu, c.MaSP AS MaSP, s.TenSP AS TenSP, s.DonViTinh AS DonViTinh,\n"
+            "Query=c.SoLuong AS SoLuong, c.DonGia AS DonGia, c.ThanhTien AS ThanhTien\n"
+            "Query=FROM PhieuXuat p LEFT JOIN ChiTietPhieuXuat c ON c.SoPhieu = p.SoPhieu\n"
+            "Query=LEFT JOIN SanPham s ON s.MaSP = c.MaSP\n"
+            "Query=WHERE p.SoPhieu BETWEEN ?1 AND ?2 ORDER BY p.SoPhieu, c.ID\n"
+            "DocumentKey=SoPhieu\n"
+            "PageSize=419.53 595.28\n"
+            "FontSize=8\n"
+            "\n"
+            "[ReportHeader]\n"
+            "Height=76\n"
+            "Label=0 363 center bold size=13 top=0 | PHIẾU XUẤT KHO\n"
+            "Label=0 363 center top=18 | Số: {1}\n"
+            "Label=0 80 top=36 | Ngày xuất:\n"
+            "Field=80 283 NgayXuat date top=36\n"
+            "Label=0 80 top=48 | Khách hàng:\n"
+            "Field=80 283 KhachHang top=48\n"
+            "Label=0 80 top=60 | Ghi chú:\n"
+            "Field=80 283 GhiChu top=60\n"
+            "\n"
+            "[PageHeader]\n"
+            "Height=16\n"
+            "Rules=above below\n"
+            "Label=0 50 bold | Mã hàng\n"
+            "Label=50 118 bold | Tên hàng\n"
+            "Label=168 30 center bold | ĐVT\n"
+            "Label=198 45 right bold | Số lượng\n"
+            "Label=243 55 right bold | Đơn giá\n"
+            "Label=298 65 right bold | Thành tiền\n"
+            "\n"
+            "[Detail]\n"
+            "Height=13\n"
+            "Field=0 50 MaSP\n"
+            "Field=50 118 TenSP\n"
+            "Field=168 30 DonViTinh center\n"
+            "Field=198 45 SoLuong number right\n"
+            "Field=243 55 DonGia money right\n"
+            "Field=298 65 ThanhTien money right\n"
+            "\n"
+            "[PageFooter]\n"
+            "Height=14\n"
+            "Label=0 363 right | Trang {page}\n"
+            "\n"
+            "[ReportFooter]\n"
+            "Height=80\n"
+            "Rules=above\n"
+            "Label=168 75 bold top=3 | Cộng\n"
+            "Sum=298 65 ThanhTien top=3\n"
+            "Label=0 121 center bold top=30 | Người lập phiếu\n"
+            "Label=121 121 center bold top=30 | Người nhận hàng\n"
+            "Label=242 121 center bold top=30 | Thủ kho\n"
+            "Label=0 121 center top=42 | (Ký, họ tên)\n"
+            "Label=121 121 center top=42 | (Ký, họ tên)\n"
+            "Label=242 121 center top=42 | (Ký, họ tên)\n";
+
+        const char* const kChungTuTemplate =
+            "[Report]\n"
+            "Title=Chứng từ kế toán {1}\n"
+            "Query=SELECT c.SoCT AS SoCT, c.NgayCT AS NgayCT, c.LoaiCT AS LoaiCT, c.DienGiai AS NoiDung,\n"
+            "Query=COALESCE(d.DienGiai, c.DienGiai) AS DienGiai, d.TKNo AS TKNo, d.TKCo AS TKCo, d.SoTien AS SoTien\n"
+            "Query=FROM ChungTuKeToan c LEFT JOIN DinhKhoan d ON d.SoCT = c.SoCT\n"
+            "Query=WHERE c.SoCT BETWEEN ?1 AND ?2 ORDER BY c.SoCT, d.STT, d.ID\n"
+            "DocumentKey=SoCT\n"
+            "PageSize=419.53 595.28\n"
+            "FontSize=8\n"
+            "\n"
+            "[ReportHeader]\n"
+            "Height=76\n"
+            "Label=0 363 center bold size=13 top=0 | CHỨNG TỪ KẾ TOÁN\n"
+            "Label=0 363 center top=18 | Số: {1}\n"
+            "Label=0 80 top=36 | Ngày:\n"
+            "Field=80 283 NgayCT date top=36\n"
+            "Label=0 80 top=48 | Loại chứng từ:\n"
+            "Field=80 283 LoaiCT top=48\n"
+            "Label=0 80 top=60 | Nội dung:\n"
+            "Field=80 283 NoiDung top=60\n"
+            "\n"
+            "[PageHeader]\n"
+            "Height=16\n"
+            "Rules=above below\n"
+            "Label=0 208 bold | Diễn giải\n"
+            "Label=208 45 center bold | TK Nợ\n"
+            "Label=253 45 center bold | TK Có\n"
+            "Label=298 65 right bold | Số tiền\n"
+            "\n"
+            "[Detail]\n"
+            "Height=13\n"
+            "Field=0 208 DienGiai\n"
+            "Field=208 45 TKNo center\n"
+            "Field=253 45 TKCo center\n"
+            "Field=298 65 SoTien money right\n"
+            "\n"
+            "[PageFooter]\n"
+            "Height=14\n"
+            "Label=0 363 right | Trang {page}\n"
+            "\n"
+            "[ReportFooter]\n"
+            "Height=80\n"
+            "Rules=above\n"
+            "Label=208 90 bold top=3 | Cộng\n"
+            "Sum=298 65 SoTien top=3\n"
+            "Label=0 121 center bold top=30 | Người lập\n"
+            "Label=121 121 center bold top=30 | Kế toán trưởng\n"
+            "Label=242 121 center bold top=30 | Giám đốc\n"
+            "Label=0 121 center top=42 | (Ký, họ tên)\n"
+            "Label=121 121 center top=42 | (Ký, họ tên)\n"
+            "Label=242 121 center top=42 | (Ký, họ tên, đóng dấu)\n";
+
+        std::filesystem::path FsPath(const std::string& utf8) {
+            return std::filesystem::u8path(utf8);
+        }
+
+        // Document keys may hold characters Windows does not allow in names
+        std::string SafeFileName(const std::string& key) {
+            std::string name = key;
+            for (char& c : name) {
+                if (static_cast<unsigned char>(c) < 0x20 || std::strchr("\\/:*?\"<>|", c)) {
+                    c = '_';
+                }
+            }
+            return name;
+        }
+
+        // Writes through a .part file, so a file is either whole or absent
+        bool WriteFileAtomically(const std::filesystem::path& path, const std::string& data, std::string& error) {
+            std::filesystem::path partPath = path;
+            partPath += ".part";
+            {
+                std::ofstream out(partPath, std::ios::binary | std::ios::trunc);
+                out.write(data.data(), static_cast<std::streamsize>(data.size()));
+                if (!out) {
+                    error = "Cannot write " + partPath.u8string();
+                    return false;
+                }
+            }
+            std::error_code ec;
+            std::filesystem::rename(partPath, path, ec);
+            if (ec) {
+                error = "Cannot rename " + partPath.u8string() + ": " + ec.message();
+                return false;
+            }
+            return true;
+        }
+
+        struct Checkpoint {
+            std::string job;        // hash of template and selection
+            int64_t done;
+            std::string last;       // key of the last document written
+        };
+
+        bool ReadCheckpoint(const std::filesystem::path& path, Checkpoint& checkpoint) {
+            std::ifstream in(path, std::ios::binary);
+            if (!in) {
+                return false;
+            }
+            checkpoint = Checkpoint{ std::string(), -1, std::string() };
+            std::string line;
+            while (std::getline(in, line)) {
+                size_t equals = line.find('=');
+                if (equals == std::string::npos) {
+                    continue;
+                }
+                std::string key = line.substr(0, equals);
+                std::string value = line.substr(equals + 1);
+                if (key == "job") checkpoint.job = value;
+                else if (key == "done") checkpoint.done = std::atoll(value.c_str());
+                else if (key == "last") checkpoint.last = value;
+            }
+            return !checkpoint.job.empty() && checkpoint.done >= 0;
+        }
+
+        bool WriteCheckpoint(const std::filesystem::path& path, const Checkpoint& checkpoint, std::string& error) {
+            return WriteFileAtomically(path, "job=" + checkpoint.job + "\ndone=" + std::to_string(checkpoint.done)
+                + "\nlast=" + checkpoint.last + "\n", error);
+        }
+
+    } // namespace
+
+    BatchPrintJob BatchPrintJob::ForDocuments(BatchDocumentType type, const std::string& fromDate,
+        const std::string& toDate, const std::string& outputDirectory) {
+        BatchPrintJob job;
+        switch (type) {
+        case BatchDocumentType::PhieuNhap:
+            job.templateText = kPhieuNhapTemplate;
+            job.selectionQuery = "SELECT SoPhieu FROM PhieuNhap WHERE daynum(NgayNhap) BETWEEN daynum(?1) AND daynum(?2) "
+                "AND COALESCE(TrangThai, 1) <> 2 ORDER BY SoPhieu";
+            job.fileNamePrefix = "PN_";
+            break;
+        case BatchDocumentType::PhieuXuat:
+            job.templateText = kPhieuXuatTemplate;
+            job.selectionQuery = "SELECT SoPhieu FROM PhieuXuat WHERE daynum(NgayXuat) BETWEEN daynum(?1) AND daynum(?2) "
+                "AND COALESCE(TrangThai, 1) <> 2 ORDER BY SoPhieu";
+            job.fileNamePrefix = "PX_";
+            break;
+        case BatchDocumentType::ChungTuKeToan:
+            job.templateText = kChungTuTemplate;
+            job.selectionQuery = "SELECT SoCT FROM ChungTuKeToan WHERE daynum(NgayCT) BETWEEN daynum(?1) AND daynum(?2) "
+                "AND COALESCE(TrangThai, 1) <> 2 ORDER BY SoCT";
+            job.fileNamePrefix = "CT_";
+            break;
+        }
+        // 1900-01-01 is the earliest date daynum() reads
+        job.parameters = { fromDate.empty() ? "1900-01-01" : fromDate, toDate.empty() ? "9999-12-31" : toDate };
+        job.outputDirectory = outputDirectory;
+        return job;
+    }
+
+    BatchPrintService::BatchPrintService(DatabaseManager& database, Config& config, ReportExportService& reports)
+        : database_(database)
+        , config_(config)
+        , reports_(reports)
+        , cancelled_(false)
+        , inFlight_(0)
+        , capacity_(0)
+        , fetchDone_(false)
+        , stopping_(false)
+    {
+        config_.DeclareInt("Reports.PrintThreads", 0, 0, 64);
+        config_.DeclareInt("Reports.PrintChunkSize", 200, 1, 10000);
+        config_.DeclareInt("Reports.PrintQueueDocuments", 64, 1, 10000);
+    }
+
+    void BatchPrintService::Cancel() {
+        cancelled_ = true;
+        std::lock_guard<std::mutex> lock(mutex_);
+        changed_.notify_all();
+    }
+
+    BatchPrintResult BatchPrintService::Run(const BatchPrintJob& job, ProgressCallback progress) {
+        KETOAN_TRACE_SPAN(span, "report", "BatchPrint");
+        BatchPrintResult result;
+        auto started = std::chrono::steady_clock::now();
+        cancelled_ = false;
+
+        std::shared_ptr<const ReportPlanCache::Entry> entry = reports_.PrepareTemplate(job.templateText, result.error);
+        if (!entry) {
+            return result;
+        }
+        if (entry->definition.documentKey.empty()) {
+            result.error = "Batch templates need a DocumentKey";
+            return result;
+        }
+
+        // Keys are a few bytes per document, so all are read up front
+        std::vector<std::string> keys;
+        {
+            KETOAN_TRACE_SCOPE("report", "SelectDocuments");
+            std::unique_ptr<ReadView> view = database_.OpenReadView();
+            if (!view) {
+                result.error = "No read view available";
+                return result;
+            }
+            try {
+                auto stmt = view->Prepare(job.selectionQuery);
+                for (size_t i = 0; i < job.parameters.size(); ++i) {
+                    stmt->BindText(static_cast<int>(i) + 1, job.parameters[i]);
+                }
+                while (stmt->Step()) {
+                    keys.push_back(stmt->ColumnText(0));
+                }
+            }
+            catch (const KeToanException& e) {
+                result.error = e.what();
+                Logger::Error("Batch print selection failed: %s", e.what());
+                return result;
+            }
+        }
+
+        std::error_code ec;
+        std::filesystem::create_directories(FsPath(job.outputDirectory), ec);
+        const std::filesystem::path checkpointPath = FsPath(job.outputDirectory) / kCheckpointFile;
+
+        // The checkpoint only applies to the same template and selection
+        Checkpoint checkpoint;
+        char jobId[24];
+        sprintf_s(jobId, "%016llx", static_cast<unsigned long long>(ReportPlanCache::Key(job.templateText,
+            job.selectionQuery, StringHelper::Join(job.parameters, "\x1F"))));
+        size_t first = 0;
+        Checkpoint saved;
+        if (job.resume && ReadCheckpoint(checkpointPath, saved) && saved.job == jobId) {
+            if (saved.done <= static_cast<int64_t>(keys.size())
+                && (saved.done == 0 || keys[static_cast<size_t>(saved.done) - 1] == saved.last)) {
+                first = static_cast<size_t>(saved.done);
+                Logger::Info("Resuming batch print in %s after %lld documents",
+                    job.outputDirectory.c_str(), static_cast<long long>(saved.done));
+            } else {
+                Logger::Warning("Batch print checkpoint in %s no longer matches the data; starting over",
+                    job.outputDirectory.c_str());
+            }
+        }
+        checkpoint.job = jobId;
+        checkpoint.done = static_cast<int64_t>(first);
+        checkpoint.last = first > 0 ? keys[first - 1] : std::string();
+        result.resumed = static_cast<int64_t>(first);
+
+        pending_.clear();
+        rendered_.clear();
+        inFlight_ = 0;
+        capacity_ = static_cast<size_t>(config_.GetInt("Reports.PrintQueueDocuments"));
+        fetchDone_ = false;
+        stopping_ = false;
+        fetchError_.clear();
+
+        size_t threads = static_cast<size_t>(config_.GetInt("Reports.PrintThreads"));
+        if (threads == 0) {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        const ReportFormat format = reports_.GetReportFormat();
+
+        std::thread fetcher(&BatchPrintService::Fetch, this, std::cref(*entry), std::cref(keys), first);
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < threads; ++i) {
+            workers.emplace_back(&BatchPrintService::RenderWorker, this, std::cref(*entry), std::cref(format));
+        }
+
+        // Write stage: documents in sequence, whatever order they finish in
+        int64_t next = static_cast<int64_t>(first);
+        while (true) {
+            Rendered document;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                changed_.wait(lock, [&] {
+                    return rendered_.count(next) > 0 || (fetchDone_ && inFlight_ == rendered_.size());
+                });
+                auto it = rendered_.find(next);
+                if (it == rendered_.end()) {
+                    break;
+                }
+                document = std::move(it->second);
+                rendered_.erase(it);
+            }
+
+            std::string error = document.error;
+            if (error.empty()) {
+                KETOAN_TRACE_SCOPE("report", "WriteDocument");
+                const std::filesystem::path path = FsPath(job.outputDirectory)
+                    / FsPath(job.fileNamePrefix + SafeFileName(document.key) + ".pdf");
+                checkpoint.done = next + 1;
+                checkpoint.last = document.key;
+                if (WriteFileAtomically(path, document.pdf, error) && WriteCheckpoint(checkpointPath, checkpoint, error)) {
+                    ++result.documents;
+                    result.pages += document.pages;
+                    result.bytes += static_cast<int64_t>(document.pdf.size());
+                }
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                --inFlight_;
+                if (!error.empty()) {
+                    result.error = "Document " + document.key + ": " + error;
+                    stopping_ = true;
+                }
+                changed_.notify_all();
+            }
+            if (!error.empty()) {
+                Logger::Error("Batch print stopped: %s", result.error.c_str());
+                continue;       // drain what the workers still hold
+            }
+            ++next;
+            if (progress) {
+                progress(next, static_cast<int64_t>(keys.size()));
+            }
+        }
+
+        fetcher.join();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+
+        if (result.error.empty() && !fetchError_.empty()) {
+            result.error = fetchError_;
+        }
+        result.cancelled = cancelled_ && result.error.empty();
+        result.success = result.error.empty() && !result.cancelled && next == static_cast<int64_t>(keys.size());
+        if (result.success) {
+            // Finished; a new run of the same job starts from the beginning
+            std::filesystem::remove(checkpointPath, ec);
+        }
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        KETOAN_TRACE_ARG(span, "documents", result.documents);
+
+        Logger::Info("Batch print to %s: %lld documents, %lld pages in %.2f s with %zu workers (%.0f documents/s)%s",
+            job.outputDirectory.c_str(), static_cast<long long>(result.documents), static_cast<long long>(result.pages),
+            result.seconds, threads, result.seconds > 0.0 ? result.documents / result.seconds : 0.0,
+            result.cancelled ? ", cancelled" : "");
+        return result;
+    }
+
+    void BatchPrintService::Fetch(const ReportPlanCache::Entry& entry, const std::vector<std::string>& keys, size_t first) {
+        Trace::SetThreadName("BatchPrint fetch");
+        const size_t chunkSize = static_cast<size_t>(config_.GetInt("Reports.PrintChunkSize"));
+        std::string error;
+
+        try {
+            for (size_t begin = first; begin < keys.size() && !IsStopping(); begin += chunkSize) {
+                const size_t end = std::min(keys.size(), begin + chunkSize);
+                KETOAN_TRACE_SPAN(chunkSpan, "report", "FetchChunk");
+                KETOAN_TRACE_ARG(chunkSpan, "documents", end - begin);
+
+                std::unique_ptr<ReadView> view = database_.OpenReadView();
+                if (!view) {
+                    throw DatabaseException("No read view available");
+                }
+                auto stmt = view->Prepare(entry.definition.query);
+                const int columns = stmt->ColumnCount();
+                int keyColumn = -1;
+                for (int c = 0; c < columns; ++c) {
+                    if (StringHelper::ToLower(stmt->ColumnName(c)) == StringHelper::ToLower(entry.definition.documentKey)) {
+                        keyColumn = c;
+                    }
+                }
+                if (keyColumn < 0) {
+                    throw DatabaseException("The template query does not return " + entry.definition.documentKey);
+                }
+                stmt->BindText(1, keys[begin]);
+                stmt->BindText(2, keys[end - 1]);
+
+                // Rows come in key order; rows of keys not selected are skipped
+                size_t k = begin;
+                Document document{ static_cast<int64_t>(k), keys[k], ReportRowSet() };
+                document.rows.columnCount = columns;
+                while (stmt->Step()) {
+                    std::string_view key = stmt->ColumnTextView(keyColumn);
+                    while (k < end && keys[k] < key) {
+                        if (!Push(std::move(document))) {
+                            return;
+                        }
+                        ++k;
+                        document = Document{ static_cast<int64_t>(k), k < end ? keys[k] : std::string(), ReportRowSet() };
+                        document.rows.columnCount = columns;
+                    }
+                    if (k < end && keys[k] == key) {
+                        size_t at = document.rows.values.size();
+                        document.rows.values.resize(at + columns);
+                        ReportRenderer::ReadRow(*stmt, &document.rows.values[at], columns);
+                    }
+                }
+                for (; k < end; ++k) {
+                    if (!Push(std::move(document))) {
+                        return;
+                    }
+                    document = Document{ static_cast<int64_t>(k + 1), k + 1 < end ? keys[k + 1] : std::string(), ReportRowSet() };
+                    document.rows.columnCount = columns;
+                }
+            }
+        }
+        catch (const KeToanException& e) {
+            error = e.what();
+            Logger::Error("Batch print fetch failed: %s", e.what());
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!error.empty()) {
+            fetchError_ = error;
+            stopping_ = true;
+        }
+        fetchDone_ = true;
+        changed_.notify_all();
+    }
+
+    bool BatchPrintService::Push(Document document) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        // Backpressure: wait until the writer has caught up
+        changed_.wait(lock, [&] { return inFlight_ < capacity_ || IsStopping(); });
+        if (IsStopping()) {
+            fetchDone_ = true;
+            changed_.notify_all();
+            return false;
+        }
+        pending_.push_back(std::move(document));
+        ++inFlight_;
+        changed_.notify_all();
+        return true;
+    }
+
+    void BatchPrintService::RenderWorker(const ReportPlanCache::Entry& entry, const ReportFormat& format) {
+        Trace::SetThreadName("BatchPrint render");
+        const int compressionLevel = static_cast<int>(config_.GetInt("Reports.PdfCompressionLevel"));
+
+        // Parsed once; each document's writer embeds the glyphs it used
+        ReportExportService::Fonts fonts;
+        std::string fontError;
+        const bool fontsOpen = reports_.OpenFonts(fonts, fontError);
+
+        while (true) {
+            Document document;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                changed_.wait(lock, [&] { return !pending_.empty() || fetchDone_ || IsStopping(); });
+                if (IsStopping()) {
+                    // Documents no worker has started are dropped; the
+                    // checkpoint still points before them
+                    inFlight_ -= pending_.size();
+                    pending_.clear();
+                    changed_.notify_all();
+                    return;
+                }
+                if (pending_.empty()) {
+                    return;
+                }
+                document = std::move(pending_.front());
+                pending_.pop_front();
+            }
+
+            KETOAN_TRACE_SCOPE("report", "RenderDocument");
+            Rendered rendered;
+            rendered.key = document.key;
+            rendered.pages = 0;
+
+            PdfWriter pdf;
+            int font = -1;
+            int boldFont = -1;
+            std::string title = StringHelper::ReplaceAll(entry.definition.title, "{1}", document.key);
+            if (!fontsOpen) {
+                rendered.error = fontError;
+            } else if (pdf.OpenBuffer(rendered.pdf, entry.definition.layout.pageWidth,
+                    entry.definition.layout.pageHeight, compressionLevel)) {
+                ReportExportService::AddFonts(pdf, fonts, font, boldFont);
+                pdf.SetTitle(title);
+                ReportRenderer renderer(pdf, entry.plan, format, font, boldFont);
+                if (!renderer.Render(document.rows, { document.key, document.key })) {
+                    rendered.error = "Report layout does not match the query";
+                }
+                if (!pdf.Close() && rendered.error.empty()) {
+                    rendered.error = "Rendering failed";
+                }
+                rendered.pages = pdf.GetPageCount();
+            } else if (rendered.error.empty()) {
+                rendered.error = "Rendering failed";
+            }
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            rendered_.emplace(document.sequence, std::move(rendered));
+            changed_.notify_all();
+        }
+    }
+
+} // namespace KeToanApp
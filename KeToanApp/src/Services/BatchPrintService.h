@@ -0,0 +1,127 @@
+#pragma once
+
+#include "KeToanApp/Common.h"
+#include "KeToanApp/Types.h"
+#include "ReportExportService.h"
+#include "../Core/Config.h"
+#include "../Database/DatabaseManager.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+
+namespace KeToanApp {
+
+    enum class BatchDocumentType {
+        PhieuNhap,
+        PhieuXuat,
+        ChungTuKeToan
+    };
+
+    struct BatchPrintJob {
+        std::string templateText;           // needs DocumentKey, see ReportTemplate
+        std::string selectionQuery;         // keys of the documents to print, in key order
+        std::vector<std::string> parameters;    // bound to the selection query
+        std::string outputDirectory;
+        std::string fileNamePrefix;
+        bool resume;                        // continue from the directory's checkpoint
+
+        BatchPrintJob() : resume(true) {}
+
+        // Non-voided documents of one type dated in [fromDate, toDate], with
+        // the built-in voucher templates. Dates are yyyy-mm-dd or dd/MM/yyyy
+        // and compare as day numbers, whichever form the rows were saved in.
+        static BatchPrintJob ForDocuments(BatchDocumentType type, const std::string& fromDate,
+            const std::string& toDate, const std::string& outputDirectory);
+    };
+
+    struct BatchPrintResult {
+        bool success;
+        bool cancelled;
+        int64_t documents;      // written by this run
+        int64_t resumed;        // already written by an earlier run
+        int64_t pages;
+        int64_t bytes;
+        double seconds;
+        std::string error;
+
+        BatchPrintResult()
+            : success(false), cancelled(false), documents(0), resumed(0)
+            , pages(0), bytes(0), seconds(0.0) {}
+    };
+
+    // Month-end batch printing: one PDF per document, in three stages.
+    //
+    //   fetch   one thread reads the documents with their lines,
+    //           Reports.PrintChunkSize documents per query, each chunk on a
+    //           fresh read view so WAL checkpoints are not held back
+    //   render  Reports.PrintThreads workers (0 = one per core) lay out
+    //           documents into in-memory PDFs with the template's cached plan
+    //   write   the calling thread writes documents in key order, each
+    //           through a .part file, and advances the checkpoint after
+    //           every file
+    //
+    // At most Reports.PrintQueueDocuments documents are between fetch and
+    // write at any time; fetching waits when the limit is reached, so
+    // memory stays bounded however far rendering or writing falls behind.
+    //
+    // The checkpoint (batch.checkpoint in the output directory) records the
+    // template and how many documents are done. A job that is cancelled,
+    // fails or is killed resumes after the last file written.
+    class BatchPrintService {
+    public:
+        // (documents written, documents selected)
+        using ProgressCallback = std::function<void(int64_t, int64_t)>;
+
+        BatchPrintService(DatabaseManager& database, Config& config, ReportExportService& reports);
+        ~BatchPrintService() = default;
+
+        // Non-copyable
+        BatchPrintService(const BatchPrintService&) = delete;
+        BatchPrintService& operator=(const BatchPrintService&) = delete;
+
+        BatchPrintResult Run(const BatchPrintJob& job, ProgressCallback progress = nullptr);
+
+        // Stops a running job after the documents already rendered are written
+        void Cancel();
+
+    private:
+        struct Document {
+            int64_t sequence;
+            std::string key;
+            ReportRowSet rows;
+        };
+
+        struct Rendered {
+            std::string key;
+            std::string pdf;
+            int pages;
+            std::string error;
+        };
+
+        DatabaseManager& database_;
+        Config& config_;
+        ReportExportService& reports_;
+        std::atomic<bool> cancelled_;
+
+        // Pipeline state, for the duration of Run()
+        std::mutex mutex_;
+        std::condition_variable changed_;
+        std::deque<Document> pending_;              // fetched, waiting for a worker
+        std::map<int64_t, Rendered> rendered_;      // waiting to be written in order
+        size_t inFlight_;                           // fetched and not yet written
+        size_t capacity_;
+        bool fetchDone_;
+        bool stopping_;
+        std::string fetchError_;
+
+        void Fetch(const ReportPlanCache::Entry& entry, const std::vector<std::string>& keys, size_t first);
+        bool Push(Document document);
+        void RenderWorker(const ReportPlanCache::Entry& entry, const ReportFormat& format);
+        bool IsStopping() const { return stopping_ || cancelled_; }
+    };
+
+} // namespace KeToanApp
@@ -0,0 +1,201 @@
+#include "CodeDictionary.h"
+#include "../Utils/Logger.h"
+
+namespace KeToanApp {
+
+    namespace {
+
+        // Codes every engine meets; seeded on Load() so their ids are
+        // assigned up front, in one transaction
+        const struct {
+            CodeKind kind;
+            const char* query;
+        } kMasterCodes[] = {
+            { CodeKind::Product, "SELECT MaSP FROM SanPham ORDER BY MaSP" },
+            { CodeKind::Account, "SELECT SoTK FROM TaiKhoanKeToan ORDER BY SoTK" },
+            { CodeKind::Counterparty,
+              "SELECT DISTINCT MaDoiTuong FROM CongNo WHERE MaDoiTuong IS NOT NULL ORDER BY MaDoiTuong" },
+            { CodeKind::Warehouse, "SELECT MaKho FROM Kho ORDER BY MaKho" },
+        };
+
+    } // namespace
+
+    CodeDictionary::CodeDictionary(DatabaseManager& database)
+        : database_(database)
+    {
+    }
+
+    uint32_t CodeDictionary::Add(Table& table, std::string_view code) {
+        const uint32_t id = static_cast<uint32_t>(table.codes.size());
+        table.codes.emplace_back(code);
+        table.index.emplace(table.codes.back(), id);
+        return id;
+    }
+
+    bool CodeDictionary::Load() {
+        std::unique_ptr<ReadView> view = database_.OpenReadView();
+        if (!view) {
+            Logger::Error("Code dictionary: no read view available");
+            return false;
+        }
+
+        {
+            std::unique_lock<std::shared_mutex> lock(mutex_);
+            try {
+                // Ids already known keep their codes; Load() only adds
+                auto stmt = view->Prepare("SELECT Kind, Id, Code FROM CodeDictionary ORDER BY Kind, Id");
+                while (stmt->Step()) {
+                    const int64_t kind = stmt->ColumnInt64(0);
+                    const int64_t id = stmt->ColumnInt64(1);
+                    if (kind < 0 || kind >= static_cast<int64_t>(kKinds) || id < 0 || id >= kNotFound) {
+                        Logger::Warning("Code dictionary: ignoring entry %lld/%lld",
+                            static_cast<long long>(kind), static_cast<long long>(id));
+                        continue;
+                    }
+
+                    Table& table = tables_[kind];
+                    if (static_cast<size_t>(id) < table.codes.size()) {
+                        continue;
+                    }
+                    // Ids are dense unless the table was edited by hand; a gap stays unused
+                    while (table.codes.size() < static_cast<size_t>(id)) {
+                        table.codes.emplace_back();
+                    }
+                    Add(table, stmt->ColumnTextView(2));
+                    table.saved = table.codes.size();
+                }
+
+                for (const auto& master : kMasterCodes) {
+                    Table& table = tables_[static_cast<size_t>(master.kind)];
+                    auto codes = view->Prepare(master.query);
+                    while (codes->Step()) {
+                        std::string_view code = codes->ColumnTextView(0);
+                        if (table.index.find(code) == table.index.end()) {
+                            Add(table, code);
+                        }
+                    }
+                }
+            }
+            catch (const DatabaseException& e) {
+                Logger::Error("Code dictionary: loading failed: %s", e.what());
+                return false;
+            }
+
+            Logger::Info("Code dictionary loaded: %zu products, %zu accounts, %zu counterparties, %zu warehouses",
+                tables_[0].codes.size(), tables_[1].codes.size(), tables_[2].codes.size(), tables_[3].codes.size());
+        }
+        view.reset();
+
+        return Save();
+    }
+
+    bool CodeDictionary::Save() {
+        std::lock_guard<std::mutex> saveLock(saveMutex_);
+
+        // Entries to write; codes never move, so the views outlive the lock
+        struct Entry {
+            CodeKind kind;
+            uint32_t id;
+            std::string_view code;
+        };
+        std::vector<Entry> entries;
+        size_t ends[kKinds];
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex_);
+            for (size_t kind = 0; kind < kKinds; ++kind) {
+                const Table& table = tables_[kind];
+                ends[kind] = table.codes.size();
+                for (size_t id = table.saved; id < ends[kind]; ++id) {
+                    entries.push_back({ static_cast<CodeKind>(kind), static_cast<uint32_t>(id), table.codes[id] });
+                }
+            }
+        }
+        if (entries.empty()) {
+            return true;
+        }
+
+        auto lock = database_.Lock();
+        Connection* connection = database_.GetConnection();
+        if (!connection) {
+            Logger::Error("Database not connected");
+            return false;
+        }
+        if (database_.InTransaction()) {
+            // Left for the next Save(); ids in memory are valid meanwhile
+            Logger::Warning("Code dictionary: not saved inside a transaction");
+            return false;
+        }
+
+        if (!database_.BeginTransaction()) {
+            return false;
+        }
+        try {
+            auto stmt = connection->Prepare("INSERT OR IGNORE INTO CodeDictionary (Kind, Id, Code) VALUES (?, ?, ?)");
+            for (const auto& entry : entries) {
+                stmt->BindInt64(1, static_cast<int64_t>(entry.kind))
+                    .BindInt64(2, entry.id)
+                    .BindText(3, entry.code);
+                stmt->Execute();
+                stmt->Reset();
+            }
+        }
+        catch (const DatabaseException& e) {
+            Logger::Error("Code dictionary: saving failed: %s", e.what());
+            database_.Rollback();
+            return false;
+        }
+        if (!database_.Commit()) {
+            if (database_.InTransaction()) {
+                database_.Rollback();
+            }
+            return false;
+        }
+
+        std::unique_lock<std::shared_mutex> tablesLock(mutex_);
+        for (size_t kind = 0; kind < kKinds; ++kind) {
+            tables_[kind].saved = ends[kind];
+        }
+        Logger::Debug("Code dictionary: saved %zu new codes", entries.size());
+        return true;
+    }
+
+    uint32_t CodeDictionary::Intern(CodeKind kind, std::string_view code) {
+        Table& table = tables_[static_cast<size_t>(kind)];
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex_);
+            auto it = table.index.find(code);
+            if (it != table.index.end()) {
+                return it->second;
+            }
+        }
+
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        auto it = table.index.find(code);
+        return it != table.index.end() ? it->second : Add(table, code);
+    }
+
+    uint32_t CodeDictionary::Find(CodeKind kind, std::string_view code) const {
+        const Table& table = tables_[static_cast<size_t>(kind)];
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        auto it = table.index.find(code);
+        return it != table.index.end() ? it->second : kNotFound;
+    }
+
+    std::string_view CodeDictionary::GetCode(CodeKind kind, uint32_t id) const {
+        const Table& table = tables_[static_cast<size_t>(kind)];
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        return id < table.codes.size() ? std::string_view(table.codes[id]) : std::string_view();
+    }
+
+    std::vector<std::string> CodeDictionary::GetCodes(CodeKind kind) const {
+        const Table& table = tables_[static_cast<size_t>(kind)];
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        return std::vector<std::string>(table.codes.begin(), table.codes.end());
+    }
+
+    size_t CodeDictionary::GetCount(CodeKind kind) const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        return tables_[static_cast<size_t>(kind)].codes.size();
+    }
+
+} // namespace KeToanApp
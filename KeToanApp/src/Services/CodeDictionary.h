@@ -0,0 +1,78 @@
+#pragma once
+
+#include "KeToanApp/Common.h"
+#include "KeToanApp/Types.h"
+#include "../Database/DatabaseManager.h"
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <string_view>
+#include <unordered_map>
+
+namespace KeToanApp {
+
+    enum class CodeKind : uint8_t {
+        Product = 0,        // SanPham.MaSP
+        Account = 1,        // TaiKhoanKeToan.SoTK
+        Counterparty = 2,   // CongNo.MaDoiTuong
+        Warehouse = 3       // Kho.MaKho
+    };
+
+    // Process-wide map from product, account, counterparty and warehouse
+    // codes to dense uint32 ids, one id space per kind.
+    //
+    // In-memory engines hold ids instead of code strings: columns shrink to
+    // four bytes a row, comparisons and grouping are integer operations and
+    // an id indexes plain arrays. Ids are persisted in the CodeDictionary
+    // table and never reused, so they are the same in every run and in
+    // every engine; a renamed code gets a new id.
+    //
+    // Load() reads the table and interns any master-data code it lacks.
+    // Intern() assigns ids to codes first seen at run time; Save() writes
+    // those out. Lookups take a shared lock, assigning an id an exclusive one.
+    class CodeDictionary {
+    public:
+        static const uint32_t kNotFound = UINT32_MAX;
+
+        explicit CodeDictionary(DatabaseManager& database);
+        ~CodeDictionary() = default;
+
+        // Non-copyable
+        CodeDictionary(const CodeDictionary&) = delete;
+        CodeDictionary& operator=(const CodeDictionary&) = delete;
+
+        bool Load();
+        // Persists ids assigned since the last Load() or Save()
+        bool Save();
+
+        // Id of code, assigned if new
+        uint32_t Intern(CodeKind kind, std::string_view code);
+        // kNotFound if the code has no id
+        uint32_t Find(CodeKind kind, std::string_view code) const;
+
+        // Stays valid for the life of the dictionary
+        std::string_view GetCode(CodeKind kind, uint32_t id) const;
+        // Codes by id, e.g. as pivot labels
+        std::vector<std::string> GetCodes(CodeKind kind) const;
+        size_t GetCount(CodeKind kind) const;
+
+    private:
+        static const size_t kKinds = 4;
+
+        struct Table {
+            std::deque<std::string> codes;      // by id; a deque keeps the index keys in place
+            std::unordered_map<std::string_view, uint32_t> index;
+            size_t saved = 0;                   // ids below this are in the database
+        };
+
+        DatabaseManager& database_;
+
+        mutable std::shared_mutex mutex_;
+        Table tables_[kKinds];
+        std::mutex saveMutex_;
+
+        uint32_t Add(Table& table, std::string_view code);
+    };
+
+} // namespace KeToanApp
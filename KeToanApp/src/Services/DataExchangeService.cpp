@@ -0,0 +1,472 @@
+#include "DataExchangeService.h"
+#include "../Database/BulkInserter.h"
+#include "../Utils/DateTimeHelper.h"
+#include "../Utils/Logger.h"
+#include "../Utils/Trace.h"
+#include <chrono>
+#include <unordered_set>
+
+namespace KeToanApp {
+
+    namespace {
+
+        using Type = ExchangeColumnType;
+
+        struct ExchangeColumn {
+            const char* name;
+            Type type;
+        };
+
+        enum class TableGroup { Products, Vouchers, Stock };
+
+        struct ExchangeTable {
+            uint16_t id;                // stored in the file; never renumber
+            const char* name;
+            TableGroup group;
+            std::vector<ExchangeColumn> columns;
+            int keyColumn;              // document/product key, -1 for lines
+            uint16_t parentId;          // lines: table of the owning document
+            int parentColumn;
+            std::string filter;         // ?1/?2 = date range, compared as day numbers
+        };
+
+        // Parents before their lines, so foreign keys hold during import
+        const std::vector<ExchangeTable>& ExchangeTables() {
+            static const std::vector<ExchangeTable> tables = {
+                { 1, "SanPham", TableGroup::Products,
+                  { { "MaSP", Type::Text }, { "TenSP", Type::Text }, { "DonViTinh", Type::Code },
+                    { "GiaMua", Type::Fixed }, { "GiaBan", Type::Fixed }, { "MoTa", Type::Text },
+                    { "NhomHang", Type::Code }, { "TrangThai", Type::Int } },
+                  0, 0, -1, "1" },
+                { 2, "ChungTuKeToan", TableGroup::Vouchers,
+                  { { "SoCT", Type::Text }, { "NgayCT", Type::Day }, { "LoaiCT", Type::Code },
+                    { "DienGiai", Type::Text }, { "NguoiLap", Type::Code }, { "TrangThai", Type::Int } },
+                  0, 0, -1, "daynum(NgayCT) BETWEEN daynum(?1) AND daynum(?2)" },
+                { 3, "DinhKhoan", TableGroup::Vouchers,
+                  { { "SoCT", Type::Code }, { "STT", Type::Int }, { "TKNo", Type::Code },
+                    { "TKCo", Type::Code }, { "SoTien", Type::Fixed }, { "DienGiai", Type::Text } },
+                  -1, 2, 0, "SoCT IN (SELECT SoCT FROM ChungTuKeToan WHERE daynum(NgayCT) BETWEEN daynum(?1) AND daynum(?2))" },
+                { 4, "PhieuNhap", TableGroup::Stock,
+                  { { "SoPhieu", Type::Text }, { "NgayNhap", Type::Day }, { "NhaCungCap", Type::Code },
+                    { "NguoiNhap", Type::Code }, { "TongTien", Type::Fixed }, { "GhiChu", Type::Text },
+                    { "TrangThai", Type::Int } },
+                  0, 0, -1, "daynum(NgayNhap) BETWEEN daynum(?1) AND daynum(?2)" },
+                { 5, "ChiTietPhieuNhap", TableGroup::Stock,
+                  { { "SoPhieu", Type::Code }, { "MaSP", Type::Code }, { "SoLuong", Type::Fixed },
+                    { "DonGia", Type::Fixed }, { "ThanhTien", Type::Fixed } },
+                  -1, 4, 0, "SoPhieu IN (SELECT SoPhieu FROM PhieuNhap WHERE daynum(NgayNhap) BETWEEN daynum(?1) AND daynum(?2))" },
+                { 6, "PhieuXuat", TableGroup::Stock,
+                  { { "SoPhieu", Type::Text }, { "NgayXuat", Type::Day }, { "KhachHang", Type::Code },
+                    { "NguoiXuat", Type::Code }, { "TongTien", Type::Fixed }, { "GhiChu", Type::Text },
+                    { "TrangThai", Type::Int } },
+                  0, 0, -1, "daynum(NgayXuat) BETWEEN daynum(?1) AND daynum(?2)" },
+                { 7, "ChiTietPhieuXuat", TableGroup::Stock,
+                  { { "SoPhieu", Type::Code }, { "MaSP", Type::Code }, { "SoLuong", Type::Fixed },
+                    { "DonGia", Type::Fixed }, { "ThanhTien", Type::Fixed } },
+                  -1, 6, 0, "SoPhieu IN (SELECT SoPhieu FROM PhieuXuat WHERE daynum(NgayXuat) BETWEEN daynum(?1) AND daynum(?2))" },
+            };
+            return tables;
+        }
+
+        const ExchangeTable* FindTable(uint16_t id) {
+            for (const auto& table : ExchangeTables()) {
+                if (table.id == id) {
+                    return &table;
+                }
+            }
+            return nullptr;
+        }
+
+        bool Included(const ExchangeTable& table, const ExchangeOptions& options) {
+            switch (table.group) {
+            case TableGroup::Products: return options.products;
+            case TableGroup::Vouchers: return options.vouchers;
+            case TableGroup::Stock:    return options.stock;
+            }
+            return false;
+        }
+
+        // Table definition of a block read from path; throws if the file's
+        // columns do not match it
+        const ExchangeTable& TableOf(const ExchangeBlock& block, const std::string& path) {
+            const ExchangeTable* table = FindTable(block.GetTableId());
+            if (!table || table->columns.size() != block.GetColumnCount()) {
+                throw DatabaseException("Unknown table " + std::to_string(block.GetTableId()) + " in " + path);
+            }
+            for (size_t c = 0; c < block.GetColumnCount(); ++c) {
+                if (block.GetType(c) != table->columns[c].type) {
+                    throw DatabaseException(std::string("Column types of ") + table->name + " do not match");
+                }
+            }
+            return *table;
+        }
+
+        // Header tables of the documents ValidationService checks
+        bool DocumentTypeOf(const ExchangeTable& table, DocumentType& type) {
+            switch (table.id) {
+            case 2: type = DocumentType::ChungTuKeToan; return true;
+            case 4: type = DocumentType::PhieuNhap; return true;
+            case 6: type = DocumentType::PhieuXuat; return true;
+            }
+            return false;
+        }
+
+        std::string_view CodeOrEmpty(const ExchangeBlock& block, size_t column, uint32_t row) {
+            return block.IsNull(column, row) ? std::string_view() : block.Code(column, row);
+        }
+
+        int64_t UnitsOrZero(const ExchangeBlock& block, size_t column, uint32_t row) {
+            return block.IsNull(column, row) ? 0 : block.Int(column, row);
+        }
+
+        // Without a date range every row goes, and the lines' IN (subquery)
+        // filter would only cost a probe per line
+        std::string SelectSql(const ExchangeTable& table, bool bounded) {
+            std::string sql = "SELECT ";
+            for (size_t i = 0; i < table.columns.size(); ++i) {
+                sql += (i ? ", " : "") + std::string(table.columns[i].name);
+            }
+            return sql + " FROM " + table.name + " WHERE " + (bounded ? table.filter : "1") + " ORDER BY rowid";
+        }
+
+        std::string InsertSql(const ExchangeTable& table) {
+            std::string names;
+            std::string params;
+            for (size_t i = 0; i < table.columns.size(); ++i) {
+                names += (i ? ", " : "") + std::string(table.columns[i].name);
+                params += i ? ", ?" : "?";
+            }
+            return "INSERT OR IGNORE INTO " + std::string(table.name) + " (" + names + ") VALUES (" + params + ")";
+        }
+
+        void WriteValue(ExchangeWriter& writer, Statement& stmt, int column, Type type) {
+            if (stmt.ColumnIsNull(column)) {
+                writer.Null();
+                return;
+            }
+
+            switch (type) {
+            case Type::Int:
+                writer.Int(stmt.ColumnInt64(column));
+                break;
+            case Type::Fixed:
+                writer.Fixed(Money::FromDouble(stmt.ColumnDouble(column)).units);
+                break;
+            case Type::Day: {
+                std::string_view text = stmt.ColumnTextView(column);
+                DayNumber day;
+                if (DateTimeHelper::ParseDayNumber(text.data(), text.size(), day)) {
+                    writer.Day(day);
+                } else {
+                    writer.Null();
+                }
+                break;
+            }
+            case Type::Code:
+                writer.Code(stmt.ColumnTextView(column));
+                break;
+            case Type::Text:
+                writer.Text(stmt.ColumnTextView(column));
+                break;
+            }
+        }
+
+        void BindValue(Statement& stmt, int index, const ExchangeBlock& block, size_t column, uint32_t row) {
+            if (block.IsNull(column, row)) {
+                stmt.BindNull(index);
+                return;
+            }
+
+            switch (block.GetType(column)) {
+            case Type::Int:
+                stmt.BindInt64(index, block.Int(column, row));
+                break;
+            case Type::Fixed:
+                stmt.BindDouble(index, Money::FromUnits(block.Int(column, row)).ToDouble());
+                break;
+            case Type::Day: {
+                Date date = DateTimeHelper::FromDayNumber(block.Day(column, row));
+                char text[16];
+                sprintf_s(text, "%04d-%02d-%02d", date.year, date.month, date.day);
+                stmt.BindText(index, text);
+                break;
+            }
+            case Type::Code:
+                stmt.BindText(index, block.Code(column, row));
+                break;
+            case Type::Text:
+                stmt.BindText(index, block.Text(column, row));
+                break;
+            }
+        }
+
+    } // namespace
+
+    DataExchangeService::DataExchangeService(DatabaseManager& database, ValidationService* validation)
+        : database_(database)
+        , validation_(validation)
+    {
+    }
+
+    ExchangeResult DataExchangeService::Export(const std::string& path, const ExchangeOptions& options) {
+        KETOAN_TRACE_SPAN(exportSpan, "export", "Export");
+        ExchangeResult result;
+        auto started = std::chrono::steady_clock::now();
+
+        std::unique_ptr<ReadView> view = database_.OpenReadView();
+        if (!view) {
+            result.error = "No read view available";
+            return result;
+        }
+
+        ExchangeWriter writer;
+        if (!writer.Open(path)) {
+            result.error = "Cannot create " + path;
+            return result;
+        }
+
+        const bool bounded = !options.fromDate.empty() || !options.toDate.empty();
+        const std::string from = options.fromDate.empty() ? "1900-01-01" : options.fromDate;
+        const std::string to = options.toDate.empty() ? "9999-12-31" : options.toDate;
+
+        try {
+            for (const auto& table : ExchangeTables()) {
+                if (!Included(table, options)) {
+                    continue;
+                }
+
+                KETOAN_TRACE_SCOPE("export", table.name);
+                std::vector<Type> types;
+                for (const auto& column : table.columns) {
+                    types.push_back(column.type);
+                }
+                writer.BeginTable(table.id, types);
+
+                auto stmt = view->Prepare(SelectSql(table, bounded));
+                if (stmt->ParameterCount() >= 2) {
+                    stmt->BindText(1, from).BindText(2, to);
+                }
+
+                while (stmt->Step()) {
+                    for (size_t c = 0; c < types.size(); ++c) {
+                        WriteValue(writer, *stmt, static_cast<int>(c), types[c]);
+                    }
+                    if (!writer.EndRow()) {
+                        throw DatabaseException("Writing " + path + " failed");
+                    }
+                    ++result.rows;
+                }
+            }
+        }
+        catch (const KeToanException& e) {
+            result.error = e.what();
+            writer.Close();
+            Logger::Error("Export to %s failed: %s", path.c_str(), e.what());
+            return result;
+        }
+
+        result.success = writer.Close();
+        result.bytes = writer.GetBytesWritten();
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        if (!result.success) {
+            result.error = "Writing " + path + " failed";
+        }
+
+        KETOAN_TRACE_ARG(exportSpan, "rows", result.rows);
+        Logger::Info("Exported %lld rows to %s (%lld bytes, snapshot %s) in %.2f s",
+            static_cast<long long>(result.rows), path.c_str(), static_cast<long long>(result.bytes),
+            view->GetSnapshotId().c_str(), result.seconds);
+        return result;
+    }
+
+    ExchangeResult DataExchangeService::Import(const std::string& path) {
+        KETOAN_TRACE_SPAN(importSpan, "import", "Import");
+        ExchangeResult result;
+        auto started = std::chrono::steady_clock::now();
+
+        ExchangeReader reader;
+        if (!reader.Open(path)) {
+            result.error = reader.GetError();
+            return result;
+        }
+
+        if (validation_ && !ValidateFile(path, result)) {
+            Logger::Error("Import from %s rejected: %s", path.c_str(), result.error.c_str());
+            return result;
+        }
+
+        BulkInserter inserter(database_);
+        if (!inserter.Begin()) {
+            result.error = "Cannot start import transaction";
+            return result;
+        }
+
+        // Keys of documents that were already present, per table id
+        std::unordered_map<uint16_t, std::unordered_set<std::string>> existing;
+
+        try {
+            ExchangeBlock block;
+            while (reader.Next(block)) {
+                const ExchangeTable* table = &TableOf(block, path);
+                KETOAN_TRACE_SPAN(blockSpan, "import", table->name);
+                KETOAN_TRACE_ARG(blockSpan, "rows", block.GetRowCount());
+
+                const std::string sql = InsertSql(*table);
+                const std::unordered_set<std::string>* skippedParents = nullptr;
+                if (table->parentColumn >= 0) {
+                    auto it = existing.find(table->parentId);
+                    skippedParents = it != existing.end() ? &it->second : nullptr;
+                }
+
+                for (uint32_t row = 0; row < block.GetRowCount(); ++row) {
+                    if (skippedParents && skippedParents->count(
+                            std::string(block.Code(static_cast<size_t>(table->parentColumn), row)))) {
+                        ++result.skipped;
+                        continue;
+                    }
+
+                    Statement& stmt = inserter.Prepare(sql);
+                    for (size_t c = 0; c < block.GetColumnCount(); ++c) {
+                        BindValue(stmt, static_cast<int>(c) + 1, block, c, row);
+                    }
+
+                    if (inserter.Execute(stmt) == 0) {
+                        ++result.skipped;
+                        if (table->keyColumn >= 0) {
+                            existing[table->id].emplace(block.Text(static_cast<size_t>(table->keyColumn), row));
+                        }
+                    }
+                }
+            }
+        }
+        catch (const DatabaseException& e) {
+            result.error = e.what();
+        }
+
+        if (result.error.empty() && !reader.IsComplete()) {
+            result.error = reader.GetError();
+        }
+
+        if (!result.error.empty()) {
+            inserter.Rollback();
+            Logger::Error("Import from %s failed: %s", path.c_str(), result.error.c_str());
+            return result;
+        }
+
+        result.rows = inserter.GetRowsInserted();
+        if (!inserter.Commit()) {
+            result.error = "Commit failed";
+            return result;
+        }
+
+        result.success = true;
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        KETOAN_TRACE_ARG(importSpan, "rows", result.rows);
+        Logger::Info("Imported %lld rows from %s (%lld already present) in %.2f s",
+            static_cast<long long>(result.rows), path.c_str(), static_cast<long long>(result.skipped),
+            result.seconds);
+        return result;
+    }
+
+    bool DataExchangeService::ValidateFile(const std::string& path, ExchangeResult& result) {
+        KETOAN_TRACE_SCOPE("import", "Validate");
+        ExchangeReader reader;
+        if (!reader.Open(path)) {
+            result.error = reader.GetError();
+            return false;
+        }
+
+        std::unique_ptr<ReadView> view = database_.OpenReadView();
+        if (!view) {
+            result.error = "No read view available";
+            return false;
+        }
+
+        // Documents of the file by header table and key. Documents already
+        // present are skipped by the import, so they are left out here.
+        ValidationBatch batch;
+        std::unordered_map<uint16_t, std::unordered_map<std::string, uint32_t>> documents;
+        std::string key;
+
+        try {
+            ExchangeBlock block;
+            while (reader.Next(block)) {
+                const ExchangeTable& table = TableOf(block, path);
+                DocumentType type = DocumentType::ChungTuKeToan;
+
+                if (table.keyColumn >= 0) {
+                    auto exists = view->Prepare(std::string("SELECT 1 FROM ") + table.name + " WHERE "
+                        + table.columns[static_cast<size_t>(table.keyColumn)].name + " = ?");
+                    const bool isDocument = DocumentTypeOf(table, type);
+                    const size_t status = table.columns.size() - 1;     // TrangThai
+
+                    for (uint32_t row = 0; row < block.GetRowCount(); ++row) {
+                        if (block.IsNull(static_cast<size_t>(table.keyColumn), row)) {
+                            continue;
+                        }
+                        std::string_view text = block.Text(static_cast<size_t>(table.keyColumn), row);
+                        exists->Reset();
+                        exists->BindText(1, text);
+                        if (exists->Step()) {
+                            continue;
+                        }
+                        if (table.group == TableGroup::Products) {
+                            batch.DeclareProduct(text);
+                        } else if (isDocument) {
+                            const DayNumber day = block.IsNull(1, row) ? ValidationBatch::kInvalidDay : block.Day(1, row);
+                            const bool voided = !block.IsNull(status, row)
+                                && block.Int(status, row) == static_cast<int64_t>(TrangThai::DaXoa);
+                            documents[table.id].emplace(std::string(text), batch.AddDocument(type, text, day, voided));
+                        }
+                    }
+                    continue;
+                }
+
+                auto parents = documents.find(table.parentId);
+                if (parents == documents.end()) {
+                    continue;
+                }
+                for (uint32_t row = 0; row < block.GetRowCount(); ++row) {
+                    std::string_view parent = CodeOrEmpty(block, static_cast<size_t>(table.parentColumn), row);
+                    key.assign(parent.data(), parent.size());
+                    auto document = parents->second.find(key);
+                    if (document == parents->second.end()) {
+                        continue;
+                    }
+                    if (table.group == TableGroup::Vouchers) {
+                        batch.AddEntry(document->second, CodeOrEmpty(block, 2, row), CodeOrEmpty(block, 3, row),
+                            UnitsOrZero(block, 4, row));
+                    } else {
+                        batch.AddItem(document->second, CodeOrEmpty(block, 1, row), UnitsOrZero(block, 2, row),
+                            UnitsOrZero(block, 3, row), UnitsOrZero(block, 4, row));
+                    }
+                }
+            }
+        }
+        catch (const DatabaseException& e) {
+            result.error = e.what();
+            return false;
+        }
+
+        if (!reader.IsComplete()) {
+            result.error = reader.GetError();
+            return false;
+        }
+        view.reset();
+
+        if (!validation_->Validate(batch, result.validation)) {
+            result.error = "Validation tables could not be read";
+            return false;
+        }
+        if (!result.validation.IsValid()) {
+            for (const auto& issue : result.validation.issues) {
+                Logger::Warning("Import %s: %s: %s (%s)", path.c_str(), issue.documentKey.c_str(),
+                    issue.message.c_str(), ValidationService::GetRuleName(issue.rule));
+            }
+            result.error = "Validation failed: " + result.validation.Summary();
+            return false;
+        }
+        return true;
+    }
+
+} // namespace KeToanApp
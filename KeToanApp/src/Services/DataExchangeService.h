@@ -0,0 +1,61 @@
+#pragma once
+
+#include "KeToanApp/Common.h"
+#include "KeToanApp/Types.h"
+#include "ExchangeFormat.h"
+#include "ValidationService.h"
+#include "../Database/DatabaseManager.h"
+#include <cstdint>
+
+namespace KeToanApp {
+
+    struct ExchangeOptions {
+        std::string fromDate;       // yyyy-mm-dd or dd/MM/yyyy, inclusive; empty = unbounded
+        std::string toDate;
+        bool products;
+        bool vouchers;              // ChungTuKeToan + DinhKhoan
+        bool stock;                 // PhieuNhap/PhieuXuat with their lines
+
+        ExchangeOptions() : products(true), vouchers(true), stock(true) {}
+    };
+
+    struct ExchangeResult {
+        bool success;
+        int64_t rows;           // rows exported, or inserted on import
+        int64_t skipped;        // import: rows already present (and lines of such documents)
+        int64_t bytes;
+        double seconds;
+        std::string error;
+        ValidationReport validation;    // import: problems that rejected the file
+
+        ExchangeResult() : success(false), rows(0), skipped(0), bytes(0), seconds(0.0) {}
+    };
+
+    // Export and import of branch data in the .kte format (see ExchangeFormat.h).
+    //
+    // Export reads one read-view snapshot. Import runs through BulkInserter in
+    // a single transaction: a file is applied completely or not at all.
+    // Documents and products already present are left untouched, together
+    // with the lines of such documents, so re-importing a file is harmless.
+    // Accounts (TaiKhoanKeToan) are not exchanged; lines referencing an
+    // account missing at the receiving site fail the import.
+    //
+    // With a ValidationService, an import first reads the whole file into a
+    // validation batch, leaving out documents already present, and rejects
+    // it before the transaction starts if any rule fails.
+    class DataExchangeService {
+    public:
+        explicit DataExchangeService(DatabaseManager& database, ValidationService* validation = nullptr);
+        ~DataExchangeService() = default;
+
+        ExchangeResult Export(const std::string& path, const ExchangeOptions& options = ExchangeOptions());
+        ExchangeResult Import(const std::string& path);
+
+    private:
+        DatabaseManager& database_;
+        ValidationService* validation_;
+
+        bool ValidateFile(const std::string& path, ExchangeResult& result);
+    };
+
+} // namespace KeToanApp
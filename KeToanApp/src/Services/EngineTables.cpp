@@ -0,0 +1,462 @@
+#include "EngineTables.h"
+#include "../Database/SqlFunctions.h"
+#include "../Utils/DateTimeHelper.h"
+#include "../Utils/Logger.h"
+#include "../Utils/StringHelper.h"
+#include <sqlite3.h>
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+namespace KeToanApp {
+
+    namespace {
+
+        enum class TableKind { AccountBalance, StockOnHand };
+
+        struct TableInfo {
+            const char* name;
+            const char* schema;
+            int valueColumns;       // after the code, before the hidden dates
+        };
+
+        // In TableKind order. Column 0 is the code; DenNgay, then TuNgay, follow the values.
+        const TableInfo kTables[] = {
+            { "vt_account_balance",
+              "CREATE TABLE x(SoTK TEXT, DuNoDauKy REAL, DuCoDauKy REAL, PhatSinhNo REAL, PhatSinhCo REAL, "
+              "DuNoCuoiKy REAL, DuCoCuoiKy REAL, DenNgay HIDDEN, TuNgay HIDDEN)", 6 },
+            { "vt_stock_on_hand",
+              "CREATE TABLE x(MaSP TEXT, SoLuong REAL, GiaTri REAL, DonGia REAL, DenNgay HIDDEN)", 3 },
+        };
+
+        const int kMaxValues = 6;
+
+        // idxNum bits: the constraints xFilter receives, in argv order
+        const int kKeyEquals = 1;
+        const int kKeyPrefix = 2;       // LIKE 'prefix%'; SQLite still checks the pattern
+        const int kKeyUnder = 4;        // account_under(SoTK, root)
+        const int kToDay = 8;
+        const int kFromDay = 16;
+
+        struct Context {
+            std::shared_ptr<EngineTables::Engines> engines;
+            TableKind kind;
+        };
+
+        struct Table : sqlite3_vtab {
+            Context* context;
+        };
+
+        struct Row {
+            std::string_view code;          // owned by the code dictionary
+            double values[kMaxValues];
+        };
+
+        struct Cursor : sqlite3_vtab_cursor {
+            std::vector<Row> rows;
+            size_t index;
+            DayNumber to;
+            DayNumber from;
+        };
+
+        enum class KeyMatch { All, Equals, Prefix, PrefixIgnoreCase };
+
+        bool Matches(std::string_view code, KeyMatch match, const std::string& key) {
+            switch (match) {
+            case KeyMatch::Equals:
+                return code == key;
+            case KeyMatch::Prefix:
+                return code.size() >= key.size() && code.compare(0, key.size(), key) == 0;
+            case KeyMatch::PrefixIgnoreCase:
+                return code.size() >= key.size() && std::equal(key.begin(), key.end(), code.begin(),
+                    [](char a, char b) {
+                        return std::tolower(static_cast<unsigned char>(a)) == std::tolower(static_cast<unsigned char>(b));
+                    });
+            default:
+                return true;
+            }
+        }
+
+        int Fail(sqlite3_vtab_cursor* cursor, const char* message) {
+            sqlite3_vtab* table = cursor->pVtab;
+            sqlite3_free(table->zErrMsg);
+            table->zErrMsg = sqlite3_mprintf("%s: %s", kTables[static_cast<int>(static_cast<Table*>(table)->context->kind)].name, message);
+            return SQLITE_ERROR;
+        }
+
+        int Connect(sqlite3* db, void* aux, int, const char* const*, sqlite3_vtab** vtab, char**) {
+            Context* context = static_cast<Context*>(aux);
+            int rc = sqlite3_declare_vtab(db, kTables[static_cast<int>(context->kind)].schema);
+            if (rc != SQLITE_OK) {
+                return rc;
+            }
+            Table* table = new Table();
+            table->context = context;
+            *vtab = table;
+            return SQLITE_OK;
+        }
+
+        int Disconnect(sqlite3_vtab* vtab) {
+            delete static_cast<Table*>(vtab);
+            return SQLITE_OK;
+        }
+
+        int BestIndex(sqlite3_vtab* vtab, sqlite3_index_info* info) {
+            const Context* context = static_cast<Table*>(vtab)->context;
+            const TableInfo& table = kTables[static_cast<int>(context->kind)];
+            const int toColumn = 1 + table.valueColumns;
+            const int fromColumn = context->kind == TableKind::AccountBalance ? toColumn + 1 : -1;
+
+            int keyEquals = -1;
+            int keyPrefix = -1;
+            int keyUnder = -1;
+            int to = -1;
+            int from = -1;
+            bool toUnusable = false;
+            bool fromUnusable = false;
+            for (int i = 0; i < info->nConstraint; ++i) {
+                const auto& constraint = info->aConstraint[i];
+                if (constraint.iColumn == toColumn || constraint.iColumn == fromColumn) {
+                    if (constraint.op != SQLITE_INDEX_CONSTRAINT_EQ) {
+                        continue;
+                    }
+                    bool& unusable = constraint.iColumn == toColumn ? toUnusable : fromUnusable;
+                    int& slot = constraint.iColumn == toColumn ? to : from;
+                    if (constraint.usable) {
+                        slot = i;
+                    }
+                    else {
+                        unusable = true;
+                    }
+                }
+                else if (constraint.iColumn == 0 && constraint.usable) {
+                    switch (constraint.op) {
+                    case SQLITE_INDEX_CONSTRAINT_EQ:       keyEquals = i; break;
+                    case SQLITE_INDEX_CONSTRAINT_LIKE:     keyPrefix = i; break;
+                    case SQLITE_INDEX_CONSTRAINT_FUNCTION: keyUnder = i; break;
+                    default: break;
+                    }
+                }
+            }
+
+            // A date the plan cannot bind yet would default; wait for a plan that binds it
+            if ((toUnusable && to < 0) || (fromUnusable && from < 0)) {
+                return SQLITE_CONSTRAINT;
+            }
+
+            int argument = 0;
+            int idxNum = 0;
+            auto use = [&](int constraint, int bit, bool omit) {
+                info->aConstraintUsage[constraint].argvIndex = ++argument;
+                info->aConstraintUsage[constraint].omit = omit;
+                idxNum |= bit;
+            };
+
+            CodeDictionary* codes = context->engines->codes;
+            const double count = codes
+                ? static_cast<double>(codes->GetCount(context->kind == TableKind::AccountBalance
+                    ? CodeKind::Account : CodeKind::Product))
+                : 0.0;
+            if (keyEquals >= 0) {
+                use(keyEquals, kKeyEquals, true);
+                info->estimatedRows = 1;
+                info->estimatedCost = 10.0;
+                info->idxFlags |= SQLITE_INDEX_SCAN_UNIQUE;
+            }
+            else if (keyUnder >= 0 || keyPrefix >= 0) {
+                if (keyUnder >= 0) {
+                    use(keyUnder, kKeyUnder, true);
+                }
+                else {
+                    use(keyPrefix, kKeyPrefix, false);
+                }
+                // Every code is still compared with the prefix
+                info->estimatedRows = static_cast<sqlite3_int64>(std::max(1.0, count / 10.0));
+                info->estimatedCost = 10.0 + count;
+            }
+            else {
+                info->estimatedRows = static_cast<sqlite3_int64>(std::max(1.0, count));
+                info->estimatedCost = 10.0 + 20.0 * count;
+            }
+            if (to >= 0) {
+                use(to, kToDay, true);
+            }
+            if (from >= 0) {
+                use(from, kFromDay, true);
+            }
+            info->idxNum = idxNum;
+
+            if (info->nOrderBy == 1 && info->aOrderBy[0].iColumn == 0 && !info->aOrderBy[0].desc) {
+                info->orderByConsumed = 1;
+            }
+            return SQLITE_OK;
+        }
+
+        int FindFunction(sqlite3_vtab* vtab, int arguments, const char* name,
+            void (**function)(sqlite3_context*, int, sqlite3_value**), void** userData) {
+            if (static_cast<Table*>(vtab)->context->kind != TableKind::AccountBalance ||
+                arguments != 2 || std::strcmp(name, "account_under") != 0) {
+                return 0;
+            }
+            *function = SqlFunctions::AccountUnder;
+            *userData = nullptr;
+            return SQLITE_INDEX_CONSTRAINT_FUNCTION;
+        }
+
+        int Open(sqlite3_vtab*, sqlite3_vtab_cursor** cursor) {
+            Cursor* created = new Cursor();
+            created->index = 0;
+            created->to = 0;
+            created->from = 0;
+            *cursor = created;
+            return SQLITE_OK;
+        }
+
+        int Close(sqlite3_vtab_cursor* cursor) {
+            delete static_cast<Cursor*>(cursor);
+            return SQLITE_OK;
+        }
+
+        int LoadAccounts(Cursor* cursor, EngineTables::Engines& engines, KeyMatch match, const std::string& key,
+            bool hasFrom) {
+            BalanceIndex* balances = engines.balances;
+            const DayNumber openingDay = balances->GetOpeningDay();
+            if (!hasFrom) {
+                // Without opening balances every line is movement
+                cursor->from = openingDay == INT32_MIN ? INT32_MIN + 1 : openingDay;
+            }
+
+            const uint32_t count = static_cast<uint32_t>(engines.codes->GetCount(CodeKind::Account));
+            uint32_t first = 0;
+            uint32_t last = count;
+            if (match == KeyMatch::Equals) {
+                first = engines.codes->Find(CodeKind::Account, key);
+                if (first == CodeDictionary::kNotFound) {
+                    return SQLITE_OK;
+                }
+                last = first + 1;
+            }
+
+            for (uint32_t account = first; account < last; ++account) {
+                std::string_view soTK = engines.codes->GetCode(CodeKind::Account, account);
+                if (!Matches(soTK, match, key)) {
+                    continue;
+                }
+                AccountMovement opening;
+                AccountMovement movement;
+                if (!balances->GetBalance(account, cursor->from - 1, opening) ||
+                    !balances->GetMovement(account, cursor->from, cursor->to, movement)) {
+                    return Fail(cursor, "TuNgay is before the first open year, or the balance index is not built");
+                }
+                const Money openingNet = opening.Net();
+                if (openingNet.units == 0 && movement.debit.units == 0 && movement.credit.units == 0) {
+                    continue;
+                }
+                const Money closingNet = openingNet + movement.Net();
+
+                Row row;
+                row.code = soTK;
+                row.values[0] = openingNet.units > 0 ? openingNet.ToDouble() : 0.0;
+                row.values[1] = openingNet.units < 0 ? -openingNet.ToDouble() : 0.0;
+                row.values[2] = movement.debit.ToDouble();
+                row.values[3] = movement.credit.ToDouble();
+                row.values[4] = closingNet.units > 0 ? closingNet.ToDouble() : 0.0;
+                row.values[5] = closingNet.units < 0 ? -closingNet.ToDouble() : 0.0;
+                cursor->rows.push_back(row);
+            }
+            return SQLITE_OK;
+        }
+
+        int LoadStock(Cursor* cursor, EngineTables::Engines& engines, KeyMatch match, const std::string& key) {
+            const uint32_t count = static_cast<uint32_t>(engines.codes->GetCount(CodeKind::Product));
+            uint32_t first = 0;
+            uint32_t last = count;
+            if (match == KeyMatch::Equals) {
+                first = engines.codes->Find(CodeKind::Product, key);
+                if (first == CodeDictionary::kNotFound) {
+                    return SQLITE_OK;
+                }
+                last = first + 1;
+            }
+
+            for (uint32_t product = first; product < last; ++product) {
+                std::string_view maSP = engines.codes->GetCode(CodeKind::Product, product);
+                if (!Matches(maSP, match, key)) {
+                    continue;
+                }
+                StockPosition position;
+                if (!engines.stock->GetStock(maSP, cursor->to, position)) {
+                    return Fail(cursor, "DenNgay is before the opening stock, or the stock index is not built");
+                }
+                if (position.quantity.units == 0 && position.value.units == 0) {
+                    continue;
+                }
+
+                Row row;
+                row.code = maSP;
+                row.values[0] = position.quantity.ToDouble();
+                row.values[1] = position.value.ToDouble();
+                row.values[2] = position.quantity.units != 0 ? row.values[1] / row.values[0] : 0.0;
+                cursor->rows.push_back(row);
+            }
+            return SQLITE_OK;
+        }
+
+        int Filter(sqlite3_vtab_cursor* base, int idxNum, const char*, int, sqlite3_value** argv) {
+            Cursor* cursor = static_cast<Cursor*>(base);
+            const Context* context = static_cast<Table*>(base->pVtab)->context;
+            cursor->rows.clear();
+            cursor->index = 0;
+
+            int argument = 0;
+            KeyMatch match = KeyMatch::All;
+            std::string key;
+            if (idxNum & (kKeyEquals | kKeyPrefix | kKeyUnder)) {
+                sqlite3_value* value = argv[argument++];
+                if (sqlite3_value_type(value) == SQLITE_NULL) {
+                    return SQLITE_OK;
+                }
+                key.assign(reinterpret_cast<const char*>(sqlite3_value_text(value)),
+                    static_cast<size_t>(sqlite3_value_bytes(value)));
+                if (idxNum & kKeyEquals) {
+                    match = KeyMatch::Equals;
+                }
+                else if (idxNum & kKeyUnder) {
+                    match = KeyMatch::Prefix;
+                }
+                else {
+                    // Up to the first wildcard; LIKE ignores ASCII case
+                    key.erase(std::min(key.find_first_of("%_"), key.size()));
+                    match = KeyMatch::PrefixIgnoreCase;
+                }
+            }
+
+            cursor->to = DateTimeHelper::ToDayNumber(DateTimeHelper::Today());
+            if ((idxNum & kToDay) && !SqlFunctions::ToDayNumber(argv[argument++], cursor->to)) {
+                return Fail(base, "invalid DenNgay");
+            }
+            const bool hasFrom = (idxNum & kFromDay) != 0;
+            if (hasFrom && !SqlFunctions::ToDayNumber(argv[argument++], cursor->from)) {
+                return Fail(base, "invalid TuNgay");
+            }
+
+            EngineTables::Engines& engines = *context->engines;
+            std::shared_lock<std::shared_mutex> lock(engines.mutex);
+            int rc;
+            if (context->kind == TableKind::AccountBalance) {
+                if (!engines.codes || !engines.balances) {
+                    return Fail(base, "the balance index is not available");
+                }
+                rc = LoadAccounts(cursor, engines, match, key, hasFrom);
+            }
+            else {
+                if (!engines.codes || !engines.stock) {
+                    return Fail(base, "the stock index is not available");
+                }
+                rc = LoadStock(cursor, engines, match, key);
+            }
+            if (rc != SQLITE_OK) {
+                cursor->rows.clear();
+                return rc;
+            }
+
+            std::sort(cursor->rows.begin(), cursor->rows.end(),
+                [](const Row& a, const Row& b) { return a.code < b.code; });
+            return SQLITE_OK;
+        }
+
+        int Next(sqlite3_vtab_cursor* cursor) {
+            ++static_cast<Cursor*>(cursor)->index;
+            return SQLITE_OK;
+        }
+
+        int Eof(sqlite3_vtab_cursor* base) {
+            const Cursor* cursor = static_cast<Cursor*>(base);
+            return cursor->index >= cursor->rows.size();
+        }
+
+        int Column(sqlite3_vtab_cursor* base, sqlite3_context* context, int column) {
+            const Cursor* cursor = static_cast<Cursor*>(base);
+            const TableInfo& table = kTables[static_cast<int>(static_cast<Table*>(base->pVtab)->context->kind)];
+            const Row& row = cursor->rows[cursor->index];
+            if (column == 0) {
+                sqlite3_result_text(context, row.code.data(), static_cast<int>(row.code.size()), SQLITE_STATIC);
+            }
+            else if (column <= table.valueColumns) {
+                sqlite3_result_double(context, row.values[column - 1]);
+            }
+            else {
+                const Date date = DateTimeHelper::FromDayNumber(column == table.valueColumns + 1 ? cursor->to : cursor->from);
+                const std::string iso = StringHelper::Format("%04d-%02d-%02d", date.year, date.month, date.day);
+                sqlite3_result_text(context, iso.c_str(), static_cast<int>(iso.size()), SQLITE_TRANSIENT);
+            }
+            return SQLITE_OK;
+        }
+
+        int Rowid(sqlite3_vtab_cursor* base, sqlite3_int64* rowid) {
+            *rowid = static_cast<sqlite3_int64>(static_cast<Cursor*>(base)->index);
+            return SQLITE_OK;
+        }
+
+        // Eponymous-only: no xCreate, so the tables exist on every
+        // connection without CREATE VIRTUAL TABLE
+        sqlite3_module MakeModule() {
+            sqlite3_module module;
+            std::memset(&module, 0, sizeof(module));
+            module.xConnect = Connect;
+            module.xBestIndex = BestIndex;
+            module.xDisconnect = Disconnect;
+            module.xOpen = Open;
+            module.xClose = Close;
+            module.xFilter = Filter;
+            module.xNext = Next;
+            module.xEof = Eof;
+            module.xColumn = Column;
+            module.xRowid = Rowid;
+            module.xFindFunction = FindFunction;
+            return module;
+        }
+
+        const sqlite3_module kModule = MakeModule();
+
+        bool CreateModule(sqlite3* db, const std::shared_ptr<EngineTables::Engines>& engines, TableKind kind) {
+            const char* name = kTables[static_cast<int>(kind)].name;
+            int rc = sqlite3_create_module_v2(db, name, &kModule, new Context{ engines, kind },
+                [](void* context) { delete static_cast<Context*>(context); });
+            if (rc != SQLITE_OK) {
+                Logger::Error("Registering virtual table %s failed: %s", name, sqlite3_errmsg(db));
+                return false;
+            }
+            return true;
+        }
+
+    } // namespace
+
+    EngineTables::EngineTables(DatabaseManager& database, CodeDictionary& codes, BalanceIndex* balances,
+        StockMovementIndex* stock)
+        : database_(database)
+        , engines_(std::make_shared<Engines>())
+    {
+        engines_->codes = &codes;
+        engines_->balances = balances;
+        engines_->stock = stock;
+    }
+
+    EngineTables::~EngineTables() {
+        // Queries in flight finish first; later ones get an error
+        std::unique_lock<std::shared_mutex> lock(engines_->mutex);
+        engines_->codes = nullptr;
+        engines_->balances = nullptr;
+        engines_->stock = nullptr;
+    }
+
+    bool EngineTables::Register() {
+        std::shared_ptr<Engines> engines = engines_;
+        return database_.AddConnectionSetup([engines](sqlite3* db) {
+            std::shared_lock<std::shared_mutex> lock(engines->mutex);
+            return (!engines->balances || CreateModule(db, engines, TableKind::AccountBalance))
+                && (!engines->stock || CreateModule(db, engines, TableKind::StockOnHand));
+        });
+    }
+
+} // namespace KeToanApp
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "KeToanApp/Common.h"
+#include "KeToanApp/Types.h"
+#include "../Database/DatabaseManager.h"
+#include "BalanceIndex.h"
+#include "CodeDictionary.h"
+#include "StockMovementIndex.h"
+#include <memory>
+#include <shared_mutex>
+
+namespace KeToanApp {
+
+    // The in-memory engines as SQL tables (eponymous virtual tables), so
+    // reports and ad-hoc queries read them in place rather than through
+    // temp tables:
+    //
+    //   vt_account_balance(DenNgay, TuNgay)  a row per account with a
+    //       balance or movement: SoTK, DuNoDauKy, DuCoDauKy, PhatSinhNo,
+    //       PhatSinhCo, DuNoCuoiKy, DuCoCuoiKy, from BalanceIndex
+    //   vt_stock_on_hand(DenNgay)  a row per product with stock: MaSP,
+    //       SoLuong, GiaTri, DonGia, from StockMovementIndex
+    //
+    // The dates are hidden columns, given as table arguments or equality
+    // constraints, as yyyy-mm-dd, dd/MM/yyyy or a day number. DenNgay
+    // defaults to today and TuNgay to the first day of the first open year.
+    // xBestIndex takes SoTK/MaSP = ?, LIKE 'prefix%' and account_under(SoTK, ?)
+    // so a join with a base table looks each code up instead of scanning;
+    // rows come ordered by code. Rows reflect the engines when the
+    // statement runs, not the snapshot of the read view running it.
+    //
+    // The modules are added to every connection with
+    // DatabaseManager::AddConnectionSetup(). Destroying EngineTables
+    // detaches the engines; the tables then fail with an error.
+    class EngineTables {
+    public:
+        // Engines the modules read, shared with every connection
+        struct Engines {
+            std::shared_mutex mutex;
+            CodeDictionary* codes = nullptr;
+            BalanceIndex* balances = nullptr;
+            StockMovementIndex* stock = nullptr;
+        };
+
+        // A null engine leaves its table out
+        EngineTables(DatabaseManager& database, CodeDictionary& codes, BalanceIndex* balances,
+            StockMovementIndex* stock);
+        ~EngineTables();
+
+        // Non-copyable
+        EngineTables(const EngineTables&) = delete;
+        EngineTables& operator=(const EngineTables&) = delete;
+
+        bool Register();
+
+    private:
+        DatabaseManager& database_;
+        std::shared_ptr<Engines> engines_;
+    };
+
+} // namespace KeToanApp
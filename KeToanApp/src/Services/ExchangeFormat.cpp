@@ -0,0 +1,440 @@
+#include "ExchangeFormat.h"
+#include "../Utils/Crc32.h"
+#include "../Utils/Logger.h"
+#include <cstring>
+#include <filesystem>
+
+namespace KeToanApp {
+
+    namespace {
+
+        const char kMagic[8] = { 'K', 'T', 'E', 'X', 'C', 'H', 'N', 'G' };
+        const uint32_t kVersion = 1;
+        const size_t kFileHeaderSize = 16;
+
+        void AppendU32(std::string& out, uint32_t v) {
+            char bytes[4] = {
+                static_cast<char>(v), static_cast<char>(v >> 8),
+                static_cast<char>(v >> 16), static_cast<char>(v >> 24)
+            };
+            out.append(bytes, 4);
+        }
+
+        uint32_t ReadU32(const char* p) {
+            const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+            return static_cast<uint32_t>(u[0]) | static_cast<uint32_t>(u[1]) << 8
+                | static_cast<uint32_t>(u[2]) << 16 | static_cast<uint32_t>(u[3]) << 24;
+        }
+
+        uint16_t ReadU16(const char* p) {
+            const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+            return static_cast<uint16_t>(u[0] | u[1] << 8);
+        }
+
+        // The format is little-endian, as is every Windows target
+        template <typename T>
+        void AppendArray(std::string& out, const std::vector<T>& values) {
+            out.append(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+        }
+
+        void PadTo8(std::string& out) {
+            out.append((8 - out.size() % 8) % 8, '\0');
+        }
+
+    } // namespace
+
+    ExchangeWriter::ExchangeWriter()
+        : tableId_(0)
+        , column_(0)
+        , rows_(0)
+        , bytesWritten_(0)
+    {
+    }
+
+    ExchangeWriter::~ExchangeWriter() {
+        if (out_.is_open()) {
+            Close();
+        }
+    }
+
+    bool ExchangeWriter::Open(const std::string& path) {
+        out_.open(std::filesystem::u8path(path), std::ios::binary | std::ios::trunc);
+        if (!out_) {
+            Logger::Error("Cannot create exchange file %s", path.c_str());
+            return false;
+        }
+
+        std::string header(kMagic, sizeof(kMagic));
+        AppendU32(header, kVersion);
+        AppendU32(header, 0);
+        out_.write(header.data(), static_cast<std::streamsize>(header.size()));
+        bytesWritten_ = static_cast<int64_t>(header.size());
+        return out_.good();
+    }
+
+    bool ExchangeWriter::Close() {
+        if (!out_.is_open()) {
+            return false;
+        }
+
+        bool ok = FlushBlock();
+
+        // End block: table 0, no columns, no rows
+        std::string end;
+        AppendU32(end, 0);
+        AppendU32(end, 0);
+        ok = ok && WriteBlock(end);
+
+        out_.close();
+        return ok && !out_.fail();
+    }
+
+    void ExchangeWriter::BeginTable(uint16_t tableId, const std::vector<ExchangeColumnType>& types) {
+        FlushBlock();
+        tableId_ = tableId;
+        columns_.clear();
+        columns_.resize(types.size());
+        for (size_t i = 0; i < types.size(); ++i) {
+            columns_[i].type = types[i];
+        }
+        column_ = 0;
+        rows_ = 0;
+    }
+
+    ExchangeWriter::Column& ExchangeWriter::Next(ExchangeColumnType type) {
+        if (column_ >= columns_.size() || columns_[column_].type != type) {
+            throw KeToanException("Exchange value does not match the table's column types");
+        }
+        return columns_[column_++];
+    }
+
+    ExchangeWriter& ExchangeWriter::Int(int64_t value) {
+        Next(ExchangeColumnType::Int).ints.push_back(value);
+        return *this;
+    }
+
+    ExchangeWriter& ExchangeWriter::Fixed(int64_t units) {
+        Next(ExchangeColumnType::Fixed).ints.push_back(units);
+        return *this;
+    }
+
+    ExchangeWriter& ExchangeWriter::Day(DayNumber day) {
+        Next(ExchangeColumnType::Day).days.push_back(day);
+        return *this;
+    }
+
+    ExchangeWriter& ExchangeWriter::Code(std::string_view code) {
+        Column& column = Next(ExchangeColumnType::Code);
+        scratch_.assign(code.data(), code.size());
+        auto it = column.dictionary.find(scratch_);
+        if (it == column.dictionary.end()) {
+            uint32_t id = static_cast<uint32_t>(column.codes.size());
+            it = column.dictionary.emplace(scratch_, id).first;
+            column.codes.push_back(scratch_);
+        }
+        column.ids.push_back(it->second);
+        return *this;
+    }
+
+    ExchangeWriter& ExchangeWriter::Text(std::string_view text) {
+        Column& column = Next(ExchangeColumnType::Text);
+        if (column.bytes.size() + text.size() >= kExchangeNullText) {
+            throw KeToanException("Exchange text column exceeds 2 GB in one block");
+        }
+        column.bytes.append(text.data(), text.size());
+        column.ends.push_back(static_cast<uint32_t>(column.bytes.size()));
+        return *this;
+    }
+
+    ExchangeWriter& ExchangeWriter::Null() {
+        if (column_ >= columns_.size()) {
+            throw KeToanException("Exchange row has too many values");
+        }
+        switch (columns_[column_].type) {
+        case ExchangeColumnType::Int:   return Int(kExchangeNullInt);
+        case ExchangeColumnType::Fixed: return Fixed(kExchangeNullInt);
+        case ExchangeColumnType::Day:   return Day(kExchangeNullDay);
+        case ExchangeColumnType::Text: {
+            Column& column = columns_[column_++];
+            column.ends.push_back(static_cast<uint32_t>(column.bytes.size()) | kExchangeNullText);
+            return *this;
+        }
+        case ExchangeColumnType::Code:
+            columns_[column_++].ids.push_back(kExchangeNullCode);
+            return *this;
+        }
+        return *this;
+    }
+
+    bool ExchangeWriter::EndRow() {
+        if (column_ != columns_.size()) {
+            throw KeToanException("Exchange row has too few values");
+        }
+        column_ = 0;
+        if (++rows_ >= kRowsPerBlock) {
+            return FlushBlock();
+        }
+        return true;
+    }
+
+    bool ExchangeWriter::FlushBlock() {
+        if (rows_ == 0) {
+            return true;
+        }
+
+        payload_.clear();
+        payload_.push_back(static_cast<char>(tableId_));
+        payload_.push_back(static_cast<char>(tableId_ >> 8));
+        payload_.push_back(static_cast<char>(columns_.size()));
+        payload_.push_back(static_cast<char>(columns_.size() >> 8));
+        AppendU32(payload_, rows_);
+
+        for (Column& column : columns_) {
+            size_t headerAt = payload_.size();
+            payload_.push_back(static_cast<char>(column.type));
+            payload_.append(3, '\0');
+            AppendU32(payload_, 0);     // data length, patched below
+            size_t dataAt = payload_.size();
+
+            switch (column.type) {
+            case ExchangeColumnType::Int:
+            case ExchangeColumnType::Fixed:
+                AppendArray(payload_, column.ints);
+                break;
+            case ExchangeColumnType::Day:
+                AppendArray(payload_, column.days);
+                break;
+            case ExchangeColumnType::Code: {
+                std::vector<uint32_t> ends;
+                std::string bytes;
+                for (const auto& code : column.codes) {
+                    bytes += code;
+                    ends.push_back(static_cast<uint32_t>(bytes.size()));
+                }
+                AppendU32(payload_, static_cast<uint32_t>(column.codes.size()));
+                AppendU32(payload_, static_cast<uint32_t>(bytes.size()));
+                AppendArray(payload_, column.ids);
+                AppendArray(payload_, ends);
+                payload_ += bytes;
+                break;
+            }
+            case ExchangeColumnType::Text:
+                AppendU32(payload_, static_cast<uint32_t>(column.bytes.size()));
+                AppendU32(payload_, 0);
+                AppendArray(payload_, column.ends);
+                payload_ += column.bytes;
+                break;
+            }
+
+            PadTo8(payload_);
+            uint32_t length = static_cast<uint32_t>(payload_.size() - dataAt);
+            for (int i = 0; i < 4; ++i) {
+                payload_[headerAt + 4 + i] = static_cast<char>(length >> (8 * i));
+            }
+
+            // Dictionaries are per block, so a reader needs only the block itself
+            Column fresh;
+            fresh.type = column.type;
+            column = std::move(fresh);
+        }
+
+        rows_ = 0;
+        return WriteBlock(payload_);
+    }
+
+    bool ExchangeWriter::WriteBlock(const std::string& payload) {
+        std::string header;
+        AppendU32(header, static_cast<uint32_t>(payload.size()));
+        AppendU32(header, Crc32::Compute(payload.data(), payload.size()));
+        out_.write(header.data(), static_cast<std::streamsize>(header.size()));
+        out_.write(payload.data(), static_cast<std::streamsize>(payload.size()));
+        bytesWritten_ += static_cast<int64_t>(header.size() + payload.size());
+        return out_.good();
+    }
+
+    bool ExchangeBlock::IsNull(size_t column, uint32_t row) const {
+        const ColumnView& view = columns_[column];
+        switch (view.type) {
+        case ExchangeColumnType::Int:
+        case ExchangeColumnType::Fixed:
+            return view.ints[row] == kExchangeNullInt;
+        case ExchangeColumnType::Day:
+            return view.days[row] == kExchangeNullDay;
+        case ExchangeColumnType::Code:
+            return view.ids[row] == kExchangeNullCode;
+        case ExchangeColumnType::Text:
+            return (view.ends[row] & kExchangeNullText) != 0;
+        }
+        return false;
+    }
+
+    std::string_view ExchangeBlock::Code(size_t column, uint32_t row) const {
+        const ColumnView& view = columns_[column];
+        uint32_t id = view.ids[row];
+        if (id == kExchangeNullCode) {
+            return std::string_view();
+        }
+        uint32_t begin = id == 0 ? 0 : view.ends[id - 1];
+        return std::string_view(view.bytes + begin, view.ends[id] - begin);
+    }
+
+    std::string_view ExchangeBlock::Text(size_t column, uint32_t row) const {
+        const ColumnView& view = columns_[column];
+        uint32_t begin = row == 0 ? 0 : view.ends[row - 1] & ~kExchangeNullText;
+        return std::string_view(view.bytes + begin, (view.ends[row] & ~kExchangeNullText) - begin);
+    }
+
+    ExchangeReader::ExchangeReader()
+        : offset_(0)
+        , complete_(false)
+    {
+    }
+
+    bool ExchangeReader::Fail(const std::string& error) {
+        error_ = error;
+        offset_ = file_.Size();
+        return false;
+    }
+
+    bool ExchangeReader::Open(const std::string& path) {
+        complete_ = false;
+        error_.clear();
+        if (!file_.Open(path)) {
+            return Fail("Cannot open " + path);
+        }
+        if (file_.Size() < kFileHeaderSize || memcmp(file_.Data(), kMagic, sizeof(kMagic)) != 0) {
+            return Fail("Not an exchange file");
+        }
+        if (ReadU32(file_.Data() + 8) != kVersion) {
+            return Fail("Unsupported exchange file version");
+        }
+        offset_ = kFileHeaderSize;
+        return true;
+    }
+
+    bool ExchangeReader::Next(ExchangeBlock& block) {
+        if (complete_ || offset_ >= file_.Size()) {
+            if (!complete_ && error_.empty()) {
+                Fail("Exchange file is truncated");
+            }
+            return false;
+        }
+
+        const char* base = file_.Data();
+        const size_t size = file_.Size();
+        if (size - offset_ < 8) {
+            return Fail("Exchange file is truncated");
+        }
+
+        const uint32_t length = ReadU32(base + offset_);
+        const uint32_t crc = ReadU32(base + offset_ + 4);
+        const char* payload = base + offset_ + 8;
+        if (length < 8 || length % 8 != 0 || size - offset_ - 8 < length) {
+            return Fail("Exchange block at offset " + std::to_string(offset_) + " is malformed");
+        }
+        if (Crc32::Compute(payload, length) != crc) {
+            return Fail("Checksum mismatch in block at offset " + std::to_string(offset_));
+        }
+
+        block.tableId_ = ReadU16(payload);
+        const uint16_t columnCount = ReadU16(payload + 2);
+        block.rowCount_ = ReadU32(payload + 4);
+        block.columns_.clear();
+
+        size_t pos = 8;
+        for (uint16_t c = 0; c < columnCount; ++c) {
+            if (length - pos < 8) {
+                return Fail("Exchange column header out of bounds");
+            }
+            const uint32_t dataLength = ReadU32(payload + pos + 4);
+            if (dataLength % 8 != 0 || length - pos - 8 < dataLength) {
+                return Fail("Exchange column data out of bounds");
+            }
+
+            ExchangeBlock::ColumnView view = {};
+            view.type = static_cast<ExchangeColumnType>(static_cast<unsigned char>(payload[pos]));
+            if (!ParseColumn(payload + pos + 8, dataLength, block.rowCount_, view)) {
+                return false;
+            }
+            block.columns_.push_back(view);
+            pos += 8 + dataLength;
+        }
+
+        offset_ += 8 + length;
+
+        if (block.tableId_ == 0) {
+            complete_ = true;
+            return false;
+        }
+        return true;
+    }
+
+    bool ExchangeReader::ParseColumn(const char* data, size_t length, uint32_t rows,
+        ExchangeBlock::ColumnView& view)
+    {
+        // Sizes are compared in 64 bits so crafted counts cannot wrap
+        const uint64_t rowCount = rows;
+        switch (view.type) {
+        case ExchangeColumnType::Int:
+        case ExchangeColumnType::Fixed:
+            if (rowCount * 8 > length) return Fail("Exchange numeric column is short");
+            view.ints = reinterpret_cast<const int64_t*>(data);
+            return true;
+
+        case ExchangeColumnType::Day:
+            if (rowCount * 4 > length) return Fail("Exchange date column is short");
+            view.days = reinterpret_cast<const DayNumber*>(data);
+            return true;
+
+        case ExchangeColumnType::Code: {
+            if (length < 8) return Fail("Exchange code column is short");
+            const uint64_t dictCount = ReadU32(data);
+            const uint64_t dictBytes = ReadU32(data + 4);
+            if (8 + rowCount * 4 + dictCount * 4 + dictBytes > length) {
+                return Fail("Exchange code column is short");
+            }
+            view.count = static_cast<uint32_t>(dictCount);
+            view.ids = reinterpret_cast<const uint32_t*>(data + 8);
+            view.ends = view.ids + rows;
+            view.bytes = reinterpret_cast<const char*>(view.ends + dictCount);
+
+            uint32_t previous = 0;
+            for (uint32_t i = 0; i < view.count; ++i) {
+                if (view.ends[i] < previous || view.ends[i] > dictBytes) {
+                    return Fail("Exchange dictionary is corrupt");
+                }
+                previous = view.ends[i];
+            }
+            for (uint32_t row = 0; row < rows; ++row) {
+                if (view.ids[row] >= view.count && view.ids[row] != kExchangeNullCode) {
+                    return Fail("Exchange code id out of range");
+                }
+            }
+            return true;
+        }
+
+        case ExchangeColumnType::Text: {
+            if (length < 8) return Fail("Exchange text column is short");
+            const uint64_t totalBytes = ReadU32(data);
+            if (8 + rowCount * 4 + totalBytes > length) {
+                return Fail("Exchange text column is short");
+            }
+            view.ends = reinterpret_cast<const uint32_t*>(data + 8);
+            view.bytes = reinterpret_cast<const char*>(view.ends + rows);
+
+            uint32_t previous = 0;
+            for (uint32_t row = 0; row < rows; ++row) {
+                uint32_t end = view.ends[row] & ~kExchangeNullText;
+                if (end < previous || end > totalBytes) {
+                    return Fail("Exchange text offsets are corrupt");
+                }
+                previous = end;
+            }
+            return true;
+        }
+        }
+
+        return Fail("Unknown exchange column type");
+    }
+
+} // namespace KeToanApp
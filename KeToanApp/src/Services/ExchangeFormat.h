@@ -0,0 +1,167 @@
+#pragma once
+
+#include "KeToanApp/Common.h"
+#include "KeToanApp/Types.h"
+#include "../Utils/MappedFile.h"
+#include <cstdint>
+#include <fstream>
+#include <string_view>
+#include <unordered_map>
+
+namespace KeToanApp {
+
+    // Binary interchange format (.kte) for sending vouchers, products and
+    // stock movements between sites.
+    //
+    //   file    "KTEXCHNG" u32 version, u32 reserved, then blocks
+    //   block   u32 payloadLength, u32 crc32(payload), payload
+    //   payload u16 tableId, u16 columnCount, u32 rowCount, columns
+    //   column  u8 type, 3 x u8 0, u32 dataLength, data
+    //
+    // Column data by type:
+    //   Int, Fixed  int64[rows]; Fixed is in Money units (4 decimals)
+    //   Day         int32[rows] day numbers
+    //   Code        u32 dictCount, u32 dictBytes, u32 ids[rows],
+    //               u32 ends[dictCount], dictionary bytes
+    //   Text        u32 totalBytes, u32 0, u32 ends[rows], bytes; the top
+    //               bit of an end marks a NULL row
+    //
+    // Integers are little-endian. Payloads and column data are padded to
+    // 8 bytes, so numeric columns are aligned in the mapped file and are
+    // read in place. A block with tableId 0 ends the file; a file without
+    // it is truncated.
+    enum class ExchangeColumnType : uint8_t {
+        Int = 1,
+        Fixed = 2,
+        Day = 3,
+        Code = 4,
+        Text = 5
+    };
+
+    const int64_t kExchangeNullInt = INT64_MIN;
+    const DayNumber kExchangeNullDay = INT32_MIN;
+    const uint32_t kExchangeNullCode = 0xFFFFFFFFu;
+    const uint32_t kExchangeNullText = 0x80000000u;
+
+    // Streaming writer. Values are added column by column in table order:
+    //
+    //     writer.BeginTable(id, types);
+    //     writer.Code("SP01").Fixed(units).EndRow();
+    class ExchangeWriter {
+    public:
+        static const uint32_t kRowsPerBlock = 65536;
+
+        ExchangeWriter();
+        ~ExchangeWriter();
+
+        // Non-copyable
+        ExchangeWriter(const ExchangeWriter&) = delete;
+        ExchangeWriter& operator=(const ExchangeWriter&) = delete;
+
+        bool Open(const std::string& path);
+        bool Close();   // flushes and writes the end block
+
+        void BeginTable(uint16_t tableId, const std::vector<ExchangeColumnType>& types);
+
+        ExchangeWriter& Int(int64_t value);
+        ExchangeWriter& Fixed(int64_t units);
+        ExchangeWriter& Day(DayNumber day);
+        ExchangeWriter& Code(std::string_view code);
+        ExchangeWriter& Text(std::string_view text);
+        ExchangeWriter& Null();
+        bool EndRow();
+
+        int64_t GetBytesWritten() const { return bytesWritten_; }
+
+    private:
+        struct Column {
+            ExchangeColumnType type;
+            std::vector<int64_t> ints;
+            std::vector<DayNumber> days;
+            std::vector<uint32_t> ids;
+            std::unordered_map<std::string, uint32_t> dictionary;
+            std::vector<std::string> codes;
+            std::string bytes;
+            std::vector<uint32_t> ends;
+        };
+
+        std::ofstream out_;
+        std::string payload_;
+        std::vector<Column> columns_;
+        std::string scratch_;
+        uint16_t tableId_;
+        size_t column_;
+        uint32_t rows_;
+        int64_t bytesWritten_;
+
+        Column& Next(ExchangeColumnType type);
+        bool FlushBlock();
+        bool WriteBlock(const std::string& payload);
+    };
+
+    // Zero-copy view of one block of a mapped file
+    class ExchangeBlock {
+    public:
+        uint16_t GetTableId() const { return tableId_; }
+        uint32_t GetRowCount() const { return rowCount_; }
+        size_t GetColumnCount() const { return columns_.size(); }
+        ExchangeColumnType GetType(size_t column) const { return columns_[column].type; }
+
+        // Whole columns, in place in the mapping
+        const int64_t* Ints(size_t column) const { return columns_[column].ints; }
+        const DayNumber* Days(size_t column) const { return columns_[column].days; }
+
+        bool IsNull(size_t column, uint32_t row) const;
+        int64_t Int(size_t column, uint32_t row) const { return columns_[column].ints[row]; }
+        DayNumber Day(size_t column, uint32_t row) const { return columns_[column].days[row]; }
+        std::string_view Code(size_t column, uint32_t row) const;
+        std::string_view Text(size_t column, uint32_t row) const;
+
+    private:
+        friend class ExchangeReader;
+
+        struct ColumnView {
+            ExchangeColumnType type;
+            const int64_t* ints;
+            const DayNumber* days;
+            const uint32_t* ids;
+            const uint32_t* ends;
+            const char* bytes;
+            uint32_t count;     // dictionary size for Code
+        };
+
+        uint16_t tableId_;
+        uint32_t rowCount_;
+        std::vector<ColumnView> columns_;
+    };
+
+    // Streaming reader over a memory-mapped file. Every block is bounds- and
+    // checksum-verified before it is returned.
+    class ExchangeReader {
+    public:
+        ExchangeReader();
+        ~ExchangeReader() = default;
+
+        // Non-copyable
+        ExchangeReader(const ExchangeReader&) = delete;
+        ExchangeReader& operator=(const ExchangeReader&) = delete;
+
+        bool Open(const std::string& path);
+
+        // False at the end block or on error (see GetError)
+        bool Next(ExchangeBlock& block);
+
+        bool IsComplete() const { return complete_; }
+        const std::string& GetError() const { return error_; }
+
+    private:
+        MappedFile file_;
+        size_t offset_;
+        bool complete_;
+        std::string error_;
+
+        bool Fail(const std::string& error);
+        bool ParseColumn(const char* data, size_t length, uint32_t rows, ExchangeBlock::ColumnView& view);
+    };
+
+} // namespace KeToanApp
@@ -0,0 +1,107 @@
+#include "IndexRefresher.h"
+#include "../Database/ChangeFeed.h"
+#include "../Utils/Logger.h"
+#include "../Utils/Trace.h"
+
+namespace KeToanApp {
+
+    IndexRefresher::IndexRefresher(DatabaseManager& database, Config& config)
+        : database_(database)
+        , config_(config)
+        , appliedHead_(-1)
+        , passes_(0)
+        , pending_(false)
+        , stopping_(false)
+    {
+        config_.DeclareInt("Indexes.RefreshMs", 500, 10, 600000);
+    }
+
+    IndexRefresher::~IndexRefresher() {
+        Stop();
+    }
+
+    void IndexRefresher::Add(const char* name, RefreshFunction refresh) {
+        entries_.push_back({ name, std::move(refresh) });
+    }
+
+    bool IndexRefresher::Start() {
+        std::lock_guard<std::mutex> lock(threadMutex_);
+        if (worker_.joinable()) {
+            return true;
+        }
+        stopping_ = false;
+        worker_ = std::thread(&IndexRefresher::Run, this);
+        return true;
+    }
+
+    void IndexRefresher::Stop() {
+        {
+            std::lock_guard<std::mutex> lock(threadMutex_);
+            if (!worker_.joinable()) {
+                return;
+            }
+            stopping_ = true;
+            wakeup_.notify_all();
+        }
+        worker_.join();
+    }
+
+    void IndexRefresher::Notify() {
+        std::lock_guard<std::mutex> lock(threadMutex_);
+        pending_ = true;
+        wakeup_.notify_all();
+    }
+
+    bool IndexRefresher::RefreshNow() {
+        KETOAN_TRACE_SCOPE("engine", "IndexRefresher.Pass");
+        std::lock_guard<std::mutex> lock(passMutex_);
+
+        int64_t head;
+        {
+            std::unique_ptr<ReadView> view = database_.OpenReadView(std::chrono::seconds(1));
+            if (!view) {
+                return false;
+            }
+            head = ChangeFeed::GetHeadSequence(*view);
+        }
+        if (head == appliedHead_) {
+            return true;
+        }
+
+        // Each index refreshes to its own, possibly later, snapshot; a
+        // later head only means another pass that finds little to do
+        bool ok = true;
+        for (const auto& entry : entries_) {
+            if (!entry.refresh()) {
+                Logger::Warning("Index refresh: %s failed; retrying on the next pass", entry.name);
+                ok = false;
+            }
+        }
+        if (ok) {
+            appliedHead_ = head;
+            ++passes_;
+        }
+        return ok;
+    }
+
+    uint64_t IndexRefresher::GetPasses() const {
+        std::lock_guard<std::mutex> lock(passMutex_);
+        return passes_;
+    }
+
+    void IndexRefresher::Run() {
+        std::unique_lock<std::mutex> lock(threadMutex_);
+        while (!stopping_) {
+            wakeup_.wait_for(lock, std::chrono::milliseconds(config_.GetInt("Indexes.RefreshMs")),
+                [this] { return stopping_ || pending_; });
+            if (stopping_) {
+                break;
+            }
+            pending_ = false;
+            lock.unlock();
+            RefreshNow();
+            lock.lock();
+        }
+    }
+
+} // namespace KeToanApp
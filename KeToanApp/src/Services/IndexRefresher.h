@@ -0,0 +1,74 @@
+#pragma once
+
+#include "KeToanApp/Common.h"
+#include "KeToanApp/Types.h"
+#include "../Core/Config.h"
+#include "../Database/DatabaseManager.h"
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace KeToanApp {
+
+    // Background thread that keeps the in-memory indexes current.
+    //
+    // Every Indexes.RefreshMs, or as soon as Notify() is called (the posting
+    // queue does after each commit), it reads the ChangeLog head through a
+    // read view. When the head has moved since the last complete pass, it
+    // calls each registered refresh in turn; every index reads its own
+    // changes, so a pass covers commits from any writer. A refresh that
+    // fails is logged and the pass retried on the next wakeup.
+    class IndexRefresher {
+    public:
+        using RefreshFunction = std::function<bool()>;
+
+        IndexRefresher(DatabaseManager& database, Config& config);
+        ~IndexRefresher();
+
+        // Non-copyable
+        IndexRefresher(const IndexRefresher&) = delete;
+        IndexRefresher& operator=(const IndexRefresher&) = delete;
+
+        // Registers an index; call before Start()
+        void Add(const char* name, RefreshFunction refresh);
+
+        bool Start();
+        void Stop();
+
+        // Wakes the thread for a pass; any thread, any time
+        void Notify();
+
+        // One pass on the calling thread. False if a refresh failed.
+        bool RefreshNow();
+
+        // Completed passes that found new changes
+        uint64_t GetPasses() const;
+
+    private:
+        struct Entry {
+            const char* name;
+            RefreshFunction refresh;
+        };
+
+        DatabaseManager& database_;
+        Config& config_;
+        std::vector<Entry> entries_;
+
+        // Serializes passes; appliedHead_ is the ChangeLog head all entries
+        // have seen
+        mutable std::mutex passMutex_;
+        int64_t appliedHead_;
+        uint64_t passes_;
+
+        std::mutex threadMutex_;
+        std::condition_variable wakeup_;
+        std::thread worker_;
+        bool pending_;
+        bool stopping_;
+
+        void Run();
+    };
+
+} // namespace KeToanApp
@@ -0,0 +1,368 @@
+#include "LotAllocator.h"
+#include "../Database/ChangeFeed.h"
+#include "../Utils/DateTimeHelper.h"
+#include "../Utils/Logger.h"
+#include "../Utils/Trace.h"
+#include <algorithm>
+#include <chrono>
+#include <unordered_set>
+
+namespace KeToanApp {
+
+    namespace {
+
+        const char* kActiveLotsQuery =
+            "SELECT ID, MaSP, MaKho, SoLo, HanDung, SoLuongCon FROM LoHang WHERE SoLuongCon > 0 ORDER BY ID";
+
+        // Lots stamped at or after the ChangeLog head last read; a lot
+        // written after that read carries at least that head
+        const char* kChangedLotsQuery =
+            "SELECT ID, MaSP, MaKho, SoLo, HanDung, SoLuongCon FROM LoHang WHERE ChangeSeq >= ?1 ORDER BY ID";
+
+        const size_t kChangeBatch = 1000;
+
+        uint64_t GroupOf(uint32_t product, uint32_t warehouse) {
+            return static_cast<uint64_t>(product) << 32 | warehouse;
+        }
+
+    } // namespace
+
+    LotAllocator::LotAllocator(DatabaseManager& database, CodeDictionary& codes)
+        : database_(database)
+        , codes_(codes)
+        , built_(false)
+        , changeSeq_(0)
+        , cursor_(database)
+    {
+    }
+
+    bool LotAllocator::Later(const HeapEntry& a, const HeapEntry& b) {
+        return a.expiry != b.expiry ? a.expiry > b.expiry : a.lot > b.lot;
+    }
+
+    bool LotAllocator::Earlier(const HeapEntry& a, const HeapEntry& b) {
+        return Later(b, a);
+    }
+
+    void LotAllocator::ReadLots(Statement& stmt, std::vector<LotRow>& rows) {
+        while (stmt.Step()) {
+            LotRow row;
+            row.id = stmt.ColumnInt64(0);
+            row.group = GroupOf(codes_.Intern(CodeKind::Product, stmt.ColumnTextView(1)),
+                codes_.Intern(CodeKind::Warehouse, stmt.ColumnTextView(2)));
+            row.soLo = stmt.ColumnText(3);
+            row.expiry = kNoExpiry;
+            if (!stmt.ColumnIsNull(4)) {
+                std::string_view hanDung = stmt.ColumnTextView(4);
+                if (!DateTimeHelper::ParseDayNumber(hanDung.data(), hanDung.size(), row.expiry)) {
+                    Logger::Warning("Lot allocator: lot %lld has an invalid expiry date; treated as not expiring",
+                        static_cast<long long>(row.id));
+                    row.expiry = kNoExpiry;
+                }
+            }
+            row.onHand = Money::FromDouble(stmt.ColumnDouble(5)).units;
+            rows.push_back(std::move(row));
+        }
+    }
+
+    bool LotAllocator::Build() {
+        KETOAN_TRACE_SCOPE("engine", "LotAllocator.Build");
+        std::lock_guard<std::mutex> refreshLock(refreshMutex_);
+        return Rebuild();
+    }
+
+    bool LotAllocator::Rebuild() {
+        auto started = std::chrono::steady_clock::now();
+
+        std::unique_ptr<ReadView> view = database_.OpenReadView();
+        if (!view) {
+            Logger::Error("Lot allocator: no read view available");
+            return false;
+        }
+
+        const int64_t head = ChangeFeed::GetHeadSequence(*view);
+        std::vector<LotRow> rows;
+        try {
+            auto stmt = view->Prepare(kActiveLotsQuery);
+            ReadLots(*stmt, rows);
+        }
+        catch (const DatabaseException& e) {
+            Logger::Error("Lot allocator: reading lots failed: %s", e.what());
+            return false;
+        }
+        view.reset();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        lots_.clear();
+        lotIndex_.clear();
+        heaps_.clear();
+        lots_.reserve(rows.size());
+        lotIndex_.reserve(rows.size());
+
+        // Heapify each group once rather than pushing lot by lot
+        for (auto& row : rows) {
+            const uint32_t index = static_cast<uint32_t>(lots_.size());
+            lots_.push_back({ row.id, std::move(row.soLo), row.group, row.expiry, row.onHand, 0, 0, true });
+            lotIndex_.emplace(row.id, index);
+            heaps_[row.group].usable.push_back({ row.expiry, index, 0 });
+        }
+        for (auto& heap : heaps_) {
+            std::make_heap(heap.second.usable.begin(), heap.second.usable.end(), Later);
+        }
+
+        // Documents picked before the rebuild still hold their lots
+        for (const auto& hold : holds_) {
+            for (const auto& lot : hold.second) {
+                Hold(lot.first, lot.second);
+            }
+        }
+
+        changeSeq_ = head;
+        cursor_.Set(head);
+        built_ = true;
+
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - started);
+        Logger::Info("Lot allocator built: %zu lots with stock in %zu heaps in %lld ms",
+            lots_.size(), heaps_.size(), static_cast<long long>(elapsed.count()));
+        return true;
+    }
+
+    bool LotAllocator::Refresh() {
+        KETOAN_TRACE_SCOPE("engine", "LotAllocator.Refresh");
+        std::lock_guard<std::mutex> refreshLock(refreshMutex_);
+        if (!built_) {
+            return Rebuild();
+        }
+
+        std::unique_ptr<ReadView> view = database_.OpenReadView();
+        if (!view) {
+            Logger::Error("Lot allocator: no read view available");
+            return false;
+        }
+
+        // Lots and the documents whose lines they now include, from one snapshot
+        const int64_t head = ChangeFeed::GetHeadSequence(*view);
+        std::vector<LotRow> rows;
+        std::unordered_set<std::string> committed;
+        try {
+            auto stmt = view->Prepare(kChangedLotsQuery);
+            stmt->BindInt64(1, changeSeq_);
+            ReadLots(*stmt, rows);
+
+            std::vector<ChangeRecord> records;
+            int64_t seq = changeSeq_;
+            do {
+                records.clear();
+                if (!ChangeFeed::ReadChanges(*view, seq, kChangeBatch, records)) {
+                    break;
+                }
+                for (const auto& record : records) {
+                    seq = record.seq;
+                    if (record.tableName == "PhieuXuat") {
+                        committed.insert(record.rowKey);
+                    }
+                }
+            } while (records.size() == kChangeBatch);
+        }
+        catch (const DatabaseException& e) {
+            Logger::Error("Lot allocator: reading changed lots failed: %s", e.what());
+            return false;
+        }
+        view.reset();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& row : rows) {
+            Update(row);
+        }
+        for (const auto& soPhieu : committed) {
+            auto it = holds_.find(soPhieu);
+            if (it == holds_.end()) {
+                continue;
+            }
+            for (const auto& lot : it->second) {
+                Hold(lot.first, -lot.second);
+            }
+            holds_.erase(it);
+        }
+        changeSeq_ = head;
+        cursor_.Set(head);
+
+        Logger::Debug("Lot allocator refresh: %zu lots re-read", rows.size());
+        return true;
+    }
+
+    void LotAllocator::Update(const LotRow& row) {
+        auto it = lotIndex_.find(row.id);
+        if (it == lotIndex_.end()) {
+            if (row.onHand <= 0) {
+                return;
+            }
+            const uint32_t index = static_cast<uint32_t>(lots_.size());
+            lots_.push_back({ row.id, row.soLo, row.group, row.expiry, row.onHand, 0, 0, false });
+            lotIndex_.emplace(row.id, index);
+            Push(index);
+            return;
+        }
+
+        Lot& lot = lots_[it->second];
+        if (lot.group != row.group || lot.expiry != row.expiry) {
+            // The old entry goes stale; it is dropped when it reaches the top
+            lot.group = row.group;
+            lot.expiry = row.expiry;
+            ++lot.generation;
+            lot.queued = false;
+        }
+        lot.soLo = row.soLo;
+        lot.onHand = row.onHand;
+        Push(it->second);
+    }
+
+    void LotAllocator::Push(uint32_t index) {
+        Lot& lot = lots_[index];
+        if (lot.queued || lot.Available() <= 0) {
+            return;
+        }
+        auto& usable = heaps_[lot.group].usable;
+        usable.push_back({ lot.expiry, index, lot.generation });
+        std::push_heap(usable.begin(), usable.end(), Later);
+        lot.queued = true;
+    }
+
+    void LotAllocator::Hold(int64_t lotId, int64_t quantity) {
+        auto it = lotIndex_.find(lotId);
+        if (it != lotIndex_.end()) {
+            lots_[it->second].held += quantity;
+            Push(it->second);
+        }
+    }
+
+    bool LotAllocator::FindGroup(std::string_view maSP, std::string_view maKho, uint64_t& group) const {
+        const uint32_t product = codes_.Find(CodeKind::Product, maSP);
+        const uint32_t warehouse = codes_.Find(CodeKind::Warehouse, maKho);
+        if (product == CodeDictionary::kNotFound || warehouse == CodeDictionary::kNotFound) {
+            return false;
+        }
+        group = GroupOf(product, warehouse);
+        return true;
+    }
+
+    bool LotAllocator::Allocate(const std::string& soPhieu, std::string_view maSP, std::string_view maKho,
+        Money quantity, DayNumber day, std::vector<LotAllocation>& allocations) {
+        allocations.clear();
+        if (quantity.units <= 0) {
+            return true;
+        }
+
+        uint64_t group = 0;
+        if (!FindGroup(maSP, maKho, group)) {
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = heaps_.find(group);
+        if (it == heaps_.end()) {
+            return false;
+        }
+        auto& usable = it->second.usable;
+        auto& expired = it->second.expired;
+
+        // Lots a back-dated issue can still use come back first
+        while (!expired.empty() && expired.front().expiry >= day) {
+            const HeapEntry entry = expired.front();
+            std::pop_heap(expired.begin(), expired.end(), Earlier);
+            expired.pop_back();
+            if (entry.generation == lots_[entry.lot].generation) {
+                usable.push_back(entry);
+                std::push_heap(usable.begin(), usable.end(), Later);
+            }
+        }
+
+        std::vector<std::pair<uint32_t, int64_t>> picks;
+        int64_t needed = quantity.units;
+        while (needed > 0 && !usable.empty()) {
+            const HeapEntry top = usable.front();
+            Lot& lot = lots_[top.lot];
+            const bool current = top.generation == lot.generation;
+            if (!current || lot.Available() <= 0 || top.expiry < day) {
+                std::pop_heap(usable.begin(), usable.end(), Later);
+                usable.pop_back();
+                if (current && lot.Available() > 0) {
+                    expired.push_back(top);
+                    std::push_heap(expired.begin(), expired.end(), Earlier);
+                }
+                else if (current) {
+                    lot.queued = false;
+                }
+                continue;
+            }
+
+            const int64_t taken = std::min(lot.Available(), needed);
+            lot.held += taken;
+            needed -= taken;
+            picks.emplace_back(top.lot, taken);
+            if (lot.Available() == 0) {
+                std::pop_heap(usable.begin(), usable.end(), Later);
+                usable.pop_back();
+                lot.queued = false;
+            }
+        }
+
+        if (needed > 0) {
+            for (const auto& pick : picks) {
+                lots_[pick.first].held -= pick.second;
+                Push(pick.first);
+            }
+            return false;
+        }
+
+        auto& hold = holds_[soPhieu];
+        for (const auto& pick : picks) {
+            const Lot& lot = lots_[pick.first];
+            hold.emplace_back(lot.id, pick.second);
+            allocations.push_back({ lot.id, lot.soLo, lot.expiry, Money::FromUnits(pick.second) });
+        }
+        return true;
+    }
+
+    void LotAllocator::Release(const std::string& soPhieu) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = holds_.find(soPhieu);
+        if (it == holds_.end()) {
+            return;
+        }
+        for (const auto& lot : it->second) {
+            Hold(lot.first, -lot.second);
+        }
+        holds_.erase(it);
+    }
+
+    Money LotAllocator::GetAvailable(std::string_view maSP, std::string_view maKho, DayNumber day) const {
+        uint64_t group = 0;
+        if (!FindGroup(maSP, maKho, group)) {
+            return Money();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = heaps_.find(group);
+        if (it == heaps_.end()) {
+            return Money();
+        }
+        int64_t available = 0;
+        for (const auto* entries : { &it->second.usable, &it->second.expired }) {
+            for (const auto& entry : *entries) {
+                const Lot& lot = lots_[entry.lot];
+                if (entry.generation == lot.generation && entry.expiry >= day && lot.Available() > 0) {
+                    available += lot.Available();
+                }
+            }
+        }
+        return Money::FromUnits(available);
+    }
+
+    size_t LotAllocator::GetLotCount() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return lots_.size();
+    }
+
+} // namespace KeToanApp
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "KeToanApp/Common.h"
+#include "KeToanApp/Types.h"
+#include "../Database/ChangeFeed.h"
+#include "../Database/DatabaseManager.h"
+#include "CodeDictionary.h"
+#include <cstdint>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+
+namespace KeToanApp {
+
+    // Quantity of one lot picked for an issue
+    struct LotAllocation {
+        int64_t lotId;          // LoHang.ID, for ChiTietPhieuXuat.LoHangID
+        std::string soLo;
+        DayNumber expiry;       // LotAllocator::kNoExpiry if the lot does not expire
+        Money quantity;
+    };
+
+    // First-expiry-first-out (FEFO) allocation of lots for PhieuXuat lines.
+    //
+    // Lots with stock are kept in one binary min-heap per product and
+    // warehouse, ordered by HanDung, then by lot. Allocating takes lots off
+    // the top until the quantity is covered, so a pick of k lots costs
+    // O(k log lots). Lots expired by the issue date move to a max-heap of
+    // expired lots beside it, and back when a back-dated issue can still
+    // use them; as issue dates mostly move forward, each lot crosses once.
+    //
+    // Picked quantities are held for the document until a change of it is
+    // committed and seen by Refresh(), when LoHang.SoLuongCon includes its
+    // lines; Release() drops them if the document is abandoned. Refresh()
+    // re-reads the lots stamped since the last refresh (LoHang.ChangeSeq),
+    // so receipts, issues, edits and voids all reach the heaps. A lot whose
+    // product, warehouse or expiry changes gets a new heap entry; the old
+    // one is dropped when it reaches the top.
+    class LotAllocator {
+    public:
+        static const DayNumber kNoExpiry = INT32_MAX;
+
+        LotAllocator(DatabaseManager& database, CodeDictionary& codes);
+        ~LotAllocator() = default;
+
+        // Non-copyable
+        LotAllocator(const LotAllocator&) = delete;
+        LotAllocator& operator=(const LotAllocator&) = delete;
+
+        bool Build();
+        // Applies lot changes committed since the last Build() or Refresh();
+        // builds the allocator if it has not been built
+        bool Refresh();
+
+        // Lots of maSP in maKho covering quantity for an issue dated day,
+        // earliest expiry first, held for soPhieu. False, holding nothing,
+        // if the lots usable on that day do not cover it.
+        bool Allocate(const std::string& soPhieu, std::string_view maSP, std::string_view maKho,
+            Money quantity, DayNumber day, std::vector<LotAllocation>& allocations);
+        // Drops what is held for soPhieu
+        void Release(const std::string& soPhieu);
+
+        // On hand less held, over lots usable on day
+        Money GetAvailable(std::string_view maSP, std::string_view maKho, DayNumber day) const;
+        size_t GetLotCount() const;
+
+    private:
+        struct Lot {
+            int64_t id;
+            std::string soLo;
+            uint64_t group;         // product id << 32 | warehouse id
+            DayNumber expiry;
+            int64_t onHand;         // Money units, SoLuongCon
+            int64_t held;           // Money units, picked and not yet committed
+            uint32_t generation;    // bumped when group or expiry changes
+            bool queued;            // has a current entry in either heap of its group
+
+            int64_t Available() const { return onHand - held; }
+        };
+
+        struct HeapEntry {
+            DayNumber expiry;
+            uint32_t lot;
+            uint32_t generation;
+        };
+
+        struct Heap {
+            std::vector<HeapEntry> usable;      // min-heap, by Later
+            std::vector<HeapEntry> expired;     // max-heap, by Earlier; expired before the last issue date
+        };
+
+        // Lot as read from LoHang, applied under the lock
+        struct LotRow {
+            int64_t id;
+            std::string soLo;
+            uint64_t group;
+            DayNumber expiry;
+            int64_t onHand;
+        };
+
+        DatabaseManager& database_;
+        CodeDictionary& codes_;
+
+        mutable std::mutex mutex_;
+        std::mutex refreshMutex_;
+
+        std::vector<Lot> lots_;
+        std::unordered_map<int64_t, uint32_t> lotIndex_;                // LoHang.ID -> lots_ index
+        std::unordered_map<uint64_t, Heap> heaps_;                      // by group
+        std::unordered_map<std::string, std::vector<std::pair<int64_t, int64_t>>> holds_;   // soPhieu -> lot ID, quantity
+        bool built_;
+        int64_t changeSeq_;     // ChangeLog head when lots were last read
+        ChangeCursor cursor_;   // issues it has not seen stay in the ChangeLog
+
+        bool Rebuild();
+        void ReadLots(Statement& stmt, std::vector<LotRow>& rows);
+        void Update(const LotRow& row);
+        void Push(uint32_t lot);
+        void Hold(int64_t lotId, int64_t quantity);
+        bool FindGroup(std::string_view maSP, std::string_view maKho, uint64_t& group) const;
+
+        // Orders for std::push_heap and friends: Later makes a min-heap
+        static bool Later(const HeapEntry& a, const HeapEntry& b);
+        static bool Earlier(const HeapEntry& a, const HeapEntry& b);
+    };
+
+} // namespace KeToanApp
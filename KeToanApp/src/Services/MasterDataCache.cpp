@@ -0,0 +1,325 @@
+#include "MasterDataCache.h"
+#include "../Database/ChangeFeed.h"
+#include "../Utils/Logger.h"
+#include <algorithm>
+#include <chrono>
+#include <functional>
+
+namespace KeToanApp {
+
+    namespace {
+
+        // Stripe of the calling thread, fixed for its lifetime
+        size_t ThreadStripe(size_t stripes) {
+            thread_local const size_t stripe = std::hash<std::thread::id>()(std::this_thread::get_id());
+            return stripe % stripes;
+        }
+
+    } // namespace
+
+    void StringColumn::Add(std::string_view value) {
+        bytes_.append(value.data(), value.size());
+        ends_.push_back(static_cast<uint32_t>(bytes_.size()));
+    }
+
+    uint32_t CodeIndex::Hash(std::string_view code) {
+        // FNV-1a
+        uint32_t hash = 2166136261u;
+        for (unsigned char c : code) {
+            hash = (hash ^ c) * 16777619u;
+        }
+        return hash;
+    }
+
+    void CodeIndex::Build(const StringColumn& codes) {
+        size_t capacity = 16;
+        while (capacity < codes.GetCount() * 2) {
+            capacity <<= 1;
+        }
+        slots_.assign(capacity, Slot{ 0, kNotFound });
+        mask_ = static_cast<uint32_t>(capacity - 1);
+
+        for (uint32_t row = 0; row < codes.GetCount(); ++row) {
+            const uint32_t hash = Hash(codes.Get(row));
+            uint32_t slot = hash & mask_;
+            while (slots_[slot].row != kNotFound) {
+                slot = (slot + 1) & mask_;
+            }
+            slots_[slot] = Slot{ hash, row };
+        }
+    }
+
+    uint32_t CodeIndex::Find(const StringColumn& codes, std::string_view code) const {
+        if (slots_.empty()) {
+            return kNotFound;
+        }
+        const uint32_t hash = Hash(code);
+        for (uint32_t slot = hash & mask_; slots_[slot].row != kNotFound; slot = (slot + 1) & mask_) {
+            if (slots_[slot].hash == hash && codes.Get(slots_[slot].row) == code) {
+                return slots_[slot].row;
+            }
+        }
+        return kNotFound;
+    }
+
+    uint32_t MasterData::FindProduct(std::string_view maSP) const {
+        return products_->index.Find(products_->codes, maSP);
+    }
+
+    uint32_t MasterData::FindAccount(std::string_view soTK) const {
+        return accounts_->index.Find(accounts_->codes, soTK);
+    }
+
+    MasterDataCache::Reader::Reader(const MasterDataCache& cache) {
+        Stripe& stripe = cache.stripes_[ThreadStripe(kStripes)];
+        // Register under the current epoch; if a publisher advanced it
+        // meanwhile, it may not wait for this counter, so register again
+        while (true) {
+            const uint64_t epoch = cache.epoch_.load();
+            counter_ = &stripe.readers[epoch & 1];
+            counter_->fetch_add(1);
+            if (cache.epoch_.load() == epoch) {
+                break;
+            }
+            counter_->fetch_sub(1);
+        }
+        data_ = cache.current_.load();
+    }
+
+    MasterDataCache::Reader::~Reader() {
+        counter_->fetch_sub(1, std::memory_order_release);
+    }
+
+    MasterDataCache::MasterDataCache(DatabaseManager& database, Config& config, CodeDictionary& codes)
+        : database_(database)
+        , config_(config)
+        , codes_(codes)
+        , current_(nullptr)
+        , epoch_(0)
+        , version_(0)
+        , changeSeq_(0)
+        , cursor_(database)
+        , stopping_(false)
+    {
+        config_.DeclareInt("MasterData.RefreshMs", 1000, 50, 600000);
+
+        for (auto& stripe : stripes_) {
+            stripe.readers[0] = 0;
+            stripe.readers[1] = 0;
+        }
+
+        // Empty until Load(), so readers never see a null snapshot
+        auto empty = std::make_unique<MasterData>();
+        auto products = std::make_shared<MasterData::ProductTable>();
+        products->index.Build(products->codes);
+        auto accounts = std::make_shared<MasterData::AccountTable>();
+        accounts->index.Build(accounts->codes);
+        empty->products_ = std::move(products);
+        empty->accounts_ = std::move(accounts);
+        current_ = empty.release();
+    }
+
+    MasterDataCache::~MasterDataCache() {
+        Stop();
+        delete current_.load();
+    }
+
+    bool MasterDataCache::Load() {
+        std::lock_guard<std::mutex> lock(writeMutex_);
+        return Reload(true, true);
+    }
+
+    bool MasterDataCache::Refresh() {
+        std::lock_guard<std::mutex> lock(writeMutex_);
+
+        std::unique_ptr<ReadView> view = database_.OpenReadView();
+        if (!view) {
+            return false;
+        }
+        const int64_t head = ChangeFeed::GetHeadSequence(*view);
+        if (head == changeSeq_) {
+            return true;
+        }
+
+        bool products = false;
+        bool accounts = false;
+        try {
+            // Entries purged before this cache saw them: reload everything
+            auto first = view->Prepare("SELECT MIN(Seq) FROM ChangeLog WHERE Seq > ?1");
+            first->BindInt64(1, changeSeq_);
+            if (first->Step() && !first->ColumnIsNull(0) && first->ColumnInt64(0) > changeSeq_ + 1) {
+                products = accounts = true;
+            }
+
+            auto tables = view->Prepare(
+                "SELECT DISTINCT TableName FROM ChangeLog WHERE Seq > ?1 AND Seq <= ?2 "
+                "AND TableName IN ('SanPham', 'TaiKhoanKeToan')");
+            tables->BindInt64(1, changeSeq_).BindInt64(2, head);
+            while (tables->Step()) {
+                std::string_view table = tables->ColumnTextView(0);
+                products |= table == "SanPham";
+                accounts |= table == "TaiKhoanKeToan";
+            }
+        }
+        catch (const DatabaseException& e) {
+            Logger::Error("Master data: reading change log failed: %s", e.what());
+            return false;
+        }
+        view.reset();
+
+        if (!products && !accounts) {
+            changeSeq_ = head;
+            cursor_.Set(head);
+            return true;
+        }
+        return Reload(products, accounts);
+    }
+
+    bool MasterDataCache::Reload(bool products, bool accounts) {
+        std::unique_ptr<ReadView> view = database_.OpenReadView();
+        if (!view) {
+            Logger::Error("Master data: no read view available");
+            return false;
+        }
+
+        // The writer holds writeMutex_, so current_ cannot be freed here
+        auto next = std::make_unique<MasterData>(*current_.load());
+        int64_t head = 0;
+        try {
+            head = ChangeFeed::GetHeadSequence(*view);
+            if (products) {
+                next->products_ = LoadProducts(*view);
+            }
+            if (accounts) {
+                next->accounts_ = LoadAccounts(*view);
+            }
+        }
+        catch (const DatabaseException& e) {
+            Logger::Error("Master data: loading failed: %s", e.what());
+            return false;
+        }
+
+        Logger::Info("Master data %s: %zu products, %zu accounts",
+            products && accounts ? "loaded" : "reloaded", next->GetProductCount(), next->GetAccountCount());
+        Publish(std::move(next));
+        changeSeq_ = head;
+        cursor_.Set(head);
+        return true;
+    }
+
+    void MasterDataCache::Publish(std::unique_ptr<MasterData> next) {
+        const MasterData* previous = current_.exchange(next.release());
+
+        // Readers registered under the old epoch may still use previous;
+        // new ones register under the next epoch and see the new snapshot
+        const uint64_t epoch = epoch_.fetch_add(1);
+        for (auto& stripe : stripes_) {
+            while (stripe.readers[epoch & 1].load() != 0) {
+                std::this_thread::yield();
+            }
+        }
+
+        delete previous;
+        ++version_;
+    }
+
+    std::shared_ptr<const MasterData::ProductTable> MasterDataCache::LoadProducts(ReadView& view) {
+        auto table = std::make_shared<MasterData::ProductTable>();
+        auto stmt = view.Prepare(
+            "SELECT MaSP, TenSP, DonViTinh, NhomHang, GiaMua, GiaBan, COALESCE(TrangThai, 1) FROM SanPham");
+        while (stmt->Step()) {
+            table->codes.Add(stmt->ColumnTextView(0));
+            table->names.Add(stmt->ColumnTextView(1));
+            table->units.Add(stmt->ColumnTextView(2));
+            table->groups.Add(stmt->ColumnTextView(3));
+            table->purchasePrice.push_back(Money::FromDouble(stmt->ColumnDouble(4)).units);
+            table->salePrice.push_back(Money::FromDouble(stmt->ColumnDouble(5)).units);
+            table->active.push_back(stmt->ColumnInt64(6) == static_cast<int64_t>(TrangThai::HoatDong) ? 1 : 0);
+            table->ids.push_back(codes_.Intern(CodeKind::Product, stmt->ColumnTextView(0)));
+        }
+        table->index.Build(table->codes);
+        table->rowOfId = MapIds(table->ids);
+        return table;
+    }
+
+    std::shared_ptr<const MasterData::AccountTable> MasterDataCache::LoadAccounts(ReadView& view) {
+        auto table = std::make_shared<MasterData::AccountTable>();
+        StringColumn parents;
+        auto stmt = view.Prepare(
+            "SELECT SoTK, TenTK, COALESCE(LoaiTK, 0), COALESCE(CapDo, 1), COALESCE(TrangThai, 1), "
+            "COALESCE(TKCha, '') FROM TaiKhoanKeToan");
+        while (stmt->Step()) {
+            table->codes.Add(stmt->ColumnTextView(0));
+            table->names.Add(stmt->ColumnTextView(1));
+            table->type.push_back(static_cast<uint8_t>(stmt->ColumnInt64(2)));
+            table->level.push_back(static_cast<uint8_t>(stmt->ColumnInt64(3)));
+            table->flags.push_back(static_cast<uint8_t>(MasterData::kLeaf
+                | (stmt->ColumnInt64(4) == static_cast<int64_t>(TrangThai::HoatDong) ? MasterData::kActive : 0)));
+            parents.Add(stmt->ColumnTextView(5));
+            table->ids.push_back(codes_.Intern(CodeKind::Account, stmt->ColumnTextView(0)));
+        }
+        table->index.Build(table->codes);
+        table->rowOfId = MapIds(table->ids);
+
+        // Parents by row; an account named as parent is not a leaf
+        table->parent.resize(table->codes.GetCount());
+        for (uint32_t row = 0; row < table->parent.size(); ++row) {
+            const uint32_t parent = table->index.Find(table->codes, parents.Get(row));
+            table->parent[row] = parent;
+            if (parent != MasterData::kNotFound) {
+                table->flags[parent] &= static_cast<uint8_t>(~MasterData::kLeaf);
+            }
+        }
+        return table;
+    }
+
+    std::vector<uint32_t> MasterDataCache::MapIds(const std::vector<uint32_t>& ids) {
+        uint32_t end = 0;
+        for (uint32_t id : ids) {
+            end = (std::max)(end, id + 1);
+        }
+        std::vector<uint32_t> rowOfId(end);
+        std::fill(rowOfId.begin(), rowOfId.end(), static_cast<uint32_t>(MasterData::kNotFound));
+        for (uint32_t row = 0; row < ids.size(); ++row) {
+            rowOfId[ids[row]] = row;
+        }
+        return rowOfId;
+    }
+
+    bool MasterDataCache::Start() {
+        std::lock_guard<std::mutex> lock(threadMutex_);
+        if (worker_.joinable()) {
+            return true;
+        }
+        stopping_ = false;
+        worker_ = std::thread(&MasterDataCache::Run, this);
+        return true;
+    }
+
+    void MasterDataCache::Stop() {
+        {
+            std::lock_guard<std::mutex> lock(threadMutex_);
+            if (!worker_.joinable()) {
+                return;
+            }
+            stopping_ = true;
+            wakeup_.notify_all();
+        }
+        worker_.join();
+    }
+
+    void MasterDataCache::Run() {
+        std::unique_lock<std::mutex> lock(threadMutex_);
+        while (!stopping_) {
+            wakeup_.wait_for(lock, std::chrono::milliseconds(config_.GetInt("MasterData.RefreshMs")),
+                [this] { return stopping_; });
+            if (stopping_) {
+                break;
+            }
+            lock.unlock();
+            Refresh();
+            lock.lock();
+        }
+    }
+
+} // namespace KeToanApp
@@ -0,0 +1,220 @@
+#pragma once
+
+#include "KeToanApp/Common.h"
+#include "KeToanApp/Types.h"
+#include "../Core/Config.h"
+#include "../Database/ChangeFeed.h"
+#include "../Database/DatabaseManager.h"
+#include "CodeDictionary.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string_view>
+#include <thread>
+
+namespace KeToanApp {
+
+    // Strings of one column, stored back to back
+    class StringColumn {
+    public:
+        void Add(std::string_view value);
+        std::string_view Get(uint32_t row) const {
+            const uint32_t begin = row ? ends_[row - 1] : 0;
+            return std::string_view(bytes_.data() + begin, ends_[row] - begin);
+        }
+        size_t GetCount() const { return ends_.size(); }
+
+    private:
+        std::string bytes_;
+        std::vector<uint32_t> ends_;
+    };
+
+    // Open-addressing index from code to row, linear probing over a
+    // power-of-two table at most half full. Slots keep the code's hash, so
+    // a probe compares strings only on a hash match.
+    class CodeIndex {
+    public:
+        static const uint32_t kNotFound = UINT32_MAX;
+
+        void Build(const StringColumn& codes);
+        uint32_t Find(const StringColumn& codes, std::string_view code) const;
+
+    private:
+        struct Slot {
+            uint32_t hash;
+            uint32_t row;       // kNotFound = empty
+        };
+
+        std::vector<Slot> slots_;
+        uint32_t mask_ = 0;
+
+        static uint32_t Hash(std::string_view code);
+    };
+
+    // Immutable copy of SanPham and TaiKhoanKeToan, attributes held column
+    // by column and addressed by dense row number. Engines that hold
+    // CodeDictionary ids map them to rows with ProductRow()/AccountRow(),
+    // an array lookup.
+    class MasterData {
+    public:
+        static const uint32_t kNotFound = CodeIndex::kNotFound;
+
+        // SanPham
+        uint32_t FindProduct(std::string_view maSP) const;
+        size_t GetProductCount() const { return products_->codes.GetCount(); }
+        std::string_view ProductCode(uint32_t row) const { return products_->codes.Get(row); }
+        std::string_view ProductName(uint32_t row) const { return products_->names.Get(row); }
+        std::string_view ProductUnit(uint32_t row) const { return products_->units.Get(row); }
+        std::string_view ProductGroup(uint32_t row) const { return products_->groups.Get(row); }
+        Money PurchasePrice(uint32_t row) const { return Money::FromUnits(products_->purchasePrice[row]); }
+        Money SalePrice(uint32_t row) const { return Money::FromUnits(products_->salePrice[row]); }
+        bool IsProductActive(uint32_t row) const { return products_->active[row] != 0; }
+        uint32_t ProductId(uint32_t row) const { return products_->ids[row]; }
+        uint32_t ProductRow(uint32_t id) const {
+            return id < products_->rowOfId.size() ? products_->rowOfId[id] : kNotFound;
+        }
+
+        // TaiKhoanKeToan
+        uint32_t FindAccount(std::string_view soTK) const;
+        size_t GetAccountCount() const { return accounts_->codes.GetCount(); }
+        std::string_view AccountCode(uint32_t row) const { return accounts_->codes.Get(row); }
+        std::string_view AccountName(uint32_t row) const { return accounts_->names.Get(row); }
+        int AccountType(uint32_t row) const { return accounts_->type[row]; }    // LoaiTaiKhoan, 0 if unset
+        uint32_t AccountParent(uint32_t row) const { return accounts_->parent[row]; }
+        int AccountLevel(uint32_t row) const { return accounts_->level[row]; }
+        bool IsAccountActive(uint32_t row) const { return (accounts_->flags[row] & kActive) != 0; }
+        bool IsLeafAccount(uint32_t row) const { return (accounts_->flags[row] & kLeaf) != 0; }
+        uint32_t AccountId(uint32_t row) const { return accounts_->ids[row]; }
+        uint32_t AccountRow(uint32_t id) const {
+            return id < accounts_->rowOfId.size() ? accounts_->rowOfId[id] : kNotFound;
+        }
+
+    private:
+        friend class MasterDataCache;
+
+        enum : uint8_t { kActive = 1, kLeaf = 2 };
+
+        struct ProductTable {
+            StringColumn codes;
+            CodeIndex index;
+            StringColumn names;
+            StringColumn units;
+            StringColumn groups;
+            std::vector<int64_t> purchasePrice;     // Money units
+            std::vector<int64_t> salePrice;
+            std::vector<uint8_t> active;
+            std::vector<uint32_t> ids;              // CodeKind::Product
+            std::vector<uint32_t> rowOfId;          // kNotFound for ids not in the table
+        };
+
+        struct AccountTable {
+            StringColumn codes;
+            CodeIndex index;
+            StringColumn names;
+            std::vector<uint8_t> type;
+            std::vector<uint32_t> parent;           // row of TKCha, kNotFound for top level
+            std::vector<uint8_t> level;
+            std::vector<uint8_t> flags;
+            std::vector<uint32_t> ids;              // CodeKind::Account
+            std::vector<uint32_t> rowOfId;
+        };
+
+        // Tables that did not change are shared between snapshots
+        std::shared_ptr<const ProductTable> products_;
+        std::shared_ptr<const AccountTable> accounts_;
+    };
+
+    // Read-mostly cache of the master tables for posting and validation.
+    //
+    // Load() reads both tables at startup. Refresh(), run every
+    // MasterData.RefreshMs by the thread Start() launches, looks for
+    // ChangeLog entries of SanPham or TaiKhoanKeToan since the last load and
+    // reloads just the tables they name. If entries were purged unseen,
+    // both are reloaded.
+    //
+    // A refresh builds a new snapshot and swaps the pointer, RCU style.
+    // Readers pin the current snapshot with a Reader, which only increments
+    // a striped counter for the current epoch: no lock, no database access.
+    // The publisher advances the epoch and frees the old snapshot once the
+    // counters of the previous epoch drain.
+    //
+    //     MasterDataCache::Reader data(cache);
+    //     uint32_t row = data->FindAccount("1111");
+    //     if (row != MasterData::kNotFound && data->IsLeafAccount(row)) ...
+    class MasterDataCache {
+    public:
+        class Reader {
+        public:
+            explicit Reader(const MasterDataCache& cache);
+            ~Reader();
+
+            // Non-copyable
+            Reader(const Reader&) = delete;
+            Reader& operator=(const Reader&) = delete;
+
+            const MasterData& operator*() const { return *data_; }
+            const MasterData* operator->() const { return data_; }
+
+        private:
+            std::atomic<int64_t>* counter_;
+            const MasterData* data_;
+        };
+
+        MasterDataCache(DatabaseManager& database, Config& config, CodeDictionary& codes);
+        ~MasterDataCache();
+
+        // Non-copyable
+        MasterDataCache(const MasterDataCache&) = delete;
+        MasterDataCache& operator=(const MasterDataCache&) = delete;
+
+        bool Load();
+        bool Refresh();
+
+        // Background refresh
+        bool Start();
+        void Stop();
+
+        // Snapshots published so far
+        uint64_t GetVersion() const { return version_; }
+
+    private:
+        static const size_t kStripes = 16;
+
+        // Readers per epoch parity; one cache line per stripe
+        struct alignas(64) Stripe {
+            std::atomic<int64_t> readers[2];
+        };
+
+        DatabaseManager& database_;
+        Config& config_;
+        CodeDictionary& codes_;
+
+        std::atomic<const MasterData*> current_;
+        std::atomic<uint64_t> epoch_;
+        mutable Stripe stripes_[kStripes];
+        std::atomic<uint64_t> version_;
+
+        // Publishers
+        std::mutex writeMutex_;
+        int64_t changeSeq_;     // ChangeLog position of the current snapshot
+        ChangeCursor cursor_;   // changeSeq_, published to ChangeFeed::Purge()
+
+        // Refresh thread
+        std::mutex threadMutex_;
+        std::condition_variable wakeup_;
+        std::thread worker_;
+        bool stopping_;
+
+        bool Reload(bool products, bool accounts);
+        void Publish(std::unique_ptr<MasterData> next);
+        void Run();
+
+        std::shared_ptr<const MasterData::ProductTable> LoadProducts(ReadView& view);
+        std::shared_ptr<const MasterData::AccountTable> LoadAccounts(ReadView& view);
+
+        // rowOfId of the ids column
+        static std::vector<uint32_t> MapIds(const std::vector<uint32_t>& ids);
+    };
+
+} // namespace KeToanApp
@@ -0,0 +1,479 @@
+#include "PdfWriter.h"
+#include "../Utils/Logger.h"
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <filesystem>
+
+#ifdef KETOAN_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace KeToanApp {
+
+    namespace {
+
+        const char kHeader[] = "%PDF-1.4\n%\xE2\xE3\xCF\xD3\n";
+
+        // Next code point of a UTF-8 string; malformed input yields U+FFFD
+        uint32_t NextCodepoint(std::string_view text, size_t& i) {
+            unsigned char c = static_cast<unsigned char>(text[i++]);
+            if (c < 0x80) {
+                return c;
+            }
+            int extra = c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : c >= 0xC0 ? 1 : -1;
+            if (extra < 0 || i + extra > text.size()) {
+                return 0xFFFD;
+            }
+            uint32_t cp = c & (0x3F >> extra);
+            for (int k = 0; k < extra; ++k) {
+                unsigned char next = static_cast<unsigned char>(text[i]);
+                if ((next & 0xC0) != 0x80) {
+                    return 0xFFFD;
+                }
+                cp = cp << 6 | (next & 0x3F);
+                ++i;
+            }
+            return cp;
+        }
+
+        // Shortest fixed-point form, enough for 1/100 pt. Content streams
+        // hold several numbers per text item, so this avoids printf.
+        std::string Num(double value) {
+            int64_t hundredths = std::llround(value * 100.0);
+            std::string result = hundredths < 0 ? "-" : "";
+            uint64_t magnitude = hundredths < 0 ? 0 - static_cast<uint64_t>(hundredths) : static_cast<uint64_t>(hundredths);
+            result += std::to_string(magnitude / 100);
+            unsigned fraction = static_cast<unsigned>(magnitude % 100);
+            if (fraction != 0) {
+                result += '.';
+                result += static_cast<char>('0' + fraction / 10);
+                if (fraction % 10 != 0) {
+                    result += static_cast<char>('0' + fraction % 10);
+                }
+            }
+            return result;
+        }
+
+        void AppendHex16(std::string& out, uint32_t value) {
+            static const char kDigits[] = "0123456789ABCDEF";
+            const char text[4] = { kDigits[value >> 12 & 0xF], kDigits[value >> 8 & 0xF],
+                kDigits[value >> 4 & 0xF], kDigits[value & 0xF] };
+            out.append(text, sizeof(text));
+        }
+
+        void AppendUtf16Hex(std::string& out, uint32_t cp) {
+            if (cp >= 0x10000) {
+                cp -= 0x10000;
+                AppendHex16(out, 0xD800 + (cp >> 10));
+                AppendHex16(out, 0xDC00 + (cp & 0x3FF));
+            } else {
+                AppendHex16(out, cp);
+            }
+        }
+
+        // Text string for the document information dictionary
+        std::string PdfTextString(const std::string& utf8) {
+            std::string hex = "<FEFF";
+            for (size_t i = 0; i < utf8.size();) {
+                AppendUtf16Hex(hex, NextCodepoint(utf8, i));
+            }
+            return hex + ">";
+        }
+
+        std::string Ref(int id) {
+            return std::to_string(id) + " 0 R";
+        }
+
+    } // namespace
+
+    PdfWriter::PdfWriter()
+        : buffer_(nullptr)
+        , offset_(0)
+        , width_(0.0)
+        , height_(0.0)
+        , pagesId_(0)
+        , resourcesId_(0)
+        , compressionLevel_(3)
+        , inPage_(false)
+        , failed_(false)
+    {
+    }
+
+    PdfWriter::~PdfWriter() {
+        if (IsOpen()) {
+            Close();
+        }
+    }
+
+    bool PdfWriter::Open(const std::string& path, double pageWidth, double pageHeight, int compressionLevel) {
+        out_.open(std::filesystem::u8path(path), std::ios::binary | std::ios::trunc);
+        if (!out_) {
+            Logger::Error("Cannot create %s", path.c_str());
+            return false;
+        }
+        return Start(pageWidth, pageHeight, compressionLevel);
+    }
+
+    bool PdfWriter::OpenBuffer(std::string& buffer, double pageWidth, double pageHeight, int compressionLevel) {
+        buffer.clear();
+        buffer_ = &buffer;
+        return Start(pageWidth, pageHeight, compressionLevel);
+    }
+
+    bool PdfWriter::Start(double pageWidth, double pageHeight, int compressionLevel) {
+        width_ = pageWidth;
+        height_ = pageHeight;
+        compressionLevel_ = std::clamp(compressionLevel, 0, 9);
+        offset_ = 0;
+        failed_ = false;
+        objectOffsets_.clear();
+        pageIds_.clear();
+        fonts_.clear();
+
+        Write(std::string(kHeader, sizeof(kHeader) - 1));
+        pagesId_ = NewObject();
+        resourcesId_ = NewObject();
+        return !failed_;
+    }
+
+    int PdfWriter::LoadFont(const std::string& path) {
+        auto ttf = std::make_shared<TrueTypeFont>();
+        if (!ttf->Open(path)) {
+            return -1;
+        }
+        return AddFont(std::move(ttf));
+    }
+
+    int PdfWriter::AddFont(std::shared_ptr<const TrueTypeFont> ttf) {
+        auto font = std::make_unique<Font>();
+        font->used.assign(ttf->GetGlyphCount(), false);
+        font->ttf = std::move(ttf);
+        font->objectId = NewObject();
+        fonts_.push_back(std::move(font));
+        return static_cast<int>(fonts_.size()) - 1;
+    }
+
+    bool PdfWriter::BeginPage() {
+        if (inPage_ && !EndPage()) {
+            return false;
+        }
+        content_.clear();
+        inPage_ = true;
+        return !failed_;
+    }
+
+    bool PdfWriter::EndPage() {
+        if (!inPage_) {
+            return false;
+        }
+        inPage_ = false;
+
+        int contentsId = NewObject();
+        WriteStream(contentsId, "", content_);
+        content_.clear();
+
+        int pageId = NewObject();
+        BeginObject(pageId);
+        Write("<< /Type /Page /Parent " + Ref(pagesId_) + " /Contents " + Ref(contentsId) + " >>\nendobj\n");
+        pageIds_.push_back(pageId);
+        return !failed_;
+    }
+
+    void PdfWriter::DrawText(int font, double size, double x, double baseline, std::string_view text) {
+        if (font < 0 || font >= static_cast<int>(fonts_.size()) || text.empty()) {
+            return;
+        }
+        Font& f = *fonts_[font];
+
+        content_ += "BT /F" + std::to_string(font) + " " + Num(size) + " Tf "
+            + Num(x) + " " + Num(height_ - baseline) + " Td <";
+        for (size_t i = 0; i < text.size();) {
+            uint32_t cp = NextCodepoint(text, i);
+            uint16_t glyph = f.ttf->GlyphIndex(cp);
+            if (!f.used[glyph]) {
+                f.used[glyph] = true;
+                f.unicode.emplace(glyph, cp);
+            }
+            AppendHex16(content_, glyph);
+        }
+        content_ += "> Tj ET\n";
+    }
+
+    void PdfWriter::DrawGlyphs(int font, double size, double x, double baseline, const GlyphRun& run) {
+        if (font < 0 || font >= static_cast<int>(fonts_.size()) || run.hex.empty()) {
+            return;
+        }
+        Font& f = *fonts_[font];
+
+        for (const auto& glyph : run.glyphs) {
+            if (glyph.first < f.used.size() && !f.used[glyph.first]) {
+                f.used[glyph.first] = true;
+                f.unicode.emplace(glyph.first, glyph.second);
+            }
+        }
+        content_ += "BT /F" + std::to_string(font) + " " + Num(size) + " Tf "
+            + Num(x) + " " + Num(height_ - baseline) + " Td <";
+        content_ += run.hex;
+        content_ += "> Tj ET\n";
+    }
+
+    PdfWriter::GlyphRun PdfWriter::Shape(int font, std::string_view text) const {
+        GlyphRun run;
+        if (font < 0 || font >= static_cast<int>(fonts_.size())) {
+            return run;
+        }
+        const TrueTypeFont& ttf = *fonts_[font]->ttf;
+        uint64_t units = 0;
+        for (size_t i = 0; i < text.size();) {
+            uint32_t cp = NextCodepoint(text, i);
+            uint16_t glyph = ttf.GlyphIndex(cp);
+            run.glyphs.emplace_back(glyph, cp);
+            AppendHex16(run.hex, glyph);
+            units += ttf.Advance(glyph);
+        }
+        run.advance = static_cast<double>(units) / ttf.GetUnitsPerEm();
+        return run;
+    }
+
+    void PdfWriter::DrawLine(double x1, double y1, double x2, double y2, double width) {
+        content_ += Num(width) + " w " + Num(x1) + " " + Num(height_ - y1) + " m "
+            + Num(x2) + " " + Num(height_ - y2) + " l S\n";
+    }
+
+    double PdfWriter::TextWidth(int font, double size, std::string_view text) const {
+        if (font < 0 || font >= static_cast<int>(fonts_.size())) {
+            return 0.0;
+        }
+        const TrueTypeFont& ttf = *fonts_[font]->ttf;
+        uint64_t units = 0;
+        for (size_t i = 0; i < text.size();) {
+            units += ttf.Advance(ttf.GlyphIndex(NextCodepoint(text, i)));
+        }
+        return static_cast<double>(units) * size / ttf.GetUnitsPerEm();
+    }
+
+    double PdfWriter::Ascent(int font, double size) const {
+        if (font < 0 || font >= static_cast<int>(fonts_.size())) {
+            return size * 0.8;
+        }
+        const TrueTypeFont& ttf = *fonts_[font]->ttf;
+        return static_cast<double>(ttf.GetAscent()) * size / ttf.GetUnitsPerEm();
+    }
+
+    bool PdfWriter::Close() {
+        if (!IsOpen()) {
+            return false;
+        }
+        if (inPage_) {
+            EndPage();
+        }
+        if (pageIds_.empty()) {
+            BeginPage();
+            EndPage();
+        }
+
+        std::string fontNames;
+        for (size_t i = 0; i < fonts_.size(); ++i) {
+            WriteFont(*fonts_[i], static_cast<int>(i));
+            fontNames += " /F" + std::to_string(i) + " " + Ref(fonts_[i]->objectId);
+        }
+
+        BeginObject(resourcesId_);
+        Write("<< /Font <<" + fontNames + " >> /ProcSet [/PDF /Text] >>\nendobj\n");
+
+        BeginObject(pagesId_);
+        Write("<< /Type /Pages /MediaBox [0 0 " + Num(width_) + " " + Num(height_) + "] /Resources "
+            + Ref(resourcesId_) + " /Count " + std::to_string(pageIds_.size()) + " /Kids [");
+        std::string kids;
+        for (size_t i = 0; i < pageIds_.size(); ++i) {
+            kids += (i % 10 == 0 ? "\n" : " ") + Ref(pageIds_[i]);
+            if (kids.size() >= 64 * 1024) {
+                Write(kids);
+                kids.clear();
+            }
+        }
+        Write(kids + "\n] >>\nendobj\n");
+
+        int catalogId = NewObject();
+        BeginObject(catalogId);
+        Write("<< /Type /Catalog /Pages " + Ref(pagesId_) + " >>\nendobj\n");
+
+        std::time_t now = std::time(nullptr);
+        std::tm tm = {};
+        localtime_s(&tm, &now);
+        char created[32];
+        sprintf_s(created, "D:%04d%02d%02d%02d%02d%02d", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+            tm.tm_hour, tm.tm_min, tm.tm_sec);
+        int infoId = NewObject();
+        BeginObject(infoId);
+        Write(std::string("<< /Producer (KeToanApp) /CreationDate (") + created + ")"
+            + (title_.empty() ? "" : " /Title " + PdfTextString(title_)) + " >>\nendobj\n");
+
+        uint64_t xrefOffset = offset_;
+        std::string xref = "xref\n0 " + std::to_string(objectOffsets_.size() + 1) + "\n0000000000 65535 f \n";
+        for (uint64_t objectOffset : objectOffsets_) {
+            char entry[24];
+            sprintf_s(entry, "%010llu 00000 n \n", static_cast<unsigned long long>(objectOffset));
+            xref += entry;
+            if (xref.size() >= 64 * 1024) {
+                Write(xref);
+                xref.clear();
+            }
+        }
+        xref += "trailer\n<< /Size " + std::to_string(objectOffsets_.size() + 1) + " /Root " + Ref(catalogId)
+            + " /Info " + Ref(infoId) + " >>\nstartxref\n" + std::to_string(xrefOffset) + "\n%%EOF\n";
+        Write(xref);
+
+        bool ok = !failed_;
+        if (buffer_) {
+            buffer_ = nullptr;
+        } else {
+            out_.close();
+            ok = ok && !out_.fail();
+        }
+        fonts_.clear();
+        return ok;
+    }
+
+    void PdfWriter::WriteFont(Font& font, int index) {
+        const TrueTypeFont& ttf = *font.ttf;
+        const double scale = 1000.0 / ttf.GetUnitsPerEm();
+
+        // Subset tag: six capitals derived from the font and its glyph set
+        uint32_t hash = 2166136261u + static_cast<uint32_t>(index);
+        for (size_t g = 0; g < font.used.size(); ++g) {
+            if (font.used[g]) {
+                hash = (hash ^ static_cast<uint32_t>(g)) * 16777619u;
+            }
+        }
+        std::string name;
+        for (int i = 0; i < 6; ++i, hash /= 26) {
+            name += static_cast<char>('A' + hash % 26);
+        }
+        name += "+" + ttf.GetPostScriptName();
+
+        std::vector<uint16_t> newIds;
+        std::string program = ttf.Subset(font.used, newIds);
+        int fileId = NewObject();
+        WriteStream(fileId, "/Length1 " + std::to_string(program.size()), program);
+
+        // Content streams use the original glyph ids as CIDs
+        std::string cidToGid;
+        for (size_t g = 0; g < font.used.size(); ++g) {
+            if (font.used[g]) {
+                cidToGid.resize((g + 1) * 2, '\0');
+                cidToGid[g * 2] = static_cast<char>(newIds[g] >> 8);
+                cidToGid[g * 2 + 1] = static_cast<char>(newIds[g]);
+            }
+        }
+        int mapId = NewObject();
+        WriteStream(mapId, "", cidToGid);
+
+        const int16_t* box = ttf.GetBoundingBox();
+        int descriptorId = NewObject();
+        BeginObject(descriptorId);
+        Write("<< /Type /FontDescriptor /FontName /" + name + " /Flags 32 /FontBBox ["
+            + Num(box[0] * scale) + " " + Num(box[1] * scale) + " " + Num(box[2] * scale) + " " + Num(box[3] * scale)
+            + "] /ItalicAngle " + Num(ttf.GetItalicAngle()) + " /Ascent " + Num(ttf.GetAscent() * scale)
+            + " /Descent " + Num(ttf.GetDescent() * scale) + " /CapHeight " + Num(ttf.GetCapHeight() * scale)
+            + " /StemV " + (ttf.IsBold() ? "120" : "80") + " /FontFile2 " + Ref(fileId) + " >>\nendobj\n");
+
+        // Widths of the used glyphs, consecutive ids grouped
+        std::string widths;
+        for (size_t g = 0; g < font.used.size();) {
+            if (!font.used[g]) {
+                ++g;
+                continue;
+            }
+            widths += std::to_string(g) + " [";
+            for (; g < font.used.size() && font.used[g]; ++g) {
+                widths += Num(ttf.Advance(static_cast<uint16_t>(g)) * scale) + " ";
+            }
+            widths += "]\n";
+        }
+
+        int cidFontId = NewObject();
+        BeginObject(cidFontId);
+        Write("<< /Type /Font /Subtype /CIDFontType2 /BaseFont /" + name
+            + " /CIDSystemInfo << /Registry (Adobe) /Ordering (Identity) /Supplement 0 >>"
+            + " /FontDescriptor " + Ref(descriptorId) + " /CIDToGIDMap " + Ref(mapId) + " /W [\n" + widths + "] >>\nendobj\n");
+
+        std::string cmap =
+            "/CIDInit /ProcSet findresource begin\n12 dict begin\nbegincmap\n"
+            "/CIDSystemInfo << /Registry (Adobe) /Ordering (UCS) /Supplement 0 >> def\n"
+            "/CMapName /Adobe-Identity-UCS def\n/CMapType 2 def\n"
+            "1 begincodespacerange\n<0000> <FFFF>\nendcodespacerange\n";
+        std::vector<std::pair<uint16_t, uint32_t>> mappings(font.unicode.begin(), font.unicode.end());
+        std::sort(mappings.begin(), mappings.end());
+        for (size_t i = 0; i < mappings.size(); i += 100) {
+            size_t count = std::min<size_t>(100, mappings.size() - i);
+            cmap += std::to_string(count) + " beginbfchar\n";
+            for (size_t j = i; j < i + count; ++j) {
+                cmap += "<";
+                AppendHex16(cmap, mappings[j].first);
+                cmap += "> <";
+                AppendUtf16Hex(cmap, mappings[j].second);
+                cmap += ">\n";
+            }
+            cmap += "endbfchar\n";
+        }
+        cmap += "endcmap\nCMapName currentdict /CMap defineresource pop\nend\nend\n";
+        int toUnicodeId = NewObject();
+        WriteStream(toUnicodeId, "", cmap);
+
+        BeginObject(font.objectId);
+        Write("<< /Type /Font /Subtype /Type0 /BaseFont /" + name + " /Encoding /Identity-H /DescendantFonts ["
+            + Ref(cidFontId) + "] /ToUnicode " + Ref(toUnicodeId) + " >>\nendobj\n");
+    }
+
+    int PdfWriter::NewObject() {
+        objectOffsets_.push_back(0);
+        return static_cast<int>(objectOffsets_.size());
+    }
+
+    void PdfWriter::BeginObject(int id) {
+        objectOffsets_[id - 1] = offset_;
+        Write(std::to_string(id) + " 0 obj\n");
+    }
+
+    void PdfWriter::Write(const std::string& text) {
+        if (buffer_) {
+            buffer_->append(text);
+        } else {
+            out_.write(text.data(), static_cast<std::streamsize>(text.size()));
+        }
+        if (!buffer_ && !out_ && !failed_) {
+            Logger::Error("Writing PDF failed");
+            failed_ = true;
+        }
+        offset_ += text.size();
+    }
+
+    void PdfWriter::WriteStream(int id, const std::string& dictionary, const std::string& data) {
+        BeginObject(id);
+        const std::string* body = &data;
+        std::string filter;
+
+#ifdef KETOAN_HAVE_ZLIB
+        std::string compressed;
+        if (compressionLevel_ > 0) {
+            compressed.resize(compressBound(static_cast<uLong>(data.size())));
+            uLongf length = static_cast<uLongf>(compressed.size());
+            if (compress2(reinterpret_cast<Bytef*>(&compressed[0]), &length,
+                    reinterpret_cast<const Bytef*>(data.data()), static_cast<uLong>(data.size()),
+                    compressionLevel_) == Z_OK) {
+                compressed.resize(length);
+                body = &compressed;
+                filter = " /Filter /FlateDecode";
+            }
+        }
+#endif
+
+        Write("<< /Length " + std::to_string(body->size()) + filter + (dictionary.empty() ? "" : " " + dictionary)
+            + " >>\nstream\n");
+        Write(*body);
+        Write("\nendstream\nendobj\n");
+    }
+
+} // namespace KeToanApp
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "KeToanApp/Common.h"
+#include "KeToanApp/Types.h"
+#include "../Utils/TrueTypeFont.h"
+#include <cstdint>
+#include <fstream>
+#include <string_view>
+#include <unordered_map>
+
+namespace KeToanApp {
+
+    // Streaming PDF writer.
+    //
+    // Each page's content stream is built in memory, compressed (with
+    // KETOAN_HAVE_ZLIB) and written out when the page ends; afterwards only
+    // its object number and file offset are kept. Fonts, the page tree and
+    // the shared resources are written by Close(), so a 10k-page document
+    // costs a few bytes per page in memory.
+    //
+    // Text is UTF-8 and drawn with embedded TrueType fonts as Type0 /
+    // Identity-H, encoded by glyph id. Only the glyphs actually used are
+    // embedded, and a ToUnicode map keeps the text searchable and copyable.
+    //
+    // Coordinates are points from the top-left corner of the page.
+    class PdfWriter {
+    public:
+        // Text encoded once for a font and drawn any number of times. Glyph
+        // ids depend only on the font file, so a run can be drawn by any
+        // writer that loaded the same file under the same handle.
+        struct GlyphRun {
+            std::string hex;                                    // content-stream glyph ids
+            std::vector<std::pair<uint16_t, uint32_t>> glyphs;  // glyph, code point
+            double advance;                                     // width at 1 pt
+
+            GlyphRun() : advance(0.0) {}
+        };
+
+        PdfWriter();
+        ~PdfWriter();
+
+        // Non-copyable
+        PdfWriter(const PdfWriter&) = delete;
+        PdfWriter& operator=(const PdfWriter&) = delete;
+
+        // compressionLevel is the zlib level for streams, 0 = uncompressed
+        bool Open(const std::string& path, double pageWidth, double pageHeight, int compressionLevel = 3);
+        // Builds the document in buffer instead of a file
+        bool OpenBuffer(std::string& buffer, double pageWidth, double pageHeight, int compressionLevel = 3);
+        bool Close();
+        bool IsOpen() const { return buffer_ != nullptr || out_.is_open(); }
+
+        // Returns the font handle, -1 if the file is not a usable TrueType font
+        int LoadFont(const std::string& path);
+        // Adds a font already opened, which any number of writers may share.
+        // Handles are numbered in the order fonts are loaded or added.
+        int AddFont(std::shared_ptr<const TrueTypeFont> ttf);
+        void SetTitle(const std::string& title) { title_ = title; }
+
+        bool BeginPage();
+        bool EndPage();
+
+        void DrawText(int font, double size, double x, double baseline, std::string_view text);
+        void DrawGlyphs(int font, double size, double x, double baseline, const GlyphRun& run);
+        GlyphRun Shape(int font, std::string_view text) const;
+        void DrawLine(double x1, double y1, double x2, double y2, double width = 0.5);
+
+        double TextWidth(int font, double size, std::string_view text) const;
+        double Ascent(int font, double size) const;
+
+        int GetPageCount() const { return static_cast<int>(pageIds_.size()); }
+        uint64_t GetBytesWritten() const { return offset_; }
+
+    private:
+        struct Font {
+            std::shared_ptr<const TrueTypeFont> ttf;
+            int objectId;
+            std::vector<bool> used;
+            std::unordered_map<uint16_t, uint32_t> unicode;     // glyph -> first codepoint drawn with it
+        };
+
+        std::ofstream out_;
+        std::string* buffer_;
+        uint64_t offset_;
+        std::vector<uint64_t> objectOffsets_;   // by object number - 1
+        std::vector<int> pageIds_;
+        std::vector<std::unique_ptr<Font>> fonts_;
+        std::string content_;
+        std::string title_;
+        double width_;
+        double height_;
+        int pagesId_;
+        int resourcesId_;
+        int compressionLevel_;
+        bool inPage_;
+        bool failed_;
+
+        bool Start(double pageWidth, double pageHeight, int compressionLevel);
+        int NewObject();
+        void BeginObject(int id);
+        void Write(const std::string& text);
+        void WriteStream(int id, const std::string& dictionary, const std::string& data);
+        void WriteFont(Font& font, int index);
+    };
+
+} // namespace KeToanApp
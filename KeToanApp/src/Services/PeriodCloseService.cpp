@@ -0,0 +1,308 @@
+#include "PeriodCloseService.h"
+#include "../Utils/Logger.h"
+#include "../Utils/StringHelper.h"
+#include "../Utils/Trace.h"
+
+namespace KeToanApp {
+
+    namespace {
+
+        // Vouchers of the year that can leave the main file: those still
+        // referenced by an open receivable/payable stay behind.
+        const char* kArchivedVouchers =
+            "SELECT SoCT FROM main.ChungTuKeToan WHERE daynum(NgayCT) BETWEEN daynum(?2) AND daynum(?3) "
+            "AND SoCT NOT IN (SELECT SoCT FROM main.CongNo WHERE SoCT IS NOT NULL "
+            "AND COALESCE(ConLai, SoTien - DaTra) <> 0)";
+
+        struct ArchiveTable {
+            const char* table;
+            const char* key;        // unique key in the archive, used for idempotent copy
+            std::string filter;     // rows of the closed year, ?1 = year, ?2/?3 = date range
+                                    // (compared with daynum(), which also reads dd/MM/yyyy)
+            bool purge;             // delete from main once archived
+        };
+
+        // Children before parents, matching the purge order required by foreign keys
+        std::vector<ArchiveTable> ArchiveTables() {
+            std::string vouchers = kArchivedVouchers;
+            return {
+                { "CongNo", "ID", "SoCT IN (" + vouchers + ")", true },
+                { "DinhKhoan", "ID", "SoCT IN (" + vouchers + ")", true },
+                { "ChungTuKeToan", "SoCT", "SoCT IN (" + vouchers + ")", true },
+                { "ChiTietPhieuNhap", "ID",
+                  "SoPhieu IN (SELECT SoPhieu FROM main.PhieuNhap WHERE daynum(NgayNhap) BETWEEN daynum(?2) AND daynum(?3))", true },
+                { "PhieuNhap", "SoPhieu", "daynum(NgayNhap) BETWEEN daynum(?2) AND daynum(?3)", true },
+                { "ChiTietPhieuXuat", "ID",
+                  "SoPhieu IN (SELECT SoPhieu FROM main.PhieuXuat WHERE daynum(NgayXuat) BETWEEN daynum(?2) AND daynum(?3))", true },
+                { "PhieuXuat", "SoPhieu", "daynum(NgayXuat) BETWEEN daynum(?2) AND daynum(?3)", true },
+                // Opening balances of the closed year make the archive self-contained
+                { "SoDuDauKy", "NamTC, SoTK", "NamTC = ?1", false },
+                { "TonKhoDauKy", "NamTC, MaSP", "NamTC = ?1", false },
+            };
+        }
+
+        std::string YearStart(int year) {
+            return std::to_string(year) + "-01-01";
+        }
+
+        std::string YearEnd(int year) {
+            return std::to_string(year) + "-12-31";
+        }
+
+    } // namespace
+
+    PeriodCloseService::PeriodCloseService(DatabaseManager& database)
+        : database_(database)
+    {
+    }
+
+    PeriodCloseResult PeriodCloseService::CloseYear(int year) {
+        KETOAN_TRACE_SCOPE("period", "CloseYear");
+        PeriodCloseResult result;
+        result.year = year;
+        result.archivePath = GetArchivePath(year);
+
+        // Hold the writer for the whole close: nothing may be posted into the
+        // year between computing its balances and purging its rows.
+        auto lock = database_.Lock();
+        Connection* connection = database_.GetConnection();
+
+        if (!database_.IsConnected() || !connection) {
+            result.error = "Database not connected";
+            return result;
+        }
+
+        if (database_.InTransaction()) {
+            result.error = "Cannot close a period inside a transaction";
+            return result;
+        }
+
+        if (IsClosed(year)) {
+            result.error = "Fiscal year " + std::to_string(year) + " is already closed";
+            return result;
+        }
+
+        Logger::Info("Closing fiscal year %d, archive: %s", year, result.archivePath.c_str());
+
+        // ATTACH is not allowed inside a transaction
+        try {
+            auto attach = connection->Prepare("ATTACH DATABASE ? AS arc");
+            attach->BindText(1, result.archivePath);
+            attach->Execute();
+        }
+        catch (const DatabaseException& e) {
+            result.error = e.what();
+            Logger::Error("Period close: cannot attach archive: %s", e.what());
+            return result;
+        }
+
+        // Phase 1: balances for year + 1 and archive copy
+        bool ok = database_.BeginTransaction()
+               && ComputeOpeningBalances(year, result)
+               && CopyToArchive(year)
+               && database_.Commit();
+
+        // Phase 2: purge archived rows and mark the year closed
+        if (ok) {
+            ok = database_.BeginTransaction()
+              && PurgeArchived(result)
+              && RunWithYear("UPDATE KyKeToan SET TrangThai = 1, NgayKhoaSo = datetime('now') "
+                             "WHERE NamTC = ?1", year)
+              && database_.Commit();
+        }
+
+        if (!ok) {
+            if (database_.InTransaction()) {
+                database_.Rollback();
+            }
+            result.error = "Period close failed: " + connection->GetLastError();
+        }
+
+        database_.ExecuteQuery("DETACH DATABASE arc");
+
+        if (ok) {
+            result.success = true;
+            Logger::Info("Fiscal year %d closed: %lld account and %lld product balances carried, %lld rows archived",
+                year, static_cast<long long>(result.accountBalances),
+                static_cast<long long>(result.productBalances),
+                static_cast<long long>(result.archivedRows));
+        } else {
+            Logger::Error("Closing fiscal year %d failed: %s", year, result.error.c_str());
+        }
+        return result;
+    }
+
+    bool PeriodCloseService::IsClosed(int year) {
+        std::string status;
+        return database_.ExecuteScalar(
+            "SELECT TrangThai FROM KyKeToan WHERE NamTC = " + std::to_string(year), status)
+            && status == "1";
+    }
+
+    std::string PeriodCloseService::GetArchivePath(int year) const {
+        std::string path = database_.GetSettings().databasePath;
+
+        size_t slash = path.find_last_of("\\/");
+        size_t dot = path.find_last_of('.');
+        if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+            dot = path.size();
+        }
+
+        return path.substr(0, dot) + "_" + std::to_string(year) + path.substr(dot);
+    }
+
+    bool PeriodCloseService::AttachArchive(Connection& connection, int year,
+                                           std::string& schemaName) const {
+        std::string path = GetArchivePath(year);
+
+        WIN32_FILE_ATTRIBUTE_DATA info;
+        if (!GetFileAttributesExW(StringHelper::ToWideString(path).c_str(),
+                                  GetFileExInfoStandard, &info)) {
+            Logger::Warning("No archive for fiscal year %d: %s", year, path.c_str());
+            return false;
+        }
+
+        try {
+            schemaName = "nam" + std::to_string(year);
+            auto attach = connection.Prepare("ATTACH DATABASE ? AS " + schemaName);
+            attach->BindText(1, path);
+            attach->Execute();
+            return true;
+        }
+        catch (const DatabaseException& e) {
+            Logger::Error("Cannot attach archive %s: %s", path.c_str(), e.what());
+            return false;
+        }
+    }
+
+    bool PeriodCloseService::DetachArchive(Connection& connection, const std::string& schemaName) const {
+        return connection.Execute("DETACH DATABASE " + schemaName);
+    }
+
+    bool PeriodCloseService::ComputeOpeningBalances(int year, PeriodCloseResult& result) {
+        // Fiscal period rows for the closed and the next year
+        if (!RunWithYear("INSERT OR IGNORE INTO KyKeToan (NamTC, NgayBatDau, NgayKetThuc, TrangThai) "
+                         "VALUES (?1, ?2, ?3, 0)", year) ||
+            !RunWithYear("INSERT OR IGNORE INTO KyKeToan (NamTC, NgayBatDau, NgayKetThuc, TrangThai) "
+                         "VALUES (?4, CAST(?4 AS TEXT) || '-01-01', CAST(?4 AS TEXT) || '-12-31', 0)", year)) {
+            return false;
+        }
+
+        // Account balances: opening + debits - credits, summed exactly by money_sum(), split into Nợ/Có sides
+        const char* accountSql = R"(
+            INSERT INTO SoDuDauKy (NamTC, SoTK, DuNo, DuCo)
+            SELECT ?4, SoTK,
+                   CASE WHEN SoDu > 0 THEN SoDu ELSE 0 END,
+                   CASE WHEN SoDu < 0 THEN -SoDu ELSE 0 END
+            FROM (
+                SELECT SoTK, money_sum(SoTien) AS SoDu FROM (
+                    SELECT SoTK, DuNo - DuCo AS SoTien FROM SoDuDauKy WHERE NamTC = ?1
+                    UNION ALL
+                    SELECT dk.TKNo, dk.SoTien FROM DinhKhoan dk
+                    JOIN ChungTuKeToan ct ON ct.SoCT = dk.SoCT
+                    WHERE daynum(ct.NgayCT) BETWEEN daynum(?2) AND daynum(?3) AND COALESCE(ct.TrangThai, 1) <> 2
+                    UNION ALL
+                    SELECT dk.TKCo, -dk.SoTien FROM DinhKhoan dk
+                    JOIN ChungTuKeToan ct ON ct.SoCT = dk.SoCT
+                    WHERE daynum(ct.NgayCT) BETWEEN daynum(?2) AND daynum(?3) AND COALESCE(ct.TrangThai, 1) <> 2
+                ) GROUP BY SoTK
+            ) WHERE SoDu <> 0
+        )";
+
+        // Stock: opening + receipts - issues, valued at the year's weighted
+        // average cost (bình quân gia quyền cuối kỳ)
+        const char* productSql = R"(
+            INSERT INTO TonKhoDauKy (NamTC, MaSP, SoLuong, GiaTri)
+            SELECT ?4, MaSP, SLNhap - SLXuat,
+                   CASE WHEN SLNhap > 0 THEN ROUND((SLNhap - SLXuat) * GTNhap / SLNhap, 4) ELSE 0 END
+            FROM (
+                SELECT MaSP, money_sum(SLNhap) AS SLNhap, money_sum(SLXuat) AS SLXuat, money_sum(GTNhap) AS GTNhap FROM (
+                    SELECT MaSP, SoLuong AS SLNhap, 0 AS SLXuat, GiaTri AS GTNhap
+                    FROM TonKhoDauKy WHERE NamTC = ?1
+                    UNION ALL
+                    SELECT ct.MaSP, ct.SoLuong, 0, ct.ThanhTien FROM ChiTietPhieuNhap ct
+                    JOIN PhieuNhap p ON p.SoPhieu = ct.SoPhieu
+                    WHERE daynum(p.NgayNhap) BETWEEN daynum(?2) AND daynum(?3) AND COALESCE(p.TrangThai, 1) <> 2
+                    UNION ALL
+                    SELECT ct.MaSP, 0, ct.SoLuong, 0 FROM ChiTietPhieuXuat ct
+                    JOIN PhieuXuat p ON p.SoPhieu = ct.SoPhieu
+                    WHERE daynum(p.NgayXuat) BETWEEN daynum(?2) AND daynum(?3) AND COALESCE(p.TrangThai, 1) <> 2
+                ) GROUP BY MaSP
+            ) WHERE SLNhap <> SLXuat
+        )";
+
+        // Re-running a close replaces the carried balances
+        return RunWithYear("DELETE FROM SoDuDauKy WHERE NamTC = ?4", year)
+            && RunWithYear("DELETE FROM TonKhoDauKy WHERE NamTC = ?4", year)
+            && RunWithYear(accountSql, year, &result.accountBalances)
+            && RunWithYear(productSql, year, &result.productBalances);
+    }
+
+    bool PeriodCloseService::CopyToArchive(int year) {
+        for (const auto& spec : ArchiveTables()) {
+            std::string table = spec.table;
+
+            // Archive tables mirror the current columns; no foreign keys, since
+            // the referenced master tables live in the main file.
+            if (!database_.ExecuteQuery("CREATE TABLE IF NOT EXISTS arc." + table +
+                                        " AS SELECT * FROM main." + table + " WHERE 0") ||
+                !database_.ExecuteQuery("CREATE UNIQUE INDEX IF NOT EXISTS arc.UX_" + table +
+                                        " ON " + table + "(" + spec.key + ")")) {
+                return false;
+            }
+
+            if (!RunWithYear("INSERT OR IGNORE INTO arc." + table + " SELECT * FROM main." + table +
+                             " WHERE " + spec.filter, year)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool PeriodCloseService::PurgeArchived(PeriodCloseResult& result) {
+        // Delete exactly what the archive now holds, never more
+        for (const auto& spec : ArchiveTables()) {
+            if (!spec.purge) {
+                continue;
+            }
+
+            std::string table = spec.table;
+            int64_t deleted = 0;
+            std::string sql = "DELETE FROM main." + table + " WHERE " + spec.key +
+                              " IN (SELECT " + spec.key + " FROM arc." + table + ")";
+            if (!RunWithYear(sql, result.year, &deleted)) {
+                return false;
+            }
+            result.archivedRows += deleted;
+            Logger::Info("Archived %lld rows from %s", static_cast<long long>(deleted), table.c_str());
+        }
+
+        return true;
+    }
+
+    bool PeriodCloseService::RunWithYear(const std::string& sql, int year, int64_t* changes) {
+        Connection* connection = database_.GetConnection();
+
+        try {
+            // ?1 = year, ?2/?3 = its date range, ?4 = next year; bind what the SQL uses
+            auto stmt = connection->Prepare(sql);
+            int count = stmt->ParameterCount();
+            if (count >= 1) stmt->BindInt64(1, year);
+            if (count >= 2) stmt->BindText(2, YearStart(year));
+            if (count >= 3) stmt->BindText(3, YearEnd(year));
+            if (count >= 4) stmt->BindInt64(4, year + 1);
+            stmt->Execute();
+
+            if (changes) {
+                *changes = connection->Changes();
+            }
+            return true;
+        }
+        catch (const DatabaseException& e) {
+            Logger::Error("Period close step failed: %s", e.what());
+            return false;
+        }
+    }
+
+} // namespace KeToanApp
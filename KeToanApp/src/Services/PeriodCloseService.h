@@ -0,0 +1,67 @@
+#pragma once
+
+#include "KeToanApp/Common.h"
+#include "KeToanApp/Types.h"
+#include "../Database/DatabaseManager.h"
+#include <cstdint>
+
+namespace KeToanApp {
+
+    struct PeriodCloseResult {
+        bool success;
+        int year;
+        int64_t accountBalances;    // SoDuDauKy rows written for year + 1
+        int64_t productBalances;    // TonKhoDauKy rows written for year + 1
+        int64_t archivedRows;       // detail + header rows moved to the archive
+        std::string archivePath;
+        std::string error;
+
+        PeriodCloseResult()
+            : success(false), year(0), accountBalances(0), productBalances(0), archivedRows(0) {}
+    };
+
+    // Fiscal year close (khóa sổ cuối năm).
+    //
+    // Closing a year:
+    //   1. computes closing balances per account (SoDuDauKy + DinhKhoan) and
+    //      per product (TonKhoDauKy + nhập - xuất) and writes them as the
+    //      opening balances of the next year;
+    //   2. copies the year's vouchers, receipts and issues with their detail
+    //      lines into a per-year archive database next to the main file;
+    //   3. deletes the copied rows from the main database and marks the year closed.
+    // Steps 1-2 and step 3 commit separately: SQLite does not commit attached
+    // WAL databases atomically, so rows leave the main file only after the
+    // archive holding them is durable. Copies are idempotent, so a close that
+    // was interrupted can simply be run again.
+    //
+    // Dates (NgayCT, NgayNhap, NgayXuat) may be stored as yyyy-mm-dd or
+    // dd/MM/yyyy; the year's rows are selected by daynum(), which reads both.
+    // Revenue/expense accounts are carried like any other account; year-end
+    // closing entries (kết chuyển 911) must be posted before the close.
+    class PeriodCloseService {
+    public:
+        explicit PeriodCloseService(DatabaseManager& database);
+        ~PeriodCloseService() = default;
+
+        PeriodCloseResult CloseYear(int year);
+        bool IsClosed(int year);
+
+        // Per-year archive file: <db dir>/<db name>_<year>.db
+        std::string GetArchivePath(int year) const;
+
+        // Attach a closed year's archive to a connection (typically a read
+        // view's) as schema "nam<year>", so reports can query e.g.
+        // nam2024.DinhKhoan. Returns false if the year has no archive.
+        bool AttachArchive(Connection& connection, int year, std::string& schemaName) const;
+        bool DetachArchive(Connection& connection, const std::string& schemaName) const;
+
+    private:
+        DatabaseManager& database_;
+
+        bool ComputeOpeningBalances(int year, PeriodCloseResult& result);
+        bool CopyToArchive(int year);
+        bool PurgeArchived(PeriodCloseResult& result);
+        bool RunWithYear(const std::string& sql, int year, int64_t* changes = nullptr);
+    };
+
+} // namespace KeToanApp
@@ -0,0 +1,481 @@
+#include "ReportExportService.h"
+#include "../Utils/DateTimeHelper.h"
+#include "../Utils/Logger.h"
+#include "../Utils/StringHelper.h"
+#include "../Utils/Trace.h"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+namespace KeToanApp {
+
+    namespace {
+
+        const char* const kGeneralLedgerQuery =
+            "SELECT c.NgayCT, c.SoCT, COALESCE(d.DienGiai, c.DienGiai), d.TKNo, d.TKCo, d.SoTien "
+            "FROM DinhKhoan d JOIN ChungTuKeToan c ON c.SoCT = d.SoCT "
+            "WHERE daynum(c.NgayCT) BETWEEN daynum(?1) AND daynum(?2) AND COALESCE(c.TrangThai, 1) <> 2 "
+            "ORDER BY daynum(c.NgayCT), c.SoCT, d.STT, d.ID";
+
+        // Printed ledger: the ledger columns plus the month it groups on.
+        // Arguments: from date, to date, period caption.
+        const char* const kGeneralLedgerTemplate =
+            "[Report]\n"
+            "Title=Sổ cái\n"
+            "Query=SELECT c.NgayCT AS NgayCT, c.SoCT AS SoCT, COALESCE(d.DienGiai, c.DienGiai) AS DienGiai,\n"
+            "Query=d.TKNo AS TKNo, d.TKCo AS TKCo, d.SoTien AS SoTien,\n"
+            "Query='Tháng ' || substr(period_of(c.NgayCT, 'month'), 6, 2) || '/'\n"
+            "Query=|| substr(period_of(c.NgayCT, 'month'), 1, 4) AS Thang\n"
+            "Query=FROM DinhKhoan d JOIN ChungTuKeToan c ON c.SoCT = d.SoCT\n"
+            "Query=WHERE daynum(c.NgayCT) BETWEEN daynum(?1) AND daynum(?2) AND COALESCE(c.TrangThai, 1) <> 2\n"
+            "Query=ORDER BY daynum(c.NgayCT), c.SoCT, d.STT, d.ID\n"
+            "GroupBy=Thang\n"
+            "\n"
+            "[ReportHeader]\n"
+            "Height=44\n"
+            "Label=0 539 center bold size=14 top=4 | SỔ CÁI\n"
+            "Label=0 539 center top=26 | {3}\n"
+            "\n"
+            "[PageHeader]\n"
+            "Height=18\n"
+            "Rules=above below\n"
+            "Label=0 56 bold | Ngày CT\n"
+            "Label=56 64 bold | Số CT\n"
+            "Label=120 229 bold | Diễn giải\n"
+            "Label=349 40 center bold | TK Nợ\n"
+            "Label=389 40 center bold | TK Có\n"
+            "Label=429 110 right bold | Số tiền\n"
+            "\n"
+            "[GroupHeader]\n"
+            "Height=16\n"
+            "Field=0 349 Thang bold\n"
+            "\n"
+            "[Detail]\n"
+            "Height=14\n"
+            "Field=0 56 NgayCT date\n"
+            "Field=56 64 SoCT\n"
+            "Field=120 229 DienGiai\n"
+            "Field=349 40 TKNo center\n"
+            "Field=389 40 TKCo center\n"
+            "Field=429 110 SoTien money right\n"
+            "\n"
+            "[GroupFooter]\n"
+            "Height=16\n"
+            "Rules=above\n"
+            "Label=120 229 bold | Cộng tháng\n"
+            "Sum=429 110 SoTien\n"
+            "\n"
+            "[PageFooter]\n"
+            "Height=30\n"
+            "Rules=above\n"
+            "Label=120 229 top=3 | Cộng trang\n"
+            "Sum=429 110 SoTien regular top=3\n"
+            "Label=0 539 center top=18 | Trang {page}\n"
+            "\n"
+            "[ReportFooter]\n"
+            "Height=18\n"
+            "Rules=above below\n"
+            "Label=120 229 bold | Tổng cộng\n"
+            "Sum=429 110 SoTien\n";
+
+        void WriteCell(XlsxWriter& xlsx, Statement& stmt, int column, ReportColumnType type) {
+            if (stmt.ColumnIsNull(column)) {
+                xlsx.Blank();
+                return;
+            }
+
+            switch (type) {
+            case ReportColumnType::Text:
+                xlsx.Text(stmt.ColumnTextView(column));
+                break;
+            case ReportColumnType::Integer:
+                xlsx.Integer(stmt.ColumnInt64(column));
+                break;
+            case ReportColumnType::Number:
+                xlsx.Number(stmt.ColumnDouble(column));
+                break;
+            case ReportColumnType::Money:
+                xlsx.Amount(Money::FromDouble(stmt.ColumnDouble(column)));
+                break;
+            case ReportColumnType::Date: {
+                std::string_view text = stmt.ColumnTextView(column);
+                DayNumber day;
+                if (DateTimeHelper::ParseDayNumber(text.data(), text.size(), day)) {
+                    xlsx.Day(day);
+                } else {
+                    xlsx.Text(text);
+                }
+                break;
+            }
+            }
+        }
+
+        void SetInterrupted(ReportExportResult& result, const QueryGuard& guard, const QueryInterruptedException& e) {
+            result.cancelled = guard.IsCancelled();
+            result.timedOut = guard.IsTimedOut();
+            result.error = guard.GetReason();
+            if (result.error.empty()) {
+                result.error = e.what();
+            }
+        }
+
+        // Exports are written under a temporary name, so a cancelled or
+        // failed export never leaves a partial file at the target path
+        std::string PartPath(const std::string& path) {
+            return path + ".part";
+        }
+
+        // Renames the finished .part file to path, or deletes it if !written
+        bool FinishPart(const std::string& path, bool written, std::string& error) {
+            const std::filesystem::path partPath = std::filesystem::u8path(PartPath(path));
+            std::error_code ec;
+            if (written) {
+                std::filesystem::rename(partPath, std::filesystem::u8path(path), ec);
+                if (!ec) {
+                    return true;
+                }
+                error = "Cannot rename " + PartPath(path) + ": " + ec.message();
+            }
+            std::filesystem::remove(partPath, ec);
+            return false;
+        }
+
+    } // namespace
+
+    ReportExportService::ReportExportService(DatabaseManager& database, Config& config)
+        : database_(database)
+        , config_(config)
+    {
+        config_.DeclareInt("Reports.ExcelCompressionLevel", 6, 0, 9);
+        config_.DeclareInt("Reports.PdfCompressionLevel", 3, 0, 9);
+        config_.Declare("Reports.PdfFont", "C:\\Windows\\Fonts\\arial.ttf");
+        config_.Declare("Reports.PdfBoldFont", "C:\\Windows\\Fonts\\arialbd.ttf");
+        config_.DeclareInt("Reports.QueryTimeoutMs", 600000, 0, 86400000);
+    }
+
+    ReportExportResult ReportExportService::ExportGeneralLedger(const std::string& path,
+        const std::string& fromDate, const std::string& toDate) {
+        static const std::vector<ReportColumn> columns = {
+            { "Ngày CT", ReportColumnType::Date, 12 },
+            { "Số CT", ReportColumnType::Text, 14 },
+            { "Diễn giải", ReportColumnType::Text, 48 },
+            { "TK Nợ", ReportColumnType::Text, 10 },
+            { "TK Có", ReportColumnType::Text, 10 },
+            { "Số tiền", ReportColumnType::Money, 18 },
+        };
+
+        return ExportQuery(path, "Sổ cái", kGeneralLedgerQuery, columns,
+            { fromDate.empty() ? "1900-01-01" : fromDate, toDate.empty() ? "9999-12-31" : toDate });
+    }
+
+    ReportExportResult ReportExportService::ExportQuery(const std::string& path, const std::string& sheetName,
+        const std::string& query, const std::vector<ReportColumn>& columns,
+        const std::vector<std::string>& parameters) {
+        KETOAN_TRACE_SPAN(span, "report", "ExportXlsx");
+        ReportExportResult result;
+        auto started = std::chrono::steady_clock::now();
+
+        std::unique_ptr<ReadView> view = database_.OpenReadView();
+        if (!view) {
+            result.error = "No read view available";
+            return result;
+        }
+
+        XlsxWriter xlsx(static_cast<int>(config_.GetInt("Application.NumberPrecision")),
+            config_.GetString("Application.DateFormat"));
+        if (!xlsx.Open(PartPath(path), static_cast<int>(config_.GetInt("Reports.ExcelCompressionLevel")))) {
+            result.error = "Cannot create " + path;
+            return result;
+        }
+
+        std::vector<XlsxColumn> sheetColumns;
+        for (const auto& column : columns) {
+            sheetColumns.push_back({ column.title, column.width });
+        }
+
+        QueryGuard guard(view->GetConnection(), GetCancellationToken(), GetQueryTimeout());
+        try {
+            auto stmt = view->Prepare(query);
+            if (stmt->ColumnCount() != static_cast<int>(columns.size())) {
+                throw DatabaseException("Report query returns " + std::to_string(stmt->ColumnCount())
+                    + " columns, " + std::to_string(columns.size()) + " expected");
+            }
+            for (size_t i = 0; i < parameters.size(); ++i) {
+                stmt->BindText(static_cast<int>(i) + 1, parameters[i]);
+            }
+
+            if (!xlsx.BeginSheet(sheetName, sheetColumns)) {
+                throw DatabaseException("Writing " + path + " failed");
+            }
+            while (stmt->Step()) {
+                for (size_t c = 0; c < columns.size(); ++c) {
+                    WriteCell(xlsx, *stmt, static_cast<int>(c), columns[c].type);
+                }
+                if (!xlsx.EndRow()) {
+                    throw DatabaseException("Writing " + path + " failed");
+                }
+            }
+        }
+        catch (const QueryInterruptedException& e) {
+            SetInterrupted(result, guard, e);
+            xlsx.Close();
+            FinishPart(path, false, result.error);
+            Logger::Warning("Excel export to %s stopped: %s", path.c_str(), result.error.c_str());
+            return result;
+        }
+        catch (const KeToanException& e) {
+            result.error = e.what();
+            xlsx.Close();
+            FinishPart(path, false, result.error);
+            Logger::Error("Excel export to %s failed: %s", path.c_str(), e.what());
+            return result;
+        }
+
+        const bool written = xlsx.Close();
+        result.success = FinishPart(path, written, result.error);
+        result.rows = xlsx.GetRowsWritten();
+        KETOAN_TRACE_ARG(span, "rows", result.rows);
+        result.bytes = static_cast<int64_t>(xlsx.GetBytesWritten());
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        if (!written) {
+            result.error = "Writing " + path + " failed";
+        }
+
+        Logger::Info("Exported %lld rows to %s (%lld bytes, snapshot %s) in %.2f s",
+            static_cast<long long>(result.rows), path.c_str(), static_cast<long long>(result.bytes),
+            view->GetSnapshotId().c_str(), result.seconds);
+        return result;
+    }
+
+    ReportExportResult ReportExportService::ExportGeneralLedgerPdf(const std::string& path,
+        const std::string& fromDate, const std::string& toDate) {
+        const std::string from = fromDate.empty() ? "1900-01-01" : fromDate;   // earliest date daynum() reads
+        const std::string to = toDate.empty() ? "9999-12-31" : toDate;
+
+        std::string period;
+        const std::string dateFormat = config_.GetString("Application.DateFormat");
+        DayNumber day;
+        if (!fromDate.empty() && DateTimeHelper::ParseDayNumber(from.data(), from.size(), day)) {
+            period = "Từ ngày " + DateTimeHelper::FormatDate(DateTimeHelper::FromDayNumber(day), dateFormat);
+        }
+        if (!toDate.empty() && DateTimeHelper::ParseDayNumber(to.data(), to.size(), day)) {
+            period += (period.empty() ? "Đến ngày " : " đến ngày ")
+                + DateTimeHelper::FormatDate(DateTimeHelper::FromDayNumber(day), dateFormat);
+        }
+
+        return RenderTemplate(path, kGeneralLedgerTemplate, { from, to, period });
+    }
+
+    ReportExportResult ReportExportService::RenderTemplateFile(const std::string& path,
+        const std::string& templatePath, const std::vector<std::string>& arguments) {
+        std::ifstream file(std::filesystem::u8path(templatePath), std::ios::binary);
+        if (!file) {
+            ReportExportResult result;
+            result.error = "Cannot open report template " + templatePath;
+            Logger::Error("%s", result.error.c_str());
+            return result;
+        }
+        std::ostringstream text;
+        text << file.rdbuf();
+        return RenderTemplate(path, text.str(), arguments);
+    }
+
+    std::shared_ptr<const ReportPlanCache::Entry> ReportExportService::PrepareTemplate(
+        const std::string& templateText, std::string& error) {
+        KETOAN_TRACE_SCOPE("report", "PrepareTemplate");
+        const uint64_t key = ReportPlanCache::Key(templateText,
+            config_.GetString("Reports.PdfFont"), config_.GetString("Reports.PdfBoldFont"));
+        if (auto entry = planCache_.Find(key)) {
+            return entry;
+        }
+
+        auto compiled = std::make_shared<ReportPlanCache::Entry>();
+        if (!ReportTemplate::Parse(templateText, compiled->definition, error)) {
+            Logger::Error("Invalid report template: %s", error.c_str());
+            return nullptr;
+        }
+
+        // Shaping needs the fonts and binding needs the query's columns
+        std::string scratch;
+        PdfWriter pdf;
+        pdf.OpenBuffer(scratch, compiled->definition.layout.pageWidth, compiled->definition.layout.pageHeight);
+        int font = -1;
+        int boldFont = -1;
+        if (!LoadFonts(pdf, font, boldFont, error)) {
+            return nullptr;
+        }
+
+        std::unique_ptr<ReadView> view = database_.OpenReadView();
+        if (!view) {
+            error = "No read view available";
+            return nullptr;
+        }
+        std::vector<std::string> columns;
+        try {
+            auto stmt = view->Prepare(compiled->definition.query);
+            for (int c = 0; c < stmt->ColumnCount(); ++c) {
+                columns.push_back(stmt->ColumnName(c));
+            }
+        }
+        catch (const KeToanException& e) {
+            error = e.what();
+            Logger::Error("Report template query failed: %s", e.what());
+            return nullptr;
+        }
+
+        if (!ReportPlan::Compile(compiled->definition.layout, columns, pdf, font, boldFont, compiled->plan)) {
+            error = "Report layout does not match the query";
+            return nullptr;
+        }
+        return planCache_.Insert(key, compiled);
+    }
+
+    bool ReportExportService::LoadFonts(PdfWriter& pdf, int& font, int& boldFont, std::string& error) {
+        const std::string fontPath = config_.GetString("Reports.PdfFont");
+        font = pdf.LoadFont(fontPath);
+        if (font < 0) {
+            error = "Cannot load font " + fontPath;
+            Logger::Error("%s", error.c_str());
+            return false;
+        }
+        // Without a bold face, bold text falls back to the regular one
+        boldFont = pdf.LoadFont(config_.GetString("Reports.PdfBoldFont"));
+        return true;
+    }
+
+    bool ReportExportService::OpenFonts(Fonts& fonts, std::string& error) {
+        const std::string fontPath = config_.GetString("Reports.PdfFont");
+        auto regular = std::make_shared<TrueTypeFont>();
+        if (!regular->Open(fontPath)) {
+            error = "Cannot load font " + fontPath;
+            Logger::Error("%s", error.c_str());
+            return false;
+        }
+        auto bold = std::make_shared<TrueTypeFont>();
+        fonts.regular = std::move(regular);
+        fonts.bold = bold->Open(config_.GetString("Reports.PdfBoldFont")) ? std::move(bold) : nullptr;
+        return true;
+    }
+
+    void ReportExportService::AddFonts(PdfWriter& pdf, const Fonts& fonts, int& font, int& boldFont) {
+        font = pdf.AddFont(fonts.regular);
+        boldFont = fonts.bold ? pdf.AddFont(fonts.bold) : -1;
+    }
+
+    ReportFormat ReportExportService::GetReportFormat() const {
+        ReportFormat format;
+        format.moneyDecimals = static_cast<int>(config_.GetInt("Application.NumberPrecision"));
+        format.dateFormat = config_.GetString("Application.DateFormat");
+        if (config_.GetString("Application.Language") != "vi-VN") {
+            format.thousandsSeparator = ',';
+            format.decimalSeparator = '.';
+        }
+        return format;
+    }
+
+    void ReportExportService::Cancel() {
+        std::lock_guard<std::mutex> lock(cancelMutex_);
+        cancel_.Cancel();
+        cancel_ = CancellationToken();
+        Logger::Info("Running reports cancelled");
+    }
+
+    CancellationToken ReportExportService::GetCancellationToken() {
+        std::lock_guard<std::mutex> lock(cancelMutex_);
+        return cancel_;
+    }
+
+    std::chrono::milliseconds ReportExportService::GetQueryTimeout() const {
+        return std::chrono::milliseconds(config_.GetInt("Reports.QueryTimeoutMs"));
+    }
+
+    ReportExportResult ReportExportService::RenderTemplate(const std::string& path,
+        const std::string& templateText, const std::vector<std::string>& arguments) {
+        KETOAN_TRACE_SPAN(span, "report", "RenderPdf");
+        ReportExportResult result;
+        auto started = std::chrono::steady_clock::now();
+
+        std::shared_ptr<const ReportPlanCache::Entry> entry = PrepareTemplate(templateText, result.error);
+        if (!entry) {
+            return result;
+        }
+        const ReportTemplate& definition = entry->definition;
+
+        std::unique_ptr<ReadView> view = database_.OpenReadView();
+        if (!view) {
+            result.error = "No read view available";
+            return result;
+        }
+
+        PdfWriter pdf;
+        if (!pdf.Open(PartPath(path), definition.layout.pageWidth, definition.layout.pageHeight,
+                static_cast<int>(config_.GetInt("Reports.PdfCompressionLevel")))) {
+            result.error = "Cannot create " + path;
+            return result;
+        }
+
+        std::string title = definition.title;
+        for (size_t i = 0; i < arguments.size(); ++i) {
+            title = StringHelper::ReplaceAll(title, "{" + std::to_string(i + 1) + "}", arguments[i]);
+        }
+        pdf.SetTitle(title);
+
+        int font = -1;
+        int boldFont = -1;
+        if (!LoadFonts(pdf, font, boldFont, result.error)) {
+            pdf.Close();
+            FinishPart(path, false, result.error);
+            return result;
+        }
+
+        int64_t rows = 0;
+        QueryGuard guard(view->GetConnection(), GetCancellationToken(), GetQueryTimeout());
+        try {
+            auto stmt = view->Prepare(definition.query);
+            // Arguments past the query's parameters are only for labels
+            const size_t bound = std::min(arguments.size(), static_cast<size_t>(stmt->ParameterCount()));
+            for (size_t i = 0; i < bound; ++i) {
+                stmt->BindText(static_cast<int>(i) + 1, arguments[i]);
+            }
+
+            ReportRenderer renderer(pdf, entry->plan, GetReportFormat(), font, boldFont);
+            if (!renderer.Render(*stmt, arguments)) {
+                throw DatabaseException("Report layout does not match the query");
+            }
+            rows = renderer.GetRowCount();
+        }
+        catch (const QueryInterruptedException& e) {
+            SetInterrupted(result, guard, e);
+            pdf.Close();
+            FinishPart(path, false, result.error);
+            Logger::Warning("PDF export to %s stopped: %s", path.c_str(), result.error.c_str());
+            return result;
+        }
+        catch (const KeToanException& e) {
+            result.error = e.what();
+            pdf.Close();
+            FinishPart(path, false, result.error);
+            Logger::Error("PDF export to %s failed: %s", path.c_str(), e.what());
+            return result;
+        }
+
+        const bool written = pdf.Close();
+        result.success = FinishPart(path, written, result.error);
+        result.rows = rows;
+        KETOAN_TRACE_ARG(span, "rows", rows);
+        result.pages = pdf.GetPageCount();
+        result.bytes = static_cast<int64_t>(pdf.GetBytesWritten());
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        if (!written) {
+            result.error = "Writing " + path + " failed";
+        }
+
+        Logger::Info("Rendered %lld rows on %d pages to %s (%lld bytes, snapshot %s) in %.2f s",
+            static_cast<long long>(result.rows), result.pages, path.c_str(),
+            static_cast<long long>(result.bytes), view->GetSnapshotId().c_str(), result.seconds);
+        return result;
+    }
+
+} // namespace KeToanApp
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "KeToanApp/Common.h"
+#include "KeToanApp/Types.h"
+#include "ReportTemplate.h"
+#include "XlsxWriter.h"
+#include "../Core/Config.h"
+#include "../Database/DatabaseManager.h"
+#include "../Utils/CancellationToken.h"
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+namespace KeToanApp {
+
+    struct ReportColumn {
+        std::string title;
+        ReportColumnType type;
+        double width;
+    };
+
+    struct ReportExportResult {
+        bool success;
+        bool cancelled;         // stopped by Cancel()
+        bool timedOut;          // query ran past Reports.QueryTimeoutMs
+        int64_t rows;
+        int pages;              // PDF only
+        int64_t bytes;
+        double seconds;
+        std::string error;
+
+        ReportExportResult()
+            : success(false), cancelled(false), timedOut(false), rows(0), pages(0), bytes(0), seconds(0.0) {}
+    };
+
+    // Excel and PDF export of reports.
+    //
+    // Each report is one query over a read-view snapshot whose cursor is
+    // streamed straight into an XlsxWriter sheet or through ReportRenderer
+    // into a PdfWriter, so memory use does not depend on the number of rows
+    // or pages. Amounts and dates are shown with the application's number
+    // precision and date format. PDF text uses the TrueType fonts set by
+    // Reports.PdfFont and Reports.PdfBoldFont, which must cover Vietnamese;
+    // Reports.PdfCompressionLevel trades file size for rendering time.
+    //
+    // A report's query is stopped, and its reader connection released, when
+    // Cancel() is called or once it has run for Reports.QueryTimeoutMs.
+    // Excel and PDF files are written as <path>.part and renamed when
+    // complete, so a stopped or failed export leaves nothing at path.
+    class ReportExportService {
+    public:
+        ReportExportService(DatabaseManager& database, Config& config);
+        ~ReportExportService() = default;
+
+        // Non-copyable
+        ReportExportService(const ReportExportService&) = delete;
+        ReportExportService& operator=(const ReportExportService&) = delete;
+
+        // Sổ cái: every posting of non-voided vouchers in [fromDate, toDate]
+        ReportExportResult ExportGeneralLedger(const std::string& path,
+            const std::string& fromDate, const std::string& toDate);
+
+        // Any query; columns map the result columns in order.
+        // Parameters are bound as text to ?1, ?2, ...
+        ReportExportResult ExportQuery(const std::string& path, const std::string& sheetName,
+            const std::string& query, const std::vector<ReportColumn>& columns,
+            const std::vector<std::string>& parameters = {});
+
+        // Printed sổ cái, grouped by month, with page and month totals
+        ReportExportResult ExportGeneralLedgerPdf(const std::string& path,
+            const std::string& fromDate, const std::string& toDate);
+
+        // A report template (see ReportTemplate) rendered with its query;
+        // arguments bind to ?1, ?2, ... and fill {1}, {2}, ... in labels.
+        // Compiled plans are cached, so batches from one template compile
+        // it once.
+        ReportExportResult RenderTemplate(const std::string& path, const std::string& templateText,
+            const std::vector<std::string>& arguments = {});
+        ReportExportResult RenderTemplateFile(const std::string& path, const std::string& templatePath,
+            const std::vector<std::string>& arguments = {});
+
+        // Parsed and compiled template from the plan cache; compiles it on a miss
+        std::shared_ptr<const ReportPlanCache::Entry> PrepareTemplate(const std::string& templateText,
+            std::string& error);
+        // Loads Reports.PdfFont and Reports.PdfBoldFont, in that order
+        bool LoadFonts(PdfWriter& pdf, int& font, int& boldFont, std::string& error);
+
+        // The same fonts opened once, for adding to any number of writers;
+        // bold is null without a bold face
+        struct Fonts {
+            std::shared_ptr<const TrueTypeFont> regular;
+            std::shared_ptr<const TrueTypeFont> bold;
+        };
+        bool OpenFonts(Fonts& fonts, std::string& error);
+        // Adds fonts to pdf under the handles LoadFonts() would give
+        static void AddFonts(PdfWriter& pdf, const Fonts& fonts, int& font, int& boldFont);
+        ReportFormat GetReportFormat() const;
+
+        // Stops every report running now, from any thread. Reports started
+        // later are unaffected.
+        void Cancel();
+
+        ReportPlanCache& GetPlanCache() { return planCache_; }
+
+    private:
+        DatabaseManager& database_;
+        Config& config_;
+        ReportPlanCache planCache_;
+
+        // Shared by the reports running now; Cancel() replaces it
+        std::mutex cancelMutex_;
+        CancellationToken cancel_;
+
+        CancellationToken GetCancellationToken();
+        std::chrono::milliseconds GetQueryTimeout() const;
+    };
+
+} // namespace KeToanApp
@@ -0,0 +1,446 @@
+#include "ReportLayout.h"
+#include "../Utils/DateTimeHelper.h"
+#include "../Utils/Logger.h"
+#include "../Utils/StringHelper.h"
+#include <algorithm>
+#include <cmath>
+
+namespace KeToanApp {
+
+    namespace {
+
+        const double kPadding = 2.0;
+        const double kRuleWidth = 0.5;
+        const char kEllipsis[] = "\xE2\x80\xA6";
+
+        bool IsContinuationByte(char c) {
+            return (static_cast<unsigned char>(c) & 0xC0) == 0x80;
+        }
+
+        bool SameName(const std::string& a, const std::string& b) {
+            return a.size() == b.size() && StringHelper::ToLower(a) == StringHelper::ToLower(b);
+        }
+
+        template <typename Visitor>
+        void ForEachBand(const ReportPlan& plan, Visitor visit) {
+            for (const ReportPlan::Band* band : { &plan.reportHeader, &plan.pageHeader, &plan.groupHeader,
+                     &plan.detail, &plan.groupFooter, &plan.pageFooter, &plan.reportFooter }) {
+                visit(*band);
+            }
+        }
+
+    } // namespace
+
+    bool ReportPlan::Compile(const ReportLayout& layout, const std::vector<std::string>& columns,
+        const PdfWriter& pdf, int font, int boldFont, ReportPlan& plan) {
+        plan = ReportPlan();
+        plan.pageWidth = layout.pageWidth;
+        plan.pageHeight = layout.pageHeight;
+        plan.left = layout.margin;
+        plan.right = layout.pageWidth - layout.margin;
+        plan.top = layout.margin;
+        plan.bottom = layout.pageHeight - layout.margin - layout.pageFooter.height;
+        plan.columnCount = static_cast<int>(columns.size());
+        if (boldFont < 0) {
+            boldFont = font;
+        }
+
+        bool valid = true;
+        auto resolve = [&](const std::string& name) {
+            for (size_t i = 0; i < columns.size(); ++i) {
+                if (SameName(columns[i], name)) {
+                    return static_cast<int>(i);
+                }
+            }
+            Logger::Error("Report layout refers to column '%s', which the query does not return", name.c_str());
+            valid = false;
+            return -1;
+        };
+
+        if (!layout.groupBy.empty()) {
+            plan.groupColumn = resolve(layout.groupBy);
+        }
+
+        auto compile = [&](const ReportBand& band, Band& out) {
+            out.height = band.height;
+            out.ruleAbove = band.ruleAbove;
+            out.ruleBelow = band.ruleBelow;
+            for (const auto& control : band.controls) {
+                Item item;
+                item.kind = control.kind;
+                item.column = -1;
+                item.format = control.format;
+                item.align = control.align;
+                item.bold = control.bold;
+                item.size = control.fontSize > 0.0 ? control.fontSize : layout.fontSize;
+                item.x = layout.margin + control.left + kPadding;
+                item.width = control.width - 2 * kPadding;
+                item.shaped = false;
+
+                // By default the capitals are centred vertically in the band
+                const int itemFont = item.bold ? boldFont : font;
+                item.baseline = control.top >= 0.0
+                    ? control.top + pdf.Ascent(itemFont, item.size)
+                    : band.height / 2 + item.size * 0.35;
+
+                if (control.kind == ReportControl::Kind::Label) {
+                    if (control.text.find('{') == std::string::npos) {
+                        item.run = pdf.Shape(itemFont, FitText(pdf, control.text, itemFont, item.size, item.width));
+                        if (item.align != ReportAlign::Left) {
+                            double slack = item.width - item.run.advance * item.size;
+                            item.x += item.align == ReportAlign::Right ? slack : slack / 2;
+                        }
+                        item.shaped = true;
+                    } else {
+                        item.text = control.text;
+                    }
+                } else {
+                    item.column = resolve(control.column);
+                    if (control.kind == ReportControl::Kind::Sum && item.column >= 0
+                        && std::find(plan.sumColumns.begin(), plan.sumColumns.end(), item.column) == plan.sumColumns.end()) {
+                        plan.sumColumns.push_back(item.column);
+                    }
+                }
+                out.items.push_back(std::move(item));
+            }
+        };
+
+        compile(layout.reportHeader, plan.reportHeader);
+        compile(layout.pageHeader, plan.pageHeader);
+        compile(layout.groupHeader, plan.groupHeader);
+        compile(layout.detail, plan.detail);
+        compile(layout.groupFooter, plan.groupFooter);
+        compile(layout.pageFooter, plan.pageFooter);
+        compile(layout.reportFooter, plan.reportFooter);
+        return valid;
+    }
+
+    std::string ReportPlan::FitText(const PdfWriter& pdf, const std::string& text, int font, double size, double width) {
+        if (pdf.TextWidth(font, size, text) <= width) {
+            return text;
+        }
+
+        // Longest prefix of whole characters that leaves room for the ellipsis
+        const double room = width - pdf.TextWidth(font, size, kEllipsis);
+        double used = 0.0;
+        size_t end = 0;
+        while (end < text.size()) {
+            size_t next = end + 1;
+            while (next < text.size() && IsContinuationByte(text[next])) {
+                ++next;
+            }
+            used += pdf.TextWidth(font, size, std::string_view(text.data() + end, next - end));
+            if (used > room) {
+                break;
+            }
+            end = next;
+        }
+        return room > 0.0 ? text.substr(0, end) + kEllipsis : std::string();
+    }
+
+    ReportRenderer::ReportRenderer(PdfWriter& pdf, const ReportPlan& plan, const ReportFormat& format,
+        int font, int boldFont)
+        : pdf_(pdf)
+        , plan_(plan)
+        , format_(format)
+        , font_(font)
+        , boldFont_(boldFont >= 0 ? boldFont : font)
+        , y_(0.0)
+        , pageTop_(0.0)
+        , page_(0)
+        , rows_(0)
+        , pending_(false)
+    {
+        format_.moneyDecimals = std::clamp(format_.moneyDecimals, 0, 4);
+    }
+
+    bool ReportRenderer::Render(Statement& cursor, const std::vector<std::string>& arguments) {
+        return Run(cursor.ColumnCount(), [&](std::vector<ReportValue>& row) {
+            if (!cursor.Step()) {
+                return false;
+            }
+            ReadRow(cursor, row.data(), static_cast<int>(row.size()));
+            return true;
+        }, arguments);
+    }
+
+    bool ReportRenderer::Render(const ReportRowSet& rows, const std::vector<std::string>& arguments) {
+        size_t next = 0;
+        return Run(rows.columnCount, [&](std::vector<ReportValue>& row) {
+            if (next + row.size() > rows.values.size()) {
+                return false;
+            }
+            std::copy(rows.values.begin() + next, rows.values.begin() + next + row.size(), row.begin());
+            next += row.size();
+            return true;
+        }, arguments);
+    }
+
+    template <typename NextRow>
+    bool ReportRenderer::Run(int columns, NextRow next, const std::vector<std::string>& arguments) {
+        if (columns != plan_.columnCount) {
+            Logger::Error("Report plan was compiled for %d columns, the query returns %d", plan_.columnCount, columns);
+            return false;
+        }
+
+        ResolveLabels(arguments);
+        row_.assign(columns, ReportValue{ std::string(), 0.0, true });
+        previous_ = row_;
+        for (auto& sums : sums_) {
+            sums.assign(columns, 0);
+        }
+        rows_ = 0;
+        page_ = 0;
+
+        // Read ahead one row, so headers show the row about to be printed
+        pending_ = next(row_);
+        StartPage();
+
+        const int group = plan_.groupColumn;
+        while (pending_) {
+            if (group >= 0 && (rows_ == 0 || row_[group].isNull != previous_[group].isNull
+                    || row_[group].text != previous_[group].text)) {
+                if (rows_ > 0 && !plan_.groupFooter.IsEmpty()) {
+                    Emit(plan_.groupFooter, previous_, Scope::Group);
+                }
+                std::fill(sums_[static_cast<int>(Scope::Group)].begin(), sums_[static_cast<int>(Scope::Group)].end(), 0);
+                if (!plan_.groupHeader.IsEmpty()) {
+                    Emit(plan_.groupHeader, row_, Scope::Report, plan_.detail.height);
+                }
+            }
+
+            // Break first, so the row counts towards the page it lands on
+            EnsureSpace(plan_.detail.height);
+            Accumulate(row_);
+            Draw(plan_.detail, row_, Scope::Report, y_);
+            y_ += plan_.detail.height;
+
+            ++rows_;
+            std::swap(row_, previous_);
+            pending_ = next(row_);
+        }
+
+        if (rows_ > 0 && group >= 0 && !plan_.groupFooter.IsEmpty()) {
+            Emit(plan_.groupFooter, previous_, Scope::Group);
+        }
+        if (!plan_.reportFooter.IsEmpty()) {
+            Emit(plan_.reportFooter, previous_, Scope::Report);
+        }
+        FinishPage();
+        return true;
+    }
+
+    void ReportRenderer::ResolveLabels(const std::vector<std::string>& arguments) {
+        labels_.clear();
+        ForEachBand(plan_, [&](const ReportPlan::Band& band) {
+            for (const auto& item : band.items) {
+                if (item.kind != ReportControl::Kind::Label || item.shaped) {
+                    continue;
+                }
+
+                Label& label = labels_[&item];
+                label.text = item.text;
+                for (size_t i = 0; i < arguments.size(); ++i) {
+                    label.text = StringHelper::ReplaceAll(label.text, "{" + std::to_string(i + 1) + "}", arguments[i]);
+                }
+                label.perPage = label.text.find("{page}") != std::string::npos;
+                if (!label.perPage) {
+                    const int font = item.bold ? boldFont_ : font_;
+                    label.run = pdf_.Shape(font, ReportPlan::FitText(pdf_, label.text, font, item.size, item.width));
+                    label.x = item.x;
+                    if (item.align != ReportAlign::Left) {
+                        double slack = item.width - label.run.advance * item.size;
+                        label.x += item.align == ReportAlign::Right ? slack : slack / 2;
+                    }
+                }
+            }
+        });
+    }
+
+    void ReportRenderer::ReadRow(Statement& cursor, ReportValue* row, int columns) {
+        for (int c = 0; c < columns; ++c) {
+            ReportValue& value = row[c];
+            value.isNull = cursor.ColumnIsNull(c);
+            if (value.isNull) {
+                value.text.clear();
+                value.number = 0.0;
+            } else {
+                std::string_view text = cursor.ColumnTextView(c);
+                value.text.assign(text.data(), text.size());
+                value.number = cursor.ColumnDouble(c);
+            }
+        }
+    }
+
+    void ReportRenderer::Accumulate(const std::vector<ReportValue>& row) {
+        for (int column : plan_.sumColumns) {
+            if (!row[column].isNull) {
+                int64_t units = Money::FromDouble(row[column].number).units;
+                for (auto& sums : sums_) {
+                    sums[column] += units;
+                }
+            }
+        }
+    }
+
+    void ReportRenderer::StartPage() {
+        pdf_.BeginPage();
+        ++page_;
+        y_ = plan_.top;
+        std::fill(sums_[static_cast<int>(Scope::Page)].begin(), sums_[static_cast<int>(Scope::Page)].end(), 0);
+
+        const std::vector<ReportValue>& current = pending_ ? row_ : previous_;
+        if (page_ == 1 && !plan_.reportHeader.IsEmpty()) {
+            Draw(plan_.reportHeader, current, Scope::Report, y_);
+            y_ += plan_.reportHeader.height;
+        }
+        // On later pages, running totals in the page header carry the
+        // amount brought forward
+        if (!plan_.pageHeader.IsEmpty()) {
+            Draw(plan_.pageHeader, current, Scope::Report, y_);
+            y_ += plan_.pageHeader.height;
+        }
+        pageTop_ = y_;
+    }
+
+    void ReportRenderer::FinishPage() {
+        if (!plan_.pageFooter.IsEmpty()) {
+            Draw(plan_.pageFooter, previous_, Scope::Page, plan_.bottom);
+        }
+        pdf_.EndPage();
+    }
+
+    void ReportRenderer::EnsureSpace(double height) {
+        // A band taller than the page is drawn anyway rather than looping
+        if (y_ + height > plan_.bottom && y_ > pageTop_) {
+            FinishPage();
+            StartPage();
+        }
+    }
+
+    void ReportRenderer::Emit(const ReportPlan::Band& band, const std::vector<ReportValue>& row, Scope sumScope, double keepWith) {
+        EnsureSpace(band.height + keepWith);
+        Draw(band, row, sumScope, y_);
+        y_ += band.height;
+    }
+
+    void ReportRenderer::Draw(const ReportPlan::Band& band, const std::vector<ReportValue>& row, Scope sumScope, double top) {
+        if (band.ruleAbove) {
+            pdf_.DrawLine(plan_.left, top, plan_.right, top, kRuleWidth);
+        }
+
+        for (const auto& item : band.items) {
+            const double baseline = top + item.baseline;
+            switch (item.kind) {
+            case ReportControl::Kind::Label:
+                if (item.shaped) {
+                    pdf_.DrawGlyphs(item.bold ? boldFont_ : font_, item.size, item.x, baseline, item.run);
+                } else {
+                    const Label& label = labels_.at(&item);
+                    if (label.perPage) {
+                        DrawAligned(item, baseline, StringHelper::ReplaceAll(label.text, "{page}", std::to_string(page_)));
+                    } else {
+                        pdf_.DrawGlyphs(item.bold ? boldFont_ : font_, item.size, label.x, baseline, label.run);
+                    }
+                }
+                break;
+            case ReportControl::Kind::Field:
+                DrawAligned(item, baseline, FormatValue(row[item.column], item.format));
+                break;
+            case ReportControl::Kind::Sum: {
+                int64_t units = sums_[static_cast<int>(sumScope)][item.column];
+                DrawAligned(item, baseline, item.format == ReportColumnType::Money
+                    ? FormatAmount(units, format_.moneyDecimals, false, format_.thousandsSeparator, format_.decimalSeparator)
+                    : FormatAmount(units, 4, true, format_.thousandsSeparator, format_.decimalSeparator));
+                break;
+            }
+            }
+        }
+
+        if (band.ruleBelow) {
+            pdf_.DrawLine(plan_.left, top + band.height, plan_.right, top + band.height, kRuleWidth);
+        }
+    }
+
+    void ReportRenderer::DrawAligned(const ReportPlan::Item& item, double baseline, const std::string& text) {
+        const int font = item.bold ? boldFont_ : font_;
+        std::string fitted = ReportPlan::FitText(pdf_, text, font, item.size, item.width);
+        if (fitted.empty()) {
+            return;
+        }
+
+        double x = item.x;
+        if (item.align != ReportAlign::Left) {
+            double slack = item.width - pdf_.TextWidth(font, item.size, fitted);
+            x += item.align == ReportAlign::Right ? slack : slack / 2;
+        }
+        pdf_.DrawText(font, item.size, x, baseline, fitted);
+    }
+
+    std::string ReportRenderer::FormatValue(const ReportValue& value, ReportColumnType format) const {
+        if (value.isNull) {
+            return std::string();
+        }
+
+        switch (format) {
+        case ReportColumnType::Text:
+            return value.text;
+        case ReportColumnType::Integer:
+            return std::to_string(static_cast<long long>(std::llround(value.number)));
+        case ReportColumnType::Number:
+            return FormatAmount(Money::FromDouble(value.number).units, 4, true,
+                format_.thousandsSeparator, format_.decimalSeparator);
+        case ReportColumnType::Money:
+            return FormatAmount(Money::FromDouble(value.number).units, format_.moneyDecimals, false,
+                format_.thousandsSeparator, format_.decimalSeparator);
+        case ReportColumnType::Date: {
+            DayNumber day;
+            if (DateTimeHelper::ParseDayNumber(value.text.data(), value.text.size(), day)) {
+                return DateTimeHelper::FormatDate(DateTimeHelper::FromDayNumber(day), format_.dateFormat);
+            }
+            return value.text;
+        }
+        }
+        return value.text;
+    }
+
+    std::string ReportRenderer::FormatAmount(int64_t units, int decimals, bool trimZeros,
+        char thousandsSeparator, char decimalSeparator) {
+        decimals = std::clamp(decimals, 0, 4);
+        int64_t divisor = 1;
+        for (int i = decimals; i < 4; ++i) {
+            divisor *= 10;
+        }
+        int64_t scale = Money::kScale / divisor;
+
+        // Round half away from zero to the shown decimals
+        const bool negative = units < 0;
+        uint64_t magnitude = negative ? 0 - static_cast<uint64_t>(units) : static_cast<uint64_t>(units);
+        magnitude = (magnitude + static_cast<uint64_t>(divisor) / 2) / static_cast<uint64_t>(divisor);
+        uint64_t whole = magnitude / static_cast<uint64_t>(scale);
+        uint64_t fraction = magnitude % static_cast<uint64_t>(scale);
+
+        std::string digits = std::to_string(whole);
+        std::string result;
+        for (size_t i = 0; i < digits.size(); ++i) {
+            if (i > 0 && (digits.size() - i) % 3 == 0) {
+                result += thousandsSeparator;
+            }
+            result += digits[i];
+        }
+
+        if (decimals > 0) {
+            std::string fractionText = std::to_string(fraction);
+            fractionText.insert(0, static_cast<size_t>(decimals) - fractionText.size(), '0');
+            if (trimZeros) {
+                fractionText.erase(fractionText.find_last_not_of('0') + 1);
+            }
+            if (!fractionText.empty()) {
+                result += decimalSeparator + fractionText;
+            }
+        }
+
+        return negative && magnitude != 0 ? "-" + result : result;
+    }
+
+} // namespace KeToanApp
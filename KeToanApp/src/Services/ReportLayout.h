@@ -0,0 +1,251 @@
+#pragma once
+
+#include "KeToanApp/Common.h"
+#include "KeToanApp/Types.h"
+#include "PdfWriter.h"
+#include "../Database/Statement.h"
+#include <cstdint>
+#include <unordered_map>
+
+namespace KeToanApp {
+
+    enum class ReportColumnType {
+        Text,
+        Integer,
+        Number,
+        Money,      // REAL amounts, handled exactly via Money
+        Date        // ISO or dd/MM/yyyy text, shown as a date
+    };
+
+    enum class ReportAlign {
+        Left,
+        Center,
+        Right
+    };
+
+    // One text item of a band; left is measured from the left margin.
+    // A Label shows fixed text ("{page}" is replaced by the page number,
+    // "{1}", "{2}", ... by the report arguments); a Field shows a column of
+    // the current row (in headers the row about to be printed, in footers
+    // the last one printed); a Sum shows the total of a column over the
+    // band's scope:
+    //   page footer   rows on this page ("cộng trang")
+    //   group footer  rows of the group
+    //   report footer all rows
+    //   other bands   running total up to the current row ("lũy kế")
+    // Columns are named as the query returns them.
+    struct ReportControl {
+        enum class Kind { Label, Field, Sum };
+
+        Kind kind;
+        double left;
+        double width;
+        double top;         // text line offset in the band; < 0 = centred vertically
+        std::string text;
+        std::string column;
+        ReportColumnType format;
+        ReportAlign align;
+        bool bold;
+        double fontSize;    // 0 = layout default
+
+        static ReportControl Label(double left, double width, const std::string& text,
+            ReportAlign align = ReportAlign::Left, bool bold = false, double fontSize = 0.0) {
+            return { Kind::Label, left, width, -1.0, text, std::string(), ReportColumnType::Text, align, bold, fontSize };
+        }
+
+        static ReportControl Field(double left, double width, const std::string& column,
+            ReportColumnType format = ReportColumnType::Text, ReportAlign align = ReportAlign::Left, bool bold = false) {
+            return { Kind::Field, left, width, -1.0, std::string(), column, format, align, bold, 0.0 };
+        }
+
+        static ReportControl Sum(double left, double width, const std::string& column,
+            ReportColumnType format = ReportColumnType::Money, bool bold = true) {
+            return { Kind::Sum, left, width, -1.0, std::string(), column, format, ReportAlign::Right, bold, 0.0 };
+        }
+    };
+
+    struct ReportBand {
+        double height;
+        std::vector<ReportControl> controls;
+        bool ruleAbove;
+        bool ruleBelow;
+
+        ReportBand() : height(0.0), ruleAbove(false), ruleBelow(false) {}
+        bool IsEmpty() const { return height <= 0.0; }
+    };
+
+    // Band layout in the style of the Access report objects it replaces.
+    // Sizes are in points; the default page is A4 portrait.
+    struct ReportLayout {
+        double pageWidth;
+        double pageHeight;
+        double margin;
+        double fontSize;
+        std::string groupBy;    // rows are grouped while this column is unchanged; empty = none
+
+        ReportBand reportHeader;
+        ReportBand pageHeader;
+        ReportBand groupHeader;
+        ReportBand detail;
+        ReportBand groupFooter;
+        ReportBand pageFooter;
+        ReportBand reportFooter;
+
+        ReportLayout()
+            : pageWidth(595.28), pageHeight(841.89), margin(28.0), fontSize(9.0) {}
+    };
+
+    // A layout compiled for one query and one pair of fonts. Columns are
+    // resolved to indexes, every control has its page position, font and
+    // baseline, and fixed labels are fitted, aligned and shaped, so
+    // rendering does no lookups and shapes only data.
+    class ReportPlan {
+    public:
+        struct Item {
+            ReportControl::Kind kind;
+            int column;             // -1 for labels
+            ReportColumnType format;
+            ReportAlign align;
+            bool bold;
+            double size;
+            double x;               // text box left; for shaped labels the aligned text start
+            double width;           // text box width
+            double baseline;        // from the band top
+            bool shaped;            // label fixed at compile time: run is final
+            std::string text;       // label with placeholders
+            PdfWriter::GlyphRun run;
+        };
+
+        struct Band {
+            double height;
+            bool ruleAbove;
+            bool ruleBelow;
+            std::vector<Item> items;
+
+            Band() : height(0.0), ruleAbove(false), ruleBelow(false) {}
+            bool IsEmpty() const { return height <= 0.0; }
+        };
+
+        // Fails (logging why) when a control names a column the query
+        // does not return
+        static bool Compile(const ReportLayout& layout, const std::vector<std::string>& columns,
+            const PdfWriter& pdf, int font, int boldFont, ReportPlan& plan);
+
+        double pageWidth;
+        double pageHeight;
+        double left;            // margins
+        double right;
+        double top;
+        double bottom;          // top of the page footer
+        int columnCount;
+        int groupColumn;        // -1 = none
+        std::vector<int> sumColumns;
+
+        Band reportHeader;
+        Band pageHeader;
+        Band groupHeader;
+        Band detail;
+        Band groupFooter;
+        Band pageFooter;
+        Band reportFooter;
+
+        ReportPlan()
+            : pageWidth(0.0), pageHeight(0.0), left(0.0), right(0.0), top(0.0), bottom(0.0)
+            , columnCount(0), groupColumn(-1) {}
+
+        // Widest prefix of text, with an ellipsis, that fits in width
+        static std::string FitText(const PdfWriter& pdf, const std::string& text, int font, double size, double width);
+    };
+
+    struct ReportFormat {
+        int moneyDecimals;
+        std::string dateFormat;
+        char thousandsSeparator;
+        char decimalSeparator;
+
+        ReportFormat() : moneyDecimals(2), dateFormat("dd/MM/yyyy"), thousandsSeparator('.'), decimalSeparator(',') {}
+    };
+
+    struct ReportValue {
+        std::string text;
+        double number;
+        bool isNull;
+    };
+
+    // Rows fetched ahead of rendering, in the plan's column order
+    struct ReportRowSet {
+        int columnCount;
+        std::vector<ReportValue> values;    // row-major
+
+        ReportRowSet() : columnCount(0) {}
+        size_t GetRowCount() const { return columnCount > 0 ? values.size() / columnCount : 0; }
+    };
+
+    // Lays out a row cursor into pages with a compiled plan, one band at a
+    // time. Pages are finished as soon as they are full, so memory does not
+    // grow with the number of rows or pages. The fonts must be loaded from
+    // the files the plan was compiled with.
+    class ReportRenderer {
+    public:
+        ReportRenderer(PdfWriter& pdf, const ReportPlan& plan, const ReportFormat& format,
+            int font, int boldFont);
+        ~ReportRenderer() = default;
+
+        // Non-copyable
+        ReportRenderer(const ReportRenderer&) = delete;
+        ReportRenderer& operator=(const ReportRenderer&) = delete;
+
+        // Steps the cursor to the end and renders the whole report.
+        // arguments replace "{1}", "{2}", ... in labels.
+        bool Render(Statement& cursor, const std::vector<std::string>& arguments = {});
+        bool Render(const ReportRowSet& rows, const std::vector<std::string>& arguments = {});
+
+        int64_t GetRowCount() const { return rows_; }
+
+        // Reads the cursor's current row into row[0 .. columns)
+        static void ReadRow(Statement& cursor, ReportValue* row, int columns);
+
+        static std::string FormatAmount(int64_t units, int decimals, bool trimZeros,
+            char thousandsSeparator, char decimalSeparator);
+
+    private:
+        // Labels with placeholders, resolved once per render
+        struct Label {
+            std::string text;       // still holding {page}
+            bool perPage;
+            double x;
+            PdfWriter::GlyphRun run;
+        };
+
+        enum class Scope { Page, Group, Report };
+
+        PdfWriter& pdf_;
+        const ReportPlan& plan_;
+        ReportFormat format_;
+        int font_;
+        int boldFont_;
+        std::unordered_map<const ReportPlan::Item*, Label> labels_;
+        std::vector<ReportValue> row_;
+        std::vector<ReportValue> previous_;
+        std::vector<int64_t> sums_[3];      // Money units per column, by Scope
+        double y_;
+        double pageTop_;        // below the page header
+        int page_;
+        int64_t rows_;
+        bool pending_;          // row_ holds the next row to print
+
+        // next(row) fills the next row and returns false at the end
+        template <typename NextRow>
+        bool Run(int columns, NextRow next, const std::vector<std::string>& arguments);
+        void ResolveLabels(const std::vector<std::string>& arguments);
+        void Accumulate(const std::vector<ReportValue>& row);
+        void StartPage();
+        void FinishPage();
+        void EnsureSpace(double height);
+        void Emit(const ReportPlan::Band& band, const std::vector<ReportValue>& row, Scope sumScope, double keepWith = 0.0);
+        void Draw(const ReportPlan::Band& band, const std::vector<ReportValue>& row, Scope sumScope, double top);
+        void DrawAligned(const ReportPlan::Item& item, double baseline, const std::string& text);
+        std::string FormatValue(const ReportValue& value, ReportColumnType format) const;
+    };
+
+} // namespace KeToanApp
@@ -0,0 +1,284 @@
+#include "ReportTemplate.h"
+#include "../Utils/StringHelper.h"
+#include <cstdlib>
+#include <sstream>
+
+namespace KeToanApp {
+
+    namespace {
+
+        bool ParseNumber(const std::string& text, double& value) {
+            if (text.empty()) {
+                return false;
+            }
+            char* end = nullptr;
+            value = std::strtod(text.c_str(), &end);
+            return end == text.c_str() + text.size();
+        }
+
+        std::vector<std::string> Tokens(const std::string& text) {
+            std::vector<std::string> tokens;
+            std::istringstream stream(text);
+            std::string token;
+            while (stream >> token) {
+                tokens.push_back(token);
+            }
+            return tokens;
+        }
+
+        ReportBand* FindBand(ReportLayout& layout, const std::string& section) {
+            if (section == "reportheader") return &layout.reportHeader;
+            if (section == "pageheader") return &layout.pageHeader;
+            if (section == "groupheader") return &layout.groupHeader;
+            if (section == "detail") return &layout.detail;
+            if (section == "groupfooter") return &layout.groupFooter;
+            if (section == "pagefooter") return &layout.pageFooter;
+            if (section == "reportfooter") return &layout.reportFooter;
+            return nullptr;
+        }
+
+        // "left width [options] [| text]" for Label, "left width column [options]" otherwise
+        bool ParseControl(ReportControl::Kind kind, const std::string& value, ReportControl& control, std::string& error) {
+            std::string spec = value;
+            std::string text;
+            if (kind == ReportControl::Kind::Label) {
+                size_t bar = value.find('|');
+                if (bar == std::string::npos) {
+                    error = "label text must follow '|'";
+                    return false;
+                }
+                spec = value.substr(0, bar);
+                text = StringHelper::Trim(value.substr(bar + 1));
+            }
+
+            std::vector<std::string> tokens = Tokens(spec);
+            const size_t fixed = kind == ReportControl::Kind::Label ? 2 : 3;
+            double left = 0.0;
+            double width = 0.0;
+            if (tokens.size() < fixed || !ParseNumber(tokens[0], left) || !ParseNumber(tokens[1], width) || width <= 0.0) {
+                error = kind == ReportControl::Kind::Label
+                    ? "expected: left width [options] | text"
+                    : "expected: left width column [options]";
+                return false;
+            }
+
+            switch (kind) {
+            case ReportControl::Kind::Label:
+                control = ReportControl::Label(left, width, text);
+                break;
+            case ReportControl::Kind::Field:
+                control = ReportControl::Field(left, width, tokens[2]);
+                break;
+            case ReportControl::Kind::Sum:
+                control = ReportControl::Sum(left, width, tokens[2]);
+                break;
+            }
+
+            for (size_t i = fixed; i < tokens.size(); ++i) {
+                const std::string option = StringHelper::ToLower(tokens[i]);
+                double number = 0.0;
+                if (option == "left") control.align = ReportAlign::Left;
+                else if (option == "center") control.align = ReportAlign::Center;
+                else if (option == "right") control.align = ReportAlign::Right;
+                else if (option == "bold") control.bold = true;
+                else if (option == "regular") control.bold = false;
+                else if (option == "text") control.format = ReportColumnType::Text;
+                else if (option == "integer") control.format = ReportColumnType::Integer;
+                else if (option == "number") control.format = ReportColumnType::Number;
+                else if (option == "money") control.format = ReportColumnType::Money;
+                else if (option == "date") control.format = ReportColumnType::Date;
+                else if (StringHelper::StartsWith(option, "size=") && ParseNumber(option.substr(5), number) && number > 0.0) {
+                    control.fontSize = number;
+                }
+                else if (StringHelper::StartsWith(option, "top=") && ParseNumber(option.substr(4), number) && number >= 0.0) {
+                    control.top = number;
+                }
+                else {
+                    error = "unknown option '" + tokens[i] + "'";
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        bool ParseReportKey(const std::string& key, const std::string& value, ReportTemplate& result, std::string& error) {
+            if (key == "title") {
+                result.title = value;
+            } else if (key == "query") {
+                result.query += (result.query.empty() ? "" : " ") + value;
+            } else if (key == "groupby") {
+                result.layout.groupBy = value;
+            } else if (key == "documentkey") {
+                result.documentKey = value;
+            } else if (key == "pagesize") {
+                std::vector<std::string> tokens = Tokens(value);
+                if (tokens.size() != 2 || !ParseNumber(tokens[0], result.layout.pageWidth)
+                    || !ParseNumber(tokens[1], result.layout.pageHeight)
+                    || result.layout.pageWidth <= 0.0 || result.layout.pageHeight <= 0.0) {
+                    error = "expected: PageSize=width height";
+                    return false;
+                }
+            } else if (key == "margin") {
+                if (!ParseNumber(value, result.layout.margin) || result.layout.margin < 0.0) {
+                    error = "invalid margin";
+                    return false;
+                }
+            } else if (key == "fontsize") {
+                if (!ParseNumber(value, result.layout.fontSize) || result.layout.fontSize <= 0.0) {
+                    error = "invalid font size";
+                    return false;
+                }
+            } else {
+                error = "unknown key";
+                return false;
+            }
+            return true;
+        }
+
+        bool ParseBandKey(const std::string& key, const std::string& value, ReportBand& band, std::string& error) {
+            if (key == "height") {
+                if (!ParseNumber(value, band.height) || band.height < 0.0) {
+                    error = "invalid height";
+                    return false;
+                }
+            } else if (key == "rules") {
+                for (const auto& token : Tokens(StringHelper::ToLower(value))) {
+                    if (token == "above") band.ruleAbove = true;
+                    else if (token == "below") band.ruleBelow = true;
+                    else {
+                        error = "rules are 'above' and 'below'";
+                        return false;
+                    }
+                }
+            } else if (key == "label" || key == "field" || key == "sum") {
+                ReportControl control;
+                ReportControl::Kind kind = key == "label" ? ReportControl::Kind::Label
+                    : key == "field" ? ReportControl::Kind::Field : ReportControl::Kind::Sum;
+                if (!ParseControl(kind, value, control, error)) {
+                    return false;
+                }
+                band.controls.push_back(std::move(control));
+            } else {
+                error = "unknown key";
+                return false;
+            }
+            return true;
+        }
+
+    } // namespace
+
+    bool ReportTemplate::Parse(const std::string& text, ReportTemplate& result, std::string& error) {
+        result = ReportTemplate();
+        std::istringstream stream(text);
+        std::string line;
+        std::string section;
+        int lineNumber = 0;
+
+        while (std::getline(stream, line)) {
+            ++lineNumber;
+            // UTF-8 byte order mark left by Notepad
+            if (lineNumber == 1 && StringHelper::StartsWith(line, "\xEF\xBB\xBF")) {
+                line.erase(0, 3);
+            }
+            line = StringHelper::Trim(line);
+            if (line.empty() || line[0] == ';' || line[0] == '#') {
+                continue;
+            }
+
+            if (line.front() == '[' && line.back() == ']') {
+                section = StringHelper::ToLower(StringHelper::Trim(line.substr(1, line.size() - 2)));
+                if (section != "report" && !FindBand(result.layout, section)) {
+                    error = "line " + std::to_string(lineNumber) + ": unknown section [" + section + "]";
+                    return false;
+                }
+                continue;
+            }
+
+            size_t equals = line.find('=');
+            if (equals == std::string::npos || section.empty()) {
+                error = "line " + std::to_string(lineNumber) + ": expected key=value inside a section";
+                return false;
+            }
+            const std::string key = StringHelper::ToLower(StringHelper::Trim(line.substr(0, equals)));
+            const std::string value = StringHelper::Trim(line.substr(equals + 1));
+
+            std::string message;
+            bool ok = section == "report"
+                ? ParseReportKey(key, value, result, message)
+                : ParseBandKey(key, value, *FindBand(result.layout, section), message);
+            if (!ok) {
+                error = "line " + std::to_string(lineNumber) + ": " + message;
+                return false;
+            }
+        }
+
+        if (result.query.empty()) {
+            error = "[Report] has no Query";
+            return false;
+        }
+        return true;
+    }
+
+    ReportPlanCache::ReportPlanCache(size_t capacity)
+        : capacity_(capacity > 0 ? capacity : 1)
+        , hits_(0)
+        , misses_(0)
+    {
+    }
+
+    uint64_t ReportPlanCache::Key(const std::string& templateText, const std::string& fontPath,
+        const std::string& boldFontPath) {
+        // FNV-1a over the three strings, each followed by a separator
+        uint64_t hash = 0xCBF29CE484222325ULL;
+        for (const std::string* part : { &templateText, &fontPath, &boldFontPath }) {
+            for (unsigned char c : *part) {
+                hash = (hash ^ c) * 0x100000001B3ULL;
+            }
+            hash = (hash ^ 0xFF) * 0x100000001B3ULL;
+        }
+        return hash;
+    }
+
+    std::shared_ptr<const ReportPlanCache::Entry> ReportPlanCache::Find(uint64_t key) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(key);
+        if (it == entries_.end()) {
+            ++misses_;
+            return nullptr;
+        }
+        ++hits_;
+        return it->second;
+    }
+
+    std::shared_ptr<const ReportPlanCache::Entry> ReportPlanCache::Insert(uint64_t key,
+        std::shared_ptr<const Entry> entry) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(key);
+        if (it != entries_.end()) {
+            return it->second;
+        }
+        // There are only a few dozen templates; a full cache means stale
+        // ones from edited files, so start over
+        if (entries_.size() >= capacity_) {
+            entries_.clear();
+        }
+        entries_.emplace(key, entry);
+        return entry;
+    }
+
+    void ReportPlanCache::Clear() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries_.clear();
+    }
+
+    uint64_t ReportPlanCache::GetHits() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return hits_;
+    }
+
+    uint64_t ReportPlanCache::GetMisses() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return misses_;
+    }
+
+} // namespace KeToanApp
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "KeToanApp/Common.h"
+#include "KeToanApp/Types.h"
+#include "ReportLayout.h"
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+namespace KeToanApp {
+
+    // Declarative report definition, in the INI style of config.ini, so
+    // layouts mirroring the old Access reports can be kept as text:
+    //
+    //   [Report]
+    //   Title=Phiếu thu {1}
+    //   Query=SELECT c.SoCT AS SoCT, c.NgayCT AS NgayCT, ...
+    //   Query=FROM ChungTuKeToan c WHERE c.SoCT = ?1
+    //   GroupBy=SoCT
+    //   DocumentKey=SoCT
+    //   PageSize=595.28 841.89
+    //   Margin=28
+    //   FontSize=9
+    //
+    //   [PageHeader]
+    //   Height=18
+    //   Rules=above below
+    //   Label=0 56 bold | Ngày CT
+    //   Field=0 56 NgayCT date
+    //   Sum=429 110 SoTien money
+    //
+    // Repeated Query keys continue the query. Band sections are
+    // ReportHeader, PageHeader, GroupHeader, Detail, GroupFooter,
+    // PageFooter and ReportFooter. Controls start with left and width; the
+    // options that follow are left/center/right, bold/regular,
+    // text/integer/number/money/date, size=N and top=N. Report arguments
+    // bind to ?1, ?2, ... in the query and replace {1}, {2}, ... in the
+    // title and labels. Lines starting with ';' or '#' are comments.
+    //
+    // Templates printed in batches (BatchPrintService) name the column
+    // identifying a document in DocumentKey. Their query selects the
+    // documents with keys between ?1 and ?2 and is ordered by that key
+    // first.
+    struct ReportTemplate {
+        std::string title;
+        std::string query;
+        std::string documentKey;
+        ReportLayout layout;
+
+        // On failure error names the line
+        static bool Parse(const std::string& text, ReportTemplate& result, std::string& error);
+    };
+
+    // Compiled plans keyed by a hash of the template text and the font
+    // files, so a batch printed from one template is parsed and compiled
+    // once. Thread-safe; entries are immutable once cached.
+    class ReportPlanCache {
+    public:
+        struct Entry {
+            ReportTemplate definition;
+            ReportPlan plan;
+        };
+
+        explicit ReportPlanCache(size_t capacity = 32);
+        ~ReportPlanCache() = default;
+
+        // Non-copyable
+        ReportPlanCache(const ReportPlanCache&) = delete;
+        ReportPlanCache& operator=(const ReportPlanCache&) = delete;
+
+        static uint64_t Key(const std::string& templateText, const std::string& fontPath,
+            const std::string& boldFontPath);
+
+        std::shared_ptr<const Entry> Find(uint64_t key);
+        // Returns the entry already cached under key, if another thread
+        // compiled the same template first
+        std::shared_ptr<const Entry> Insert(uint64_t key, std::shared_ptr<const Entry> entry);
+        void Clear();
+
+        uint64_t GetHits() const;
+        uint64_t GetMisses() const;
+
+    private:
+        mutable std::mutex mutex_;
+        std::unordered_map<uint64_t, std::shared_ptr<const Entry>> entries_;
+        size_t capacity_;
+        uint64_t hits_;
+        uint64_t misses_;
+    };
+
+} // namespace KeToanApp
@@ -0,0 +1,486 @@
+#include "StockMovementIndex.h"
+#include "../Database/ChangeFeed.h"
+#include "../Utils/DateTimeHelper.h"
+#include "../Utils/Logger.h"
+#include "../Utils/Trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <unordered_set>
+
+namespace KeToanApp {
+
+    namespace {
+
+        // Per document kind: lines of documents not voided
+        const char* kLineQueries[2] = {
+            "SELECT c.ID, p.SoPhieu, p.NgayNhap, c.MaSP, c.SoLuong, c.ThanhTien "
+            "FROM ChiTietPhieuNhap c JOIN PhieuNhap p ON p.SoPhieu = c.SoPhieu "
+            "WHERE COALESCE(p.TrangThai, 1) <> 2",
+            "SELECT c.ID, p.SoPhieu, p.NgayXuat, c.MaSP, c.SoLuong, c.ThanhTien "
+            "FROM ChiTietPhieuXuat c JOIN PhieuXuat p ON p.SoPhieu = c.SoPhieu "
+            "WHERE COALESCE(p.TrangThai, 1) <> 2",
+        };
+
+        const char* kDocumentTables[2] = { "PhieuNhap", "PhieuXuat" };
+
+        const size_t kChangeBatch = 1000;
+
+        // Re-reading more documents than this one by one is slower than a rebuild
+        const size_t kMaxChangedDocuments = 5000;
+
+    } // namespace
+
+    uint32_t StockMovementIndex::Documents::Intern(const std::string& soPhieu) {
+        auto it = index.find(soPhieu);
+        if (it != index.end()) {
+            return it->second;
+        }
+        const uint32_t id = static_cast<uint32_t>(keys.size());
+        keys.push_back(soPhieu);
+        products.emplace_back();
+        index.emplace(soPhieu, id);
+        return id;
+    }
+
+    StockMovementIndex::StockMovementIndex(DatabaseManager& database, CodeDictionary& codes)
+        : database_(database)
+        , codes_(codes)
+        , openingDay_(kNoDay)
+        , built_(false)
+        , changeSeq_(0)
+        , cursor_(database)
+    {
+    }
+
+    bool StockMovementIndex::Build() {
+        KETOAN_TRACE_SCOPE("engine", "StockMovementIndex.Build");
+        std::lock_guard<std::mutex> refreshLock(refreshMutex_);
+        return Rebuild();
+    }
+
+    bool StockMovementIndex::Rebuild() {
+        auto started = std::chrono::steady_clock::now();
+
+        std::unique_ptr<ReadView> view = database_.OpenReadView();
+        if (!view) {
+            Logger::Error("Stock index: no read view available");
+            return false;
+        }
+
+        const int64_t head = ChangeFeed::GetHeadSequence(*view);
+        DayNumber openingDay = kNoDay;
+        std::vector<std::pair<uint32_t, Totals>> opening;
+        std::vector<Change> changes;
+        try {
+            // Stock carried into the first open year
+            auto year = view->Prepare("SELECT MAX(NamTC) FROM TonKhoDauKy");
+            if (year->Step() && !year->ColumnIsNull(0)) {
+                const int namTC = static_cast<int>(year->ColumnInt64(0));
+                openingDay = DateTimeHelper::ToDayNumber(1, 1, namTC);
+
+                auto stmt = view->Prepare("SELECT MaSP, SoLuong, GiaTri FROM TonKhoDauKy WHERE NamTC = ?1");
+                stmt->BindInt64(1, namTC);
+                while (stmt->Step()) {
+                    Totals totals;
+                    totals.quantity = Money::FromDouble(stmt->ColumnDouble(1)).units;
+                    totals.receivedQuantity = totals.quantity;
+                    totals.receivedValue = Money::FromDouble(stmt->ColumnDouble(2)).units;
+                    opening.emplace_back(codes_.Intern(CodeKind::Product, stmt->ColumnTextView(0)), totals);
+                }
+            }
+        }
+        catch (const DatabaseException& e) {
+            Logger::Error("Stock index: reading opening stock failed: %s", e.what());
+            return false;
+        }
+        if (!ReadLines(*view, kReceipt, nullptr, changes) || !ReadLines(*view, kIssue, nullptr, changes)) {
+            return false;
+        }
+        view.reset();
+
+        size_t lines = 0;
+        size_t documents = 0;
+        {
+            std::unique_lock<std::shared_mutex> lock(mutex_);
+            products_.clear();
+            documents_[kReceipt] = Documents();
+            documents_[kIssue] = Documents();
+            for (const auto& product : opening) {
+                if (product.first >= products_.size()) {
+                    products_.resize(product.first + 1);
+                }
+                products_[product.first].opening = product.second;
+            }
+            for (const auto& change : changes) {
+                lines += change.lines.size();
+            }
+            Apply(changes);
+            openingDay_ = openingDay;
+            changeSeq_ = head;
+            cursor_.Set(head);
+            built_ = true;
+            documents = documents_[kReceipt].keys.size() + documents_[kIssue].keys.size();
+        }
+
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - started);
+        Logger::Info("Stock index built: %zu movements, %zu documents in %lld ms",
+            lines, documents, static_cast<long long>(elapsed.count()));
+        return true;
+    }
+
+    bool StockMovementIndex::ReadLines(ReadView& view, uint8_t kind, const std::string* soPhieu,
+        std::vector<Change>& changes)
+    {
+        // One document, or all of them grouped by document
+        std::string sql = kLineQueries[kind];
+        sql += soPhieu ? " AND p.SoPhieu = ?1" : " ORDER BY p.SoPhieu";
+
+        if (soPhieu) {
+            changes.push_back(Change{ kind, *soPhieu, {} });
+        }
+        try {
+            auto stmt = view.Prepare(sql);
+            if (soPhieu) {
+                stmt->BindText(1, *soPhieu);
+            }
+
+            while (stmt->Step()) {
+                std::string_view key = stmt->ColumnTextView(1);
+                if (changes.empty() || changes.back().kind != kind || changes.back().soPhieu != key) {
+                    changes.push_back(Change{ kind, std::string(key), {} });
+                }
+
+                std::string_view date = stmt->ColumnTextView(2);
+                Entry entry;
+                if (!DateTimeHelper::ParseDayNumber(date.data(), date.size(), entry.day)) {
+                    Logger::Warning("Stock index: skipping %s %.*s with bad date '%.*s'", kDocumentTables[kind],
+                        static_cast<int>(key.size()), key.data(), static_cast<int>(date.size()), date.data());
+                    continue;
+                }
+                entry.document = 0;     // assigned by Apply()
+                entry.kind = kind;
+                entry.line = stmt->ColumnInt64(0);
+                entry.quantity = Money::FromDouble(stmt->ColumnDouble(4)).units;
+                if (kind == kIssue) {
+                    entry.quantity = -entry.quantity;
+                }
+                entry.amount = Money::FromDouble(stmt->ColumnDouble(5)).units;
+                changes.back().lines.emplace_back(codes_.Intern(CodeKind::Product, stmt->ColumnTextView(3)), entry);
+            }
+        }
+        catch (const DatabaseException& e) {
+            Logger::Error("Stock index: reading %s lines failed: %s", kDocumentTables[kind], e.what());
+            return false;
+        }
+        return true;
+    }
+
+    bool StockMovementIndex::Refresh() {
+        KETOAN_TRACE_SCOPE("engine", "StockMovementIndex.Refresh");
+        std::lock_guard<std::mutex> refreshLock(refreshMutex_);
+        if (!built_) {
+            return Rebuild();
+        }
+
+        std::unique_ptr<ReadView> view = database_.OpenReadView();
+        if (!view) {
+            Logger::Error("Stock index: no read view available");
+            return false;
+        }
+        const int64_t head = ChangeFeed::GetHeadSequence(*view);
+        if (head == changeSeq_) {
+            return true;
+        }
+
+        // Documents named since the last refresh, each re-read once
+        std::vector<std::pair<uint8_t, std::string>> documents;
+        bool rebuild = false;
+        try {
+            auto first = view->Prepare("SELECT MIN(Seq) FROM ChangeLog WHERE Seq > ?1");
+            first->BindInt64(1, changeSeq_);
+            rebuild = first->Step() && !first->ColumnIsNull(0) && first->ColumnInt64(0) > changeSeq_ + 1;
+
+            std::unordered_set<std::string> seen[2];
+            std::vector<ChangeRecord> records;
+            int64_t seq = changeSeq_;
+            do {
+                records.clear();
+                if (rebuild || !ChangeFeed::ReadChanges(*view, seq, kChangeBatch, records)) {
+                    break;
+                }
+                for (const auto& record : records) {
+                    seq = record.seq;
+                    const uint8_t kind = record.tableName == "PhieuNhap" ? kReceipt
+                        : record.tableName == "PhieuXuat" ? kIssue : 2;
+                    if (kind == 2) {
+                        continue;
+                    }
+                    if (record.operation == ChangeOperation::Delete || documents.size() > kMaxChangedDocuments) {
+                        rebuild = true;
+                        break;
+                    }
+                    if (seen[kind].insert(record.rowKey).second) {
+                        documents.emplace_back(kind, record.rowKey);
+                    }
+                }
+            } while (!rebuild && records.size() == kChangeBatch);
+        }
+        catch (const DatabaseException& e) {
+            Logger::Error("Stock index: reading change log failed: %s", e.what());
+            return false;
+        }
+
+        if (rebuild) {
+            view.reset();
+            Logger::Info("Stock index: documents deleted, change log purged or many changes; rebuilding");
+            return Rebuild();
+        }
+
+        std::vector<Change> changes;
+        for (const auto& document : documents) {
+            if (!ReadLines(*view, document.first, &document.second, changes)) {
+                return false;
+            }
+        }
+        view.reset();
+
+        {
+            std::unique_lock<std::shared_mutex> lock(mutex_);
+            Apply(changes);
+            changeSeq_ = head;
+            cursor_.Set(head);
+        }
+        Logger::Debug("Stock index refresh: %zu documents re-read", documents.size());
+        return true;
+    }
+
+    void StockMovementIndex::Apply(std::vector<Change>& changes) {
+        // Products the batch touches: lines of re-read documents to drop
+        // (kind << 32 | document), the first entry that changes and where
+        // the batch's lines are appended
+        struct Dirty {
+            uint32_t product;
+            std::vector<uint64_t> dropped;
+            size_t firstChanged;
+            size_t tail;
+        };
+        std::vector<Dirty> dirty;
+        std::vector<uint32_t> slot(products_.size(), 0);   // 1 + index into dirty
+        auto touch = [&](uint32_t product) -> Dirty& {
+            if (product >= slot.size()) {
+                slot.resize(product + 1, 0);
+            }
+            if (!slot[product]) {
+                dirty.push_back(Dirty{ product, {}, SIZE_MAX, 0 });
+                slot[product] = static_cast<uint32_t>(dirty.size());
+            }
+            return dirty[slot[product] - 1];
+        };
+
+        for (auto& change : changes) {
+            Documents& documents = documents_[change.kind];
+            const uint32_t document = documents.Intern(change.soPhieu);
+            auto& products = documents.products[document];
+            for (uint32_t product : products) {
+                touch(product).dropped.push_back(static_cast<uint64_t>(change.kind) << 32 | document);
+            }
+            products.clear();
+
+            for (auto& line : change.lines) {
+                line.second.document = document;
+                touch(line.first);
+                if (std::find(products.begin(), products.end(), line.first) == products.end()) {
+                    products.push_back(line.first);
+                }
+            }
+        }
+
+        // Drop the lines applied before in one pass per product; what is
+        // left stays sorted
+        if (slot.size() > products_.size()) {
+            products_.resize(slot.size());
+        }
+        for (auto& product : dirty) {
+            auto& entries = products_[product.product].entries;
+            if (!product.dropped.empty()) {
+                std::sort(product.dropped.begin(), product.dropped.end());
+                auto isDropped = [&](const Entry& entry) {
+                    return std::binary_search(product.dropped.begin(), product.dropped.end(),
+                        static_cast<uint64_t>(entry.kind) << 32 | entry.document);
+                };
+                auto first = std::find_if(entries.begin(), entries.end(), isDropped);
+                product.firstChanged = static_cast<size_t>(first - entries.begin());
+                entries.erase(std::remove_if(first, entries.end(), isDropped), entries.end());
+            }
+            product.tail = entries.size();
+        }
+
+        for (const auto& change : changes) {
+            for (const auto& line : change.lines) {
+                products_[line.first].entries.push_back(line.second);
+            }
+        }
+
+        for (const auto& product : dirty) {
+            Merge(products_[product.product], product.tail, product.firstChanged);
+        }
+    }
+
+    void StockMovementIndex::Merge(Product& product, size_t tail, size_t firstChanged) {
+        auto& entries = product.entries;
+        const auto before = [](const Entry& a, const Entry& b) {
+            if (a.day != b.day) return a.day < b.day;
+            if (a.kind != b.kind) return a.kind < b.kind;
+            return a.line < b.line;
+        };
+
+        // Only the appended lines are out of order: sort them, then merge
+        // them in from the first sorted entry they precede
+        if (tail < entries.size()) {
+            std::sort(entries.begin() + tail, entries.end(), before);
+            auto from = std::upper_bound(entries.begin(), entries.begin() + tail, entries[tail], before);
+            firstChanged = (std::min)(firstChanged, static_cast<size_t>(from - entries.begin()));
+            std::inplace_merge(from, entries.begin() + tail, entries.end(), before);
+        }
+        firstChanged = (std::min)(firstChanged, entries.size());
+
+        // Checkpoints up to the first changed entry still hold. The rest
+        // are recomputed through the end, so every count has its checkpoint.
+        const size_t valid = firstChanged / kCheckpointInterval;
+        Totals totals;
+        size_t i = 0;
+        if (valid < product.checkpoints.size()) {
+            product.checkpoints.resize(valid + 1);
+            totals = product.checkpoints.back();
+            i = valid * kCheckpointInterval;
+        } else {
+            product.checkpoints.clear();
+        }
+        for (; i <= entries.size(); ++i) {
+            if (i % kCheckpointInterval == 0 && i / kCheckpointInterval == product.checkpoints.size()) {
+                product.checkpoints.push_back(totals);
+            }
+            if (i == entries.size()) {
+                break;
+            }
+            const Entry& entry = entries[i];
+            totals.quantity += entry.quantity;
+            if (entry.kind == kReceipt) {
+                totals.receivedQuantity += entry.quantity;
+                totals.receivedValue += entry.amount;
+            }
+        }
+    }
+
+    StockMovementIndex::Totals StockMovementIndex::Sum(const Product& product, size_t count) {
+        Totals totals = product.opening;
+        if (count == 0) {
+            return totals;
+        }
+
+        const size_t checkpoint = count / kCheckpointInterval;
+        const Totals& before = product.checkpoints[checkpoint];
+        totals.quantity += before.quantity;
+        totals.receivedQuantity += before.receivedQuantity;
+        totals.receivedValue += before.receivedValue;
+        for (size_t i = checkpoint * kCheckpointInterval; i < count; ++i) {
+            const Entry& entry = product.entries[i];
+            totals.quantity += entry.quantity;
+            if (entry.kind == kReceipt) {
+                totals.receivedQuantity += entry.quantity;
+                totals.receivedValue += entry.amount;
+            }
+        }
+        return totals;
+    }
+
+    size_t StockMovementIndex::UpperBound(const Product& product, DayNumber day) {
+        auto it = std::upper_bound(product.entries.begin(), product.entries.end(), day,
+            [](DayNumber value, const Entry& entry) { return value < entry.day; });
+        return static_cast<size_t>(it - product.entries.begin());
+    }
+
+    StockPosition StockMovementIndex::Value(const Totals& totals) {
+        StockPosition position;
+        position.quantity = Money::FromUnits(totals.quantity);
+        if (totals.receivedQuantity > 0) {
+            const double averageCost = static_cast<double>(totals.receivedValue) / totals.receivedQuantity;
+            position.value = Money::FromUnits(std::llround(totals.quantity * averageCost));
+        }
+        return position;
+    }
+
+    const StockMovementIndex::Product* StockMovementIndex::Find(std::string_view maSP) const {
+        const uint32_t id = codes_.Find(CodeKind::Product, maSP);
+        return id < products_.size() ? &products_[id] : nullptr;
+    }
+
+    bool StockMovementIndex::GetStock(std::string_view maSP, DayNumber asOf, StockPosition& position) const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        position = StockPosition();
+        if (!built_ || (openingDay_ != kNoDay && asOf < openingDay_ - 1)) {
+            return false;
+        }
+
+        const Product* product = Find(maSP);
+        if (product) {
+            position = Value(Sum(*product, UpperBound(*product, asOf)));
+        }
+        return true;
+    }
+
+    size_t StockMovementIndex::GetMovementCount(std::string_view maSP, DayNumber from, DayNumber to) const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        const Product* product = Find(maSP);
+        if (!product || to < from) {
+            return 0;
+        }
+        return UpperBound(*product, to) - UpperBound(*product, from - 1);
+    }
+
+    bool StockMovementIndex::GetMovements(std::string_view maSP, DayNumber from, DayNumber to, size_t offset,
+        size_t limit, std::vector<StockMovement>& movements) const
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        movements.clear();
+        if (!built_) {
+            return false;
+        }
+
+        const Product* product = Find(maSP);
+        if (!product || to < from) {
+            return true;
+        }
+
+        const size_t begin = UpperBound(*product, from - 1) + offset;
+        const size_t end = (std::min)(UpperBound(*product, to), begin + limit);
+        if (begin >= end) {
+            return true;
+        }
+
+        int64_t balance = Sum(*product, begin).quantity;
+        movements.reserve(end - begin);
+        for (size_t i = begin; i < end; ++i) {
+            const Entry& entry = product->entries[i];
+            balance += entry.quantity;
+
+            StockMovement movement;
+            movement.day = entry.day;
+            movement.receipt = entry.kind == kReceipt;
+            movement.soPhieu = documents_[entry.kind].keys[entry.document];
+            movement.quantity = Money::FromUnits(entry.kind == kReceipt ? entry.quantity : -entry.quantity);
+            movement.amount = Money::FromUnits(entry.amount);
+            movement.balance = Money::FromUnits(balance);
+            movements.push_back(std::move(movement));
+        }
+        return true;
+    }
+
+    DayNumber StockMovementIndex::GetOpeningDay() const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        return openingDay_;
+    }
+
+} // namespace KeToanApp
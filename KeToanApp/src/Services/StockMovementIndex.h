@@ -0,0 +1,146 @@
+#pragma once
+
+#include "KeToanApp/Common.h"
+#include "KeToanApp/Types.h"
+#include "../Database/ChangeFeed.h"
+#include "../Database/DatabaseManager.h"
+#include "CodeDictionary.h"
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <string_view>
+#include <unordered_map>
+
+namespace KeToanApp {
+
+    // Stock of one product at a point in time
+    struct StockPosition {
+        Money quantity;
+        Money value;        // at the weighted average cost of opening stock and receipts so far
+    };
+
+    // One line of the movement history (lịch sử xuất nhập)
+    struct StockMovement {
+        DayNumber day;
+        bool receipt;           // PhieuNhap line, else PhieuXuat
+        std::string soPhieu;
+        Money quantity;
+        Money amount;           // ThanhTien of the line
+        Money balance;          // quantity on hand after this movement
+    };
+
+    // Per-product, time-ordered index of ChiTietPhieuNhap/ChiTietPhieuXuat
+    // for stock-as-of-date lookups and paged movement history.
+    //
+    // Each product's movements are kept sorted by date, receipts before
+    // issues on the same day (as the stock validation rule counts them),
+    // then by line ID. Every kCheckpointInterval movements a checkpoint
+    // holds the running totals, so stock as of a date is a binary search
+    // plus at most one interval of movements, and a history page starts
+    // from the checkpoint before it: no re-sorting, no aggregation in SQL.
+    // Stock starts from the TonKhoDauKy of the first open year.
+    //
+    // Refresh() re-reads the documents the ChangeLog names since the last
+    // refresh, so inserts, edits and voids are all exact. Their new lines
+    // are sorted on their own and merged in, and checkpoints are recomputed
+    // only from the first entry that changed. A deleted
+    // document (period close), a gap in the ChangeLog or a very large
+    // batch of changes rebuilds the index. Queries take a shared lock.
+    class StockMovementIndex {
+    public:
+        static const size_t kCheckpointInterval = 64;
+
+        StockMovementIndex(DatabaseManager& database, CodeDictionary& codes);
+        ~StockMovementIndex() = default;
+
+        // Non-copyable
+        StockMovementIndex(const StockMovementIndex&) = delete;
+        StockMovementIndex& operator=(const StockMovementIndex&) = delete;
+
+        bool Build();
+        // Applies changes committed since the last Build() or Refresh();
+        // builds the index if it has not been built
+        bool Refresh();
+
+        // Stock after all movements up to and including asOf. False if
+        // asOf is before the opening stock or the index is not built.
+        bool GetStock(std::string_view maSP, DayNumber asOf, StockPosition& position) const;
+
+        // Movements over [from, to], oldest first
+        size_t GetMovementCount(std::string_view maSP, DayNumber from, DayNumber to) const;
+        bool GetMovements(std::string_view maSP, DayNumber from, DayNumber to, size_t offset, size_t limit,
+            std::vector<StockMovement>& movements) const;
+
+        // First day of the first open year; INT32_MIN without opening stock
+        DayNumber GetOpeningDay() const;
+
+    private:
+        static const DayNumber kNoDay = INT32_MIN;
+
+        enum DocumentKind : uint8_t { kReceipt = 0, kIssue = 1 };
+
+        struct Entry {
+            DayNumber day;
+            uint32_t document;      // documents_[kind] index
+            uint8_t kind;
+            int64_t line;           // detail ID, orders a day's movements
+            int64_t quantity;       // Money units, negative for issues
+            int64_t amount;         // Money units
+        };
+
+        // Totals of the movements before a checkpoint
+        struct Totals {
+            int64_t quantity = 0;           // on hand, net of issues
+            int64_t receivedQuantity = 0;
+            int64_t receivedValue = 0;
+        };
+
+        struct Product {
+            std::vector<Entry> entries;
+            std::vector<Totals> checkpoints;    // [i] = totals of entries before i * kCheckpointInterval
+            Totals opening;                     // TonKhoDauKy; receivedValue holds GiaTri
+        };
+
+        struct Documents {
+            std::vector<std::string> keys;                      // SoPhieu
+            std::unordered_map<std::string, uint32_t> index;
+            std::vector<std::vector<uint32_t>> products;        // products with lines, by document
+
+            uint32_t Intern(const std::string& soPhieu);
+        };
+
+        // Lines of one document as read, to be applied under the lock
+        struct Change {
+            uint8_t kind;
+            std::string soPhieu;
+            std::vector<std::pair<uint32_t, Entry>> lines;      // product id, entry
+        };
+
+        DatabaseManager& database_;
+        CodeDictionary& codes_;
+
+        mutable std::shared_mutex mutex_;
+        std::mutex refreshMutex_;
+
+        std::vector<Product> products_;         // by CodeKind::Product id
+        Documents documents_[2];
+        DayNumber openingDay_;
+        bool built_;
+        int64_t changeSeq_;
+        ChangeCursor cursor_;   // holds ChangeFeed::Purge() back to changeSeq_
+
+        bool Rebuild();
+        bool ReadLines(ReadView& view, uint8_t kind, const std::string* soPhieu, std::vector<Change>& changes);
+        void Apply(std::vector<Change>& changes);
+        const Product* Find(std::string_view maSP) const;
+
+        // Totals of the first count entries
+        static Totals Sum(const Product& product, size_t count);
+        // Merges the entries from tail on into the sorted ones before them
+        // and recomputes the checkpoints from firstChanged on
+        static void Merge(Product& product, size_t tail, size_t firstChanged);
+        static size_t UpperBound(const Product& product, DayNumber day);
+        static StockPosition Value(const Totals& totals);
+    };
+
+} // namespace KeToanApp
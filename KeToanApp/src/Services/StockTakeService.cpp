@@ -0,0 +1,651 @@
+#include "StockTakeService.h"
+#include "../Database/BulkInserter.h"
+#include "../Utils/DateTimeHelper.h"
+#include "../Utils/Logger.h"
+#include "../Utils/MappedFile.h"
+#include "../Utils/StringHelper.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstring>
+
+namespace KeToanApp {
+
+    namespace {
+
+        // Where lines and opening stock without a warehouse belong
+        // (DatabaseManager::CreateWarehouseTables)
+        const char* kDefaultWarehouse = "KHO01";
+
+        // Lots with their stock at the end of ?1: on hand less later movements
+        const char* kLotBookQuery = R"(
+            SELECT l.ID, l.MaSP, l.MaKho, l.SoLo, l.SoLuongCon
+                - COALESCE((SELECT SUM(c.SoLuong) FROM ChiTietPhieuNhap c JOIN PhieuNhap p ON p.SoPhieu = c.SoPhieu
+                            WHERE c.LoHangID = l.ID AND daynum(p.NgayNhap) > daynum(?1) AND COALESCE(p.TrangThai, 1) <> 2), 0)
+                + COALESCE((SELECT SUM(c.SoLuong) FROM ChiTietPhieuXuat c JOIN PhieuXuat p ON p.SoPhieu = c.SoPhieu
+                            WHERE c.LoHangID = l.ID AND daynum(p.NgayXuat) > daynum(?1) AND COALESCE(p.TrangThai, 1) <> 2), 0)
+            FROM LoHang l
+        )";
+
+        // Stock held in lots per product at the start of day ?1
+        const char* kLotOpeningQuery = R"(
+            SELECT l.MaSP, SUM(l.SoLuongCon
+                - COALESCE((SELECT SUM(c.SoLuong) FROM ChiTietPhieuNhap c JOIN PhieuNhap p ON p.SoPhieu = c.SoPhieu
+                            WHERE c.LoHangID = l.ID AND daynum(p.NgayNhap) >= daynum(?1) AND COALESCE(p.TrangThai, 1) <> 2), 0)
+                + COALESCE((SELECT SUM(c.SoLuong) FROM ChiTietPhieuXuat c JOIN PhieuXuat p ON p.SoPhieu = c.SoPhieu
+                            WHERE c.LoHangID = l.ID AND daynum(p.NgayXuat) >= daynum(?1) AND COALESCE(p.TrangThai, 1) <> 2), 0))
+            FROM LoHang l GROUP BY l.MaSP
+        )";
+
+        // Net movement of stock not tracked by lot over [?2, ?1]
+        const char* kUnlottedBookQuery = R"(
+            SELECT MaSP, MaKho, SUM(SoLuong) FROM (
+                SELECT c.MaSP, c.MaKho, c.SoLuong FROM ChiTietPhieuNhap c JOIN PhieuNhap p ON p.SoPhieu = c.SoPhieu
+                WHERE c.LoHangID IS NULL AND daynum(p.NgayNhap) BETWEEN daynum(?2) AND daynum(?1) AND COALESCE(p.TrangThai, 1) <> 2
+                UNION ALL
+                SELECT c.MaSP, c.MaKho, -c.SoLuong FROM ChiTietPhieuXuat c JOIN PhieuXuat p ON p.SoPhieu = c.SoPhieu
+                WHERE c.LoHangID IS NULL AND daynum(p.NgayXuat) BETWEEN daynum(?2) AND daynum(?1) AND COALESCE(p.TrangThai, 1) <> 2
+            ) GROUP BY MaSP, MaKho
+        )";
+
+        std::string IsoDate(DayNumber day) {
+            const Date date = DateTimeHelper::FromDayNumber(day);
+            return StringHelper::Format("%04d-%02d-%02d", date.year, date.month, date.day);
+        }
+
+        std::string_view TrimView(std::string_view text) {
+            while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) {
+                text.remove_prefix(1);
+            }
+            while (!text.empty() && (text.back() == ' ' || text.back() == '\t')) {
+                text.remove_suffix(1);
+            }
+            return text;
+        }
+
+        bool EqualsIgnoreCase(std::string_view a, const char* b) {
+            const size_t length = std::strlen(b);
+            if (a.size() != length) {
+                return false;
+            }
+            for (size_t i = 0; i < length; ++i) {
+                if (std::tolower(static_cast<unsigned char>(a[i])) != std::tolower(static_cast<unsigned char>(b[i]))) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // Splits a CSV line. Quotes around a field are dropped and a
+        // delimiter between them is kept; codes never contain quotes.
+        void SplitFields(std::string_view line, char delimiter, std::vector<std::string_view>& fields) {
+            fields.clear();
+            size_t pos = 0;
+            for (;;) {
+                size_t start = pos;
+                size_t end;
+                if (pos < line.size() && line[pos] == '"') {
+                    const size_t close = std::min(line.find('"', pos + 1), line.size());
+                    start = pos + 1;
+                    end = close;
+                    pos = line.find(delimiter, close);
+                } else {
+                    pos = line.find(delimiter, pos);
+                    end = pos == std::string_view::npos ? line.size() : pos;
+                }
+                fields.push_back(TrimView(line.substr(start, end - start)));
+                if (pos == std::string_view::npos) {
+                    break;
+                }
+                ++pos;
+            }
+        }
+
+        // Non-negative quantity with '.' or ',' as the decimal mark and at
+        // most four decimals, exactly into Money units
+        bool ParseQuantity(std::string_view text, int64_t& units) {
+            int64_t whole = 0;
+            int64_t fraction = 0;
+            int decimals = -1;
+            int digits = 0;
+            for (char c : text) {
+                if (c >= '0' && c <= '9') {
+                    if (decimals < 0) {
+                        if (++digits > 14) {
+                            return false;
+                        }
+                        whole = whole * 10 + (c - '0');
+                    } else {
+                        if (++decimals > 4) {
+                            return false;
+                        }
+                        fraction = fraction * 10 + (c - '0');
+                    }
+                } else if ((c == '.' || c == ',') && decimals < 0) {
+                    decimals = 0;
+                } else {
+                    return false;
+                }
+            }
+            if (digits == 0 && decimals <= 0) {
+                return false;
+            }
+            for (int i = std::max(decimals, 0); i < 4; ++i) {
+                fraction *= 10;
+            }
+            units = whole * Money::kScale + fraction;
+            return true;
+        }
+
+    } // namespace
+
+    size_t StockTakeService::KeyHash::operator()(const Key& key) const {
+        return std::hash<uint64_t>()(key.group) * 31 + std::hash<std::string>()(key.soLo);
+    }
+
+    StockTakeService::StockTakeService(DatabaseManager& database, Config& config, CodeDictionary& codes,
+        StockMovementIndex* stockIndex)
+        : database_(database)
+        , config_(config)
+        , codes_(codes)
+        , stockIndex_(stockIndex)
+    {
+        // Thừa: Nợ 156 / Có 3381; thiếu: Nợ 1381 / Có 156
+        config_.Declare("StockTake.InventoryAccount", "156");
+        config_.Declare("StockTake.SurplusAccount", "3381");
+        config_.Declare("StockTake.ShortageAccount", "1381");
+    }
+
+    StockTakeResult StockTakeService::Reconcile(const std::string& sheetPath, const StockTakeOptions& requested) {
+        StockTakeResult result;
+        auto started = std::chrono::steady_clock::now();
+
+        DayNumber day = 0;
+        if (requested.soKiemKe.empty()) {
+            result.error = "Stock-take number is required";
+            return result;
+        }
+        if (!DateTimeHelper::ParseDayNumber(requested.ngayKiemKe.c_str(), requested.ngayKiemKe.size(), day)) {
+            result.error = "Invalid stock-take date: " + requested.ngayKiemKe;
+            return result;
+        }
+
+        // Saved in ISO form; the book queries compare day numbers, so stored
+        // dates in either format count
+        StockTakeOptions options = requested;
+        options.ngayKiemKe = IsoDate(day);
+
+        BookTable book;
+        std::vector<int64_t> purchasePrices;
+        std::vector<uint8_t> warehouses;
+        if (!LoadBook(options.ngayKiemKe, book, purchasePrices, warehouses, result) ||
+            !ReadSheet(sheetPath, book, purchasePrices, warehouses, result)) {
+            Logger::Error("Stock-take %s: %s", options.soKiemKe.c_str(), result.error.c_str());
+            return result;
+        }
+
+        // Combinations on the sheet, and book stock of the warehouses it counts
+        std::vector<Line> lines;
+        lines.reserve(book.size());
+        std::vector<int64_t> unitCosts(purchasePrices.size(), -1);
+        for (const auto& entry : book) {
+            const Balance& balance = entry.second;
+            const uint32_t product = static_cast<uint32_t>(entry.first.group >> 32);
+            const uint32_t warehouse = static_cast<uint32_t>(entry.first.group);
+            if (!balance.onSheet) {
+                const bool counted = warehouse < warehouses.size() && warehouses[warehouse] == kCountedWarehouse;
+                if (!options.zeroUncounted || !counted || balance.book == 0) {
+                    continue;
+                }
+            }
+
+            // Average cost as of the count date, for each product once
+            if (product >= unitCosts.size()) {
+                unitCosts.resize(product + 1, -1);
+            }
+            if (unitCosts[product] < 0) {
+                StockPosition position;
+                unitCosts[product] = product < purchasePrices.size() ? std::max<int64_t>(purchasePrices[product], 0) : 0;
+                if (stockIndex_ && stockIndex_->GetStock(codes_.GetCode(CodeKind::Product, product), day, position) &&
+                    position.quantity.units > 0 && position.value.units > 0) {
+                    unitCosts[product] = std::llround(static_cast<double>(position.value.units) * Money::kScale /
+                        static_cast<double>(position.quantity.units));
+                }
+            }
+
+            lines.push_back({ &entry.first, &balance, codes_.GetCode(CodeKind::Product, product),
+                codes_.GetCode(CodeKind::Warehouse, warehouse), unitCosts[product] });
+        }
+        std::sort(lines.begin(), lines.end(), [](const Line& a, const Line& b) {
+            if (a.maSP != b.maSP) {
+                return a.maSP < b.maSP;
+            }
+            if (a.maKho != b.maKho) {
+                return a.maKho < b.maKho;
+            }
+            return a.key->soLo < b.key->soLo;
+        });
+
+        for (const auto& line : lines) {
+            ++result.compared;
+            if (line.balance->counted == line.balance->book) {
+                continue;
+            }
+            StockVariance variance;
+            variance.maSP.assign(line.maSP.data(), line.maSP.size());
+            variance.maKho.assign(line.maKho.data(), line.maKho.size());
+            variance.soLo = line.key->soLo;
+            variance.book = Money::FromUnits(line.balance->book);
+            variance.counted = Money::FromUnits(line.balance->counted);
+            variance.unitCost = Money::FromUnits(line.unitCost);
+            if (variance.Quantity().units > 0) {
+                result.surplusValue += variance.Value();
+            } else {
+                result.shortageValue -= variance.Value();
+            }
+            result.variances.push_back(std::move(variance));
+        }
+
+        if (!options.post) {
+            result.success = true;
+        } else if (result.rejectedLines > 0) {
+            result.error = "Count sheet has rejected lines; adjustments not posted";
+        } else {
+            result.success = Post(options, lines, result);
+        }
+
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        if (result.success) {
+            Logger::Info("Stock-take %s: %lld sheet lines, %lld compared, %zu differences "
+                "(surplus %s, shortage %s)%s in %.2f s",
+                options.soKiemKe.c_str(), static_cast<long long>(result.sheetLines),
+                static_cast<long long>(result.compared), result.variances.size(),
+                result.surplusValue.ToString().c_str(), result.shortageValue.ToString().c_str(),
+                options.post ? ", posted" : "", result.seconds);
+        } else {
+            Logger::Error("Stock-take %s: %s", options.soKiemKe.c_str(), result.error.c_str());
+        }
+        return result;
+    }
+
+    bool StockTakeService::LoadBook(const std::string& ngayKiemKe, BookTable& book,
+        std::vector<int64_t>& purchasePrices, std::vector<uint8_t>& warehouses, StockTakeResult& result) {
+        std::unique_ptr<ReadView> view = database_.OpenReadView();
+        if (!view) {
+            result.error = "No read view available";
+            return false;
+        }
+
+        const uint32_t defaultWarehouse = codes_.Intern(CodeKind::Warehouse, kDefaultWarehouse);
+        auto productOf = [this, &purchasePrices](std::string_view maSP) {
+            const uint32_t id = codes_.Intern(CodeKind::Product, maSP);
+            if (id >= purchasePrices.size()) {
+                purchasePrices.resize(id + 1, -1);
+            }
+            return id;
+        };
+        auto add = [&book](uint32_t product, uint32_t warehouse, std::string_view soLo, double quantity) -> Balance& {
+            Balance& balance = book[Key{ GroupOf(product, warehouse), std::string(soLo) }];
+            balance.book += Money::FromDouble(quantity).units;
+            return balance;
+        };
+
+        try {
+            auto products = view->Prepare("SELECT MaSP, COALESCE(GiaMua, 0) FROM SanPham");
+            while (products->Step()) {
+                purchasePrices[productOf(products->ColumnTextView(0))] = Money::FromDouble(products->ColumnDouble(1)).units;
+            }
+
+            auto kho = view->Prepare("SELECT MaKho FROM Kho");
+            while (kho->Step()) {
+                const uint32_t id = codes_.Intern(CodeKind::Warehouse, kho->ColumnTextView(0));
+                if (id >= warehouses.size()) {
+                    warehouses.resize(id + 1, kUnknownWarehouse);
+                }
+                warehouses[id] = kKnownWarehouse;
+            }
+
+            auto lots = view->Prepare(kLotBookQuery);
+            lots->BindText(1, ngayKiemKe);
+            while (lots->Step()) {
+                Balance& balance = add(productOf(lots->ColumnTextView(1)),
+                    codes_.Intern(CodeKind::Warehouse, lots->ColumnTextView(2)),
+                    lots->ColumnTextView(3), lots->ColumnDouble(4));
+                balance.lotId = lots->ColumnInt64(0);
+            }
+
+            // Opening stock of the first open year, less what lots held then
+            std::string openingDate = "1900-01-01";     // earliest date daynum() reads
+            auto year = view->Prepare("SELECT MAX(NamTC) FROM TonKhoDauKy");
+            if (year->Step() && !year->ColumnIsNull(0)) {
+                const int namTC = static_cast<int>(year->ColumnInt64(0));
+                openingDate = StringHelper::Format("%04d-01-01", namTC);
+
+                auto opening = view->Prepare("SELECT MaSP, SoLuong FROM TonKhoDauKy WHERE NamTC = ?1");
+                opening->BindInt64(1, namTC);
+                while (opening->Step()) {
+                    add(productOf(opening->ColumnTextView(0)), defaultWarehouse, std::string_view(),
+                        opening->ColumnDouble(1));
+                }
+
+                auto inLots = view->Prepare(kLotOpeningQuery);
+                inLots->BindText(1, openingDate);
+                while (inLots->Step()) {
+                    add(productOf(inLots->ColumnTextView(0)), defaultWarehouse, std::string_view(),
+                        -inLots->ColumnDouble(1));
+                }
+            }
+
+            auto unlotted = view->Prepare(kUnlottedBookQuery);
+            unlotted->BindText(1, ngayKiemKe).BindText(2, openingDate);
+            while (unlotted->Step()) {
+                add(productOf(unlotted->ColumnTextView(0)), codes_.Intern(CodeKind::Warehouse, unlotted->ColumnTextView(1)),
+                    std::string_view(), unlotted->ColumnDouble(2));
+            }
+        }
+        catch (const DatabaseException& e) {
+            result.error = std::string("Reading book stock failed: ") + e.what();
+            return false;
+        }
+
+        if (warehouses.size() < codes_.GetCount(CodeKind::Warehouse)) {
+            warehouses.resize(codes_.GetCount(CodeKind::Warehouse), kUnknownWarehouse);
+        }
+        return true;
+    }
+
+    bool StockTakeService::ReadSheet(const std::string& path, BookTable& book,
+        const std::vector<int64_t>& purchasePrices, std::vector<uint8_t>& warehouses, StockTakeResult& result) {
+        MappedFile file;
+        if (!file.Open(path)) {
+            result.error = "Cannot open count sheet: " + path;
+            return false;
+        }
+
+        std::string_view text(file.Data() ? file.Data() : "", file.Size());
+        if (text.substr(0, 3) == "\xEF\xBB\xBF") {
+            text.remove_prefix(3);
+        }
+
+        auto reject = [&result](int64_t lineNumber, const std::string& problem) {
+            ++result.rejectedLines;
+            if (result.problems.size() < kMaxProblems) {
+                result.problems.push_back(StringHelper::Format("Line %lld: %s",
+                    static_cast<long long>(lineNumber), problem.c_str()));
+            }
+        };
+
+        enum Column { kMaKho, kMaSP, kSoLo, kHanDung, kSoLuong, kColumns };
+        static const char* const kColumnNames[kColumns] = { "MaKho", "MaSP", "SoLo", "HanDung", "SoLuong" };
+        int columns[kColumns] = { -1, -1, -1, -1, -1 };
+        size_t needed = 0;
+        char delimiter = ',';
+
+        std::vector<std::string_view> fields;
+        Key key;
+        int64_t lineNumber = 0;
+        bool header = true;
+        while (!text.empty()) {
+            const size_t end = text.find('\n');
+            std::string_view line = text.substr(0, end);
+            text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+            ++lineNumber;
+            if (!line.empty() && line.back() == '\r') {
+                line.remove_suffix(1);
+            }
+            if (TrimView(line).empty()) {
+                continue;
+            }
+
+            if (header) {
+                // Semicolons where the comma is the decimal mark
+                delimiter = line.find(';') != std::string_view::npos ? ';' : ',';
+                SplitFields(line, delimiter, fields);
+                for (size_t i = 0; i < fields.size(); ++i) {
+                    for (int c = 0; c < kColumns; ++c) {
+                        if (EqualsIgnoreCase(fields[i], kColumnNames[c])) {
+                            columns[c] = static_cast<int>(i);
+                            needed = std::max(needed, i + 1);
+                        }
+                    }
+                }
+                if (columns[kMaKho] < 0 || columns[kMaSP] < 0 || columns[kSoLuong] < 0) {
+                    result.error = "Count sheet needs the columns MaKho, MaSP and SoLuong";
+                    return false;
+                }
+                header = false;
+                continue;
+            }
+
+            ++result.sheetLines;
+            SplitFields(line, delimiter, fields);
+            if (fields.size() < needed) {
+                reject(lineNumber, "missing columns");
+                continue;
+            }
+
+            const std::string_view maSP = fields[static_cast<size_t>(columns[kMaSP])];
+            const uint32_t product = codes_.Find(CodeKind::Product, maSP);
+            if (product >= purchasePrices.size() || purchasePrices[product] < 0) {
+                reject(lineNumber, "unknown product '" + std::string(maSP) + "'");
+                continue;
+            }
+
+            const std::string_view maKho = fields[static_cast<size_t>(columns[kMaKho])];
+            const uint32_t warehouse = codes_.Find(CodeKind::Warehouse, maKho);
+            if (warehouse >= warehouses.size() || warehouses[warehouse] == kUnknownWarehouse) {
+                reject(lineNumber, "unknown warehouse '" + std::string(maKho) + "'");
+                continue;
+            }
+
+            int64_t quantity = 0;
+            const std::string_view soLuong = fields[static_cast<size_t>(columns[kSoLuong])];
+            if (!ParseQuantity(soLuong, quantity)) {
+                reject(lineNumber, "invalid quantity '" + std::string(soLuong) + "'");
+                continue;
+            }
+
+            DayNumber expiry = 0;
+            bool hasExpiry = false;
+            if (columns[kHanDung] >= 0) {
+                const std::string_view hanDung = fields[static_cast<size_t>(columns[kHanDung])];
+                if (!hanDung.empty()) {
+                    if (!DateTimeHelper::ParseDayNumber(hanDung.data(), hanDung.size(), expiry)) {
+                        reject(lineNumber, "invalid expiry date '" + std::string(hanDung) + "'");
+                        continue;
+                    }
+                    hasExpiry = true;
+                }
+            }
+
+            // Probe the books; a combination they lack is a surplus
+            key.group = GroupOf(product, warehouse);
+            if (columns[kSoLo] >= 0) {
+                const std::string_view soLo = fields[static_cast<size_t>(columns[kSoLo])];
+                key.soLo.assign(soLo.data(), soLo.size());
+            }
+            Balance& balance = book[key];
+            balance.counted += quantity;
+            balance.onSheet = true;
+            if (hasExpiry) {
+                balance.expiry = expiry;
+                balance.hasExpiry = true;
+            }
+            warehouses[warehouse] = kCountedWarehouse;
+        }
+
+        if (header) {
+            result.error = "Count sheet is empty";
+            return false;
+        }
+        return true;
+    }
+
+    bool StockTakeService::Post(const StockTakeOptions& options, const std::vector<Line>& lines,
+        StockTakeResult& result) {
+        bool surplus = false;
+        bool shortage = false;
+        for (const auto& variance : result.variances) {
+            (variance.Quantity().units > 0 ? surplus : shortage) = true;
+        }
+        const std::string soPhieuNhap = surplus ? options.soKiemKe + "-N" : std::string();
+        const std::string soPhieuXuat = shortage ? options.soKiemKe + "-X" : std::string();
+        const bool voucher = result.surplusValue.units != 0 || result.shortageValue.units != 0;
+        const std::string soCT = voucher ? options.soKiemKe : std::string();
+
+        auto bindOptional = [](Statement& stmt, int index, const std::string& text) -> Statement& {
+            return text.empty() ? stmt.BindNull(index) : stmt.BindText(index, text);
+        };
+
+        BulkInserter inserter(database_);
+        if (!inserter.Begin()) {
+            result.error = "Cannot start stock-take transaction";
+            return false;
+        }
+
+        try {
+            Statement& header = inserter.Prepare(
+                "INSERT OR IGNORE INTO KiemKe (SoKiemKe, NgayKiemKe, DienGiai, NguoiLap, SoPhieuNhap, SoPhieuXuat, SoCT) "
+                "VALUES (?, ?, ?, ?, ?, ?, ?)");
+            header.BindText(1, options.soKiemKe).BindText(2, options.ngayKiemKe);
+            bindOptional(header, 3, options.dienGiai);
+            bindOptional(header, 4, options.nguoiLap);
+            bindOptional(header, 5, soPhieuNhap);
+            bindOptional(header, 6, soPhieuXuat);
+            bindOptional(header, 7, soCT);
+            if (inserter.Execute(header) == 0) {
+                inserter.Rollback();
+                result.error = "Stock-take " + options.soKiemKe + " has already been posted";
+                return false;
+            }
+
+            const std::string ghiChu = "Kiểm kê " + options.soKiemKe;
+            if (surplus) {
+                Statement& stmt = inserter.Prepare(
+                    "INSERT INTO PhieuNhap (SoPhieu, NgayNhap, NguoiNhap, TongTien, GhiChu) VALUES (?, ?, ?, ?, ?)");
+                stmt.BindText(1, soPhieuNhap).BindText(2, options.ngayKiemKe);
+                bindOptional(stmt, 3, options.nguoiLap);
+                stmt.BindDouble(4, result.surplusValue.ToDouble()).BindText(5, ghiChu);
+                inserter.Execute(stmt);
+            }
+            if (shortage) {
+                Statement& stmt = inserter.Prepare(
+                    "INSERT INTO PhieuXuat (SoPhieu, NgayXuat, NguoiXuat, TongTien, GhiChu) VALUES (?, ?, ?, ?, ?)");
+                stmt.BindText(1, soPhieuXuat).BindText(2, options.ngayKiemKe);
+                bindOptional(stmt, 3, options.nguoiLap);
+                stmt.BindDouble(4, result.shortageValue.ToDouble()).BindText(5, ghiChu);
+                inserter.Execute(stmt);
+            }
+
+            // The receipt's and issue's own ChangeLog entries cover their lines
+            if ((surplus && !database_.BeginDocumentLines("PhieuNhap", soPhieuNhap)) ||
+                (shortage && !database_.BeginDocumentLines("PhieuXuat", soPhieuXuat))) {
+                throw DatabaseException("Cannot mark the adjustment documents");
+            }
+
+            Connection* connection = database_.GetConnection();
+            for (const auto& line : lines) {
+                const Balance& balance = *line.balance;
+                const Money quantity = Money::FromUnits(balance.counted - balance.book);
+                const Money unitCost = Money::FromUnits(line.unitCost);
+                const Money value = Money::FromDouble(quantity.ToDouble() * unitCost.ToDouble());
+
+                // A lot the books lack, found by the count
+                int64_t lotId = balance.lotId;
+                if (lotId == 0 && !line.key->soLo.empty() && quantity.units > 0) {
+                    Statement& lot = inserter.Prepare(
+                        "INSERT INTO LoHang (MaSP, MaKho, SoLo, HanDung) VALUES (?, ?, ?, ?)");
+                    lot.BindText(1, line.maSP).BindText(2, line.maKho).BindText(3, line.key->soLo);
+                    if (balance.hasExpiry) {
+                        lot.BindText(4, IsoDate(balance.expiry));
+                    } else {
+                        lot.BindNull(4);
+                    }
+                    inserter.Execute(lot);
+                    lotId = connection->LastInsertRowId();
+                }
+
+                Statement& detail = inserter.Prepare(
+                    "INSERT INTO ChiTietKiemKe (SoKiemKe, MaSP, MaKho, LoHangID, SoLuongSoSach, SoLuongThucTe, "
+                    "ChenhLech, DonGia, GiaTriChenhLech) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)");
+                detail.BindText(1, options.soKiemKe).BindText(2, line.maSP).BindText(3, line.maKho);
+                if (lotId != 0) {
+                    detail.BindInt64(4, lotId);
+                } else {
+                    detail.BindNull(4);
+                }
+                detail.BindDouble(5, Money::FromUnits(balance.book).ToDouble())
+                    .BindDouble(6, Money::FromUnits(balance.counted).ToDouble())
+                    .BindDouble(7, quantity.ToDouble())
+                    .BindDouble(8, unitCost.ToDouble())
+                    .BindDouble(9, value.ToDouble());
+                inserter.Execute(detail);
+
+                if (quantity.units == 0) {
+                    continue;
+                }
+                const bool receipt = quantity.units > 0;
+                Statement& movement = inserter.Prepare(receipt
+                    ? "INSERT INTO ChiTietPhieuNhap (SoPhieu, MaSP, SoLuong, DonGia, ThanhTien, MaKho, LoHangID) "
+                      "VALUES (?, ?, ?, ?, ?, ?, ?)"
+                    : "INSERT INTO ChiTietPhieuXuat (SoPhieu, MaSP, SoLuong, DonGia, ThanhTien, MaKho, LoHangID) "
+                      "VALUES (?, ?, ?, ?, ?, ?, ?)");
+                movement.BindText(1, receipt ? soPhieuNhap : soPhieuXuat)
+                    .BindText(2, line.maSP)
+                    .BindDouble(3, (receipt ? quantity : -quantity).ToDouble())
+                    .BindDouble(4, unitCost.ToDouble())
+                    .BindDouble(5, (receipt ? value : -value).ToDouble())
+                    .BindText(6, line.maKho);
+                if (lotId != 0) {
+                    movement.BindInt64(7, lotId);
+                } else {
+                    movement.BindNull(7);
+                }
+                inserter.Execute(movement);
+            }
+
+            if ((surplus && !database_.EndDocumentLines("PhieuNhap", soPhieuNhap)) ||
+                (shortage && !database_.EndDocumentLines("PhieuXuat", soPhieuXuat))) {
+                throw DatabaseException("Cannot clear the adjustment documents");
+            }
+
+            if (voucher) {
+                const std::string inventory = config_.GetString("StockTake.InventoryAccount");
+                ChungTu chungTu;
+                chungTu.soCT = soCT;
+                chungTu.ngayCT = options.ngayKiemKe;
+                chungTu.loaiCT = "KK";
+                chungTu.dienGiai = ghiChu;
+                chungTu.nguoiLap = options.nguoiLap;
+                if (result.surplusValue.units != 0) {
+                    chungTu.lines.emplace_back(static_cast<int>(chungTu.lines.size()) + 1, inventory,
+                        config_.GetString("StockTake.SurplusAccount"), result.surplusValue.ToDouble(), "Hàng thừa");
+                }
+                if (result.shortageValue.units != 0) {
+                    chungTu.lines.emplace_back(static_cast<int>(chungTu.lines.size()) + 1,
+                        config_.GetString("StockTake.ShortageAccount"), inventory, result.shortageValue.ToDouble(),
+                        "Hàng thiếu");
+                }
+                if (!database_.InsertChungTu(chungTu)) {
+                    throw DatabaseException("Posting the stock-take voucher failed");
+                }
+            }
+        }
+        catch (const DatabaseException& e) {
+            inserter.Rollback();
+            result.error = std::string("Posting adjustments failed: ") + e.what();
+            return false;
+        }
+
+        if (!inserter.Commit()) {
+            result.error = "Commit failed";
+            return false;
+        }
+
+        result.soPhieuNhap = soPhieuNhap;
+        result.soPhieuXuat = soPhieuXuat;
+        result.soCT = soCT;
+        return true;
+    }
+
+} // namespace KeToanApp
@@ -0,0 +1,147 @@
+#pragma once
+
+#include "KeToanApp/Common.h"
+#include "KeToanApp/Types.h"
+#include "../Core/Config.h"
+#include "../Database/DatabaseManager.h"
+#include "CodeDictionary.h"
+#include "StockMovementIndex.h"
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+
+namespace KeToanApp {
+
+    struct StockTakeOptions {
+        std::string soKiemKe;       // also numbers the adjustment documents
+        std::string ngayKiemKe;     // yyyy-mm-dd or dd/MM/yyyy; the books are taken at the end of this day
+        std::string dienGiai;
+        std::string nguoiLap;
+        bool post;                  // false: variance report only
+        bool zeroUncounted;         // book stock missing from the sheet, in a warehouse it counts, was counted as zero
+
+        StockTakeOptions() : post(true), zeroUncounted(true) {}
+    };
+
+    // Count against the books for one product, warehouse and lot
+    struct StockVariance {
+        std::string maSP;
+        std::string maKho;
+        std::string soLo;           // empty for stock not tracked by lot
+        Money book;
+        Money counted;
+        Money unitCost;
+
+        Money Quantity() const { return counted - book; }
+        Money Value() const { return Money::FromDouble(Quantity().ToDouble() * unitCost.ToDouble()); }
+    };
+
+    struct StockTakeResult {
+        bool success;
+        int64_t sheetLines;
+        int64_t rejectedLines;
+        int64_t compared;                       // product/warehouse/lot combinations compared
+        std::vector<std::string> problems;      // rejected sheet lines, up to kMaxProblems
+        std::vector<StockVariance> variances;   // non-zero only, by product, warehouse and lot
+        Money surplusValue;
+        Money shortageValue;
+        std::string soPhieuNhap;                // adjustment documents posted, empty if none
+        std::string soPhieuXuat;
+        std::string soCT;
+        double seconds;
+        std::string error;
+
+        StockTakeResult() : success(false), sheetLines(0), rejectedLines(0), compared(0), seconds(0.0) {}
+    };
+
+    // Stock-take (kiểm kê): reconciles a count sheet with the books and
+    // posts the adjustments.
+    //
+    // The count sheet is CSV with a header row naming the columns MaKho,
+    // MaSP and SoLuong, optionally SoLo and HanDung, separated by commas or
+    // semicolons. It is read through a memory mapping one line at a time
+    // and hash-joined with the book stock as of the count date, loaded
+    // first from one read view into a table keyed by product, warehouse
+    // and lot. Lines for the same product, warehouse and lot add up.
+    //
+    // The book stock of a lot is LoHang.SoLuongCon less its movements after
+    // the count date. Stock not tracked by lot is the opening stock
+    // (TonKhoDauKy, in the default warehouse, less what lots held then)
+    // plus lines without a lot up to the count date.
+    //
+    // Posting writes through BulkInserter, in one transaction: the KiemKe
+    // record with a line per combination compared, lots the sheet found
+    // that the books lack, a PhieuNhap for surpluses and a PhieuXuat for
+    // shortages (SoKiemKe-N and SoKiemKe-X), and a voucher numbered SoKiemKe
+    // taking their value to StockTake.SurplusAccount and
+    // StockTake.ShortageAccount against StockTake.InventoryAccount. A sheet
+    // with rejected lines is reported but not posted. Differences are
+    // valued at the average cost from the stock index when there is one,
+    // otherwise at SanPham.GiaMua.
+    class StockTakeService {
+    public:
+        static const size_t kMaxProblems = 100;
+
+        StockTakeService(DatabaseManager& database, Config& config, CodeDictionary& codes,
+            StockMovementIndex* stockIndex = nullptr);
+        ~StockTakeService() = default;
+
+        // Non-copyable
+        StockTakeService(const StockTakeService&) = delete;
+        StockTakeService& operator=(const StockTakeService&) = delete;
+
+        StockTakeResult Reconcile(const std::string& sheetPath, const StockTakeOptions& options);
+
+    private:
+        struct Key {
+            uint64_t group;         // product id << 32 | warehouse id
+            std::string soLo;
+
+            bool operator==(const Key& other) const { return group == other.group && soLo == other.soLo; }
+        };
+
+        struct KeyHash {
+            size_t operator()(const Key& key) const;
+        };
+
+        struct Balance {
+            int64_t lotId = 0;          // LoHang.ID; 0 for no lot or a lot not in the books
+            int64_t book = 0;           // Money units
+            int64_t counted = 0;
+            DayNumber expiry = 0;       // HanDung from the sheet, for a new lot
+            bool hasExpiry = false;
+            bool onSheet = false;
+        };
+
+        using BookTable = std::unordered_map<Key, Balance, KeyHash>;
+
+        // One compared combination, in posting order
+        struct Line {
+            const Key* key;
+            const Balance* balance;
+            std::string_view maSP;
+            std::string_view maKho;
+            int64_t unitCost;       // Money units
+        };
+
+        // Warehouses by id: in Kho, and counted by the sheet
+        enum WarehouseState : uint8_t { kUnknownWarehouse = 0, kKnownWarehouse = 1, kCountedWarehouse = 2 };
+
+        DatabaseManager& database_;
+        Config& config_;
+        CodeDictionary& codes_;
+        StockMovementIndex* stockIndex_;
+
+        // purchasePrices by product id, -1 for codes not in SanPham
+        bool LoadBook(const std::string& ngayKiemKe, BookTable& book, std::vector<int64_t>& purchasePrices,
+            std::vector<uint8_t>& warehouses, StockTakeResult& result);
+        bool ReadSheet(const std::string& path, BookTable& book, const std::vector<int64_t>& purchasePrices,
+            std::vector<uint8_t>& warehouses, StockTakeResult& result);
+        bool Post(const StockTakeOptions& options, const std::vector<Line>& lines, StockTakeResult& result);
+
+        static uint64_t GroupOf(uint32_t product, uint32_t warehouse) {
+            return static_cast<uint64_t>(product) << 32 | warehouse;
+        }
+    };
+
+} // namespace KeToanApp
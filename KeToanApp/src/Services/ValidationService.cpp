@@ -0,0 +1,623 @@
+#include "ValidationService.h"
+#include "../Utils/DateTimeHelper.h"
+#include "../Utils/Logger.h"
+#include "../Utils/StringHelper.h"
+#include <algorithm>
+#include <cmath>
+
+namespace KeToanApp {
+
+    namespace {
+
+        const uint32_t kVoucher = 1u << static_cast<int>(DocumentType::ChungTuKeToan);
+        const uint32_t kReceipt = 1u << static_cast<int>(DocumentType::PhieuNhap);
+        const uint32_t kIssue = 1u << static_cast<int>(DocumentType::PhieuXuat);
+
+        struct RuleInfo {
+            ValidationRule rule;
+            const char* name;
+            uint32_t types;         // document types the rule applies to
+        };
+
+        // In ValidationRule order
+        const RuleInfo kRules[] = {
+            { ValidationRule::Lines,    "lines",    kVoucher | kReceipt | kIssue },
+            { ValidationRule::Balanced, "balanced", kVoucher },
+            { ValidationRule::Amounts,  "amounts",  kVoucher | kReceipt | kIssue },
+            { ValidationRule::Accounts, "accounts", kVoucher },
+            { ValidationRule::Period,   "period",   kVoucher | kReceipt | kIssue },
+            { ValidationRule::Products, "products", kReceipt | kIssue },
+            { ValidationRule::Stock,    "stock",    kIssue },
+        };
+
+        struct TypeInfo {
+            const char* configKey;
+            const char* defaultRules;
+        };
+
+        // In DocumentType order
+        const TypeInfo kTypes[] = {
+            { "Validation.ChungTuKeToan", "lines,balanced,amounts,accounts,period" },
+            { "Validation.PhieuNhap",     "lines,amounts,products,period" },
+            { "Validation.PhieuXuat",     "lines,amounts,products,period,stock" },
+        };
+
+        uint32_t Bit(ValidationRule rule) {
+            return 1u << static_cast<int>(rule);
+        }
+
+        // Rule mask for a comma-separated list; false on an unknown name or
+        // a rule that does not apply to the type
+        bool ParseRules(const std::string& value, DocumentType type, uint32_t& mask) {
+            mask = 0;
+            for (const auto& token : StringHelper::Split(value, ',')) {
+                const std::string name = StringHelper::ToLower(StringHelper::Trim(token));
+                if (name.empty()) {
+                    continue;
+                }
+                const RuleInfo* found = nullptr;
+                for (const auto& info : kRules) {
+                    if (name == info.name) {
+                        found = &info;
+                    }
+                }
+                if (!found || !(found->types & (1u << static_cast<int>(type)))) {
+                    return false;
+                }
+                mask |= Bit(found->rule);
+            }
+            return true;
+        }
+
+        std::string FormatDay(DayNumber day) {
+            return DateTimeHelper::FromDayNumber(day).ToString();
+        }
+
+        std::string FormatUnits(int64_t units) {
+            return Money::FromUnits(units).ToString();
+        }
+
+    } // namespace
+
+    std::string ValidationReport::Summary() const {
+        if (issueCount == 0) {
+            return "no problems";
+        }
+        std::string summary = std::to_string(issueCount) + (issueCount == 1 ? " problem" : " problems");
+        if (!issues.empty()) {
+            summary += "; first: " + issues.front().documentKey + ": " + issues.front().message;
+        }
+        return summary;
+    }
+
+    uint32_t ValidationBatch::Codes::Intern(std::string_view code) {
+        scratch.assign(code.data(), code.size());
+        auto it = index.find(scratch);
+        if (it != index.end()) {
+            return it->second;
+        }
+        uint32_t id = static_cast<uint32_t>(values.size());
+        values.push_back(scratch);
+        index.emplace(scratch, id);
+        return id;
+    }
+
+    uint32_t ValidationBatch::AddDocument(DocumentType type, std::string_view key, DayNumber day, bool voided) {
+        types_.push_back(type);
+        keys_.emplace_back(key);
+        days_.push_back(day);
+        voided_.push_back(voided ? 1 : 0);
+        return static_cast<uint32_t>(types_.size() - 1);
+    }
+
+    void ValidationBatch::AddEntry(uint32_t document, std::string_view debit, std::string_view credit,
+        int64_t amountUnits) {
+        entryDocument_.push_back(document);
+        debit_.push_back(accounts_.Intern(debit));
+        credit_.push_back(accounts_.Intern(credit));
+        entryAmount_.push_back(amountUnits);
+    }
+
+    void ValidationBatch::AddItem(uint32_t document, std::string_view product, int64_t quantityUnits,
+        int64_t priceUnits, int64_t amountUnits, std::string_view warehouse) {
+        const uint32_t productId = products_.Intern(product);
+        const uint32_t warehouseId = warehouses_.Intern(warehouse);
+        auto stock = stockIndex_.emplace(StockKey(productId, warehouseId), static_cast<uint32_t>(stockKeys_.size()));
+        if (stock.second) {
+            stockKeys_.emplace_back(productId, warehouseId);
+        }
+        itemDocument_.push_back(document);
+        product_.push_back(productId);
+        stock_.push_back(stock.first->second);
+        quantity_.push_back(quantityUnits);
+        price_.push_back(priceUnits);
+        itemAmount_.push_back(amountUnits);
+    }
+
+    void ValidationBatch::DeclareProduct(std::string_view product) {
+        declaredProducts_.push_back(products_.Intern(product));
+    }
+
+    uint32_t ValidationBatch::Add(const ChungTu& chungTu) {
+        DayNumber day = kInvalidDay;
+        if (!DateTimeHelper::ParseDayNumber(chungTu.ngayCT.data(), chungTu.ngayCT.size(), day)) {
+            day = kInvalidDay;
+        }
+        uint32_t document = AddDocument(DocumentType::ChungTuKeToan, chungTu.soCT, day,
+            chungTu.trangThai == TrangThai::DaXoa);
+        for (const auto& line : chungTu.lines) {
+            AddEntry(document, line.tkNo, line.tkCo, Money::FromDouble(line.soTien.value).units);
+        }
+        return document;
+    }
+
+    void ValidationBatch::Clear() {
+        *this = ValidationBatch();
+    }
+
+    struct ValidationService::ReferenceData {
+        std::vector<std::pair<DayNumber, DayNumber>> closedPeriods;
+        std::string closedYears;        // ClosedYears() when loaded
+    };
+
+    struct ValidationService::CheckContext {
+        const ValidationBatch& batch;
+        const MasterData& master;
+        const ReferenceData& reference;
+        const uint32_t* ruleMasks;
+        std::vector<int64_t> onHand;        // per batch stock id, Money units
+        ValidationReport& report;
+        size_t maxIssues;
+
+        bool Enabled(ValidationRule rule, uint32_t document) const {
+            return !batch.voided_[document]
+                && (ruleMasks[static_cast<int>(batch.types_[document])] & Bit(rule));
+        }
+
+        void Fail(uint32_t document, ValidationRule rule, const std::string& message) {
+            ++report.issueCount;
+            if (report.issues.size() < maxIssues) {
+                report.issues.push_back(ValidationIssue{ batch.keys_[document], rule, message });
+            }
+        }
+    };
+
+    ValidationService::ValidationService(DatabaseManager& database, Config& config, MasterDataCache& masterData)
+        : database_(database)
+        , config_(config)
+        , masterData_(masterData)
+    {
+        config_.DeclareInt("Validation.MaxIssues", 100, 1, 100000);
+
+        for (int t = 0; t < 3; ++t) {
+            const DocumentType type = static_cast<DocumentType>(t);
+            config_.Declare(kTypes[t].configKey, kTypes[t].defaultRules,
+                [type](const std::string& value) {
+                    uint32_t mask;
+                    return ParseRules(value, type, mask);
+                });
+            ruleMasks_[t] = 0;
+            Compile(type);
+            subscriptions_[t] = config_.Subscribe(kTypes[t].configKey,
+                [this, type](const std::string&, const std::string&) { Compile(type); });
+        }
+    }
+
+    ValidationService::~ValidationService() {
+        for (auto id : subscriptions_) {
+            config_.Unsubscribe(id);
+        }
+    }
+
+    const char* ValidationService::GetRuleName(ValidationRule rule) {
+        return kRules[static_cast<int>(rule)].name;
+    }
+
+    void ValidationService::Compile(DocumentType type) {
+        const int t = static_cast<int>(type);
+        uint32_t mask = 0;
+        ParseRules(config_.GetString(kTypes[t].configKey), type, mask);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        ruleMasks_[t] = mask;
+    }
+
+    bool ValidationService::Refresh() {
+        std::unique_ptr<ReadView> view = database_.OpenReadView();
+        if (!view) {
+            Logger::Error("Validation: no read view available");
+            return false;
+        }
+
+        auto reference = std::make_shared<ReferenceData>();
+        try {
+            reference->closedYears = ClosedYears(*view);
+            auto periods = view->Prepare("SELECT NgayBatDau, NgayKetThuc FROM KyKeToan WHERE TrangThai = 1");
+            while (periods->Step()) {
+                std::string_view from = periods->ColumnTextView(0);
+                std::string_view to = periods->ColumnTextView(1);
+                DayNumber first;
+                DayNumber last;
+                if (DateTimeHelper::ParseDayNumber(from.data(), from.size(), first)
+                    && DateTimeHelper::ParseDayNumber(to.data(), to.size(), last)) {
+                    reference->closedPeriods.emplace_back(first, last);
+                }
+            }
+        }
+        catch (const DatabaseException& e) {
+            Logger::Error("Validation: loading closed periods failed: %s", e.what());
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        reference_ = std::move(reference);
+        return true;
+    }
+
+    std::string ValidationService::ClosedYears(ReadView& view) {
+        auto years = view.Prepare("SELECT COALESCE(group_concat(NamTC), '') FROM "
+            "(SELECT NamTC FROM KyKeToan WHERE TrangThai = 1 ORDER BY NamTC)");
+        return years->Step() ? years->ColumnText(0) : std::string();
+    }
+
+    bool ValidationService::IsCurrent(const ReferenceData& reference) {
+        std::unique_ptr<ReadView> view = database_.OpenReadView();
+        if (!view) {
+            return true;        // keep what is loaded; Refresh() would fail the same way
+        }
+        try {
+            return ClosedYears(*view) == reference.closedYears;
+        }
+        catch (const DatabaseException& e) {
+            Logger::Warning("Validation: checking closed periods failed: %s", e.what());
+            return true;
+        }
+    }
+
+    bool ValidationService::LoadStock(const ValidationBatch& batch, std::vector<int64_t>& onHand) {
+        onHand.assign(batch.stockKeys_.size(), 0);
+
+        std::unique_ptr<ReadView> view = database_.OpenReadView();
+        if (!view) {
+            Logger::Error("Validation: no read view available");
+            return false;
+        }
+
+        // Carried balance of the latest closed year, which is kept in the
+        // default warehouse, plus every movement still in the main file;
+        // closed years' movements are archived
+        const char* sql = R"(
+            SELECT MaSP, MaKho, SUM(SoLuong) FROM (
+                SELECT MaSP, ?1 AS MaKho, SoLuong FROM TonKhoDauKy
+                WHERE NamTC = (SELECT MAX(NamTC) FROM TonKhoDauKy)
+                UNION ALL
+                SELECT c.MaSP, c.MaKho, c.SoLuong FROM ChiTietPhieuNhap c
+                JOIN PhieuNhap p ON p.SoPhieu = c.SoPhieu WHERE COALESCE(p.TrangThai, 1) <> 2
+                UNION ALL
+                SELECT c.MaSP, c.MaKho, -c.SoLuong FROM ChiTietPhieuXuat c
+                JOIN PhieuXuat p ON p.SoPhieu = c.SoPhieu WHERE COALESCE(p.TrangThai, 1) <> 2
+            ) GROUP BY MaSP, MaKho
+        )";
+
+        try {
+            auto stmt = view->Prepare(sql);
+            stmt->BindText(1, ValidationBatch::kDefaultWarehouse);
+            std::string code;
+            while (stmt->Step()) {
+                std::string_view text = stmt->ColumnTextView(0);
+                code.assign(text.data(), text.size());
+                auto product = batch.products_.index.find(code);
+                if (product == batch.products_.index.end()) {
+                    continue;
+                }
+                text = stmt->ColumnTextView(1);
+                code.assign(text.data(), text.size());
+                auto warehouse = batch.warehouses_.index.find(code);
+                if (warehouse == batch.warehouses_.index.end()) {
+                    continue;
+                }
+                auto stock = batch.stockIndex_.find(ValidationBatch::StockKey(product->second, warehouse->second));
+                if (stock != batch.stockIndex_.end()) {
+                    onHand[stock->second] = Money::FromDouble(stmt->ColumnDouble(2)).units;
+                }
+            }
+        }
+        catch (const DatabaseException& e) {
+            Logger::Error("Validation: reading stock on hand failed: %s", e.what());
+            return false;
+        }
+        return true;
+    }
+
+    bool ValidationService::Validate(const ValidationBatch& batch, ValidationReport& report) {
+        report = ValidationReport();
+        report.documents = static_cast<int64_t>(batch.GetDocumentCount());
+
+        std::shared_ptr<const ReferenceData> reference;
+        uint32_t masks[3];
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            reference = reference_;
+            std::copy(std::begin(ruleMasks_), std::end(ruleMasks_), masks);
+        }
+        // A year closed since the last load, here or by another process,
+        // is picked up before the batch is checked against it
+        if (!reference || !IsCurrent(*reference)) {
+            if (!Refresh()) {
+                return false;
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            reference = reference_;
+        }
+
+        MasterDataCache::Reader master(masterData_);
+        CheckContext context{ batch, *master, *reference, masks, std::vector<int64_t>(), report,
+            static_cast<size_t>(config_.GetInt("Validation.MaxIssues")) };
+
+        const uint32_t used = masks[0] | masks[1] | masks[2];
+        if ((used & Bit(ValidationRule::Stock)) && !batch.product_.empty()
+            && !LoadStock(batch, context.onHand)) {
+            return false;
+        }
+
+        static void (*const checks[])(CheckContext&) = {
+            &CheckLines, &CheckBalanced, &CheckAmounts, &CheckAccounts,
+            &CheckPeriod, &CheckProducts, &CheckStock
+        };
+        for (const auto& info : kRules) {
+            if (used & Bit(info.rule)) {
+                checks[static_cast<int>(info.rule)](context);
+            }
+        }
+        return true;
+    }
+
+    void ValidationService::CheckLines(CheckContext& context) {
+        const ValidationBatch& batch = context.batch;
+        std::vector<uint32_t> lines(batch.types_.size(), 0);
+        for (uint32_t document : batch.entryDocument_) {
+            ++lines[document];
+        }
+        for (uint32_t document : batch.itemDocument_) {
+            ++lines[document];
+        }
+
+        for (uint32_t d = 0; d < lines.size(); ++d) {
+            if (lines[d] == 0 && context.Enabled(ValidationRule::Lines, d)) {
+                context.Fail(d, ValidationRule::Lines, "document has no lines");
+            }
+        }
+    }
+
+    void ValidationService::CheckBalanced(CheckContext& context) {
+        const ValidationBatch& batch = context.batch;
+        std::vector<uint8_t> empty(batch.accounts_.values.size());
+        for (size_t id = 0; id < empty.size(); ++id) {
+            empty[id] = batch.accounts_.values[id].empty() ? 1 : 0;
+        }
+
+        std::vector<int64_t> debits(batch.types_.size(), 0);
+        std::vector<int64_t> credits(batch.types_.size(), 0);
+        const size_t entries = batch.entryDocument_.size();
+        for (size_t i = 0; i < entries; ++i) {
+            const uint32_t document = batch.entryDocument_[i];
+            const int64_t amount = batch.entryAmount_[i];
+            debits[document] += empty[batch.debit_[i]] ? 0 : amount;
+            credits[document] += empty[batch.credit_[i]] ? 0 : amount;
+        }
+
+        for (uint32_t d = 0; d < debits.size(); ++d) {
+            if (debits[d] != credits[d] && context.Enabled(ValidationRule::Balanced, d)) {
+                context.Fail(d, ValidationRule::Balanced, "debits " + FormatUnits(debits[d])
+                    + " do not equal credits " + FormatUnits(credits[d]));
+            }
+        }
+    }
+
+    void ValidationService::CheckAmounts(CheckContext& context) {
+        const ValidationBatch& batch = context.batch;
+        std::vector<uint32_t> lineNumber(batch.types_.size(), 0);
+
+        const size_t entries = batch.entryDocument_.size();
+        for (size_t i = 0; i < entries; ++i) {
+            const uint32_t d = batch.entryDocument_[i];
+            const uint32_t line = ++lineNumber[d];
+            if (!context.Enabled(ValidationRule::Amounts, d)) {
+                continue;
+            }
+            const std::string& debit = batch.accounts_.values[batch.debit_[i]];
+            const std::string& credit = batch.accounts_.values[batch.credit_[i]];
+            if (batch.entryAmount_[i] <= 0) {
+                context.Fail(d, ValidationRule::Amounts, "line " + std::to_string(line)
+                    + ": amount " + FormatUnits(batch.entryAmount_[i]) + " is not positive");
+            }
+            if (debit.empty() && credit.empty()) {
+                context.Fail(d, ValidationRule::Amounts, "line " + std::to_string(line) + " has no account");
+            } else if (debit == credit) {
+                context.Fail(d, ValidationRule::Amounts, "line " + std::to_string(line)
+                    + " debits and credits the same account " + debit);
+            }
+        }
+
+        std::fill(lineNumber.begin(), lineNumber.end(), 0);
+        const size_t items = batch.itemDocument_.size();
+        for (size_t i = 0; i < items; ++i) {
+            const uint32_t d = batch.itemDocument_[i];
+            const uint32_t line = ++lineNumber[d];
+            if (!context.Enabled(ValidationRule::Amounts, d)) {
+                continue;
+            }
+            if (batch.quantity_[i] <= 0) {
+                context.Fail(d, ValidationRule::Amounts, "line " + std::to_string(line)
+                    + ": quantity " + FormatUnits(batch.quantity_[i]) + " is not positive");
+            }
+            if (batch.price_[i] < 0) {
+                context.Fail(d, ValidationRule::Amounts, "line " + std::to_string(line)
+                    + ": negative unit price " + FormatUnits(batch.price_[i]));
+            }
+            // ThanhTien may be rounded to whole đồng
+            const double expected = static_cast<double>(batch.quantity_[i]) * static_cast<double>(batch.price_[i])
+                / static_cast<double>(Money::kScale);
+            if (std::fabs(expected - static_cast<double>(batch.itemAmount_[i])) >= static_cast<double>(Money::kScale)) {
+                context.Fail(d, ValidationRule::Amounts, "line " + std::to_string(line) + ": ThanhTien "
+                    + FormatUnits(batch.itemAmount_[i]) + " is not SoLuong x DonGia");
+            }
+        }
+    }
+
+    void ValidationService::CheckAccounts(CheckContext& context) {
+        const ValidationBatch& batch = context.batch;
+
+        // Resolve each distinct code once; 0 = valid or empty
+        enum : uint8_t { kValid = 0, kMissing, kInactive, kParent };
+        const std::vector<std::string>& codes = batch.accounts_.values;
+        std::vector<uint8_t> status(codes.size(), kValid);
+        for (size_t id = 0; id < codes.size(); ++id) {
+            if (codes[id].empty()) {
+                continue;
+            }
+            const uint32_t row = context.master.FindAccount(codes[id]);
+            if (row == MasterData::kNotFound) {
+                status[id] = kMissing;
+            } else if (!context.master.IsAccountActive(row)) {
+                status[id] = kInactive;
+            } else if (!context.master.IsLeafAccount(row)) {
+                status[id] = kParent;
+            }
+        }
+
+        // One issue per account and document
+        std::vector<uint32_t> reportedIn(codes.size(), UINT32_MAX);
+        auto check = [&](uint32_t d, uint32_t id) {
+            if (status[id] == kValid || reportedIn[id] == d) {
+                return;
+            }
+            reportedIn[id] = d;
+            static const char* const reasons[] = { "", " does not exist", " is not active",
+                " has sub-accounts; post to a detail account" };
+            context.Fail(d, ValidationRule::Accounts, "account " + codes[id] + reasons[status[id]]);
+        };
+
+        const size_t entries = batch.entryDocument_.size();
+        for (size_t i = 0; i < entries; ++i) {
+            const uint32_t d = batch.entryDocument_[i];
+            if ((status[batch.debit_[i]] | status[batch.credit_[i]]) && context.Enabled(ValidationRule::Accounts, d)) {
+                check(d, batch.debit_[i]);
+                check(d, batch.credit_[i]);
+            }
+        }
+    }
+
+    void ValidationService::CheckPeriod(CheckContext& context) {
+        const ValidationBatch& batch = context.batch;
+        const auto& closed = context.reference.closedPeriods;
+
+        for (uint32_t d = 0; d < batch.days_.size(); ++d) {
+            const DayNumber day = batch.days_[d];
+            if (!context.Enabled(ValidationRule::Period, d)) {
+                continue;
+            }
+            if (day == ValidationBatch::kInvalidDay) {
+                context.Fail(d, ValidationRule::Period, "invalid date");
+                continue;
+            }
+            for (const auto& period : closed) {
+                if (day >= period.first && day <= period.second) {
+                    context.Fail(d, ValidationRule::Period, "date " + FormatDay(day)
+                        + " is in a closed fiscal year");
+                    break;
+                }
+            }
+        }
+    }
+
+    void ValidationService::CheckProducts(CheckContext& context) {
+        const ValidationBatch& batch = context.batch;
+
+        enum : uint8_t { kValid = 0, kMissing, kInactive };
+        const std::vector<std::string>& codes = batch.products_.values;
+        std::vector<uint8_t> status(codes.size(), kValid);
+        for (size_t id = 0; id < codes.size(); ++id) {
+            const uint32_t row = context.master.FindProduct(codes[id]);
+            if (row == MasterData::kNotFound) {
+                status[id] = kMissing;
+            } else if (!context.master.IsProductActive(row)) {
+                status[id] = kInactive;
+            }
+        }
+        for (uint32_t id : batch.declaredProducts_) {
+            status[id] = kValid;
+        }
+
+        std::vector<uint32_t> reportedIn(codes.size(), UINT32_MAX);
+        const size_t items = batch.itemDocument_.size();
+        for (size_t i = 0; i < items; ++i) {
+            const uint32_t d = batch.itemDocument_[i];
+            const uint32_t id = batch.product_[i];
+            if (status[id] == kValid || reportedIn[id] == d || !context.Enabled(ValidationRule::Products, d)) {
+                continue;
+            }
+            reportedIn[id] = d;
+            context.Fail(d, ValidationRule::Products, "product " + codes[id]
+                + (status[id] == kMissing ? " does not exist" : " is not active"));
+        }
+    }
+
+    void ValidationService::CheckStock(CheckContext& context) {
+        const ValidationBatch& batch = context.batch;
+        const size_t documents = batch.types_.size();
+
+        // Lines grouped by document (counting sort on the document column)
+        std::vector<uint32_t> first(documents + 1, 0);
+        for (uint32_t d : batch.itemDocument_) {
+            ++first[d + 1];
+        }
+        for (size_t d = 0; d < documents; ++d) {
+            first[d + 1] += first[d];
+        }
+        std::vector<uint32_t> lines(batch.itemDocument_.size());
+        {
+            std::vector<uint32_t> next(first.begin(), first.end() - 1);
+            for (uint32_t i = 0; i < lines.size(); ++i) {
+                lines[next[batch.itemDocument_[i]]++] = i;
+            }
+        }
+
+        // Stock documents by date, receipts before issues on the same day
+        std::vector<uint32_t> order;
+        for (uint32_t d = 0; d < documents; ++d) {
+            if (batch.types_[d] != DocumentType::ChungTuKeToan && !batch.voided_[d]
+                && batch.days_[d] != ValidationBatch::kInvalidDay) {
+                order.push_back(d);
+            }
+        }
+        std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+            if (batch.days_[a] != batch.days_[b]) {
+                return batch.days_[a] < batch.days_[b];
+            }
+            return batch.types_[a] == DocumentType::PhieuNhap && batch.types_[b] == DocumentType::PhieuXuat;
+        });
+
+        // Running balance per product and warehouse, from today's stock on
+        // hand: posted movements count whatever their date. One issue per
+        // product and warehouse.
+        std::vector<int64_t>& balance = context.onHand;
+        balance.resize(batch.stockKeys_.size(), 0);
+        std::vector<uint8_t> reported(balance.size(), 0);
+        for (uint32_t d : order) {
+            const bool issue = batch.types_[d] == DocumentType::PhieuXuat;
+            for (uint32_t k = first[d]; k < first[d + 1]; ++k) {
+                const uint32_t i = lines[k];
+                const uint32_t id = batch.stock_[i];
+                balance[id] += issue ? -batch.quantity_[i] : batch.quantity_[i];
+                if (issue && balance[id] < 0 && !reported[id] && context.Enabled(ValidationRule::Stock, d)) {
+                    reported[id] = 1;
+                    context.Fail(d, ValidationRule::Stock, "product " + batch.products_.values[batch.product_[i]]
+                        + " in " + batch.warehouses_.values[batch.stockKeys_[id].second] + ": issuing " + FormatUnits(batch.quantity_[i]) + " leaves "
+                        + FormatUnits(balance[id]) + " in stock");
+                }
+            }
+        }
+    }
+
+} // namespace KeToanApp
@@ -0,0 +1,184 @@
+#pragma once
+
+#include "KeToanApp/Common.h"
+#include "KeToanApp/Types.h"
+#include "../Core/Config.h"
+#include "../Database/DatabaseManager.h"
+#include "../Models/ChungTu.h"
+#include "MasterDataCache.h"
+#include <cstdint>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+
+namespace KeToanApp {
+
+    enum class ValidationRule : uint8_t {
+        Lines,          // a document has at least one line
+        Balanced,       // debits equal credits per SoCT
+        Amounts,        // positive amounts; ThanhTien = SoLuong x DonGia
+        Accounts,       // accounts exist, are active and have no sub-accounts
+        Period,         // the date is valid and not in a closed fiscal year
+        Products,       // products exist and are active
+        Stock           // issues do not take a warehouse's stock below zero
+    };
+
+    struct ValidationIssue {
+        std::string documentKey;
+        ValidationRule rule;
+        std::string message;
+    };
+
+    struct ValidationReport {
+        std::vector<ValidationIssue> issues;    // at most Validation.MaxIssues
+        int64_t issueCount;                     // including those not kept
+        int64_t documents;                      // documents checked
+
+        ValidationReport() : issueCount(0), documents(0) {}
+
+        bool IsValid() const { return issueCount == 0; }
+        // "N problems; first: ..." for error messages
+        std::string Summary() const;
+    };
+
+    // Documents to validate together, held column-wise: one vector per
+    // field, account and product codes interned to dense ids. Documents of
+    // all three types may share a batch, so receipts and issues of one
+    // import are checked against each other.
+    class ValidationBatch {
+    public:
+        static const DayNumber kInvalidDay = INT32_MIN;
+        // Warehouse of lines that name none, and of carried opening stock
+        static constexpr const char* kDefaultWarehouse = "KHO01";
+
+        ValidationBatch() = default;
+
+        // Returns the document index used to add its lines
+        uint32_t AddDocument(DocumentType type, std::string_view key, DayNumber day, bool voided = false);
+        // DinhKhoan line; an empty account marks a one-sided line of a
+        // compound entry
+        void AddEntry(uint32_t document, std::string_view debit, std::string_view credit, int64_t amountUnits);
+        // ChiTietPhieuNhap/ChiTietPhieuXuat line, all in Money units
+        void AddItem(uint32_t document, std::string_view product, int64_t quantityUnits,
+            int64_t priceUnits, int64_t amountUnits, std::string_view warehouse = kDefaultWarehouse);
+        // Products created by the same import, valid for its lines
+        void DeclareProduct(std::string_view product);
+
+        uint32_t Add(const ChungTu& chungTu);
+
+        size_t GetDocumentCount() const { return types_.size(); }
+        void Clear();
+
+    private:
+        friend class ValidationService;
+
+        struct Codes {
+            std::unordered_map<std::string, uint32_t> index;
+            std::vector<std::string> values;
+            std::string scratch;
+
+            uint32_t Intern(std::string_view code);
+        };
+
+        // Documents
+        std::vector<DocumentType> types_;
+        std::vector<std::string> keys_;
+        std::vector<DayNumber> days_;
+        std::vector<uint8_t> voided_;
+
+        // Accounting lines
+        std::vector<uint32_t> entryDocument_;
+        std::vector<uint32_t> debit_;           // accounts_ ids
+        std::vector<uint32_t> credit_;
+        std::vector<int64_t> entryAmount_;
+
+        // Stock lines
+        std::vector<uint32_t> itemDocument_;
+        std::vector<uint32_t> product_;         // products_ ids
+        std::vector<uint32_t> stock_;           // stockKeys_ ids
+        std::vector<int64_t> quantity_;
+        std::vector<int64_t> price_;
+        std::vector<int64_t> itemAmount_;
+
+        Codes accounts_;
+        Codes products_;
+        Codes warehouses_;
+        std::vector<uint32_t> declaredProducts_;
+
+        // Distinct (product, warehouse) pairs of the stock lines
+        std::unordered_map<uint64_t, uint32_t> stockIndex_;
+        std::vector<std::pair<uint32_t, uint32_t>> stockKeys_;
+
+        static uint64_t StockKey(uint32_t product, uint32_t warehouse) {
+            return static_cast<uint64_t>(product) << 32 | warehouse;
+        }
+    };
+
+    // Business rules for vouchers and stock documents.
+    //
+    // The rules checked for each document type come from config
+    // (Validation.ChungTuKeToan, Validation.PhieuNhap, Validation.PhieuXuat,
+    // comma-separated rule names) and are compiled into a rule mask per
+    // type, recompiled when the setting changes. Each enabled check is one
+    // pass over a batch's columns. Accounts and products are looked up in
+    // the MasterDataCache, closed periods in a table loaded by Refresh() and
+    // reloaded by Validate() once the set of closed years in KyKeToan changes;
+    // codes are resolved once per distinct code in a batch, not per line.
+    // Stock on hand per product and warehouse is read when a batch is
+    // validated.
+    //
+    // Validation runs before any transaction is opened, so a rejected import
+    // never holds the write lock. It does not lock anything either: a
+    // document posted concurrently is not seen by a batch validated before
+    // it.
+    class ValidationService {
+    public:
+        ValidationService(DatabaseManager& database, Config& config, MasterDataCache& masterData);
+        ~ValidationService();
+
+        // Non-copyable
+        ValidationService(const ValidationService&) = delete;
+        ValidationService& operator=(const ValidationService&) = delete;
+
+        // Reloads the closed periods
+        bool Refresh();
+
+        // Loads the tables on first use, and again after a fiscal year is
+        // closed or reopened. Returns false only if they could not be read;
+        // rule violations are in the report.
+        bool Validate(const ValidationBatch& batch, ValidationReport& report);
+
+        static const char* GetRuleName(ValidationRule rule);
+
+    private:
+        struct ReferenceData;
+        struct CheckContext;
+
+        DatabaseManager& database_;
+        Config& config_;
+        MasterDataCache& masterData_;
+
+        mutable std::mutex mutex_;
+        std::shared_ptr<const ReferenceData> reference_;
+        uint32_t ruleMasks_[3];         // per DocumentType, bit (1 << rule) per enabled rule
+        Config::SubscriptionId subscriptions_[3];
+
+        void Compile(DocumentType type);
+        // False once the closed years differ from those reference was loaded with
+        bool IsCurrent(const ReferenceData& reference);
+        bool LoadStock(const ValidationBatch& batch, std::vector<int64_t>& onHand);
+
+        // Closed fiscal years, "2024,2025"; throws DatabaseException
+        static std::string ClosedYears(ReadView& view);
+
+        // One pass over the batch each, in ValidationRule order
+        static void CheckLines(CheckContext& context);
+        static void CheckBalanced(CheckContext& context);
+        static void CheckAmounts(CheckContext& context);
+        static void CheckAccounts(CheckContext& context);
+        static void CheckPeriod(CheckContext& context);
+        static void CheckProducts(CheckContext& context);
+        static void CheckStock(CheckContext& context);
+    };
+
+} // namespace KeToanApp
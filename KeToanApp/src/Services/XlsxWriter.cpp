@@ -0,0 +1,431 @@
+#include "XlsxWriter.h"
+#include "../Utils/Logger.h"
+#include "../Utils/StringHelper.h"
+#include <cmath>
+#include <cstring>
+
+namespace KeToanApp {
+
+    namespace {
+
+        const size_t kFlushBytes = 64 * 1024;
+        const size_t kMaxSheetNameChars = 31;
+
+        // Excel serial of 1970-01-01 (serials count from 1899-12-30)
+        const int32_t kEpochSerial = 25569;
+
+        // Cell style indexes into cellXfs, see StylesXml()
+        const char* const kStyleHeader = "1";
+        const char* const kStyleMoney = "2";
+        const char* const kStyleDate = "3";
+        const char* const kStyleInteger = "4";
+
+        const char kXmlDeclaration[] = "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\n";
+        const char kMainNamespace[] = "http://schemas.openxmlformats.org/spreadsheetml/2006/main";
+        const char kRelNamespace[] = "http://schemas.openxmlformats.org/officeDocument/2006/relationships";
+        const char kPackageRelNamespace[] = "http://schemas.openxmlformats.org/package/2006/relationships";
+
+        void AppendEscaped(std::string& out, std::string_view text) {
+            for (char c : text) {
+                switch (c) {
+                case '&': out += "&amp;"; break;
+                case '<': out += "&lt;"; break;
+                case '>': out += "&gt;"; break;
+                case '"': out += "&quot;"; break;
+                default:
+                    // Control characters other than tab/newline are not valid XML
+                    if (static_cast<unsigned char>(c) >= 0x20 || c == '\t' || c == '\n' || c == '\r') {
+                        out += c;
+                    }
+                    break;
+                }
+            }
+        }
+
+        void AppendNumber(std::string& out, const char* style, const char* value) {
+            out += "<c";
+            if (style) {
+                out += " s=\"";
+                out += style;
+                out += '"';
+            }
+            out += "><v>";
+            out += value;
+            out += "</v></c>";
+        }
+
+        std::string ColumnLetters(size_t index) {
+            std::string letters;
+            for (size_t n = index + 1; n > 0; n = (n - 1) / 26) {
+                letters.insert(letters.begin(), static_cast<char>('A' + (n - 1) % 26));
+            }
+            return letters;
+        }
+
+        // Cuts a UTF-8 string to at most maxChars code points
+        std::string TruncateChars(const std::string& text, size_t maxChars) {
+            size_t chars = 0;
+            for (size_t i = 0; i < text.size(); ++i) {
+                if ((static_cast<unsigned char>(text[i]) & 0xC0) != 0x80 && chars++ == maxChars) {
+                    return text.substr(0, i);
+                }
+            }
+            return text;
+        }
+
+        std::string CleanSheetName(const std::string& name) {
+            std::string clean;
+            for (char c : name) {
+                bool invalid = c == '[' || c == ']' || c == ':' || c == '*' || c == '?'
+                    || c == '/' || c == '\\' || static_cast<unsigned char>(c) < 0x20;
+                clean += invalid ? '_' : c;
+            }
+            if (!clean.empty() && clean.front() == '\'') {
+                clean.front() = '_';
+            }
+            if (!clean.empty() && clean.back() == '\'') {
+                clean.back() = '_';
+            }
+            return clean.empty() ? "Sheet" : clean;
+        }
+
+    } // namespace
+
+    XlsxWriter::XlsxWriter(int moneyDecimals, const std::string& dateFormat)
+        : moneyDecimals_(moneyDecimals)
+        // Excel reads lower-case "mm" after "dd" as the month
+        , dateFormat_(StringHelper::ToLower(dateFormat))
+        , row_(0)
+        , inSheet_(false)
+        , rowOpen_(false)
+        , failed_(false)
+        , rowsWritten_(0)
+    {
+    }
+
+    bool XlsxWriter::Open(const std::string& path, int compressionLevel) {
+        sheetNames_.clear();
+        sheetFilters_.clear();
+        inSheet_ = false;
+        failed_ = false;
+        rowsWritten_ = 0;
+        return zip_.Open(path, compressionLevel);
+    }
+
+    bool XlsxWriter::BeginSheet(const std::string& name, const std::vector<XlsxColumn>& columns) {
+        if (inSheet_ && !EndSheet()) {
+            return false;
+        }
+        sheetName_ = name;
+        columns_ = columns;
+        inSheet_ = true;
+        return StartPart();
+    }
+
+    bool XlsxWriter::EndSheet() {
+        if (!inSheet_) {
+            return false;
+        }
+        inSheet_ = false;
+        return FinishPart();
+    }
+
+    bool XlsxWriter::StartPart() {
+        sheetNames_.push_back(UniqueSheetName(sheetName_));
+        if (!zip_.BeginEntry("xl/worksheets/sheet" + std::to_string(sheetNames_.size()) + ".xml")) {
+            failed_ = true;
+            return false;
+        }
+
+        buffer_.clear();
+        buffer_ += kXmlDeclaration;
+        buffer_ += "<worksheet xmlns=\"";
+        buffer_ += kMainNamespace;
+        buffer_ += "\"><sheetViews><sheetView workbookViewId=\"0\">"
+                   "<pane ySplit=\"1\" topLeftCell=\"A2\" activePane=\"bottomLeft\" state=\"frozen\"/>"
+                   "</sheetView></sheetViews>";
+
+        if (!columns_.empty()) {
+            buffer_ += "<cols>";
+            for (size_t i = 0; i < columns_.size(); ++i) {
+                char col[96];
+                sprintf_s(col, "<col min=\"%zu\" max=\"%zu\" width=\"%.1f\" customWidth=\"1\"/>",
+                    i + 1, i + 1, columns_[i].width);
+                buffer_ += col;
+            }
+            buffer_ += "</cols>";
+        }
+        buffer_ += "<sheetData>";
+
+        row_ = 0;
+        rowOpen_ = false;
+        OpenRow();
+        for (const auto& column : columns_) {
+            buffer_ += "<c s=\"";
+            buffer_ += kStyleHeader;
+            buffer_ += "\" t=\"inlineStr\"><is><t>";
+            AppendEscaped(buffer_, column.title);
+            buffer_ += "</t></is></c>";
+        }
+        buffer_ += "</row>";
+        rowOpen_ = false;
+        return true;
+    }
+
+    bool XlsxWriter::FinishPart() {
+        if (rowOpen_) {
+            buffer_ += "</row>";
+            rowOpen_ = false;
+        }
+        buffer_ += "</sheetData>";
+        std::string filter;
+        if (!columns_.empty()) {
+            filter = "$A$1:$" + ColumnLetters(columns_.size() - 1) + "$" + std::to_string(row_);
+            buffer_ += "<autoFilter ref=\"A1:" + ColumnLetters(columns_.size() - 1)
+                + std::to_string(row_) + "\"/>";
+        }
+        sheetFilters_.push_back(filter);
+        buffer_ += "</worksheet>";
+
+        bool ok = zip_.Write(buffer_) && zip_.EndEntry();
+        buffer_.clear();
+        failed_ = failed_ || !ok;
+        return ok;
+    }
+
+    void XlsxWriter::OpenRow() {
+        buffer_ += "<row r=\"";
+        buffer_ += std::to_string(++row_);
+        buffer_ += "\">";
+        rowOpen_ = true;
+    }
+
+    bool XlsxWriter::FlushIfFull() {
+        if (buffer_.size() < kFlushBytes) {
+            return true;
+        }
+        bool ok = zip_.Write(buffer_);
+        buffer_.clear();
+        failed_ = failed_ || !ok;
+        return ok;
+    }
+
+    XlsxWriter& XlsxWriter::Text(std::string_view text) {
+        if (!rowOpen_) {
+            OpenRow();
+        }
+        buffer_ += "<c t=\"inlineStr\"><is><t xml:space=\"preserve\">";
+        AppendEscaped(buffer_, text);
+        buffer_ += "</t></is></c>";
+        return *this;
+    }
+
+    XlsxWriter& XlsxWriter::Number(double value) {
+        if (!std::isfinite(value)) {
+            return Blank();
+        }
+        if (!rowOpen_) {
+            OpenRow();
+        }
+        char text[32];
+        sprintf_s(text, "%.15g", value);
+        AppendNumber(buffer_, nullptr, text);
+        return *this;
+    }
+
+    XlsxWriter& XlsxWriter::Integer(int64_t value) {
+        if (!rowOpen_) {
+            OpenRow();
+        }
+        char text[32];
+        sprintf_s(text, "%lld", static_cast<long long>(value));
+        AppendNumber(buffer_, kStyleInteger, text);
+        return *this;
+    }
+
+    XlsxWriter& XlsxWriter::Amount(const Money& value) {
+        if (!rowOpen_) {
+            OpenRow();
+        }
+
+        // Exact decimal from the fixed-point units, no trip through double
+        uint64_t units = value.units < 0 ? 0 - static_cast<uint64_t>(value.units) : static_cast<uint64_t>(value.units);
+        unsigned long long whole = units / Money::kScale;
+        unsigned long long fraction = units % Money::kScale;
+        char text[40];
+        if (fraction == 0) {
+            sprintf_s(text, "%s%llu", value.units < 0 ? "-" : "", whole);
+        } else {
+            sprintf_s(text, "%s%llu.%04llu", value.units < 0 ? "-" : "", whole, fraction);
+            size_t length = strlen(text);
+            while (text[length - 1] == '0') {
+                text[--length] = '\0';
+            }
+        }
+        AppendNumber(buffer_, kStyleMoney, text);
+        return *this;
+    }
+
+    XlsxWriter& XlsxWriter::Day(DayNumber day) {
+        if (!rowOpen_) {
+            OpenRow();
+        }
+        char text[16];
+        sprintf_s(text, "%d", day + kEpochSerial);
+        AppendNumber(buffer_, kStyleDate, text);
+        return *this;
+    }
+
+    XlsxWriter& XlsxWriter::Blank() {
+        if (!rowOpen_) {
+            OpenRow();
+        }
+        buffer_ += "<c/>";
+        return *this;
+    }
+
+    bool XlsxWriter::EndRow() {
+        if (!inSheet_ || failed_) {
+            return false;
+        }
+        if (!rowOpen_) {
+            OpenRow();
+        }
+        buffer_ += "</row>";
+        rowOpen_ = false;
+        ++rowsWritten_;
+
+        if (row_ >= kMaxRowsPerSheet) {
+            if (!FinishPart() || !StartPart()) {
+                return false;
+            }
+            Logger::Info("Sheet %s is full, continuing on %s", sheetName_.c_str(), sheetNames_.back().c_str());
+        }
+        return FlushIfFull();
+    }
+
+    bool XlsxWriter::Close() {
+        if (!zip_.IsOpen()) {
+            return false;
+        }
+        if (inSheet_) {
+            EndSheet();
+        }
+        if (sheetNames_.empty()) {
+            // A workbook needs at least one sheet
+            BeginSheet("Sheet1", {});
+            EndSheet();
+        }
+
+        std::string contentTypes = kXmlDeclaration;
+        contentTypes += "<Types xmlns=\"http://schemas.openxmlformats.org/package/2006/content-types\">"
+            "<Default Extension=\"rels\" ContentType=\"application/vnd.openxmlformats-package.relationships+xml\"/>"
+            "<Default Extension=\"xml\" ContentType=\"application/xml\"/>"
+            "<Override PartName=\"/xl/workbook.xml\" "
+            "ContentType=\"application/vnd.openxmlformats-officedocument.spreadsheetml.sheet.main+xml\"/>"
+            "<Override PartName=\"/xl/styles.xml\" "
+            "ContentType=\"application/vnd.openxmlformats-officedocument.spreadsheetml.styles+xml\"/>";
+        for (size_t i = 1; i <= sheetNames_.size(); ++i) {
+            contentTypes += "<Override PartName=\"/xl/worksheets/sheet" + std::to_string(i) + ".xml\" "
+                "ContentType=\"application/vnd.openxmlformats-officedocument.spreadsheetml.worksheet+xml\"/>";
+        }
+        contentTypes += "</Types>";
+
+        std::string rootRels = kXmlDeclaration;
+        rootRels += std::string("<Relationships xmlns=\"") + kPackageRelNamespace + "\">"
+            "<Relationship Id=\"rId1\" Type=\"" + kRelNamespace + "/officeDocument\" Target=\"xl/workbook.xml\"/>"
+            "</Relationships>";
+
+        std::string workbook = kXmlDeclaration;
+        workbook += std::string("<workbook xmlns=\"") + kMainNamespace + "\" xmlns:r=\"" + kRelNamespace + "\"><sheets>";
+        std::string workbookRels = kXmlDeclaration;
+        workbookRels += std::string("<Relationships xmlns=\"") + kPackageRelNamespace + "\">";
+        for (size_t i = 1; i <= sheetNames_.size(); ++i) {
+            const std::string id = std::to_string(i);
+            workbook += "<sheet name=\"";
+            AppendEscaped(workbook, sheetNames_[i - 1]);
+            workbook += "\" sheetId=\"" + id + "\" r:id=\"rId" + id + "\"/>";
+            workbookRels += "<Relationship Id=\"rId" + id + "\" Type=\"" + kRelNamespace
+                + "/worksheet\" Target=\"worksheets/sheet" + id + ".xml\"/>";
+        }
+        workbook += "</sheets>";
+
+        // Excel keeps autofilter ranges as hidden defined names
+        std::string definedNames;
+        for (size_t i = 0; i < sheetFilters_.size(); ++i) {
+            if (!sheetFilters_[i].empty()) {
+                definedNames += "<definedName name=\"_xlnm._FilterDatabase\" localSheetId=\""
+                    + std::to_string(i) + "\" hidden=\"1\">";
+                AppendEscaped(definedNames, "'" + StringHelper::ReplaceAll(sheetNames_[i], "'", "''") + "'!"
+                    + sheetFilters_[i]);
+                definedNames += "</definedName>";
+            }
+        }
+        if (!definedNames.empty()) {
+            workbook += "<definedNames>" + definedNames + "</definedNames>";
+        }
+        workbook += "</workbook>";
+        workbookRels += "<Relationship Id=\"rId" + std::to_string(sheetNames_.size() + 1) + "\" Type=\""
+            + kRelNamespace + "/styles\" Target=\"styles.xml\"/></Relationships>";
+
+        bool ok = !failed_
+            && zip_.BeginEntry("[Content_Types].xml") && zip_.Write(contentTypes)
+            && zip_.BeginEntry("_rels/.rels") && zip_.Write(rootRels)
+            && zip_.BeginEntry("xl/workbook.xml") && zip_.Write(workbook)
+            && zip_.BeginEntry("xl/_rels/workbook.xml.rels") && zip_.Write(workbookRels)
+            && zip_.BeginEntry("xl/styles.xml") && zip_.Write(StylesXml());
+        return zip_.Close() && ok;
+    }
+
+    std::string XlsxWriter::UniqueSheetName(const std::string& name) const {
+        const std::string base = CleanSheetName(name);
+        auto taken = [this](const std::string& candidate) {
+            const std::string lower = StringHelper::ToLower(candidate);
+            for (const auto& existing : sheetNames_) {
+                if (StringHelper::ToLower(existing) == lower) {
+                    return true;
+                }
+            }
+            return false;
+        };
+
+        std::string candidate = TruncateChars(base, kMaxSheetNameChars);
+        for (int n = 2; taken(candidate); ++n) {
+            const std::string suffix = " (" + std::to_string(n) + ")";
+            candidate = TruncateChars(base, kMaxSheetNameChars - suffix.size()) + suffix;
+        }
+        return candidate;
+    }
+
+    std::string XlsxWriter::StylesXml() const {
+        std::string moneyFormat = "#,##0";
+        if (moneyDecimals_ > 0) {
+            moneyFormat += "." + std::string(static_cast<size_t>(moneyDecimals_), '0');
+        }
+
+        std::string xml = kXmlDeclaration;
+        xml += std::string("<styleSheet xmlns=\"") + kMainNamespace + "\">";
+        xml += "<numFmts count=\"2\"><numFmt numFmtId=\"164\" formatCode=\"";
+        AppendEscaped(xml, moneyFormat);
+        xml += "\"/><numFmt numFmtId=\"165\" formatCode=\"";
+        AppendEscaped(xml, dateFormat_);
+        xml += "\"/></numFmts>"
+            "<fonts count=\"2\"><font><sz val=\"11\"/><name val=\"Calibri\"/></font>"
+            "<font><b/><sz val=\"11\"/><name val=\"Calibri\"/></font></fonts>"
+            "<fills count=\"2\"><fill><patternFill patternType=\"none\"/></fill>"
+            "<fill><patternFill patternType=\"gray125\"/></fill></fills>"
+            "<borders count=\"1\"><border><left/><right/><top/><bottom/><diagonal/></border></borders>"
+            "<cellStyleXfs count=\"1\"><xf numFmtId=\"0\" fontId=\"0\" fillId=\"0\" borderId=\"0\"/></cellStyleXfs>"
+            "<cellXfs count=\"5\">"
+            "<xf numFmtId=\"0\" fontId=\"0\" fillId=\"0\" borderId=\"0\" xfId=\"0\"/>"
+            "<xf numFmtId=\"0\" fontId=\"1\" fillId=\"0\" borderId=\"0\" xfId=\"0\" applyFont=\"1\"/>"
+            "<xf numFmtId=\"164\" fontId=\"0\" fillId=\"0\" borderId=\"0\" xfId=\"0\" applyNumberFormat=\"1\"/>"
+            "<xf numFmtId=\"165\" fontId=\"0\" fillId=\"0\" borderId=\"0\" xfId=\"0\" applyNumberFormat=\"1\"/>"
+            "<xf numFmtId=\"3\" fontId=\"0\" fillId=\"0\" borderId=\"0\" xfId=\"0\" applyNumberFormat=\"1\"/>"
+            "</cellXfs>"
+            "<cellStyles count=\"1\"><cellStyle name=\"Normal\" xfId=\"0\" builtinId=\"0\"/></cellStyles>"
+            "</styleSheet>";
+        return xml;
+    }
+
+} // namespace KeToanApp
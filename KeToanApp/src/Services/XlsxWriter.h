@@ -0,0 +1,80 @@
+#pragma once
+
+#include "KeToanApp/Common.h"
+#include "KeToanApp/Types.h"
+#include "../Utils/ZipWriter.h"
+#include <cstdint>
+#include <string_view>
+
+namespace KeToanApp {
+
+    struct XlsxColumn {
+        std::string title;
+        double width;           // in characters
+    };
+
+    // Streaming .xlsx writer.
+    //
+    // Sheet XML is generated row by row and passed through ZipWriter as it
+    // is produced, so memory stays flat however many rows are written.
+    // Strings are written inline (no shared string table, which would grow
+    // with the data). Every sheet starts with a bold, frozen header row; a
+    // sheet that reaches Excel's row limit continues on a new sheet with the
+    // same header. Cells are added left to right:
+    //
+    //     xlsx.BeginSheet("So cai", columns);
+    //     xlsx.Day(day).Text(soCT).Amount(soTien).EndRow();
+    class XlsxWriter {
+    public:
+        static const uint32_t kMaxRowsPerSheet = 1048576;
+
+        // moneyDecimals: decimals shown for Amount cells;
+        // dateFormat: app-style pattern such as "dd/MM/yyyy"
+        XlsxWriter(int moneyDecimals = 2, const std::string& dateFormat = "dd/MM/yyyy");
+        ~XlsxWriter() = default;
+
+        // Non-copyable
+        XlsxWriter(const XlsxWriter&) = delete;
+        XlsxWriter& operator=(const XlsxWriter&) = delete;
+
+        bool Open(const std::string& path, int compressionLevel = 6);
+        bool Close();   // ends the open sheet and writes the workbook parts
+
+        bool BeginSheet(const std::string& name, const std::vector<XlsxColumn>& columns);
+        bool EndSheet();
+
+        XlsxWriter& Text(std::string_view text);
+        XlsxWriter& Number(double value);
+        XlsxWriter& Integer(int64_t value);
+        XlsxWriter& Amount(const Money& value);
+        XlsxWriter& Day(DayNumber day);
+        XlsxWriter& Blank();
+        bool EndRow();
+
+        int64_t GetRowsWritten() const { return rowsWritten_; }
+        uint64_t GetBytesWritten() const { return zip_.GetBytesWritten(); }
+
+    private:
+        ZipWriter zip_;
+        int moneyDecimals_;
+        std::string dateFormat_;
+        std::string buffer_;
+        std::vector<std::string> sheetNames_;
+        std::vector<std::string> sheetFilters_;   // autofilter range per sheet, "" if none
+        std::string sheetName_;
+        std::vector<XlsxColumn> columns_;
+        uint32_t row_;          // rows in the current sheet part, header included
+        bool inSheet_;
+        bool rowOpen_;
+        bool failed_;
+        int64_t rowsWritten_;
+
+        bool StartPart();
+        bool FinishPart();
+        void OpenRow();
+        bool FlushIfFull();
+        std::string UniqueSheetName(const std::string& name) const;
+        std::string StylesXml() const;
+    };
+
+} // namespace KeToanApp
@@ -0,0 +1,35 @@
+#include "CancellationToken.h"
+#include <algorithm>
+
+namespace KeToanApp {
+
+    CancellationToken::CancellationToken()
+        : state_(std::make_shared<State>())
+    {
+    }
+
+    void CancellationToken::Cancel() {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        if (state_->cancelled.exchange(true, std::memory_order_acq_rel)) {
+            return;
+        }
+        for (auto& entry : state_->callbacks) {
+            entry.second();
+        }
+    }
+
+    uint64_t CancellationToken::Register(Callback callback) {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        const uint64_t id = ++state_->lastId;
+        state_->callbacks.emplace_back(id, std::move(callback));
+        return id;
+    }
+
+    void CancellationToken::Unregister(uint64_t id) {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        auto& callbacks = state_->callbacks;
+        callbacks.erase(std::remove_if(callbacks.begin(), callbacks.end(),
+            [id](const std::pair<uint64_t, Callback>& entry) { return entry.first == id; }), callbacks.end());
+    }
+
+} // namespace KeToanApp
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "KeToanApp/Common.h"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+
+namespace KeToanApp {
+
+    // Cancellation flag shared by all copies of a token. The code running a
+    // long operation polls IsCancelled() or registers a callback; any thread
+    // may call Cancel(). A token is never reset: start each operation with a
+    // new one.
+    class CancellationToken {
+    public:
+        using Callback = std::function<void()>;
+
+        CancellationToken();
+
+        void Cancel();
+        bool IsCancelled() const { return state_->cancelled.load(std::memory_order_acquire); }
+
+        // Callbacks run on the cancelling thread and must not register or
+        // unregister. Unregister() waits for a callback that is running, so
+        // what it uses may be released afterwards. A callback registered
+        // after Cancel() is not run.
+        uint64_t Register(Callback callback);
+        void Unregister(uint64_t id);
+
+    private:
+        struct State {
+            std::atomic<bool> cancelled{ false };
+            std::mutex mutex;
+            std::vector<std::pair<uint64_t, Callback>> callbacks;
+            uint64_t lastId = 0;
+        };
+
+        std::shared_ptr<State> state_;
+    };
+
+} // namespace KeToanApp
@@ -0,0 +1,59 @@
+#include "Crc32.h"
+
+namespace KeToanApp {
+namespace Crc32 {
+
+    namespace {
+
+        // Slicing-by-8 tables: table[k][b] is the CRC of byte b followed by k zero bytes
+        struct Tables {
+            uint32_t table[8][256];
+
+            Tables() {
+                for (uint32_t b = 0; b < 256; ++b) {
+                    uint32_t crc = b;
+                    for (int bit = 0; bit < 8; ++bit) {
+                        crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+                    }
+                    table[0][b] = crc;
+                }
+                for (uint32_t b = 0; b < 256; ++b) {
+                    for (int k = 1; k < 8; ++k) {
+                        table[k][b] = (table[k - 1][b] >> 8) ^ table[0][table[k - 1][b] & 0xFF];
+                    }
+                }
+            }
+        };
+
+        const Tables& GetTables() {
+            static const Tables tables;
+            return tables;
+        }
+
+    } // namespace
+
+    uint32_t Update(uint32_t crc, const void* data, size_t size) {
+        const uint32_t (&t)[8][256] = GetTables().table;
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+        crc = ~crc;
+
+        // Eight bytes per step; bytes are combined explicitly, so the result
+        // does not depend on host byte order or alignment
+        while (size >= 8) {
+            uint32_t low = crc ^ (static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8
+                | static_cast<uint32_t>(p[2]) << 16 | static_cast<uint32_t>(p[3]) << 24);
+            crc = t[7][low & 0xFF] ^ t[6][(low >> 8) & 0xFF] ^ t[5][(low >> 16) & 0xFF] ^ t[4][low >> 24]
+                ^ t[3][p[4]] ^ t[2][p[5]] ^ t[1][p[6]] ^ t[0][p[7]];
+            p += 8;
+            size -= 8;
+        }
+
+        while (size--) {
+            crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xFF];
+        }
+
+        return ~crc;
+    }
+
+} // namespace Crc32
+} // namespace KeToanApp
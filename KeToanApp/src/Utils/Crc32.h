@@ -0,0 +1,18 @@
+#pragma once
+
+#include "KeToanApp/Common.h"
+#include <cstdint>
+
+namespace KeToanApp {
+namespace Crc32 {
+
+    // CRC-32 (IEEE 802.3, reflected 0xEDB88320), as used by zip and zlib.
+    // Update() continues a running value; start from 0.
+    uint32_t Update(uint32_t crc, const void* data, size_t size);
+
+    inline uint32_t Compute(const void* data, size_t size) {
+        return Update(0, data, size);
+    }
+
+} // namespace Crc32
+} // namespace KeToanApp
@@ -13,10 +13,6 @@ namespace DateTimeHelper {
         return Date(timeinfo.tm_mday, timeinfo.tm_mon + 1, timeinfo.tm_year + 1900);
     }
 
-    Date Date::Today() {
-        return DateTimeHelper::Today();
-    }
-
     std::string CurrentDateString(const std::string& format) {
         KETOAN_UNUSED(format);
         return Today().ToString();
@@ -150,6 +146,71 @@ namespace DateTimeHelper {
         return days[month - 1];
     }
 
+    DayNumber ToDayNumber(const Date& date) {
+        return ToDayNumber(date.day, date.month, date.year);
+    }
+
+    DayNumber ToDayNumber(int day, int month, int year) {
+        // days_from_civil (H. Hinnant): shift the year to start in March
+        year -= month <= 2;
+        const int era = (year >= 0 ? year : year - 399) / 400;
+        const int yoe = year - era * 400;
+        const int doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+        const int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+        return era * 146097 + doe - 719468;
+    }
+
+    Date FromDayNumber(DayNumber dayNumber) {
+        // civil_from_days (H. Hinnant)
+        const int z = dayNumber + 719468;
+        const int era = (z >= 0 ? z : z - 146096) / 146097;
+        const int doe = z - era * 146097;
+        const int yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+        const int doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+        const int mp = (5 * doy + 2) / 153;
+        const int day = doy - (153 * mp + 2) / 5 + 1;
+        const int month = mp < 10 ? mp + 3 : mp - 9;
+        return Date(day, month, yoe + era * 400 + (month <= 2));
+    }
+
+    bool ParseDayNumber(const char* text, size_t length, DayNumber& dayNumber) {
+        auto digits = [text](size_t pos, size_t count, int& value) {
+            value = 0;
+            for (size_t i = pos; i < pos + count; ++i) {
+                unsigned digit = static_cast<unsigned>(text[i] - '0');
+                if (digit > 9) return false;
+                value = value * 10 + static_cast<int>(digit);
+            }
+            return true;
+        };
+
+        if (!text || length < 10) {
+            return false;
+        }
+
+        int day, month, year;
+        if (text[4] == '-' && text[7] == '-') {
+            // yyyy-mm-dd[...]
+            if (!digits(0, 4, year) || !digits(5, 2, month) || !digits(8, 2, day)) {
+                return false;
+            }
+        } else if (text[2] == '/' && text[5] == '/') {
+            // dd/MM/yyyy
+            if (!digits(0, 2, day) || !digits(3, 2, month) || !digits(6, 4, year)) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+
+        if (!IsValidDate(day, month, year)) {
+            return false;
+        }
+
+        dayNumber = ToDayNumber(day, month, year);
+        return true;
+    }
+
     bool IsBefore(const Date& date1, const Date& date2) {
         if (date1.year != date2.year) return date1.year < date2.year;
         if (date1.month != date2.month) return date1.month < date2.month;
@@ -167,4 +228,10 @@ namespace DateTimeHelper {
     }
 
 } // namespace DateTimeHelper
+
+    // Declared in Types.h; defined here next to the helper it forwards to
+    Date Date::Today() {
+        return DateTimeHelper::Today();
+    }
+
 } // namespace KeToanApp
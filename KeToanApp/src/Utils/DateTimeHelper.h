@@ -30,6 +30,15 @@ namespace DateTimeHelper {
     bool IsLeapYear(int year);
     int DaysInMonth(int month, int year);
 
+    // Serial day numbers (days since 1970-01-01, proleptic Gregorian)
+    DayNumber ToDayNumber(const Date& date);
+    DayNumber ToDayNumber(int day, int month, int year);
+    Date FromDayNumber(DayNumber dayNumber);
+
+    // Fast parse of a stored date, ISO yyyy-mm-dd (optionally followed by a
+    // time) or dd/MM/yyyy, without allocation. Returns false if malformed.
+    bool ParseDayNumber(const char* text, size_t length, DayNumber& dayNumber);
+
     // Date comparison
     bool IsBefore(const Date& date1, const Date& date2);
     bool IsAfter(const Date& date1, const Date& date2);
@@ -0,0 +1,88 @@
+#include "LatencyHistogram.h"
+
+namespace KeToanApp {
+
+    LatencyHistogram::LatencyHistogram()
+        : count_(0)
+        , sum_(0)
+        , max_(0)
+    {
+        for (auto& bucket : buckets_) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void LatencyHistogram::Record(uint64_t micros) {
+        buckets_[BucketIndex(micros)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(micros, std::memory_order_relaxed);
+
+        uint64_t seen = max_.load(std::memory_order_relaxed);
+        while (micros > seen &&
+               !max_.compare_exchange_weak(seen, micros, std::memory_order_relaxed)) {
+        }
+    }
+
+    void LatencyHistogram::Reset() {
+        for (auto& bucket : buckets_) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+        count_.store(0, std::memory_order_relaxed);
+        sum_.store(0, std::memory_order_relaxed);
+        max_.store(0, std::memory_order_relaxed);
+    }
+
+    double LatencyHistogram::Mean() const {
+        uint64_t count = Count();
+        return count ? static_cast<double>(Sum()) / static_cast<double>(count) : 0.0;
+    }
+
+    uint64_t LatencyHistogram::Percentile(double percentile) const {
+        uint64_t count = Count();
+        if (count == 0) {
+            return 0;
+        }
+
+        uint64_t target = static_cast<uint64_t>(percentile / 100.0 * static_cast<double>(count) + 0.5);
+        if (target == 0) target = 1;
+
+        uint64_t seen = 0;
+        for (int i = 0; i < kBucketCount; ++i) {
+            seen += buckets_[i].load(std::memory_order_relaxed);
+            if (seen >= target) {
+                uint64_t bound = BucketUpperBound(i);
+                uint64_t max = Max();
+                return bound < max ? bound : max;
+            }
+        }
+        return Max();
+    }
+
+    int LatencyHistogram::BucketIndex(uint64_t value) {
+        // Values below kSubBuckets get exact buckets
+        if (value < static_cast<uint64_t>(kSubBuckets)) {
+            return static_cast<int>(value);
+        }
+
+        int magnitude = 63;
+        while (!(value & (1ULL << magnitude))) {
+            --magnitude;
+        }
+
+        int shift = magnitude - kSubBucketBits;
+        int sub = static_cast<int>((value >> shift) & (kSubBuckets - 1));
+        return (shift + 1) * kSubBuckets + sub;
+    }
+
+    uint64_t LatencyHistogram::BucketUpperBound(int index) {
+        if (index < kSubBuckets) {
+            return static_cast<uint64_t>(index);
+        }
+
+        int shift = index / kSubBuckets - 1;
+        uint64_t sub = static_cast<uint64_t>(index % kSubBuckets);
+        uint64_t lower = (static_cast<uint64_t>(kSubBuckets) + sub) << shift;
+        return lower + ((1ULL << shift) - 1);
+    }
+
+} // namespace KeToanApp
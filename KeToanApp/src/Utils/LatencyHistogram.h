@@ -0,0 +1,46 @@
+#pragma once
+
+#include "KeToanApp/Common.h"
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+namespace KeToanApp {
+
+    // Lock-free log-linear histogram of durations in microseconds.
+    // Each power-of-two range is split into kSubBuckets linear buckets, so
+    // reported percentiles are within ~12% of the recorded value.
+    class LatencyHistogram {
+    public:
+        static const int kSubBucketBits = 3;
+        static const int kSubBuckets = 1 << kSubBucketBits;
+        static const int kBucketCount = 64 * kSubBuckets;
+
+        LatencyHistogram();
+
+        // Non-copyable (atomics)
+        LatencyHistogram(const LatencyHistogram&) = delete;
+        LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+        void Record(uint64_t micros);
+        void Reset();
+
+        uint64_t Count() const { return count_.load(std::memory_order_relaxed); }
+        uint64_t Sum() const { return sum_.load(std::memory_order_relaxed); }
+        uint64_t Max() const { return max_.load(std::memory_order_relaxed); }
+        double Mean() const;
+
+        // Upper bound of the bucket holding the given percentile (0..100)
+        uint64_t Percentile(double percentile) const;
+
+        static int BucketIndex(uint64_t value);
+        static uint64_t BucketUpperBound(int index);
+
+    private:
+        std::array<std::atomic<uint64_t>, kBucketCount> buckets_;
+        std::atomic<uint64_t> count_;
+        std::atomic<uint64_t> sum_;
+        std::atomic<uint64_t> max_;
+    };
+
+} // namespace KeToanApp
@@ -8,8 +8,8 @@ namespace KeToanApp {
 
     std::ofstream Logger::logFile_;
     std::mutex Logger::mutex_;
-    LogLevel Logger::currentLevel_ = LogLevel::Debug;
-    bool Logger::consoleOutput_ = false;
+    std::atomic<LogLevel> Logger::currentLevel_{ LogLevel::Debug };
+    std::atomic<bool> Logger::consoleOutput_{ false };
     bool Logger::initialized_ = false;
 
     void Logger::Initialize(const std::string& filename) {
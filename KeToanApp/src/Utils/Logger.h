@@ -1,6 +1,7 @@
 #pragma once
 
 #include "KeToanApp/Common.h"
+#include <atomic>
 #include <fstream>
 #include <mutex>
 
@@ -29,8 +30,9 @@ namespace KeToanApp {
     private:
         static std::ofstream logFile_;
         static std::mutex mutex_;
-        static LogLevel currentLevel_;
-        static bool consoleOutput_;
+        // Atomic: changed at runtime by config hot reload
+        static std::atomic<LogLevel> currentLevel_;
+        static std::atomic<bool> consoleOutput_;
         static bool initialized_;
 
         static void Log(LogLevel level, const char* format, va_list args);
@@ -0,0 +1,80 @@
+#include "MappedFile.h"
+#include "StringHelper.h"
+#include "Logger.h"
+
+namespace KeToanApp {
+
+    MappedFile::MappedFile()
+        : file_(INVALID_HANDLE_VALUE)
+        , mapping_(nullptr)
+        , data_(nullptr)
+        , size_(0)
+    {
+    }
+
+    MappedFile::~MappedFile() {
+        Close();
+    }
+
+    bool MappedFile::Open(const std::string& path) {
+        Close();
+
+        // Share write/delete so editors can replace the file while it is mapped
+        std::wstring widePath = StringHelper::ToWideString(path);
+        file_ = CreateFileW(widePath.c_str(), GENERIC_READ,
+            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file_ == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file_, &fileSize)) {
+            Logger::Error("GetFileSizeEx failed for %s (error %lu)", path.c_str(), GetLastError());
+            Close();
+            return false;
+        }
+
+        size_ = static_cast<size_t>(fileSize.QuadPart);
+        if (size_ == 0) {
+            // CreateFileMapping rejects zero-length files
+            return true;
+        }
+
+        mapping_ = CreateFileMappingW(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping_) {
+            Logger::Error("CreateFileMapping failed for %s (error %lu)", path.c_str(), GetLastError());
+            Close();
+            return false;
+        }
+
+        data_ = static_cast<const char*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+        if (!data_) {
+            Logger::Error("MapViewOfFile failed for %s (error %lu)", path.c_str(), GetLastError());
+            Close();
+            return false;
+        }
+
+        return true;
+    }
+
+    void MappedFile::Close() {
+        if (data_) {
+            UnmapViewOfFile(data_);
+            data_ = nullptr;
+        }
+
+        if (mapping_) {
+            CloseHandle(mapping_);
+            mapping_ = nullptr;
+        }
+
+        if (file_ != INVALID_HANDLE_VALUE) {
+            CloseHandle(file_);
+            file_ = INVALID_HANDLE_VALUE;
+        }
+
+        size_ = 0;
+    }
+
+} // namespace KeToanApp
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "KeToanApp/Common.h"
+
+namespace KeToanApp {
+
+    // Read-only memory mapping of a whole file.
+    // The view stays valid until Close() or destruction.
+    class MappedFile {
+    public:
+        MappedFile();
+        ~MappedFile();
+
+        // Non-copyable
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        bool Open(const std::string& path);
+        void Close();
+        bool IsOpen() const { return file_ != INVALID_HANDLE_VALUE; }
+
+        // Empty files map to (nullptr, 0)
+        const char* Data() const { return data_; }
+        size_t Size() const { return size_; }
+
+    private:
+        HANDLE file_;
+        HANDLE mapping_;
+        const char* data_;
+        size_t size_;
+    };
+
+} // namespace KeToanApp
@@ -125,5 +125,26 @@ namespace StringHelper {
         return buffer;
     }
 
+    void AppendJsonString(std::string& out, std::string_view text) {
+        out += '"';
+        for (char c : text) {
+            switch (c) {
+            case '"':  out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    out += Format("\\u%04x", c);
+                }
+                else {
+                    out += c;
+                }
+            }
+        }
+        out += '"';
+    }
+
 } // namespace StringHelper
 } // namespace KeToanApp
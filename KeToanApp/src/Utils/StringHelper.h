@@ -1,6 +1,7 @@
 #pragma once
 
 #include "KeToanApp/Common.h"
+#include <string_view>
 
 namespace KeToanApp {
 namespace StringHelper {
@@ -32,5 +33,8 @@ namespace StringHelper {
     // Formatting
     std::string Format(const char* format, ...);
 
+    // Appends text as a quoted, escaped JSON string
+    void AppendJsonString(std::string& out, std::string_view text);
+
 } // namespace StringHelper
 } // namespace KeToanApp
@@ -0,0 +1,198 @@
+#include "Trace.h"
+#include "Logger.h"
+#include "StringHelper.h"
+#include <fstream>
+
+namespace KeToanApp {
+
+    struct Trace::ThreadBuffer {
+        struct Slot {
+            TraceEvent event;
+            int tid;                    // the thread that owned the buffer then
+        };
+
+        std::mutex mutex;               // the owning thread's Record() against export
+        std::vector<Slot> slots;
+        size_t next = 0;
+        size_t count = 0;
+        uint64_t overwritten = 0;
+        int tid = 0;
+        std::atomic<bool> owned{ false };
+    };
+
+    // Gives the buffer back when its thread exits
+    struct Trace::BufferHolder {
+        ThreadBuffer* buffer = nullptr;
+
+        ~BufferHolder() {
+            if (buffer) {
+                buffer->owned.store(false, std::memory_order_release);
+            }
+        }
+    };
+
+    std::atomic<bool> Trace::enabled_{ false };
+    std::atomic<int64_t> Trace::epoch_{ 0 };
+    std::mutex Trace::mutex_;
+    std::vector<std::unique_ptr<Trace::ThreadBuffer>> Trace::buffers_;
+    std::unordered_map<int, const char*> Trace::threadNames_;
+    int Trace::lastTid_ = 0;
+    size_t Trace::capacity_ = 0;
+
+    namespace {
+
+        thread_local const char* threadName = nullptr;
+        thread_local int threadId = 0;          // 0 until the thread records a span
+
+    } // namespace
+
+    void Trace::Start(size_t eventsPerThread) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        capacity_ = eventsPerThread > 0 ? eventsPerThread : 1;
+        for (auto& buffer : buffers_) {
+            std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+            buffer->slots.assign(capacity_, ThreadBuffer::Slot());
+            buffer->next = 0;
+            buffer->count = 0;
+            buffer->overwritten = 0;
+        }
+        epoch_.store(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count(), std::memory_order_relaxed);
+        enabled_.store(true, std::memory_order_release);
+        Logger::Info("Tracing started (%zu spans per thread)", capacity_);
+    }
+
+    void Trace::Stop() {
+        // Spans already open still record when they close
+        enabled_.store(false, std::memory_order_release);
+    }
+
+    void Trace::SetThreadName(const char* name) {
+        threadName = name;
+        if (threadId != 0) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            threadNames_[threadId] = name;
+        }
+    }
+
+    Trace::ThreadBuffer* Trace::AcquireBuffer() {
+        static thread_local BufferHolder holder;
+        if (holder.buffer) {
+            return holder.buffer;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& buffer : buffers_) {
+            bool expected = false;
+            if (buffer->owned.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+                holder.buffer = buffer.get();
+                break;
+            }
+        }
+        if (!holder.buffer) {
+            auto buffer = std::make_unique<ThreadBuffer>();
+            buffer->slots.assign(capacity_, ThreadBuffer::Slot());
+            buffer->owned.store(true, std::memory_order_relaxed);
+            holder.buffer = buffer.get();
+            buffers_.push_back(std::move(buffer));
+        }
+
+        threadId = ++lastTid_;
+        if (threadName) {
+            threadNames_[threadId] = threadName;
+        }
+        std::lock_guard<std::mutex> bufferLock(holder.buffer->mutex);
+        holder.buffer->tid = threadId;
+        return holder.buffer;
+    }
+
+    void Trace::Record(const TraceEvent& event) {
+        ThreadBuffer* buffer = AcquireBuffer();
+
+        std::lock_guard<std::mutex> lock(buffer->mutex);
+        if (buffer->slots.empty()) {
+            return;
+        }
+        buffer->slots[buffer->next] = { event, buffer->tid };
+        buffer->next = (buffer->next + 1) % buffer->slots.size();
+        if (buffer->count < buffer->slots.size()) {
+            ++buffer->count;
+        }
+        else {
+            ++buffer->overwritten;
+        }
+    }
+
+    std::string Trace::ToChromeJson() {
+        std::string json = "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n"
+            "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, \"args\": {\"name\": \"KeToanApp\"}}";
+        size_t spans = 0;
+        uint64_t overwritten = 0;
+        std::vector<int> tids;
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& buffer : buffers_) {
+            std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+
+            // Oldest first
+            const size_t size = buffer->slots.size();
+            const size_t first = size ? (buffer->next + size - buffer->count) % size : 0;
+            for (size_t i = 0; i < buffer->count; ++i) {
+                const ThreadBuffer::Slot& slot = buffer->slots[(first + i) % size];
+                const TraceEvent& event = slot.event;
+                if (tids.empty() || tids.back() != slot.tid) {
+                    tids.push_back(slot.tid);
+                }
+
+                json += ",\n{\"name\": ";
+                StringHelper::AppendJsonString(json, event.name);
+                json += ", \"cat\": ";
+                StringHelper::AppendJsonString(json, event.category);
+                json += StringHelper::Format(", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",
+                    slot.tid, static_cast<double>(event.start) / 1000.0, static_cast<double>(event.duration) / 1000.0);
+                if (event.argName) {
+                    json += ", \"args\": {";
+                    StringHelper::AppendJsonString(json, event.argName);
+                    json += StringHelper::Format(": %lld}", static_cast<long long>(event.argValue));
+                }
+                json += '}';
+            }
+            spans += buffer->count;
+            overwritten += buffer->overwritten;
+        }
+
+        // Names of the threads with spans in the trace
+        for (int tid : tids) {
+            auto it = threadNames_.find(tid);
+            json += StringHelper::Format(",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": ",
+                tid);
+            StringHelper::AppendJsonString(json, it != threadNames_.end()
+                ? std::string(it->second) : StringHelper::Format("Thread %d", tid));
+            json += "}}";
+        }
+        json += "\n]}\n";
+
+        if (overwritten > 0) {
+            Logger::Warning("Trace: %llu older spans were overwritten; raise Trace.EventsPerThread to keep them",
+                static_cast<unsigned long long>(overwritten));
+        }
+        Logger::Debug("Trace: %zu spans from %zu threads", spans, tids.size());
+        return json;
+    }
+
+    bool Trace::WriteChromeJson(const std::string& path) {
+        const std::string json = ToChromeJson();
+        std::ofstream file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!file) {
+            Logger::Error("Trace: cannot write %s", path.c_str());
+            return false;
+        }
+        file.write(json.data(), static_cast<std::streamsize>(json.size()));
+        if (!file) {
+            Logger::Error("Trace: writing %s failed", path.c_str());
+            return false;
+        }
+        return true;
+    }
+
+} // namespace KeToanApp
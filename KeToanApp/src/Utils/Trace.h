@@ -0,0 +1,122 @@
+#pragma once
+
+#include "KeToanApp/Common.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+namespace KeToanApp {
+
+    // One completed span. Names are string literals (or other strings that
+    // live for the whole run); they are stored as pointers.
+    struct TraceEvent {
+        const char* category;
+        const char* name;
+        const char* argName;    // null if the span has no argument
+        int64_t argValue;
+        int64_t start;          // ns since Trace::Start()
+        int64_t duration;       // ns
+    };
+
+    // Scoped-span tracing for finding where a slow run spends its time.
+    //
+    // Spans go into a ring buffer per thread (the oldest are overwritten once
+    // it is full) and are written out in the Chrome trace event format,
+    // which chrome://tracing and ui.perfetto.dev open. A buffer whose
+    // thread has exited is reused by the next new thread, so short-lived
+    // worker threads do not add buffers without bound; each thread keeps
+    // its own id in the trace.
+    //
+    // Instrument code with the macros below; they compile to nothing unless
+    // KETOAN_TRACING is defined. While tracing is stopped a span costs one
+    // relaxed load.
+    class Trace {
+    public:
+        static void Start(size_t eventsPerThread);
+        static void Stop();
+        static bool IsEnabled() { return enabled_.load(std::memory_order_relaxed); }
+
+        // Shown as the thread's name in the trace; call from the thread
+        static void SetThreadName(const char* name);
+
+        // Chrome trace JSON of the spans still in the buffers
+        static std::string ToChromeJson();
+        static bool WriteChromeJson(const std::string& path);
+
+        static int64_t Now() {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count() - epoch_.load(std::memory_order_relaxed);
+        }
+
+        static void Record(const TraceEvent& event);
+
+    private:
+        struct ThreadBuffer;
+        struct BufferHolder;
+
+        static std::atomic<bool> enabled_;
+        static std::atomic<int64_t> epoch_;
+        static std::mutex mutex_;
+        static std::vector<std::unique_ptr<ThreadBuffer>> buffers_;
+        static std::unordered_map<int, const char*> threadNames_;
+        static int lastTid_;
+        static size_t capacity_;
+
+        static ThreadBuffer* AcquireBuffer();
+    };
+
+    // Records [construction, destruction) as one span while tracing is on
+    class TraceSpan {
+    public:
+        TraceSpan(const char* category, const char* name)
+            : category_(category)
+            , name_(name)
+            , argName_(nullptr)
+            , argValue_(0)
+            , start_(Trace::IsEnabled() ? Trace::Now() : -1)
+        {
+        }
+
+        ~TraceSpan() {
+            if (start_ >= 0) {
+                Trace::Record({ category_, name_, argName_, argValue_, start_, Trace::Now() - start_ });
+            }
+        }
+
+        // Non-copyable
+        TraceSpan(const TraceSpan&) = delete;
+        TraceSpan& operator=(const TraceSpan&) = delete;
+
+        void SetArg(const char* name, int64_t value) {
+            argName_ = name;
+            argValue_ = value;
+        }
+
+    private:
+        const char* category_;
+        const char* name_;
+        const char* argName_;
+        int64_t argValue_;
+        int64_t start_;
+    };
+
+} // namespace KeToanApp
+
+// KETOAN_TRACE_SCOPE(category, name)       span for the rest of the scope
+// KETOAN_TRACE_SPAN(span, category, name)  the same, named for KETOAN_TRACE_ARG
+// KETOAN_TRACE_ARG(span, argName, value)   one integer argument shown with the span;
+//                                          value is not evaluated in builds without tracing
+#ifdef KETOAN_TRACING
+#define KETOAN_TRACE_CONCAT_(a, b) a##b
+#define KETOAN_TRACE_CONCAT(a, b) KETOAN_TRACE_CONCAT_(a, b)
+#define KETOAN_TRACE_SCOPE(category, name) \
+    ::KeToanApp::TraceSpan KETOAN_TRACE_CONCAT(traceSpan_, __LINE__)(category, name)
+#define KETOAN_TRACE_SPAN(span, category, name) ::KeToanApp::TraceSpan span(category, name)
+#define KETOAN_TRACE_ARG(span, argName, value) span.SetArg(argName, static_cast<int64_t>(value))
+#else
+#define KETOAN_TRACE_SCOPE(category, name) ((void)0)
+#define KETOAN_TRACE_SPAN(span, category, name) ((void)0)
+#define KETOAN_TRACE_ARG(span, argName, value) ((void)0)
+#endif
@@ -0,0 +1,471 @@
+#include "TrueTypeFont.h"
+#include "Logger.h"
+#include <algorithm>
+#include <cstring>
+
+namespace KeToanApp {
+
+    namespace {
+
+        // TrueType data is big-endian
+        uint16_t U16(const unsigned char* p) {
+            return static_cast<uint16_t>(p[0] << 8 | p[1]);
+        }
+
+        int16_t I16(const unsigned char* p) {
+            return static_cast<int16_t>(U16(p));
+        }
+
+        uint32_t U32(const unsigned char* p) {
+            return static_cast<uint32_t>(p[0]) << 24 | static_cast<uint32_t>(p[1]) << 16
+                | static_cast<uint32_t>(p[2]) << 8 | static_cast<uint32_t>(p[3]);
+        }
+
+        void PutU16(std::string& out, size_t at, uint16_t v) {
+            out[at] = static_cast<char>(v >> 8);
+            out[at + 1] = static_cast<char>(v);
+        }
+
+        void PutU32(std::string& out, size_t at, uint32_t v) {
+            PutU16(out, at, static_cast<uint16_t>(v >> 16));
+            PutU16(out, at + 2, static_cast<uint16_t>(v));
+        }
+
+        void AppendU16(std::string& out, uint16_t v) {
+            out.push_back(static_cast<char>(v >> 8));
+            out.push_back(static_cast<char>(v));
+        }
+
+        void AppendU32(std::string& out, uint32_t v) {
+            AppendU16(out, static_cast<uint16_t>(v >> 16));
+            AppendU16(out, static_cast<uint16_t>(v));
+        }
+
+        uint32_t TableChecksum(const std::string& data, size_t offset, size_t length) {
+            uint32_t sum = 0;
+            for (size_t i = 0; i < length; i += 4) {
+                unsigned char word[4] = { 0, 0, 0, 0 };
+                for (size_t j = 0; j < 4 && i + j < length; ++j) {
+                    word[j] = static_cast<unsigned char>(data[offset + i + j]);
+                }
+                sum += U32(word);
+            }
+            return sum;
+        }
+
+        const int kMaxComponentDepth = 8;
+
+    } // namespace
+
+    TrueTypeFont::TrueTypeFont()
+        : glyphCount_(0)
+        , metricCount_(0)
+        , unitsPerEm_(1000)
+        , ascent_(0)
+        , descent_(0)
+        , capHeight_(0)
+        , bbox_{ 0, 0, 0, 0 }
+        , italicAngle_(0.0)
+        , bold_(false)
+    {
+    }
+
+    bool TrueTypeFont::Open(const std::string& path) {
+        if (!file_.Open(path)) {
+            Logger::Error("Cannot open font %s", path.c_str());
+            return false;
+        }
+
+        const unsigned char* data = reinterpret_cast<const unsigned char*>(file_.Data());
+        const size_t size = file_.Size();
+        if (size < 12 || (U32(data) != 0x00010000 && U32(data) != 0x74727565)) {
+            Logger::Error("%s is not a TrueType font (OpenType/CFF and .ttc are not supported)", path.c_str());
+            return false;
+        }
+
+        uint16_t numTables = U16(data + 4);
+        if (12 + static_cast<size_t>(numTables) * 16 > size) {
+            Logger::Error("Font %s is truncated", path.c_str());
+            return false;
+        }
+        for (uint16_t i = 0; i < numTables; ++i) {
+            const unsigned char* record = data + 12 + i * 16;
+            uint32_t offset = U32(record + 8);
+            uint32_t length = U32(record + 12);
+            if (offset > size || length > size - offset) {
+                Logger::Error("Font %s has a corrupt table directory", path.c_str());
+                return false;
+            }
+            tables_[std::string(reinterpret_cast<const char*>(record), 4)] = { data + offset, length };
+        }
+
+        const Table* head = FindTable("head");
+        const Table* hhea = FindTable("hhea");
+        const Table* maxp = FindTable("maxp");
+        const Table* hmtx = FindTable("hmtx");
+        if (!head || head->length < 54 || !hhea || hhea->length < 36 || !maxp || maxp->length < 6
+            || !hmtx || !FindTable("loca") || !FindTable("glyf") || !FindTable("cmap")) {
+            Logger::Error("Font %s lacks required TrueType tables", path.c_str());
+            return false;
+        }
+
+        unitsPerEm_ = U16(head->data + 18);
+        for (int i = 0; i < 4; ++i) {
+            bbox_[i] = I16(head->data + 36 + i * 2);
+        }
+        bold_ = (U16(head->data + 44) & 1) != 0;
+        glyphCount_ = U16(maxp->data + 4);
+        ascent_ = I16(hhea->data + 4);
+        descent_ = I16(hhea->data + 6);
+        if (unitsPerEm_ == 0 || glyphCount_ == 0) {
+            Logger::Error("Font %s has invalid metrics", path.c_str());
+            return false;
+        }
+
+        uint16_t metrics = U16(hhea->data + 34);
+        if (metrics == 0 || metrics > glyphCount_ || hmtx->length < metrics * 4u) {
+            Logger::Error("Font %s has an invalid hmtx table", path.c_str());
+            return false;
+        }
+        metricCount_ = metrics;
+        advances_.resize(glyphCount_);
+        for (uint16_t g = 0; g < glyphCount_; ++g) {
+            advances_[g] = U16(hmtx->data + std::min<uint16_t>(g, metrics - 1) * 4);
+        }
+
+        const Table* os2 = FindTable("OS/2");
+        capHeight_ = os2 && os2->length >= 90 && U16(os2->data) >= 2
+            ? I16(os2->data + 88) : ascent_ * 7 / 10;
+
+        const Table* post = FindTable("post");
+        if (post && post->length >= 8) {
+            italicAngle_ = static_cast<int32_t>(U32(post->data + 4)) / 65536.0;
+        }
+
+        if (!ReadLoca() || !ReadCmap()) {
+            Logger::Error("Font %s has a corrupt loca or cmap table", path.c_str());
+            return false;
+        }
+        ReadName();
+        return true;
+    }
+
+    const TrueTypeFont::Table* TrueTypeFont::FindTable(const char* tag) const {
+        auto it = tables_.find(tag);
+        return it != tables_.end() ? &it->second : nullptr;
+    }
+
+    bool TrueTypeFont::ReadLoca() {
+        const Table* head = FindTable("head");
+        const Table* loca = FindTable("loca");
+        const Table* glyf = FindTable("glyf");
+        const bool longOffsets = I16(head->data + 50) == 1;
+
+        const size_t entries = static_cast<size_t>(glyphCount_) + 1;
+        if (loca->length < entries * (longOffsets ? 4 : 2)) {
+            return false;
+        }
+
+        glyphOffsets_.resize(entries);
+        for (size_t i = 0; i < entries; ++i) {
+            glyphOffsets_[i] = longOffsets ? U32(loca->data + i * 4) : U16(loca->data + i * 2) * 2u;
+            if (glyphOffsets_[i] > glyf->length || (i > 0 && glyphOffsets_[i] < glyphOffsets_[i - 1])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool TrueTypeFont::ReadCmap() {
+        const Table* cmap = FindTable("cmap");
+        if (cmap->length < 4) {
+            return false;
+        }
+
+        // Prefer a full Unicode (format 12) subtable, then BMP (format 4)
+        const unsigned char* best = nullptr;
+        uint32_t bestLength = 0;
+        int bestScore = 0;
+        uint16_t count = U16(cmap->data + 2);
+        for (uint16_t i = 0; i < count && 4 + (i + 1) * 8u <= cmap->length; ++i) {
+            const unsigned char* record = cmap->data + 4 + i * 8;
+            uint16_t platform = U16(record);
+            uint16_t encoding = U16(record + 2);
+            uint32_t offset = U32(record + 4);
+            if (offset + 4 > cmap->length) {
+                continue;
+            }
+            const unsigned char* sub = cmap->data + offset;
+            uint16_t format = U16(sub);
+            bool unicode = platform == 0 || (platform == 3 && (encoding == 1 || encoding == 10));
+            int score = !unicode ? 0 : format == 12 ? 2 : format == 4 ? 1 : 0;
+            if (score > bestScore) {
+                best = sub;
+                bestLength = cmap->length - offset;
+                bestScore = score;
+            }
+        }
+        if (!best) {
+            return false;
+        }
+
+        bmp_.assign(0x10000, 0);
+        if (bestScore == 2) {
+            if (bestLength < 16) {
+                return false;
+            }
+            uint32_t groups = U32(best + 12);
+            if (groups > (bestLength - 16) / 12) {
+                return false;
+            }
+            for (uint32_t i = 0; i < groups; ++i) {
+                const unsigned char* group = best + 16 + i * 12;
+                uint32_t first = U32(group);
+                uint32_t last = std::min<uint32_t>(U32(group + 4), 0x10FFFF);
+                uint32_t glyph = U32(group + 8);
+                for (uint32_t c = first; c <= last; ++c, ++glyph) {
+                    if (glyph >= glyphCount_) {
+                        break;
+                    }
+                    if (c < 0x10000) {
+                        bmp_[c] = static_cast<uint16_t>(glyph);
+                    } else {
+                        supplementary_[c] = static_cast<uint16_t>(glyph);
+                    }
+                }
+            }
+            return true;
+        }
+
+        if (bestLength < 14) {
+            return false;
+        }
+        uint32_t segments = U16(best + 6) / 2u;
+        if (16 + segments * 8u > bestLength) {
+            return false;
+        }
+        const unsigned char* ends = best + 14;
+        const unsigned char* starts = ends + segments * 2 + 2;
+        const unsigned char* deltas = starts + segments * 2;
+        const unsigned char* rangeOffsets = deltas + segments * 2;
+        for (uint32_t s = 0; s < segments; ++s) {
+            uint32_t first = U16(starts + s * 2);
+            uint32_t last = U16(ends + s * 2);
+            uint16_t delta = U16(deltas + s * 2);
+            uint16_t rangeOffset = U16(rangeOffsets + s * 2);
+            for (uint32_t c = first; c <= last && c < 0xFFFF; ++c) {
+                uint32_t glyph;
+                if (rangeOffset == 0) {
+                    glyph = (c + delta) & 0xFFFF;
+                } else {
+                    const unsigned char* p = rangeOffsets + s * 2 + rangeOffset + (c - first) * 2;
+                    if (p + 2 > best + bestLength) {
+                        break;
+                    }
+                    glyph = U16(p);
+                    if (glyph != 0) {
+                        glyph = (glyph + delta) & 0xFFFF;
+                    }
+                }
+                bmp_[c] = glyph < glyphCount_ ? static_cast<uint16_t>(glyph) : 0;
+            }
+        }
+        return true;
+    }
+
+    void TrueTypeFont::ReadName() {
+        postScriptName_ = "Font";
+        const Table* name = FindTable("name");
+        if (!name || name->length < 6) {
+            return;
+        }
+
+        uint16_t count = U16(name->data + 2);
+        uint16_t stringOffset = U16(name->data + 4);
+        for (uint16_t i = 0; i < count && 6 + (i + 1) * 12u <= name->length; ++i) {
+            const unsigned char* record = name->data + 6 + i * 12;
+            uint16_t platform = U16(record);
+            uint16_t nameId = U16(record + 6);
+            uint16_t length = U16(record + 8);
+            uint32_t offset = stringOffset + U16(record + 10);
+            if (nameId != 6 || offset + length > name->length || (platform != 1 && platform != 3)) {
+                continue;
+            }
+
+            // PostScript names are printable ASCII; Windows stores UTF-16BE
+            std::string result;
+            const size_t step = platform == 3 ? 2 : 1;
+            for (size_t j = step - 1; j < length; j += step) {
+                char c = static_cast<char>(name->data[offset + j]);
+                if (c > 32 && c < 127 && !strchr("[](){}<>/%", c)) {
+                    result += c;
+                }
+            }
+            if (!result.empty()) {
+                postScriptName_ = result;
+                return;
+            }
+        }
+    }
+
+    uint16_t TrueTypeFont::GlyphIndex(uint32_t codepoint) const {
+        if (codepoint < 0x10000) {
+            return bmp_.empty() ? 0 : bmp_[codepoint];
+        }
+        auto it = supplementary_.find(codepoint);
+        return it != supplementary_.end() ? it->second : 0;
+    }
+
+    uint16_t TrueTypeFont::Advance(uint16_t glyph) const {
+        return glyph < advances_.size() ? advances_[glyph] : 0;
+    }
+
+    void TrueTypeFont::AddComponents(uint16_t glyph, std::vector<bool>& keep) const {
+        // Composite glyphs reference their parts by id; keep those too
+        std::vector<std::pair<uint16_t, int>> pending = { { glyph, 0 } };
+        const unsigned char* glyf = FindTable("glyf")->data;
+
+        while (!pending.empty()) {
+            auto [current, depth] = pending.back();
+            pending.pop_back();
+
+            const unsigned char* data = glyf + glyphOffsets_[current];
+            size_t length = glyphOffsets_[current + 1] - glyphOffsets_[current];
+            if (length < 10 || I16(data) >= 0 || depth >= kMaxComponentDepth) {
+                continue;
+            }
+
+            size_t p = 10;
+            uint16_t flags = 0;
+            do {
+                if (p + 4 > length) {
+                    break;
+                }
+                flags = U16(data + p);
+                uint16_t component = U16(data + p + 2);
+                p += 4 + ((flags & 0x0001) ? 4 : 2);
+                p += (flags & 0x0008) ? 2 : (flags & 0x0040) ? 4 : (flags & 0x0080) ? 8 : 0;
+                if (component < glyphCount_ && !keep[component]) {
+                    keep[component] = true;
+                    pending.push_back({ component, depth + 1 });
+                }
+            } while (flags & 0x0020);
+        }
+    }
+
+    std::string TrueTypeFont::Subset(const std::vector<bool>& used, std::vector<uint16_t>& newIds) const {
+        std::vector<bool> keep(glyphCount_, false);
+        keep[0] = true;
+        for (size_t g = 0; g < used.size() && g < glyphCount_; ++g) {
+            if (used[g]) {
+                keep[g] = true;
+                AddComponents(static_cast<uint16_t>(g), keep);
+            }
+        }
+
+        newIds.assign(glyphCount_, 0);
+        uint16_t kept = 0;
+        for (uint16_t g = 0; g < glyphCount_; ++g) {
+            if (keep[g]) {
+                newIds[g] = kept++;
+            }
+        }
+
+        const unsigned char* glyfData = FindTable("glyf")->data;
+        const Table* hmtxTable = FindTable("hmtx");
+        std::string glyf;
+        std::string loca;
+        std::string hmtx;
+        for (uint16_t g = 0; g < glyphCount_; ++g) {
+            if (!keep[g]) {
+                continue;
+            }
+            AppendU32(loca, static_cast<uint32_t>(glyf.size()));
+            size_t start = glyf.size();
+            size_t length = glyphOffsets_[g + 1] - glyphOffsets_[g];
+            glyf.append(reinterpret_cast<const char*>(glyfData) + glyphOffsets_[g], length);
+
+            // Point composite glyphs at the renumbered components
+            if (length >= 10 && I16(glyfData + glyphOffsets_[g]) < 0) {
+                size_t p = start + 10;
+                uint16_t flags = 0;
+                do {
+                    if (p + 4 > start + length) {
+                        break;
+                    }
+                    flags = U16(reinterpret_cast<const unsigned char*>(glyf.data()) + p);
+                    uint16_t component = U16(reinterpret_cast<const unsigned char*>(glyf.data()) + p + 2);
+                    PutU16(glyf, p + 2, component < glyphCount_ ? newIds[component] : 0);
+                    p += 4 + ((flags & 0x0001) ? 4 : 2);
+                    p += (flags & 0x0008) ? 2 : (flags & 0x0040) ? 4 : (flags & 0x0080) ? 8 : 0;
+                } while (flags & 0x0020);
+            }
+            glyf.append((4 - glyf.size() % 4) % 4, '\0');
+
+            // Every subset glyph gets a full metric
+            size_t lsbOffset = g < metricCount_ ? g * 4u + 2 : metricCount_ * 4u + (g - metricCount_) * 2u;
+            AppendU16(hmtx, advances_[g]);
+            AppendU16(hmtx, lsbOffset + 2 <= hmtxTable->length ? U16(hmtxTable->data + lsbOffset) : 0);
+        }
+        AppendU32(loca, static_cast<uint32_t>(glyf.size()));
+
+        auto copy = [this](const char* tag) {
+            const Table* table = FindTable(tag);
+            return table ? std::string(reinterpret_cast<const char*>(table->data), table->length) : std::string();
+        };
+        std::string head = copy("head");
+        PutU32(head, 8, 0);             // checkSumAdjustment, set below
+        PutU16(head, 50, 1);            // long loca offsets
+        std::string hhea = copy("hhea");
+        PutU16(hhea, 34, kept);         // numberOfHMetrics
+        std::string maxp = copy("maxp");
+        PutU16(maxp, 4, kept);          // numGlyphs
+
+        // Sorted by tag, as the table directory requires
+        std::vector<std::pair<std::string, std::string>> tables = {
+            { "OS/2", copy("OS/2") }, { "cvt ", copy("cvt ") }, { "fpgm", copy("fpgm") },
+            { "glyf", glyf }, { "head", head }, { "hhea", hhea }, { "hmtx", hmtx },
+            { "loca", loca }, { "maxp", maxp }, { "prep", copy("prep") },
+        };
+        tables.erase(std::remove_if(tables.begin(), tables.end(),
+            [](const std::pair<std::string, std::string>& t) { return t.second.empty() && t.first != "glyf"; }),
+            tables.end());
+
+        const uint16_t count = static_cast<uint16_t>(tables.size());
+        uint16_t entrySelector = 0;
+        while ((2u << entrySelector) <= count) {
+            ++entrySelector;
+        }
+        const uint16_t searchRange = static_cast<uint16_t>(16u << entrySelector);
+
+        std::string font;
+        AppendU32(font, 0x00010000);
+        AppendU16(font, count);
+        AppendU16(font, searchRange);
+        AppendU16(font, entrySelector);
+        AppendU16(font, static_cast<uint16_t>(count * 16 - searchRange));
+
+        size_t directory = font.size();
+        font.append(count * 16u, '\0');
+        size_t headOffset = 0;
+        for (uint16_t i = 0; i < count; ++i) {
+            const auto& [tag, data] = tables[i];
+            size_t offset = font.size();
+            font += data;
+            font.append((4 - font.size() % 4) % 4, '\0');
+
+            size_t record = directory + i * 16u;
+            font.replace(record, 4, tag);
+            PutU32(font, record + 4, TableChecksum(font, offset, data.size()));
+            PutU32(font, record + 8, static_cast<uint32_t>(offset));
+            PutU32(font, record + 12, static_cast<uint32_t>(data.size()));
+            if (tag == "head") {
+                headOffset = offset;
+            }
+        }
+
+        PutU32(font, headOffset + 8, 0xB1B0AFBAu - TableChecksum(font, 0, font.size()));
+        return font;
+    }
+
+} // namespace KeToanApp
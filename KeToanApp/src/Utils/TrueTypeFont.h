@@ -0,0 +1,74 @@
+#pragma once
+
+#include "KeToanApp/Common.h"
+#include "MappedFile.h"
+#include <cstdint>
+#include <unordered_map>
+
+namespace KeToanApp {
+
+    // Read-only TrueType (glyf outlines) font for PDF embedding: character
+    // mapping, advance widths, metrics and subsetting. OpenType/CFF fonts
+    // and font collections (.ttc) are not supported.
+    class TrueTypeFont {
+    public:
+        TrueTypeFont();
+        ~TrueTypeFont() = default;
+
+        // Non-copyable
+        TrueTypeFont(const TrueTypeFont&) = delete;
+        TrueTypeFont& operator=(const TrueTypeFont&) = delete;
+
+        bool Open(const std::string& path);
+
+        // 0 (.notdef) for characters the font lacks
+        uint16_t GlyphIndex(uint32_t codepoint) const;
+        uint16_t Advance(uint16_t glyph) const;     // font units
+
+        uint16_t GetGlyphCount() const { return glyphCount_; }
+        int GetUnitsPerEm() const { return unitsPerEm_; }
+        int GetAscent() const { return ascent_; }
+        int GetDescent() const { return descent_; }
+        int GetCapHeight() const { return capHeight_; }
+        const int16_t* GetBoundingBox() const { return bbox_; }
+        double GetItalicAngle() const { return italicAngle_; }
+        bool IsBold() const { return bold_; }
+        const std::string& GetPostScriptName() const { return postScriptName_; }
+
+        // Font program with only the glyphs flagged in used, plus .notdef
+        // and the components of composite glyphs, renumbered in their
+        // original order. newIds maps each original glyph id to its id in
+        // the subset (0 for dropped glyphs), as a CID-to-glyph map needs.
+        std::string Subset(const std::vector<bool>& used, std::vector<uint16_t>& newIds) const;
+
+    private:
+        struct Table {
+            const unsigned char* data;
+            uint32_t length;
+        };
+
+        MappedFile file_;
+        std::unordered_map<std::string, Table> tables_;
+        std::vector<uint16_t> bmp_;                         // BMP codepoint -> glyph
+        std::unordered_map<uint32_t, uint16_t> supplementary_;
+        std::vector<uint16_t> advances_;
+        std::vector<uint32_t> glyphOffsets_;                // from loca, glyphCount + 1
+        uint16_t glyphCount_;
+        uint16_t metricCount_;                              // hhea numberOfHMetrics
+        int unitsPerEm_;
+        int ascent_;
+        int descent_;
+        int capHeight_;
+        int16_t bbox_[4];
+        double italicAngle_;
+        bool bold_;
+        std::string postScriptName_;
+
+        const Table* FindTable(const char* tag) const;
+        bool ReadCmap();
+        bool ReadLoca();
+        void ReadName();
+        void AddComponents(uint16_t glyph, std::vector<bool>& keep) const;
+    };
+
+} // namespace KeToanApp
@@ -0,0 +1,303 @@
+#include "ZipWriter.h"
+#include "Crc32.h"
+#include "Logger.h"
+#include <ctime>
+#include <filesystem>
+
+#ifdef KETOAN_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace KeToanApp {
+
+    namespace {
+
+        const uint32_t kLocalHeaderSignature = 0x04034b50;
+        const uint32_t kCentralHeaderSignature = 0x02014b50;
+        const uint32_t kEndOfCentralSignature = 0x06054b50;
+        const uint16_t kVersionNeeded = 20;
+        const uint16_t kFlagUtf8Names = 0x0800;
+        const uint16_t kMethodStored = 0;
+        const uint16_t kMethodDeflated = 8;
+        const uint64_t kMaxSize = 0xFFFFFFFFull;
+
+        void AppendU16(std::string& out, uint16_t v) {
+            out.push_back(static_cast<char>(v));
+            out.push_back(static_cast<char>(v >> 8));
+        }
+
+        void AppendU32(std::string& out, uint32_t v) {
+            AppendU16(out, static_cast<uint16_t>(v));
+            AppendU16(out, static_cast<uint16_t>(v >> 16));
+        }
+
+    } // namespace
+
+    // zlib raw-deflate stream, reused across entries
+    struct ZipWriter::Deflater {
+#ifdef KETOAN_HAVE_ZLIB
+        z_stream stream;
+        std::vector<unsigned char> buffer;
+
+        explicit Deflater(int level) : stream(), buffer(64 * 1024) {
+            // Negative window bits: raw deflate, as zip expects
+            if (deflateInit2(&stream, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+                throw KeToanException("Cannot initialise deflate");
+            }
+        }
+
+        ~Deflater() {
+            deflateEnd(&stream);
+        }
+#endif
+    };
+
+    ZipWriter::ZipWriter()
+        : level_(6)
+        , inEntry_(false)
+        , failed_(false)
+        , offset_(0)
+        , dosTime_(0)
+        , dosDate_(0)
+    {
+    }
+
+    ZipWriter::~ZipWriter() {
+        if (out_.is_open()) {
+            Close();
+        }
+    }
+
+    bool ZipWriter::IsDeflateAvailable() {
+#ifdef KETOAN_HAVE_ZLIB
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    bool ZipWriter::Open(const std::string& path, int level) {
+        out_.open(std::filesystem::u8path(path), std::ios::binary | std::ios::trunc);
+        if (!out_) {
+            Logger::Error("Cannot create %s", path.c_str());
+            return false;
+        }
+
+        entries_.clear();
+        inEntry_ = false;
+        failed_ = false;
+        offset_ = 0;
+        level_ = IsDeflateAvailable() ? level : 0;
+#ifdef KETOAN_HAVE_ZLIB
+        if (level_ > 0) {
+            deflater_ = std::make_unique<Deflater>(level_);
+        }
+#endif
+
+        // Every entry gets the time the archive was created
+        std::time_t now = std::time(nullptr);
+        std::tm tm = {};
+        localtime_s(&tm, &now);
+        dosTime_ = static_cast<uint16_t>(tm.tm_hour << 11 | tm.tm_min << 5 | tm.tm_sec / 2);
+        dosDate_ = static_cast<uint16_t>((tm.tm_year - 80) << 9 | (tm.tm_mon + 1) << 5 | tm.tm_mday);
+        return true;
+    }
+
+    bool ZipWriter::BeginEntry(const std::string& name) {
+        if (inEntry_ && !EndEntry()) {
+            return false;
+        }
+        if (failed_ || !out_.is_open()) {
+            return false;
+        }
+
+        Entry entry;
+        entry.name = name;
+        entry.method = level_ > 0 ? kMethodDeflated : kMethodStored;
+        entry.crc = 0;
+        entry.compressedSize = 0;
+        entry.size = 0;
+        entry.offset = offset_;
+        entries_.push_back(entry);
+
+        // CRC and sizes are patched in by EndEntry()
+        std::string header;
+        AppendU32(header, kLocalHeaderSignature);
+        AppendU16(header, kVersionNeeded);
+        AppendU16(header, kFlagUtf8Names);
+        AppendU16(header, entry.method);
+        AppendU16(header, dosTime_);
+        AppendU16(header, dosDate_);
+        AppendU32(header, 0);
+        AppendU32(header, 0);
+        AppendU32(header, 0);
+        AppendU16(header, static_cast<uint16_t>(name.size()));
+        AppendU16(header, 0);
+        header += name;
+
+#ifdef KETOAN_HAVE_ZLIB
+        if (deflater_) {
+            deflateReset(&deflater_->stream);
+        }
+#endif
+
+        inEntry_ = true;
+        return WriteRaw(header.data(), header.size());
+    }
+
+    bool ZipWriter::Write(const void* data, size_t size) {
+        if (!inEntry_ || failed_) {
+            return false;
+        }
+
+        Entry& entry = entries_.back();
+        entry.crc = Crc32::Update(entry.crc, data, size);
+        entry.size += size;
+        if (entry.size > kMaxSize) {
+            return Fail("Zip entry exceeds 4 GB");
+        }
+
+#ifdef KETOAN_HAVE_ZLIB
+        if (entry.method == kMethodDeflated) {
+            z_stream& stream = deflater_->stream;
+            stream.next_in = static_cast<Bytef*>(const_cast<void*>(data));
+            stream.avail_in = static_cast<uInt>(size);
+            while (stream.avail_in > 0) {
+                stream.next_out = deflater_->buffer.data();
+                stream.avail_out = static_cast<uInt>(deflater_->buffer.size());
+                deflate(&stream, Z_NO_FLUSH);
+                size_t produced = deflater_->buffer.size() - stream.avail_out;
+                entry.compressedSize += produced;
+                if (!WriteRaw(deflater_->buffer.data(), produced)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+#endif
+
+        entry.compressedSize += size;
+        return WriteRaw(data, size);
+    }
+
+    bool ZipWriter::EndEntry() {
+        if (!inEntry_) {
+            return false;
+        }
+        inEntry_ = false;
+        if (failed_) {
+            return false;
+        }
+
+        Entry& entry = entries_.back();
+
+#ifdef KETOAN_HAVE_ZLIB
+        if (entry.method == kMethodDeflated) {
+            z_stream& stream = deflater_->stream;
+            stream.next_in = nullptr;
+            stream.avail_in = 0;
+            int rc;
+            do {
+                stream.next_out = deflater_->buffer.data();
+                stream.avail_out = static_cast<uInt>(deflater_->buffer.size());
+                rc = deflate(&stream, Z_FINISH);
+                size_t produced = deflater_->buffer.size() - stream.avail_out;
+                entry.compressedSize += produced;
+                if (!WriteRaw(deflater_->buffer.data(), produced)) {
+                    return false;
+                }
+            } while (rc == Z_OK);
+            if (rc != Z_STREAM_END) {
+                return Fail("Deflate failed");
+            }
+        }
+#endif
+
+        if (entry.compressedSize > kMaxSize || entry.offset > kMaxSize) {
+            return Fail("Zip archive exceeds 4 GB");
+        }
+
+        std::string patch;
+        AppendU32(patch, entry.crc);
+        AppendU32(patch, static_cast<uint32_t>(entry.compressedSize));
+        AppendU32(patch, static_cast<uint32_t>(entry.size));
+        out_.seekp(static_cast<std::streamoff>(entry.offset + 14));
+        out_.write(patch.data(), static_cast<std::streamsize>(patch.size()));
+        out_.seekp(0, std::ios::end);
+        if (!out_) {
+            return Fail("Cannot write zip header");
+        }
+        return true;
+    }
+
+    bool ZipWriter::Close() {
+        if (!out_.is_open()) {
+            return false;
+        }
+
+        bool ok = !inEntry_ || EndEntry();
+        ok = ok && !failed_;
+
+        if (ok) {
+            uint64_t directoryOffset = offset_;
+            std::string directory;
+            for (const Entry& entry : entries_) {
+                AppendU32(directory, kCentralHeaderSignature);
+                AppendU16(directory, kVersionNeeded);
+                AppendU16(directory, kVersionNeeded);
+                AppendU16(directory, kFlagUtf8Names);
+                AppendU16(directory, entry.method);
+                AppendU16(directory, dosTime_);
+                AppendU16(directory, dosDate_);
+                AppendU32(directory, entry.crc);
+                AppendU32(directory, static_cast<uint32_t>(entry.compressedSize));
+                AppendU32(directory, static_cast<uint32_t>(entry.size));
+                AppendU16(directory, static_cast<uint16_t>(entry.name.size()));
+                AppendU16(directory, 0);    // extra
+                AppendU16(directory, 0);    // comment
+                AppendU16(directory, 0);    // disk
+                AppendU16(directory, 0);    // internal attributes
+                AppendU32(directory, 0);    // external attributes
+                AppendU32(directory, static_cast<uint32_t>(entry.offset));
+                directory += entry.name;
+            }
+
+            if (directoryOffset + directory.size() > kMaxSize || entries_.size() > 0xFFFF) {
+                ok = Fail("Zip archive exceeds 4 GB");
+            } else {
+                uint32_t directorySize = static_cast<uint32_t>(directory.size());
+                AppendU32(directory, kEndOfCentralSignature);
+                AppendU16(directory, 0);
+                AppendU16(directory, 0);
+                AppendU16(directory, static_cast<uint16_t>(entries_.size()));
+                AppendU16(directory, static_cast<uint16_t>(entries_.size()));
+                AppendU32(directory, directorySize);
+                AppendU32(directory, static_cast<uint32_t>(directoryOffset));
+                AppendU16(directory, 0);
+                ok = WriteRaw(directory.data(), directory.size());
+            }
+        }
+
+        out_.close();
+        deflater_.reset();
+        return ok && !out_.fail();
+    }
+
+    bool ZipWriter::WriteRaw(const void* data, size_t size) {
+        out_.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+        if (!out_) {
+            return Fail("Cannot write zip archive");
+        }
+        offset_ += size;
+        return true;
+    }
+
+    bool ZipWriter::Fail(const char* error) {
+        if (!failed_) {
+            Logger::Error("%s", error);
+        }
+        failed_ = true;
+        return false;
+    }
+
+} // namespace KeToanApp
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "KeToanApp/Common.h"
+#include "KeToanApp/Types.h"
+#include <cstdint>
+#include <fstream>
+
+namespace KeToanApp {
+
+    // Streaming zip archive writer.
+    //
+    // Entries are written one at a time: BeginEntry(), any number of
+    // Write() calls, EndEntry(). Data is deflated on the fly when built with
+    // KETOAN_HAVE_ZLIB and stored otherwise; either way only a fixed-size
+    // buffer is held, whatever the entry size. Sizes and CRC are patched
+    // into the local header when the entry ends, so no data descriptors
+    // are needed. Entries are limited to 4 GB (no Zip64).
+    class ZipWriter {
+    public:
+        ZipWriter();
+        ~ZipWriter();
+
+        // Non-copyable
+        ZipWriter(const ZipWriter&) = delete;
+        ZipWriter& operator=(const ZipWriter&) = delete;
+
+        // level: 0 = store, 1..9 = deflate level (ignored without zlib)
+        bool Open(const std::string& path, int level = 6);
+        bool Close();   // ends the open entry and writes the central directory
+        bool IsOpen() const { return out_.is_open(); }
+
+        bool BeginEntry(const std::string& name);
+        bool Write(const void* data, size_t size);
+        bool Write(const std::string& text) { return Write(text.data(), text.size()); }
+        bool EndEntry();
+
+        uint64_t GetBytesWritten() const { return offset_; }
+
+        static bool IsDeflateAvailable();
+
+    private:
+        struct Entry {
+            std::string name;
+            uint16_t method;
+            uint32_t crc;
+            uint64_t compressedSize;
+            uint64_t size;
+            uint64_t offset;
+        };
+
+        struct Deflater;
+
+        std::ofstream out_;
+        std::vector<Entry> entries_;
+        std::unique_ptr<Deflater> deflater_;
+        int level_;
+        bool inEntry_;
+        bool failed_;
+        uint64_t offset_;
+        uint16_t dosTime_;
+        uint16_t dosDate_;
+
+        bool WriteRaw(const void* data, size_t size);
+        bool Fail(const char* error);
+    };
+
+} // namespace KeToanApp
@@ -0,0 +1,401 @@
+// Round-trip benchmark of branch data exchange: the same products, vouchers
+// and stock movements exported from one database and imported into an empty
+// one, once through a .kte file (DataExchangeService) and once through CSV
+// files, one per table. Both imports run through BulkInserter in a single
+// transaction, so the difference is the file format.
+//
+//   ExchangeBench [vouchers] [directory]
+//
+// vouchers (default 20000) sets the size: two lines per voucher, a tenth as
+// many products and a quarter as many receipts and issues, four lines each.
+// Each round trip runs three times; the best time is reported. Afterwards
+// every exchanged column of the imported database is compared with the
+// source, money to the unit.
+
+#include "KeToanApp/Common.h"
+#include "Database/BulkInserter.h"
+#include "Database/DatabaseManager.h"
+#include "Services/DataExchangeService.h"
+#include "Utils/Logger.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+
+namespace KeToanApp {
+namespace {
+
+    struct BenchTable {
+        const char* name;
+        const char* columns;        // as exchanged, in DataExchangeService's order
+    };
+
+    // Parents before their lines, as the import needs them
+    const BenchTable kTables[] = {
+        { "SanPham", "MaSP, TenSP, DonViTinh, GiaMua, GiaBan, MoTa, NhomHang, TrangThai" },
+        { "ChungTuKeToan", "SoCT, NgayCT, LoaiCT, DienGiai, NguoiLap, TrangThai" },
+        { "DinhKhoan", "SoCT, STT, TKNo, TKCo, SoTien, DienGiai" },
+        { "PhieuNhap", "SoPhieu, NgayNhap, NhaCungCap, NguoiNhap, TongTien, GhiChu, TrangThai" },
+        { "ChiTietPhieuNhap", "SoPhieu, MaSP, SoLuong, DonGia, ThanhTien" },
+        { "PhieuXuat", "SoPhieu, NgayXuat, KhachHang, NguoiXuat, TongTien, GhiChu, TrangThai" },
+        { "ChiTietPhieuXuat", "SoPhieu, MaSP, SoLuong, DonGia, ThanhTien" },
+    };
+
+    const char* const kAccounts[] = { "111", "112", "131", "156", "331", "511", "632" };
+
+    struct Timing {
+        double exportSeconds;
+        double importSeconds;
+        int64_t bytes;
+        int64_t rows;
+
+        Timing() : exportSeconds(0.0), importSeconds(0.0), bytes(0), rows(0) {}
+    };
+
+    double Since(std::chrono::steady_clock::time_point started) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    }
+
+    std::string InsertSql(const BenchTable& table) {
+        std::string params = "?";
+        for (const char* c = table.columns; *c; ++c) {
+            if (*c == ',') {
+                params += ", ?";
+            }
+        }
+        return std::string("INSERT OR IGNORE INTO ") + table.name + " (" + table.columns + ") VALUES (" + params + ")";
+    }
+
+    std::string Money4(int64_t units) {
+        return Money::FromUnits(units).ToString(4);
+    }
+
+    // Accounts are not exchanged; every site has its own chart
+    bool OpenDatabase(const std::string& path, std::unique_ptr<DatabaseManager>& database) {
+        std::remove(path.c_str());
+        std::remove((path + "-wal").c_str());
+        std::remove((path + "-shm").c_str());
+
+        AppSettings settings;
+        settings.databasePath = path;
+        database = std::make_unique<DatabaseManager>(settings);
+        if (!database->Connect()) {
+            return false;
+        }
+        for (const char* account : kAccounts) {
+            if (!database->ExecuteQuery(std::string("INSERT INTO TaiKhoanKeToan (SoTK, TenTK) VALUES ('")
+                    + account + "', 'Tai khoan " + account + "')")) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool Generate(DatabaseManager& database, int vouchers) {
+        const int products = std::max(1, vouchers / 10);
+        const int documents = std::max(1, vouchers / 4);
+        uint32_t seed = 12345;
+        auto next = [&seed](uint32_t range) { seed = seed * 1103515245u + 12345u; return (seed >> 8) % range; };
+        auto date = [&next](char (&text)[16]) { sprintf_s(text, "2026-%02u-%02u", 1 + next(12), 1 + next(28)); };
+        char key[32];
+        char product[32];
+        char day[16];
+
+        BulkInserter inserter(database);
+        if (!inserter.Begin()) {
+            return false;
+        }
+
+        try {
+            const std::string sanPhamSql = InsertSql(kTables[0]);
+            for (int i = 0; i < products; ++i) {
+                sprintf_s(key, "SP%06d", i);
+                Statement& sanPham = inserter.Prepare(sanPhamSql);
+                sanPham.BindText(1, key).BindText(2, std::string("Hàng hóa số ") + std::to_string(i) + ", loại " + std::to_string(i % 7))
+                    .BindText(3, i % 3 ? "Cái" : "Kg").BindText(4, Money4(1000000 + next(500000000)))
+                    .BindText(5, Money4(1500000 + next(700000000))).BindNull(6)
+                    .BindText(7, "NH" + std::to_string(i % 12)).BindInt64(8, 1);
+                inserter.Execute(sanPham);
+            }
+
+            const std::string chungTuSql = InsertSql(kTables[1]);
+            const std::string dinhKhoanSql = InsertSql(kTables[2]);
+            for (int i = 0; i < vouchers; ++i) {
+                sprintf_s(key, "CT%07d", i);
+                date(day);
+                Statement& chungTu = inserter.Prepare(chungTuSql);
+                chungTu.BindText(1, key).BindText(2, day).BindText(3, i % 2 ? "PT" : "PC")
+                    .BindText(4, "Thu tiền bán hàng, hóa đơn \"" + std::to_string(i) + "\"")
+                    .BindText(5, "NV" + std::to_string(i % 20)).BindInt64(6, 1);
+                inserter.Execute(chungTu);
+                for (int line = 1; line <= 2; ++line) {
+                    Statement& dinhKhoan = inserter.Prepare(dinhKhoanSql);
+                    dinhKhoan.BindText(1, key).BindInt64(2, line).BindText(3, kAccounts[next(7)])
+                        .BindText(4, kAccounts[next(7)]).BindText(5, Money4(next(2000000000) + 1))
+                        .BindText(6, "Dòng " + std::to_string(line));
+                    inserter.Execute(dinhKhoan);
+                }
+            }
+
+            for (int table = 3; table <= 5; table += 2) {
+                const std::string headerSql = InsertSql(kTables[table]);
+                const std::string linesSql = InsertSql(kTables[table + 1]);
+                const char* prefix = table == 3 ? "PN" : "PX";
+                for (int i = 0; i < documents; ++i) {
+                    sprintf_s(key, "%s%07d", prefix, i);
+                    date(day);
+                    int64_t quantities[4];
+                    int64_t prices[4];
+                    int64_t total = 0;
+                    for (int line = 0; line < 4; ++line) {
+                        quantities[line] = (1 + next(50)) * Money::kScale;
+                        prices[line] = 1000000 + next(500000000);
+                        total += quantities[line] / Money::kScale * prices[line];
+                    }
+                    Statement& header = inserter.Prepare(headerSql);
+                    header.BindText(1, key).BindText(2, day).BindText(3, "KH" + std::to_string(i % 50))
+                        .BindText(4, "NV" + std::to_string(i % 20)).BindText(5, Money4(total))
+                        .BindText(6, i % 5 ? "" : "Giao tại kho, ký nhận").BindInt64(7, 1);
+                    inserter.Execute(header);
+                    for (int line = 0; line < 4; ++line) {
+                        sprintf_s(product, "SP%06u", next(static_cast<uint32_t>(products)));
+                        Statement& lines = inserter.Prepare(linesSql);
+                        lines.BindText(1, key).BindText(2, product).BindText(3, Money4(quantities[line]))
+                            .BindText(4, Money4(prices[line]))
+                            .BindText(5, Money4(quantities[line] / Money::kScale * prices[line]));
+                        inserter.Execute(lines);
+                    }
+                }
+            }
+        }
+        catch (const DatabaseException& e) {
+            Logger::Error("Generating data failed: %s", e.what());
+            return false;
+        }
+        return inserter.Commit();
+    }
+
+    // Quoted when it holds a delimiter, quote or line break, quotes doubled;
+    // NULL is an empty field
+    void AppendCsvField(std::string& line, std::string_view value) {
+        if (value.find_first_of(",\"\r\n") == std::string_view::npos) {
+            line.append(value.data(), value.size());
+            return;
+        }
+        line += '"';
+        for (char c : value) {
+            if (c == '"') {
+                line += '"';
+            }
+            line += c;
+        }
+        line += '"';
+    }
+
+    void SplitCsvLine(const std::string& line, std::vector<std::string>& fields) {
+        fields.clear();
+        fields.emplace_back();
+        bool quoted = false;
+        for (size_t i = 0; i < line.size(); ++i) {
+            const char c = line[i];
+            if (quoted) {
+                if (c == '"' && i + 1 < line.size() && line[i + 1] == '"') {
+                    fields.back() += '"';
+                    ++i;
+                } else if (c == '"') {
+                    quoted = false;
+                } else {
+                    fields.back() += c;
+                }
+            } else if (c == '"') {
+                quoted = true;
+            } else if (c == ',') {
+                fields.emplace_back();
+            } else {
+                fields.back() += c;
+            }
+        }
+    }
+
+    std::string CsvPath(const std::string& directory, const BenchTable& table) {
+        return directory + "/exchange." + table.name + ".csv";
+    }
+
+    bool ExportCsv(DatabaseManager& database, const std::string& directory, Timing& timing) {
+        auto started = std::chrono::steady_clock::now();
+        std::unique_ptr<ReadView> view = database.OpenReadView();
+        if (!view) {
+            return false;
+        }
+
+        timing.bytes = 0;
+        timing.rows = 0;
+        std::string line;
+        for (const auto& table : kTables) {
+            std::ofstream file(CsvPath(directory, table), std::ios::binary | std::ios::trunc);
+            file << table.columns << "\n";
+            auto stmt = view->Prepare(std::string("SELECT ") + table.columns + " FROM " + table.name + " ORDER BY rowid");
+            const int columns = stmt->ColumnCount();
+            while (stmt->Step()) {
+                line.clear();
+                for (int c = 0; c < columns; ++c) {
+                    if (c) {
+                        line += ',';
+                    }
+                    if (!stmt->ColumnIsNull(c)) {
+                        AppendCsvField(line, stmt->ColumnTextView(c));
+                    }
+                }
+                line += '\n';
+                file.write(line.data(), static_cast<std::streamsize>(line.size()));
+                ++timing.rows;
+            }
+            timing.bytes += static_cast<int64_t>(file.tellp());
+            if (!file) {
+                return false;
+            }
+        }
+        timing.exportSeconds = Since(started);
+        return true;
+    }
+
+    bool ImportCsv(DatabaseManager& database, const std::string& directory, Timing& timing) {
+        auto started = std::chrono::steady_clock::now();
+        BulkInserter inserter(database);
+        if (!inserter.Begin()) {
+            return false;
+        }
+
+        std::string line;
+        std::vector<std::string> fields;
+        try {
+            for (const auto& table : kTables) {
+                std::ifstream file(CsvPath(directory, table), std::ios::binary);
+                const std::string sql = InsertSql(table);
+                std::getline(file, line);       // header
+                while (std::getline(file, line)) {
+                    SplitCsvLine(line, fields);
+                    Statement& stmt = inserter.Prepare(sql);
+                    for (size_t c = 0; c < fields.size(); ++c) {
+                        if (fields[c].empty()) {
+                            stmt.BindNull(static_cast<int>(c) + 1);
+                        } else {
+                            stmt.BindText(static_cast<int>(c) + 1, fields[c]);
+                        }
+                    }
+                    inserter.Execute(stmt);
+                }
+            }
+        }
+        catch (const DatabaseException& e) {
+            Logger::Error("CSV import failed: %s", e.what());
+            return false;
+        }
+
+        timing.rows = inserter.GetRowsInserted();
+        if (!inserter.Commit()) {
+            return false;
+        }
+        timing.importSeconds = Since(started);
+        return true;
+    }
+
+    // Rows of the source whose exchanged columns have no exact match in the
+    // copy; -1 if the comparison fails
+    int64_t CountDifferences(DatabaseManager& source, const std::string& copyPath) {
+        if (!source.ExecuteQuery("ATTACH DATABASE '" + copyPath + "' AS copy")) {
+            return -1;
+        }
+        int64_t differing = 0;
+        for (const auto& table : kTables) {
+            std::string count;
+            if (!source.ExecuteScalar(std::string("SELECT COUNT(*) FROM (SELECT ") + table.columns + " FROM main." + table.name
+                    + " EXCEPT SELECT " + table.columns + " FROM copy." + table.name + ")", count)) {
+                differing = -1;
+                break;
+            }
+            differing += std::atoll(count.c_str());
+        }
+        source.ExecuteQuery("DETACH DATABASE copy");
+        return differing;
+    }
+
+    void Keep(Timing& best, const Timing& run, bool first) {
+        best.exportSeconds = first ? run.exportSeconds : std::min(best.exportSeconds, run.exportSeconds);
+        best.importSeconds = first ? run.importSeconds : std::min(best.importSeconds, run.importSeconds);
+        best.bytes = run.bytes;
+        best.rows = run.rows;
+    }
+
+    int Run(int vouchers, const std::string& directory) {
+        const std::string sourcePath = directory + "/exchange-source.db";
+        const std::string copyPath = directory + "/exchange-copy.db";
+        const std::string ktePath = directory + "/exchange.kte";
+        const int runs = 3;
+
+        std::unique_ptr<DatabaseManager> source;
+        if (!OpenDatabase(sourcePath, source) || !Generate(*source, vouchers)) {
+            std::fprintf(stderr, "Cannot create %s\n", sourcePath.c_str());
+            return 1;
+        }
+
+        Timing kte;
+        Timing csv;
+        int64_t kteDifferences = 0;
+        int64_t csvDifferences = 0;
+        for (int run = 0; run < runs; ++run) {
+            std::unique_ptr<DatabaseManager> copy;
+            Timing timing;
+
+            ExchangeResult exported = DataExchangeService(*source).Export(ktePath);
+            if (!exported.success || !OpenDatabase(copyPath, copy)) {
+                std::fprintf(stderr, ".kte export failed: %s\n", exported.error.c_str());
+                return 1;
+            }
+            ExchangeResult imported = DataExchangeService(*copy).Import(ktePath);
+            if (!imported.success) {
+                std::fprintf(stderr, ".kte import failed: %s\n", imported.error.c_str());
+                return 1;
+            }
+            timing.exportSeconds = exported.seconds;
+            timing.importSeconds = imported.seconds;
+            timing.bytes = exported.bytes;
+            timing.rows = imported.rows;
+            Keep(kte, timing, run == 0);
+            copy.reset();
+            kteDifferences = CountDifferences(*source, copyPath);
+
+            if (!ExportCsv(*source, directory, timing) || !OpenDatabase(copyPath, copy)
+                    || !ImportCsv(*copy, directory, timing)) {
+                std::fprintf(stderr, "CSV round trip failed\n");
+                return 1;
+            }
+            Keep(csv, timing, run == 0);
+            copy.reset();
+            csvDifferences = CountDifferences(*source, copyPath);
+        }
+
+        std::printf("%d vouchers, %d products, %d receipts, %d issues: %lld rows, best of %d\n",
+            vouchers, std::max(1, vouchers / 10), std::max(1, vouchers / 4), std::max(1, vouchers / 4),
+            static_cast<long long>(kte.rows), runs);
+        std::printf("%-6s %12s %12s %12s %10s\n", "format", "export ms", "import ms", "bytes", "differing");
+        std::printf("%-6s %12.1f %12.1f %12lld %10lld\n", ".kte", kte.exportSeconds * 1000.0,
+            kte.importSeconds * 1000.0, static_cast<long long>(kte.bytes), static_cast<long long>(kteDifferences));
+        std::printf("%-6s %12.1f %12.1f %12lld %10lld\n", "csv", csv.exportSeconds * 1000.0,
+            csv.importSeconds * 1000.0, static_cast<long long>(csv.bytes), static_cast<long long>(csvDifferences));
+        return 0;
+    }
+
+} // namespace
+} // namespace KeToanApp
+
+int main(int argc, char** argv) {
+    const int vouchers = argc > 1 ? std::max(1, std::atoi(argv[1])) : 20000;
+    const std::string directory = argc > 2 ? argv[2] : ".";
+
+    // Failures are reported on stderr; the log stays off so it costs nothing
+    KeToanApp::Logger::SetConsoleOutput(false);
+    KeToanApp::Logger::SetLogLevel(KeToanApp::LogLevel::Warning);
+    return KeToanApp::Run(vouchers, directory);
+}